@@ -85,4 +85,16 @@ TEST_CASE("recycle ip", "[dns]") {
     // last ip is not broadcast ip
     ip = static_cast<const ip_addr_t *>(model_map_getl(ips, pool_size-1));
     CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.64.0.254"));
+
+    // with an IPv6 pool, names still resolve once the IPv4 pool is exhausted
+    REQUIRE(ziti_dns_setup_ipv6("fd00:7a69:7469::/64") == 0);
+    ziti_address_from_string(&za, "six.only");
+    CHECK(ziti_dns_register_hostname(&za, new ziti_service) == nullptr);
+    ip = ziti_dns_hostname_ip6(&za);
+    REQUIRE(ip != nullptr);
+    ip_addr_t first6;
+    REQUIRE(ipaddr_aton("fd00:7a69:7469::1", &first6));
+    CHECK(ip_addr_cmp(ip, &first6));
+    CHECK_THAT(ziti_dns_reverse_lookup("fd00:7a69:7469::1"), Catch::Equals("six.only"));
+    CHECK(ziti_dns_reverse_lookup("fd00:7a69:7468::1") == nullptr);
 }
\ No newline at end of file
@@ -0,0 +1,236 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_cache.h"
+#include "dns_host.h"
+
+#define DNS_HDR_LEN       12
+#define DNS_CACHE_KEY_MAX (256 + 4) // wire-format qname + qtype + qclass
+
+#define RR_TYPE_SOA 6
+#define RR_TYPE_OPT 41
+
+#define RCODE_NOERROR  0
+#define RCODE_NXDOMAIN 3
+
+struct dns_cache_entry_s {
+    uint8_t key[DNS_CACHE_KEY_MAX];
+    size_t key_len;
+    uint64_t stored;  // ms
+    uint64_t expires; // ms
+    TAILQ_ENTRY(dns_cache_entry_s) lru;
+    size_t resp_len;
+    uint8_t resp[];
+};
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+/* build the cache key from the (single) question of `pkt`. names are compared case-insensitively */
+static size_t question_key(const uint8_t *pkt, size_t len, uint8_t key[DNS_CACHE_KEY_MAX]) {
+    if (len < DNS_HDR_LEN || get16(pkt + 4) != 1) {
+        return 0;
+    }
+
+    size_t off = DNS_HDR_LEN;
+    size_t k = 0;
+    for (;;) {
+        if (off >= len) {
+            return 0;
+        }
+        uint8_t l = pkt[off];
+        // questions are never compressed
+        if ((l & 0xC0) != 0 || off + 1 + l > len || k + 1 + l > DNS_CACHE_KEY_MAX - 4) {
+            return 0;
+        }
+        key[k++] = l;
+        for (size_t i = 1; i <= l; i++) {
+            uint8_t c = pkt[off + i];
+            key[k++] = (c >= 'A' && c <= 'Z') ? (uint8_t) (c + ('a' - 'A')) : c;
+        }
+        off += 1 + l;
+        if (l == 0) {
+            break;
+        }
+    }
+
+    if (off + 4 > len) {
+        return 0;
+    }
+    memcpy(key + k, pkt + off, 4);
+    return k + 4;
+}
+
+struct ttl_scan {
+    bool has_ttl;
+    uint32_t min_ttl;
+    bool has_soa;
+    uint32_t soa_ttl;
+};
+
+static bool scan_ttl(uint8_t *name, uint8_t *rr, uint16_t type, const uint8_t *rdata, uint16_t rdlen,
+                     enum dns_rr_section section, void *ctx) {
+    struct ttl_scan *scan = ctx;
+    if (type == RR_TYPE_OPT || section == DNS_SECTION_ADDITIONAL) {
+        return true;
+    }
+
+    uint32_t ttl = get32(rr + 4);
+    if (!scan->has_ttl || ttl < scan->min_ttl) {
+        scan->min_ttl = ttl;
+        scan->has_ttl = true;
+    }
+
+    // the negative caching ttl is the lesser of the SOA's ttl and its MINIMUM field
+    if (type == RR_TYPE_SOA && section == DNS_SECTION_AUTHORITY && rdlen >= 4) {
+        uint32_t minimum = get32(rdata + rdlen - 4);
+        scan->soa_ttl = ttl < minimum ? ttl : minimum;
+        scan->has_soa = true;
+    }
+    return true;
+}
+
+void dns_cache_init(dns_cache_t *cache, size_t capacity) {
+    memset(cache, 0, sizeof(*cache));
+    TAILQ_INIT(&cache->lru);
+    cache->capacity = capacity;
+}
+
+static void remove_entry(dns_cache_t *cache, struct dns_cache_entry_s *e) {
+    TAILQ_REMOVE(&cache->lru, e, lru);
+    model_map_remove_key(&cache->entries, e->key, e->key_len);
+    free(e);
+}
+
+void dns_cache_clear(dns_cache_t *cache) {
+    while (!TAILQ_EMPTY(&cache->lru)) {
+        remove_entry(cache, TAILQ_FIRST(&cache->lru));
+    }
+}
+
+size_t dns_cache_size(const dns_cache_t *cache) {
+    return model_map_size((model_map *) &cache->entries);
+}
+
+size_t dns_cache_get(dns_cache_t *cache, const uint8_t *query, size_t query_len,
+                     uint8_t *resp, size_t resp_size, uint64_t now) {
+    uint8_t key[DNS_CACHE_KEY_MAX];
+    size_t key_len = question_key(query, query_len, key);
+    struct dns_cache_entry_s *e = key_len ? model_map_get_key(&cache->entries, key, key_len) : NULL;
+    if (e == NULL) {
+        cache->misses++;
+        return 0;
+    }
+
+    if (now >= e->expires) {
+        remove_entry(cache, e);
+        cache->misses++;
+        return 0;
+    }
+
+    if (e->resp_len > resp_size) {
+        cache->misses++;
+        return 0;
+    }
+
+    memcpy(resp, e->resp, e->resp_len);
+    // answer with the client's ID and the remaining TTLs
+    resp[0] = query[0];
+    resp[1] = query[1];
+    uint32_t elapsed = (uint32_t) ((now - e->stored) / 1000);
+    if (elapsed > 0) {
+        dns_age_ttl(resp, e->resp_len, elapsed);
+    }
+
+    TAILQ_REMOVE(&cache->lru, e, lru);
+    TAILQ_INSERT_HEAD(&cache->lru, e, lru);
+    cache->hits++;
+    return e->resp_len;
+}
+
+bool dns_cache_put(dns_cache_t *cache, const uint8_t *query, size_t query_len,
+                   const uint8_t *resp, size_t resp_len, uint64_t now) {
+    if (cache->capacity == 0 || resp_len < DNS_HDR_LEN) {
+        return false;
+    }
+
+    // only complete responses with a definite answer
+    uint8_t flags_hi = resp[2];
+    uint8_t rcode = resp[3] & 0x0F;
+    if ((flags_hi & 0x80) == 0 || (flags_hi & 0x02) != 0 || (rcode != RCODE_NOERROR && rcode != RCODE_NXDOMAIN)) {
+        return false;
+    }
+
+    // the response must answer the question that was asked
+    uint8_t key[DNS_CACHE_KEY_MAX];
+    uint8_t resp_key[DNS_CACHE_KEY_MAX];
+    size_t key_len = question_key(query, query_len, key);
+    if (key_len == 0 || question_key(resp, resp_len, resp_key) != key_len || memcmp(key, resp_key, key_len) != 0) {
+        return false;
+    }
+
+    struct dns_cache_entry_s *e = malloc(sizeof(struct dns_cache_entry_s) + resp_len);
+    if (e == NULL) {
+        return false;
+    }
+    memcpy(e->resp, resp, resp_len);
+    e->resp_len = resp_len;
+
+    struct ttl_scan scan = {0};
+    if (!dns_walk_rrs(e->resp, resp_len, scan_ttl, &scan)) {
+        free(e);
+        return false;
+    }
+
+    uint32_t ttl;
+    bool negative = rcode == RCODE_NXDOMAIN || get16(resp + 6) == 0;
+    if (negative) {
+        ttl = scan.has_soa ? scan.soa_ttl : 0;
+        if (ttl > DNS_CACHE_MAX_NEG_TTL) ttl = DNS_CACHE_MAX_NEG_TTL;
+    } else {
+        ttl = scan.has_ttl ? scan.min_ttl : 0;
+        if (ttl > DNS_CACHE_MAX_TTL) ttl = DNS_CACHE_MAX_TTL;
+    }
+    if (ttl == 0) {
+        free(e);
+        return false;
+    }
+
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->stored = now;
+    e->expires = now + (uint64_t) ttl * 1000;
+
+    struct dns_cache_entry_s *old = model_map_get_key(&cache->entries, key, key_len);
+    if (old) {
+        remove_entry(cache, old);
+    } else if (dns_cache_size(cache) >= cache->capacity) {
+        remove_entry(cache, TAILQ_LAST(&cache->lru, dns_cache_lru));
+        cache->evictions++;
+    }
+
+    model_map_set_key(&cache->entries, e->key, e->key_len, e);
+    TAILQ_INSERT_HEAD(&cache->lru, e, lru);
+    return true;
+}
@@ -0,0 +1,75 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DNS_CACHE_H
+#define ZITI_TUNNELER_SDK_DNS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ziti/model_collections.h>
+#include <ziti/sys/queue.h>
+
+#ifndef DNS_CACHE_DEFAULT_CAPACITY
+#define DNS_CACHE_DEFAULT_CAPACITY 4096
+#endif
+
+/* upper bounds for cached TTLs (seconds). negative answers follow RFC 2308 */
+#define DNS_CACHE_MAX_TTL     86400
+#define DNS_CACHE_MAX_NEG_TTL 300
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct dns_cache_entry_s;
+
+/**
+ * bounded LRU cache of upstream DNS responses, keyed by (qname, qtype, qclass).
+ * positive answers live for their smallest answer/authority TTL, NXDOMAIN and NODATA answers for their SOA minimum.
+ */
+typedef struct dns_cache_s {
+    model_map entries; // key -> struct dns_cache_entry_s
+    TAILQ_HEAD(dns_cache_lru, dns_cache_entry_s) lru; // most recently used first
+    size_t capacity;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} dns_cache_t;
+
+extern void dns_cache_init(dns_cache_t *cache, size_t capacity);
+
+extern void dns_cache_clear(dns_cache_t *cache);
+
+extern size_t dns_cache_size(const dns_cache_t *cache);
+
+/**
+ * copy the cached response for `query` into `resp`, with the query's ID and TTLs reduced by the time spent in the cache.
+ * `now` is a monotonic time in milliseconds. returns the response length, or 0 on a miss.
+ */
+extern size_t dns_cache_get(dns_cache_t *cache, const uint8_t *query, size_t query_len,
+                            uint8_t *resp, size_t resp_size, uint64_t now);
+
+/** cache `resp` as the answer to `query` if it is cacheable. returns true if it was stored */
+extern bool dns_cache_put(dns_cache_t *cache, const uint8_t *query, size_t query_len,
+                          const uint8_t *resp, size_t resp_len, uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DNS_CACHE_H
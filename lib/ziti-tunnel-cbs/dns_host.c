@@ -18,6 +18,8 @@
 #include "ziti_hosting.h"
 #include "dns_host.h"
 
+#include <ctype.h>
+
 #ifndef PACKETSZ
 # ifdef NS_PACKETSZ
 #  define PACKETSZ NS_PACKETSZ
@@ -26,12 +28,67 @@
 # endif // NS_PACKETSZ
 #endif // PACKETSZ
 
+#define DNS_HEADER_LEN 12
+
+/* answers are kept for their smallest TTL, up to these many seconds. negative answers for DNS_HOST_NEG_TTL */
+#define DNS_HOST_MAX_TTL 300
+#define DNS_HOST_NEG_TTL 30
+
+/* most answers kept in the cache */
+#define DNS_HOST_CACHE_MAX 1024
+
+/* resolver threads, and the most distinct queries waiting for or running on them */
+#define DNS_HOST_WORKERS 4
+#define DNS_HOST_PENDING_MAX 256
+
+struct dns_host_waiter_s;
 
 typedef struct dns_host_conn_s {
-    resolver_t resolver;
-    allowed_hostnames_t allowed_domains;
+    ziti_connection conn;
+    uv_loop_t *loop;
+    bool wire; // the client sends and receives RFC1035 messages, once it has seen our hello
+    dns_trie_t allowed_domains; // wildcard domains of the service's allowed addresses
+    LIST_HEAD(, dns_host_waiter_s) waiters; // requests that wait for a resolution
 } dns_host_conn_t;
 
+// a client request, answered when its query completes
+struct dns_host_waiter_s {
+    dns_host_conn_t *dns; // NULL if the connection closed while the query was running
+    dns_message msg;
+    uint8_t *wire; // the client's query, if it was sent in wire format
+    size_t wire_len;
+    LIST_ENTRY(dns_host_waiter_s) conn_link;
+    LIST_ENTRY(dns_host_waiter_s) query_link;
+};
+
+/**
+ * res_nquery (or DnsQuery) blocks, so queries run on our own resolver threads rather than the libuv thread pool,
+ * where a slow name server would hold up file and getaddrinfo work for the whole process.
+ * identical queries share one resolution while it is in flight, and the result stays in the cache for its TTL.
+ * the resolver's response is kept as it is for wire format clients, and only formatted into dns_answers for JSON clients.
+ */
+typedef struct dns_host_query_s {
+    char *key;
+    char *name;
+    int type;
+    dns_message result; // status set by the worker, answers once they are formatted
+    bool formatted;
+    uint8_t *raw; // the resolver's response. not available with DnsQuery
+    size_t raw_len;
+    int ttl; // seconds to cache the result, 0 if it should not be
+
+    LIST_HEAD(, dns_host_waiter_s) waiters;
+    TAILQ_ENTRY(dns_host_query_s) pool_link; // in the resolver queue, then in the completed list
+
+    uint64_t stored;  // uv_now() when the result was cached
+    uint64_t expires;
+    TAILQ_ENTRY(dns_host_query_s) cache_link;
+} dns_host_query_t;
+
+static model_map pending_queries; // key -> dns_host_query_t
+static model_map cached_queries;  // key -> dns_host_query_t
+static TAILQ_HEAD(, dns_host_query_s) cache_order = TAILQ_HEAD_INITIALIZER(cache_order); // oldest first
+
 
 typedef int (*rr_fmt)(const ns_msg *, const ns_rr*, dns_answer *ans, size_t max);
 static int fmt_srv(const ns_msg *, const ns_rr*, dns_answer *ans, size_t max);
@@ -40,6 +97,20 @@ static int fmt_txt(const ns_msg *, const ns_rr*, dns_answer *ans, size_t max);
 
 static model_map rr_formatters;
 
+// queries are handed to the resolver threads under the lock, and handed back to the loop through `completed`
+static struct {
+    uv_loop_t *loop; // NULL until the threads are started
+    uv_async_t completed;
+    uv_mutex_t lock;
+    uv_cond_t ready;
+    TAILQ_HEAD(, dns_host_query_s) queue;
+    TAILQ_HEAD(, dns_host_query_s) done;
+    int workers;
+} pool = {
+        .queue = TAILQ_HEAD_INITIALIZER(pool.queue),
+        .done = TAILQ_HEAD_INITIALIZER(pool.done),
+};
+
 static uv_once_t init;
 static void do_init() {
     model_map_setl(&rr_formatters, ns_t_srv, fmt_srv);
@@ -54,23 +125,18 @@ void dns_host_init() {
 static void on_close(ziti_connection conn) {
     dns_host_conn_t *dns = ziti_conn_data(conn);
     if (dns) {
-        res_nclose(&dns->resolver);
-        while(!LIST_EMPTY(&dns->allowed_domains)) {
-            struct allowed_hostname_s *ad = LIST_FIRST(&dns->allowed_domains);
-            LIST_REMOVE(ad, _next);
-            free(ad->domain_name);
-            free(ad);
+        ziti_conn_set_data(conn, NULL);
+        // running queries still complete, but there is no one to answer
+        while (!LIST_EMPTY(&dns->waiters)) {
+            struct dns_host_waiter_s *w = LIST_FIRST(&dns->waiters);
+            LIST_REMOVE(w, conn_link);
+            w->dns = NULL;
         }
+        dns_trie_clear(&dns->allowed_domains, NULL);
         free(dns);
     }
 }
 
-static void on_conn_complete(ziti_connection conn, int status) {
-    if (status != ZITI_OK) {
-        ziti_close(conn, on_close);
-    }
-}
-
 static void on_write(ziti_connection conn, ssize_t status, void *ctx) {
     if (ctx) free(ctx);
     
@@ -79,19 +145,27 @@ static void on_write(ziti_connection conn, ssize_t status, void *ctx) {
     }
 }
 
-static bool is_allowed(const char *name, const dns_host_conn_t *dns) {
-    struct allowed_hostname_s *ad;
-    LIST_FOREACH(ad, &dns->allowed_domains, _next) {
-        char *ptr = strstr(name, ad->domain_name);
-        if (ptr != NULL && strcmp(ptr, ad->domain_name) == 0) { // ends with domain_name
-
-            if (ptr == name) return true;
+static void on_conn_complete(ziti_connection conn, int status) {
+    if (status != ZITI_OK) {
+        ziti_close(conn, on_close);
+        return;
+    }
 
-            if (*(ptr-1) == '.') // name is XXXX.$domain_name
-                return true;
-        }
+    // older clients never ask for the wire format, and never see this
+    dns_host_conn_t *dns = ziti_conn_data(conn);
+    if (dns && dns->wire) {
+        dns_message hello = {
+                .comment = (char *) DNS_WIRE_FORMAT,
+        };
+        size_t len = 0;
+        char *json = dns_message_to_json(&hello, MODEL_JSON_COMPACT, &len);
+        ziti_write(conn, (uint8_t *) json, len, on_write, json);
     }
-    return false;
+}
+
+/** name is $domain_name or XXXX.$domain_name for one of the allowed domains */
+static bool is_allowed(const char *name, const dns_host_conn_t *dns) {
+    return dns_trie_find_wildcard(&dns->allowed_domains, name, true) != NULL;
 }
 
 #if _WIN32
@@ -118,8 +192,10 @@ void do_query(const dns_question *q, dns_message *resp, resolver_t *resolver) {
                 dns_answer *a = alloc_dns_answer();
                 a->type = type;
                 a->ttl = (int)rr->dwTtl;
-                a->data = malloc(PACKETSZ);
-                fmt(NULL, rr, a, PACKETSZ);
+                char data[PACKETSZ] = "";
+                a->data = data;
+                fmt(NULL, rr, a, sizeof(data));
+                a->data = strdup(data);
                 resp->answer[idx++] = a;
             }
         }
@@ -182,6 +258,29 @@ static uint8_t *send_and_parse_query(const dns_question *q, int class, ns_msg *a
     return resp_msg;
 }
 
+static void format_answers(ns_msg *ans, dns_message *resp) {
+    int rr_count = ns_msg_count(*ans, ns_s_an);
+    if (rr_count > 0) {
+        ns_rr rr;
+        rr_fmt fmt;
+        int a_idx = 0;
+        resp->answer = calloc(rr_count + 1, sizeof(dns_answer *));
+        for (int i = 0; i < rr_count; i++) {
+            if (ns_parserr(ans, ns_s_an, i, &rr) == 0 &&
+                (fmt = model_map_getl(&rr_formatters, ns_rr_type(rr))) != 0) {
+                dns_answer *a = alloc_dns_answer();
+                a->ttl = ns_rr_ttl(rr);
+                a->type = ns_rr_type(rr);
+                char data[PACKETSZ] = "";
+                a->data = data;
+                fmt(ans, &rr, a, sizeof(data));
+                a->data = strdup(data);
+                resp->answer[a_idx++] = a;
+            }
+        }
+    }
+}
+
 void do_query(const dns_question *q, dns_message *resp, resolver_t *resolver) {
     ns_msg ans = {0};
     uint8_t *resp_msg = send_and_parse_query(q, ns_c_in, &ans, resolver);
@@ -190,24 +289,7 @@ void do_query(const dns_question *q, dns_message *resp, resolver_t *resolver) {
         return;
     } else {
         resp->status = ns_msg_getflag(ans, ns_f_rcode);
-        int rr_count = ns_msg_count(ans, ns_s_an);
-        if (rr_count > 0) {
-            ns_rr rr;
-            rr_fmt fmt;
-            int a_idx = 0;
-            resp->answer = calloc(rr_count + 1, sizeof(dns_answer *));
-            for (int i = 0; i < rr_count; i++) {
-                if (ns_parserr(&ans, ns_s_an, i, &rr) == 0 &&
-                    (fmt = model_map_getl(&rr_formatters, ns_rr_type(rr))) != 0) {
-                    dns_answer *a = alloc_dns_answer();
-                    a->ttl = ns_rr_ttl(rr);
-                    a->type = ns_rr_type(rr);
-                    a->data = malloc(PACKETSZ);
-                    fmt(&ans, &rr, a, PACKETSZ);
-                    resp->answer[a_idx++] = a;
-                }
-            }
-        }
+        format_answers(&ans, resp);
         free(resp_msg);
     }
 }
@@ -241,48 +323,389 @@ static int fmt_txt(const ns_msg *msg, const ns_rr* rr, dns_answer *ans, size_t m
 
 #endif
 
+/** seconds to keep a result with `count` answers, the shortest of them living `min_ttl`. 0 if it should not be kept */
+static int result_ttl(int status, int count, uint32_t min_ttl) {
+    if (status == ns_r_noerror && count > 0) {
+        return min_ttl < DNS_HOST_MAX_TTL ? (int) min_ttl : DNS_HOST_MAX_TTL;
+    }
+    if (status == ns_r_noerror || status == ns_r_nxdomain) {
+        return DNS_HOST_NEG_TTL;
+    }
+    return 0;
+}
+
+static void run_query(dns_host_query_t *query, resolver_t *resolver) {
+    if (resolver == NULL) {
+        query->result.status = ns_r_servfail;
+        return;
+    }
+    dns_question q = {
+            .name = query->name,
+            .type = query->type,
+    };
+
+    uint32_t min_ttl = UINT32_MAX;
+    int count = 0;
+#if _WIN32
+    do_query(&q, &query->result, resolver);
+    query->formatted = true;
+    for (; query->result.answer && query->result.answer[count]; count++) {
+        uint32_t ttl = (uint32_t) query->result.answer[count]->ttl;
+        min_ttl = ttl < min_ttl ? ttl : min_ttl;
+    }
+#else
+    ns_msg ans = {0};
+    query->raw = send_and_parse_query(&q, ns_c_in, &ans, resolver);
+    if (query->raw == NULL) {
+        query->result.status = ns_r_servfail;
+        return;
+    }
+    query->raw_len = ns_msg_end(ans) - ns_msg_base(ans);
+    query->result.status = ns_msg_getflag(ans, ns_f_rcode);
+    ns_rr rr;
+    for (int i = 0; i < ns_msg_count(ans, ns_s_an); i++) {
+        if (ns_parserr(&ans, ns_s_an, i, &rr) == 0) {
+            min_ttl = ns_rr_ttl(rr) < min_ttl ? ns_rr_ttl(rr) : min_ttl;
+            count++;
+        }
+    }
+#endif
+    query->ttl = result_ttl((int) query->result.status, count, min_ttl);
+}
+
+/** the query's answers for JSON clients, formatted from the resolver's response the first time they are needed */
+static dns_answer **query_answers(dns_host_query_t *query) {
+#if !_WIN32
+    ns_msg ans;
+    if (!query->formatted && query->raw &&
+        ns_initparse(query->raw, (int) query->raw_len, &ans) == 0) {
+        format_answers(&ans, &query->result);
+    }
+#endif
+    query->formatted = true;
+    return query->result.answer;
+}
+
+static void free_query(dns_host_query_t *query) {
+    free_dns_message(&query->result);
+    free(query->raw);
+    free(query->key);
+    free(query->name);
+    free(query);
+}
+
+/** send `answers` to the client, with their TTLs reduced by `age` seconds */
+static void send_answer(dns_host_conn_t *dns, dns_message *msg, int status, dns_answer **answers, int age) {
+    msg->status = status;
+    msg->answer = answers;
+    for (int i = 0; answers && answers[i]; i++) {
+        answers[i]->ttl -= age;
+    }
+
+    size_t msg_len = 0;
+    char *json = dns_message_to_json(msg, 0, &msg_len);
+
+    for (int i = 0; answers && answers[i]; i++) {
+        answers[i]->ttl += age;
+    }
+    msg->answer = NULL; // borrowed from the query
+
+    ziti_write(dns->conn, (uint8_t *)json, msg_len, on_write, json);
+}
+
+/** answer a wire format query with just its question and `rcode` */
+static void send_wire_status(dns_host_conn_t *dns, const uint8_t *query, size_t query_len, int rcode) {
+    uint8_t *resp = malloc(query_len);
+    memcpy(resp, query, query_len);
+    size_t resp_len = dns_truncate(resp, query_len);
+    if (resp_len == 0) {
+        free(resp);
+        return;
+    }
+    resp[2] = (uint8_t) ((resp[2] | 0x80) & ~0x02); // QR, and not truncated after all
+    resp[3] = (uint8_t) (0x80 | (rcode & 0x0F)); // RA
+    ziti_write(dns->conn, resp, resp_len, on_write, resp);
+}
+
+/** the wire response carries the question's case as the first client asked it. give it back the way this one did */
+static void copy_question_name(uint8_t *resp, size_t resp_len, const uint8_t *wire, size_t wire_len) {
+    size_t off = DNS_HEADER_LEN;
+    while (off < wire_len && wire[off] != 0 && wire[off] < 64) {
+        off += 1 + wire[off];
+    }
+    if (off >= wire_len || off >= resp_len || wire[off] != 0) {
+        return;
+    }
+    for (size_t i = DNS_HEADER_LEN; i < off; i++) {
+        if (tolower(resp[i]) != tolower(wire[i])) {
+            return;
+        }
+    }
+    memcpy(resp + DNS_HEADER_LEN, wire + DNS_HEADER_LEN, off - DNS_HEADER_LEN);
+}
+
+/** answer a waiting request in the format it was asked in, with TTLs reduced by `age` seconds */
+static void send_result(dns_host_conn_t *dns, dns_message *msg, const uint8_t *wire, size_t wire_len,
+                        dns_host_query_t *query, int age) {
+    if (wire == NULL) {
+        send_answer(dns, msg, (int) query->result.status, query_answers(query), age);
+        return;
+    }
+    if (query->raw == NULL) {
+        send_wire_status(dns, wire, wire_len, (int) query->result.status);
+        return;
+    }
+
+    uint8_t *resp = malloc(query->raw_len);
+    memcpy(resp, query->raw, query->raw_len);
+    resp[0] = wire[0];
+    resp[1] = wire[1];
+    copy_question_name(resp, query->raw_len, wire, wire_len);
+    if (age > 0) {
+        dns_age_ttl(resp, query->raw_len, (uint32_t) age);
+    }
+    ziti_write(dns->conn, resp, query->raw_len, on_write, resp);
+}
+
+static void evict_query(dns_host_query_t *query) {
+    TAILQ_REMOVE(&cache_order, query, cache_link);
+    model_map_remove(&cached_queries, query->key);
+    free_query(query);
+}
+
+static void cache_query(uv_loop_t *loop, dns_host_query_t *query) {
+    int ttl = query->ttl;
+    if (ttl == 0) {
+        free_query(query);
+        return;
+    }
+
+    while (model_map_size(&cached_queries) >= DNS_HOST_CACHE_MAX) {
+        evict_query(TAILQ_FIRST(&cache_order));
+    }
+    query->stored = uv_now(loop);
+    query->expires = query->stored + (uint64_t) ttl * 1000;
+    model_map_set(&cached_queries, query->key, query);
+    TAILQ_INSERT_TAIL(&cache_order, query, cache_link);
+}
+
+static void query_done(uv_loop_t *loop, dns_host_query_t *query) {
+    model_map_remove(&pending_queries, query->key);
+
+    while (!LIST_EMPTY(&query->waiters)) {
+        struct dns_host_waiter_s *w = LIST_FIRST(&query->waiters);
+        LIST_REMOVE(w, query_link);
+        if (w->dns) {
+            LIST_REMOVE(w, conn_link);
+            send_result(w->dns, &w->msg, w->wire, w->wire_len, query, 0);
+        }
+        free_dns_message(&w->msg);
+        free(w->wire);
+        free(w);
+    }
+
+    cache_query(loop, query);
+}
+
+// every resolver thread has its own resolver state, since a __res_state must not be shared between threads
+static void resolver_thread(void *arg) {
+    resolver_t resolver_state = {0};
+    resolver_t *resolver = res_ninit(&resolver_state) == 0 ? &resolver_state : NULL;
+
+    uv_mutex_lock(&pool.lock);
+    for (;;) {
+        while (TAILQ_EMPTY(&pool.queue)) {
+            uv_cond_wait(&pool.ready, &pool.lock);
+        }
+        dns_host_query_t *query = TAILQ_FIRST(&pool.queue);
+        TAILQ_REMOVE(&pool.queue, query, pool_link);
+        uv_mutex_unlock(&pool.lock);
+
+        run_query(query, resolver);
+
+        uv_mutex_lock(&pool.lock);
+        TAILQ_INSERT_TAIL(&pool.done, query, pool_link);
+        uv_async_send(&pool.completed);
+    }
+}
+
+static void on_queries_completed(uv_async_t *async) {
+    TAILQ_HEAD(, dns_host_query_s) done = TAILQ_HEAD_INITIALIZER(done);
+    uv_mutex_lock(&pool.lock);
+    TAILQ_CONCAT(&done, &pool.done, pool_link);
+    uv_mutex_unlock(&pool.lock);
+
+    while (!TAILQ_EMPTY(&done)) {
+        dns_host_query_t *query = TAILQ_FIRST(&done);
+        TAILQ_REMOVE(&done, query, pool_link);
+        query_done(async->loop, query);
+    }
+}
+
+/** start the resolver threads on the first connection. queries complete on `loop` */
+static void start_pool(uv_loop_t *loop) {
+    if (pool.loop) {
+        return;
+    }
+    pool.loop = loop;
+    uv_mutex_init(&pool.lock);
+    uv_cond_init(&pool.ready);
+    uv_async_init(loop, &pool.completed, on_queries_completed);
+    uv_unref((uv_handle_t *) &pool.completed);
+
+    for (int i = 0; i < DNS_HOST_WORKERS; i++) {
+        uv_thread_t t;
+        int rc = uv_thread_create(&t, resolver_thread, NULL);
+        if (rc != 0) {
+            ZITI_LOG(WARN, "failed to start resolver thread: %s", uv_strerror(rc));
+            break;
+        }
+        pool.workers++;
+    }
+}
+
+static int queue_query(dns_host_query_t *query) {
+    if (pool.workers == 0) {
+        return UV_EAGAIN;
+    }
+    if (model_map_size(&pending_queries) >= DNS_HOST_PENDING_MAX) {
+        return UV_EBUSY;
+    }
+    uv_mutex_lock(&pool.lock);
+    TAILQ_INSERT_TAIL(&pool.queue, query, pool_link);
+    uv_cond_signal(&pool.ready);
+    uv_mutex_unlock(&pool.lock);
+    return 0;
+}
+
+/** the cache key of a query. names are case-insensitive, so they share a key whatever case the client used */
+static void query_key(char *key, size_t max, int type, const char *name) {
+    int len = snprintf(key, max, "%d:", type);
+    size_t i = len > 0 ? (size_t) len : 0;
+    for (; *name != '\0' && i + 1 < max; name++) {
+        key[i++] = (char) tolower((unsigned char) *name);
+    }
+    key[i] = '\0';
+}
+
+static dns_host_query_t *cached_query(uv_loop_t *loop, const char *key) {
+    dns_host_query_t *query = model_map_get(&cached_queries, key);
+    if (query && query->expires <= uv_now(loop)) {
+        evict_query(query);
+        query = NULL;
+    }
+    return query;
+}
+
 static ssize_t on_dns_req(ziti_connection conn, const uint8_t *data, ssize_t datalen) {
     if (datalen < 0) {
         ziti_close(conn, on_close);
         return 0;
     }
     dns_host_conn_t *dns = ziti_conn_data(conn);
+    if (dns == NULL) {
+        return datalen;
+    }
 
-    ZITI_LOG(DEBUG, "resolve_req: %.*s", (int)datalen, data);
+    // a wire format query can start with '{' too, but it never parses as JSON
     dns_message msg = {0};
-    parse_dns_message(&msg, (const char*) data, datalen);
+    const uint8_t *wire = NULL;
+    if (datalen > 0 && data[0] == '{' && parse_dns_message(&msg, (const char*) data, datalen) >= 0) {
+        ZITI_LOG(DEBUG, "resolve_req: %.*s", (int)datalen, data);
+    } else {
+        free_dns_message(&msg);
+        msg = (dns_message){0};
+        if (!dns->wire || parse_dns_req(&msg, data, datalen) != 0) {
+            free_dns_message(&msg);
+            msg = (dns_message){0};
+        }
+        wire = data;
+    }
+    if (msg.question == NULL || msg.question[0] == NULL) {
+        ZITI_LOG(WARN, "invalid resolve request");
+        free_dns_message(&msg);
+        return datalen;
+    }
     dns_question *q = msg.question[0];
+    ZITI_LOG(TRACE, "resolve_req[%04x] %s type[%d] format[%s]", (unsigned) msg.id, q->name, (int) q->type,
+             wire ? DNS_WIRE_FORMAT : "json");
 
-    if (is_allowed(q->name, dns)) {
-        do_query(q, &msg, &dns->resolver);
-    } else {
-        msg.status = ns_r_refused;
+    if (!is_allowed(q->name, dns)) {
+        if (wire) {
+            send_wire_status(dns, wire, datalen, ns_r_refused);
+        } else {
+            send_answer(dns, &msg, ns_r_refused, NULL, 0);
+        }
+        free_dns_message(&msg);
+        return datalen;
     }
 
-    size_t msg_len = 0;
-    char *json = dns_message_to_json(&msg, 0, &msg_len);
-    ziti_write(conn, (uint8_t *)json, msg_len, on_write, json);
-    free_dns_message(&msg);
+    uv_loop_t *loop = dns->loop;
+    char key[16 + 256];
+    query_key(key, sizeof(key), (int) q->type, q->name);
+
+    dns_host_query_t *query = cached_query(loop, key);
+    if (query) {
+        int age = (int) ((uv_now(loop) - query->stored) / 1000);
+        send_result(dns, &msg, wire, datalen, query, age);
+        free_dns_message(&msg);
+        return datalen;
+    }
+
+    query = model_map_get(&pending_queries, key);
+    if (query == NULL) {
+        query = calloc(1, sizeof(dns_host_query_t));
+        query->key = strdup(key);
+        query->name = strdup(q->name);
+        query->type = (int) q->type;
+        LIST_INIT(&query->waiters);
+        int rc = queue_query(query);
+        if (rc != 0) {
+            ZITI_LOG(WARN, "failed to queue query for %s: %s", q->name, uv_strerror(rc));
+            free_query(query);
+            if (wire) {
+                send_wire_status(dns, wire, datalen, ns_r_servfail);
+            } else {
+                send_answer(dns, &msg, ns_r_servfail, NULL, 0);
+            }
+            free_dns_message(&msg);
+            return datalen;
+        }
+        model_map_set(&pending_queries, key, query);
+    }
+
+    struct dns_host_waiter_s *w = calloc(1, sizeof(struct dns_host_waiter_s));
+    w->dns = dns;
+    w->msg = msg; // the waiter owns the request now
+    if (wire) {
+        w->wire = malloc(datalen);
+        memcpy(w->wire, wire, datalen);
+        w->wire_len = datalen;
+    }
+    LIST_INSERT_HEAD(&dns->waiters, w, conn_link);
+    LIST_INSERT_HEAD(&query->waiters, w, query_link);
     return datalen;
 }
 
-void accept_resolver_conn(ziti_connection conn, allowed_hostnames_t *allowed) {
+void accept_resolver_conn(ziti_connection conn, uv_loop_t *loop, allowed_hostnames_t *allowed, const char *dns_format) {
     uv_once(&init, do_init);
+    start_pool(loop);
     dns_host_conn_t *dns = calloc(1, sizeof(dns_host_conn_t));
-    if (res_ninit(&dns->resolver) == 0) {
-        ziti_conn_set_data(conn, dns);
-        struct allowed_hostname_s *ah;
-        LIST_FOREACH(ah, allowed, _next) {
-            if (ah->domain_name[0] == '*' && ah->domain_name[1] == '.') {
-                struct allowed_hostname_s *allowed_domain = calloc(1, sizeof(struct allowed_hostname_s));
-                allowed_domain->domain_name = strdup(ah->domain_name + 2); // skip *.
-                LIST_INSERT_HEAD(&dns->allowed_domains, allowed_domain, _next);
-            }
+    dns->conn = conn;
+    dns->loop = loop;
+#if !_WIN32
+    // DnsQuery does not give us the resolver's response, so windows hosts stay with JSON
+    dns->wire = dns_format != NULL && strcmp(dns_format, DNS_WIRE_FORMAT) == 0;
+#endif
+    LIST_INIT(&dns->waiters);
+    ziti_conn_set_data(conn, dns);
+    struct allowed_hostname_s *ah;
+    LIST_FOREACH(ah, allowed, _next) {
+        if (ah->domain_name[0] == '*' && ah->domain_name[1] == '.') {
+            dns_trie_set(&dns->allowed_domains, ah->domain_name + 2, true, dns); // skip *.
         }
-        ziti_accept(conn, on_conn_complete, on_dns_req);
-    } else {
-        ziti_close(conn, on_close);
     }
+    ziti_accept(conn, on_conn_complete, on_dns_req);
 }
 
 
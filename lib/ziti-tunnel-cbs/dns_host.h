@@ -32,7 +32,10 @@
 #define ns_t_mx  DNS_TYPE_MX
 #define ns_t_txt DNS_TYPE_TEXT
 
-#define ns_r_refused DNS_RCODE_REFUSED
+#define ns_r_noerror  DNS_RCODE_NOERROR
+#define ns_r_servfail DNS_RCODE_SERVFAIL
+#define ns_r_nxdomain DNS_RCODE_NXDOMAIN
+#define ns_r_refused  DNS_RCODE_REFUSED
 
 typedef struct {
     int no_use;
@@ -50,6 +53,7 @@ typedef struct __res_state resolver_t;
 
 #endif
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <ziti/model_support.h>
 
@@ -77,6 +81,9 @@ XX(comment, model_string, none, comment, __VA_ARGS__)
 extern "C" {
 #endif
 
+/* dns_format requested in a resolver connection's app_data by clients that exchange RFC1035 messages instead of JSON */
+#define DNS_WIRE_FORMAT "wire"
+
 #define DNS_FLAG_QR(f) (((f) & 0x8000U) != 0)
 #define DNS_FLAG_RD(f) (((f) & 0x0100U) != 0)
 
@@ -92,6 +99,50 @@ void do_query(const dns_question *q, dns_message *resp, resolver_t *resolver);
 
 int parse_dns_req(dns_message *msg, const unsigned char* buf, size_t buflen);
 
+/* UDP payload size advertised in the message's EDNS0 OPT record, or -1 if it has none */
+int dns_edns_payload(const uint8_t *msg, size_t len);
+
+/* remove the OPT record from a message. returns the new length */
+size_t dns_strip_opt(uint8_t *msg, size_t len);
+
+/* the sections that hold resource records, numbered after their count in the header */
+enum dns_rr_section {
+    DNS_SECTION_ANSWER = 1,
+    DNS_SECTION_AUTHORITY,
+    DNS_SECTION_ADDITIONAL,
+};
+
+/* called for each resource record. `name` points at its owner name, and `rr` at its fixed part:
+ * type, class, ttl, rdlength. return false to stop the walk */
+typedef bool (*dns_rr_visitor)(uint8_t *name, uint8_t *rr, uint16_t type, const uint8_t *rdata, uint16_t rdlen,
+                               enum dns_rr_section section, void *ctx);
+
+/* visit the resource records that follow a message's questions. returns false if the message is malformed */
+bool dns_walk_rrs(uint8_t *msg, size_t len, dns_rr_visitor visit, void *ctx);
+
+/* reduce the TTLs of a response's records by `elapsed` seconds */
+void dns_age_ttl(uint8_t *msg, size_t len, uint32_t elapsed);
+
+/* cut a response down to its header and question, and set TC. returns the new length, or 0 if it is malformed */
+size_t dns_truncate(uint8_t *msg, size_t len);
+
+/* largest DNS message; the TCP length prefix is 16 bits */
+#define DNS_MAX_MSG_LEN 65535
+
+/* largest response for UDP clients that do not advertise an EDNS0 payload size */
+#define DNS_UDP_MIN_PAYLOAD 512
+
+/* largest response the client that sent `query` accepts. sets `edns` if the query has an OPT record */
+size_t dns_max_response(const uint8_t *query, size_t len, bool tcp, bool *edns);
+
+/* fit a response to its client: drop the OPT record unless the client sent one, and truncate it if it is
+ * larger than `max_len`. returns the new length */
+size_t dns_fit_response(uint8_t *resp, size_t len, bool edns, size_t max_len);
+
+/* length of the first length-prefixed message (RFC 1035 4.2.2) in a TCP stream, including its two byte
+ * prefix, or 0 if it hasn't been received completely */
+size_t dns_tcp_frame_len(const uint8_t *buf, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,15 +16,19 @@
 
 #include "dns_host.h"
 #include <stdint.h>
+#include <string.h>
 
 static int parse_dns_q(dns_question *q, const unsigned char *buf, size_t buflen) {
     const uint8_t *p = buf;
+    const uint8_t *end = buf + buflen;
     size_t namelen = 1; // ensure there's room for a nul byte if name is empty
 
-    while(*p != 0) {
+    while(p < end && *p != 0) {
+        if ((*p & 0xC0) != 0) return -1; // questions are not compressed
         namelen += (*p + 1);
         p += (*p + 1);
     }
+    if (p + 5 > end) return -1;
     p++;
     int type = ntohs(*(uint16_t*)p);
     int cls = ntohs(*(((uint16_t*)p) + 1));
@@ -49,6 +53,7 @@ static int parse_dns_q(dns_question *q, const unsigned char *buf, size_t buflen)
 }
 
 int parse_dns_req(dns_message *msg, const unsigned char* buf, size_t buflen) {
+    if (buflen < 12) return -1;
 
     msg->id = ntohs(*((uint16_t*)buf));
     uint16_t flags = ntohs(*((uint16_t*)buf + 1));
@@ -61,8 +66,185 @@ int parse_dns_req(dns_message *msg, const unsigned char* buf, size_t buflen) {
     msg->recursive = DNS_FLAG_RD(flags);
     msg->question = calloc(2, sizeof(dns_question*));
     msg->question[0] = calloc(1, sizeof(dns_question));
-    parse_dns_q(msg->question[0], buf + 12, buflen - 12);
+    if (parse_dns_q(msg->question[0], buf + 12, buflen - 12) < 0) return -1;
+
+    return 0;
+}
 
+#define DNS_HDR_LEN 12
+#define DNS_T_OPT   41
 
+static inline uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) (v & 0xff);
+}
+
+/* offset just past the (possibly compressed) name at `off`, or 0 if it is malformed or runs past the end */
+static size_t skip_name(const uint8_t *pkt, size_t len, size_t off) {
+    while (off < len) {
+        uint8_t l = pkt[off];
+        if ((l & 0xc0) == 0xc0) {
+            return off + 2 <= len ? off + 2 : 0;
+        }
+        if (l & 0xc0) {
+            return 0;
+        }
+        off += 1 + l;
+        if (l == 0) {
+            return off;
+        }
+    }
     return 0;
 }
+
+/* offset just past the question section, or 0 if the message is malformed */
+static size_t skip_questions(const uint8_t *pkt, size_t len) {
+    if (len < DNS_HDR_LEN) {
+        return 0;
+    }
+    size_t off = DNS_HDR_LEN;
+    for (uint16_t i = get_u16(pkt + 4); i > 0; i--) {
+        off = skip_name(pkt, len, off);
+        if (off == 0 || off + 4 > len) {
+            return 0;
+        }
+        off += 4;
+    }
+    return off;
+}
+
+bool dns_walk_rrs(uint8_t *msg, size_t len, dns_rr_visitor visit, void *ctx) {
+    size_t off = skip_questions(msg, len);
+    if (off == 0) {
+        return false;
+    }
+
+    for (enum dns_rr_section s = DNS_SECTION_ANSWER; s <= DNS_SECTION_ADDITIONAL; s++) {
+        for (uint16_t i = 0, n = get_u16(msg + 4 + 2 * s); i < n; i++) {
+            size_t name = off;
+            off = skip_name(msg, len, off);
+            if (off == 0 || off + 10 > len) {
+                return false;
+            }
+            uint16_t rdlen = get_u16(msg + off + 8);
+            if (off + 10 + rdlen > len) {
+                return false;
+            }
+            if (!visit(msg + name, msg + off, get_u16(msg + off), msg + off + 10, rdlen, s, ctx)) {
+                return true;
+            }
+            off += 10 + rdlen;
+        }
+    }
+    return true;
+}
+
+struct opt_rr {
+    uint8_t *name;
+    uint8_t *rr;
+    size_t len; // of the whole record
+};
+
+static bool find_opt_rr(uint8_t *name, uint8_t *rr, uint16_t type, const uint8_t *rdata, uint16_t rdlen,
+                        enum dns_rr_section section, void *ctx) {
+    if (section != DNS_SECTION_ADDITIONAL || type != DNS_T_OPT) {
+        return true;
+    }
+    struct opt_rr *opt = ctx;
+    opt->name = name;
+    opt->rr = rr;
+    opt->len = (size_t) (rdata + rdlen - name);
+    return false;
+}
+
+/* finds the OPT record among the additional records. returns false if there is none */
+static bool find_opt(uint8_t *msg, size_t len, struct opt_rr *opt) {
+    memset(opt, 0, sizeof(*opt));
+    return dns_walk_rrs(msg, len, find_opt_rr, opt) && opt->name != NULL;
+}
+
+int dns_edns_payload(const uint8_t *msg, size_t len) {
+    struct opt_rr opt;
+    // find_opt doesn't modify the message
+    if (!find_opt((uint8_t *) msg, len, &opt)) {
+        return -1;
+    }
+    // the OPT record's class is the sender's UDP payload size
+    return get_u16(opt.rr + 2);
+}
+
+size_t dns_strip_opt(uint8_t *msg, size_t len) {
+    struct opt_rr opt;
+    if (!find_opt(msg, len, &opt)) {
+        return len;
+    }
+    size_t end = (size_t) (opt.name - msg) + opt.len;
+    memmove(opt.name, msg + end, len - end);
+    put_u16(msg + 10, get_u16(msg + 10) - 1);
+    return len - opt.len;
+}
+
+static bool age_ttl(uint8_t *name, uint8_t *rr, uint16_t type, const uint8_t *rdata, uint16_t rdlen,
+                    enum dns_rr_section section, void *ctx) {
+    // the OPT record's ttl field holds flags
+    if (type != DNS_T_OPT) {
+        uint32_t elapsed = *(const uint32_t *) ctx;
+        uint8_t *ttl = rr + 4;
+        uint32_t t = (uint32_t) get_u16(ttl) << 16 | get_u16(ttl + 2);
+        t = t > elapsed ? t - elapsed : 0;
+        put_u16(ttl, (uint16_t) (t >> 16));
+        put_u16(ttl + 2, (uint16_t) t);
+    }
+    return true;
+}
+
+void dns_age_ttl(uint8_t *msg, size_t len, uint32_t elapsed) {
+    dns_walk_rrs(msg, len, age_ttl, &elapsed);
+}
+
+size_t dns_truncate(uint8_t *msg, size_t len) {
+    size_t off = skip_questions(msg, len);
+    if (off == 0) {
+        return 0;
+    }
+    msg[2] |= 0x02; // TC
+    put_u16(msg + 6, 0);
+    put_u16(msg + 8, 0);
+    put_u16(msg + 10, 0);
+    return off;
+}
+
+size_t dns_max_response(const uint8_t *query, size_t len, bool tcp, bool *edns) {
+    int payload = dns_edns_payload(query, len);
+    *edns = payload >= 0;
+    if (tcp) {
+        return DNS_MAX_MSG_LEN;
+    }
+    // RFC 6891 6.2.5: payload sizes below 512 are treated as 512
+    return payload > DNS_UDP_MIN_PAYLOAD ? (size_t) payload : DNS_UDP_MIN_PAYLOAD;
+}
+
+size_t dns_fit_response(uint8_t *resp, size_t len, bool edns, size_t max_len) {
+    if (!edns) {
+        len = dns_strip_opt(resp, len);
+    }
+    if (len > max_len) {
+        size_t truncated = dns_truncate(resp, len);
+        if (truncated > 0) {
+            len = truncated;
+        }
+    }
+    return len;
+}
+
+size_t dns_tcp_frame_len(const uint8_t *buf, size_t len) {
+    if (len < 2) {
+        return 0;
+    }
+    size_t frame_len = 2 + get_u16(buf);
+    return len >= frame_len ? frame_len : 0;
+}
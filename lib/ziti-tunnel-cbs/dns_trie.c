@@ -0,0 +1,160 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_trie.h"
+
+/**
+ * step to the label before the first `*rest` characters of `name`, and drop it (and its dot) from `*rest`.
+ * returns false once the labels are used up.
+ */
+static bool prev_label(const char *name, size_t *rest, const char **label, size_t *label_len) {
+    if (*rest == 0) {
+        return false;
+    }
+    size_t start = *rest;
+    while (start > 0 && name[start - 1] != '.') {
+        start--;
+    }
+    *label = name + start;
+    *label_len = *rest - start;
+    *rest = start > 0 ? start - 1 : 0;
+    return true;
+}
+
+static size_t label_count(const char *name) {
+    size_t rest = strlen(name);
+    const char *label;
+    size_t len;
+    size_t count = 0;
+    while (prev_label(name, &rest, &label, &len)) {
+        count++;
+    }
+    return count;
+}
+
+static dns_trie_node *child(const dns_trie_node *n, const char *label, size_t len) {
+    return model_map_get_key((model_map *) &n->children, label, len);
+}
+
+void dns_trie_init(dns_trie_t *trie) {
+    memset(trie, 0, sizeof(*trie));
+}
+
+static void clear_node(dns_trie_node *n, void (*free_fn)(void *)) {
+    model_map_iter it = model_map_iterator(&n->children);
+    while (it != NULL) {
+        dns_trie_node *c = model_map_it_value(it);
+        it = model_map_it_remove(it);
+        clear_node(c, free_fn);
+        free(c);
+    }
+    if (free_fn) {
+        if (n->value) free_fn(n->value);
+        if (n->wildcard) free_fn(n->wildcard);
+    }
+    n->value = n->wildcard = NULL;
+}
+
+void dns_trie_clear(dns_trie_t *trie, void (*free_fn)(void *)) {
+    clear_node(&trie->root, free_fn);
+    trie->size = 0;
+}
+
+void *dns_trie_set(dns_trie_t *trie, const char *name, bool wildcard, void *value) {
+    if (label_count(name) > DNS_TRIE_MAX_DEPTH) return NULL;
+
+    dns_trie_node *n = &trie->root;
+    size_t rest = strlen(name);
+    const char *label;
+    size_t len;
+    while (prev_label(name, &rest, &label, &len)) {
+        dns_trie_node *c = child(n, label, len);
+        if (c == NULL) {
+            c = calloc(1, sizeof(*c));
+            model_map_set_key(&n->children, label, len, c);
+        }
+        n = c;
+    }
+
+    void **slot = wildcard ? &n->wildcard : &n->value;
+    void *old = *slot;
+    *slot = value;
+    if (old == NULL && value != NULL) trie->size++;
+    if (old != NULL && value == NULL) trie->size--;
+    return old;
+}
+
+void *dns_trie_get(const dns_trie_t *trie, const char *name, bool wildcard) {
+    const dns_trie_node *n = &trie->root;
+    size_t rest = strlen(name);
+    const char *label;
+    size_t len;
+    while (n != NULL && prev_label(name, &rest, &label, &len)) {
+        n = child(n, label, len);
+    }
+    if (n == NULL) return NULL;
+    return wildcard ? n->wildcard : n->value;
+}
+
+void *dns_trie_remove(dns_trie_t *trie, const char *name, bool wildcard) {
+    dns_trie_node *path[DNS_TRIE_MAX_DEPTH + 1];
+    const char *labels[DNS_TRIE_MAX_DEPTH];
+    size_t lens[DNS_TRIE_MAX_DEPTH];
+    int depth = 0;
+
+    path[0] = &trie->root;
+    size_t rest = strlen(name);
+    while (depth < DNS_TRIE_MAX_DEPTH && prev_label(name, &rest, &labels[depth], &lens[depth])) {
+        dns_trie_node *c = child(path[depth], labels[depth], lens[depth]);
+        if (c == NULL) return NULL;
+        path[++depth] = c;
+    }
+    // deeper names are never stored
+    if (rest > 0) return NULL;
+
+    dns_trie_node *n = path[depth];
+    void **slot = wildcard ? &n->wildcard : &n->value;
+    void *old = *slot;
+    *slot = NULL;
+    if (old != NULL) trie->size--;
+
+    // drop nodes that no longer lead to a value
+    while (depth > 0) {
+        n = path[depth];
+        if (n->value || n->wildcard || model_map_size(&n->children) > 0) break;
+        depth--;
+        model_map_remove_key(&path[depth]->children, labels[depth], lens[depth]);
+        free(n);
+    }
+    return old;
+}
+
+void *dns_trie_find_wildcard(const dns_trie_t *trie, const char *name, bool or_self) {
+    const dns_trie_node *n = &trie->root;
+    void *best = NULL;
+    size_t rest = strlen(name);
+    const char *label;
+    size_t len;
+    while (prev_label(name, &rest, &label, &len)) {
+        if (n->wildcard) best = n->wildcard;
+        n = child(n, label, len);
+        if (n == NULL) return best;
+    }
+    return or_self && n->wildcard ? n->wildcard : best;
+}
@@ -0,0 +1,74 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DNS_TRIE_H
+#define ZITI_TUNNELER_SDK_DNS_TRIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <ziti/model_collections.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a name has at most 127 labels (RFC 1035 2.3.4) */
+#define DNS_TRIE_MAX_DEPTH 128
+
+typedef struct dns_trie_node_s {
+    model_map children; // label -> struct dns_trie_node_s
+    void *value;        // value of the name that ends here
+    void *wildcard;     // value of `*.<name>`, which matches every name below this one
+} dns_trie_node;
+
+/**
+ * DNS names keyed by their labels, last label first, so a lookup costs one map lookup per label no matter how
+ * many names and wildcard domains are stored. labels are compared as given; callers normalize case.
+ * the empty name is the root, and its wildcard matches every name.
+ */
+typedef struct dns_trie_s {
+    dns_trie_node root;
+    size_t size;
+} dns_trie_t;
+
+extern void dns_trie_init(dns_trie_t *trie);
+
+/** remove all names, calling `free_fn` (if not NULL) with every value */
+extern void dns_trie_clear(dns_trie_t *trie, void (*free_fn)(void *));
+
+/**
+ * store `value` for `name`, or for `*.<name>` if `wildcard` is set. returns the value it replaced.
+ * names with more than DNS_TRIE_MAX_DEPTH labels are not stored.
+ */
+extern void *dns_trie_set(dns_trie_t *trie, const char *name, bool wildcard, void *value);
+
+/** the value stored for `name`, or for `*.<name>` if `wildcard` is set */
+extern void *dns_trie_get(const dns_trie_t *trie, const char *name, bool wildcard);
+
+/** remove and return the value stored for `name`, or for `*.<name>` if `wildcard` is set */
+extern void *dns_trie_remove(dns_trie_t *trie, const char *name, bool wildcard);
+
+/**
+ * the value of the most specific wildcard domain that `name` is below. `*.example.com` matches `a.example.com` and
+ * `a.b.example.com`, and `example.com` only if `or_self` is set.
+ */
+extern void *dns_trie_find_wildcard(const dns_trie_t *trie, const char *name, bool or_self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DNS_TRIE_H
@@ -0,0 +1,124 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <string.h>
+
+#include "dns_upstream.h"
+
+#define INITIAL_RTT     100.0
+#define EWMA_WEIGHT     0.2
+#define FAILOVER_MIN    250
+#define FAILOVER_MAX    2000
+#define HEDGE_MIN       20
+#define HEDGE_MAX       1000
+
+static const char *const strategy_names[] = {
+        [dns_upstream_race] = "race",
+        [dns_upstream_sequential] = "sequential",
+        [dns_upstream_all] = "all",
+};
+
+int dns_upstream_strategy_from_string(const char *name, dns_upstream_strategy *strategy) {
+    for (size_t i = 0; i < sizeof(strategy_names) / sizeof(strategy_names[0]); i++) {
+        if (strcmp(name, strategy_names[i]) == 0) {
+            *strategy = (dns_upstream_strategy) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *dns_upstream_strategy_name(dns_upstream_strategy strategy) {
+    return strategy_names[strategy];
+}
+
+void dns_upstream_stats_init(dns_upstream_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->rtt = INITIAL_RTT;
+    stats->p50 = INITIAL_RTT;
+}
+
+void dns_upstream_on_answer(dns_upstream_stats_t *stats, uint64_t rtt) {
+    double sample = (double) rtt;
+    stats->rtt += EWMA_WEIGHT * (sample - stats->rtt);
+    // frugal median: step towards each sample by a fraction of the current estimate
+    double step = stats->p50 / 16.0 > 1.0 ? stats->p50 / 16.0 : 1.0;
+    if (sample > stats->p50) {
+        stats->p50 += step;
+    } else if (sample < stats->p50) {
+        stats->p50 = stats->p50 - step > sample ? stats->p50 - step : sample;
+    }
+    stats->error_rate -= EWMA_WEIGHT * stats->error_rate;
+    stats->consecutive_errors = 0;
+    stats->demoted_until = 0;
+    stats->answers++;
+}
+
+bool dns_upstream_on_error(dns_upstream_stats_t *stats, uint64_t now) {
+    stats->error_rate += EWMA_WEIGHT * (1.0 - stats->error_rate);
+    stats->errors++;
+    if (++stats->consecutive_errors >= DNS_UPSTREAM_DEMOTE_ERRORS && !dns_upstream_is_demoted(stats, now)) {
+        stats->demoted_until = now + DNS_UPSTREAM_DEMOTE_MS;
+        return true;
+    }
+    return false;
+}
+
+bool dns_upstream_is_demoted(const dns_upstream_stats_t *stats, uint64_t now) {
+    return stats->demoted_until > now;
+}
+
+/* expected cost of asking an upstream: its latency, inflated by how often it fails */
+static double score(const dns_upstream_stats_t *stats) {
+    return stats->rtt * (1.0 + 4.0 * stats->error_rate);
+}
+
+void dns_upstream_order(const dns_upstream_stats_t *stats, size_t count, uint64_t now, uint8_t *order) {
+    for (size_t i = 0; i < count; i++) {
+        order[i] = (uint8_t) i;
+    }
+    // insertion sort; there are only a handful of upstreams. ties keep the configured order
+    for (size_t i = 1; i < count; i++) {
+        uint8_t idx = order[i];
+        bool demoted = dns_upstream_is_demoted(&stats[idx], now);
+        double s = score(&stats[idx]);
+        size_t j = i;
+        while (j > 0) {
+            const dns_upstream_stats_t *prev = &stats[order[j - 1]];
+            bool prev_demoted = dns_upstream_is_demoted(prev, now);
+            if (prev_demoted < demoted || (prev_demoted == demoted && score(prev) <= s)) {
+                break;
+            }
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = idx;
+    }
+}
+
+static uint64_t clamp(double v, uint64_t lo, uint64_t hi) {
+    if (v < (double) lo) return lo;
+    if (v > (double) hi) return hi;
+    return (uint64_t) v;
+}
+
+uint64_t dns_upstream_hedge_delay(const dns_upstream_stats_t *stats) {
+    return clamp(stats->p50, HEDGE_MIN, HEDGE_MAX);
+}
+
+uint64_t dns_upstream_failover_delay(const dns_upstream_stats_t *stats) {
+    return clamp(4.0 * stats->rtt, FAILOVER_MIN, FAILOVER_MAX);
+}
@@ -0,0 +1,83 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DNS_UPSTREAM_H
+#define ZITI_TUNNELER_SDK_DNS_UPSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* how recursive queries are spread over the configured upstreams */
+typedef enum {
+    dns_upstream_race,       // ask the best upstream, and hedge to the next one after its median latency
+    dns_upstream_sequential, // ask one upstream at a time, failing over to the next one after a few round trips
+    dns_upstream_all,        // ask every upstream at once
+} dns_upstream_strategy;
+
+/* how long an upstream has to answer before the query fails and counts against its health.
+ * like a stub resolver's timeout (resolv.conf defaults to 5s), so slow recursive lookups can finish.
+ * hedging and failing over to other upstreams happen much sooner, without giving up on this one */
+#define DNS_UPSTREAM_TIMEOUT_MS    5000
+
+/* consecutive errors after which an upstream is only used when healthier ones are exhausted */
+#define DNS_UPSTREAM_DEMOTE_ERRORS 3
+#define DNS_UPSTREAM_DEMOTE_MS     30000
+
+/* latency and health of one upstream. times are in milliseconds */
+typedef struct dns_upstream_stats_s {
+    double rtt;        // EWMA of answer latency
+    double p50;        // streaming estimate of the median answer latency
+    double error_rate; // EWMA of queries that failed or timed out, 0..1
+    unsigned consecutive_errors;
+    uint64_t demoted_until;
+
+    uint64_t queries;
+    uint64_t answers;
+    uint64_t errors;
+} dns_upstream_stats_t;
+
+extern int dns_upstream_strategy_from_string(const char *name, dns_upstream_strategy *strategy);
+
+extern const char *dns_upstream_strategy_name(dns_upstream_strategy strategy);
+
+extern void dns_upstream_stats_init(dns_upstream_stats_t *stats);
+
+extern void dns_upstream_on_answer(dns_upstream_stats_t *stats, uint64_t rtt);
+
+/* returns true if this error demoted the upstream */
+extern bool dns_upstream_on_error(dns_upstream_stats_t *stats, uint64_t now);
+
+extern bool dns_upstream_is_demoted(const dns_upstream_stats_t *stats, uint64_t now);
+
+/* fill `order` with the indexes of `count` upstreams, best first. demoted upstreams come last */
+extern void dns_upstream_order(const dns_upstream_stats_t *stats, size_t count, uint64_t now, uint8_t *order);
+
+/* how long to wait for an answer before also asking the next upstream, in the race strategy */
+extern uint64_t dns_upstream_hedge_delay(const dns_upstream_stats_t *stats);
+
+/* how long to wait for an answer before failing over to the next upstream, in the sequential strategy */
+extern uint64_t dns_upstream_failover_delay(const dns_upstream_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DNS_UPSTREAM_H
@@ -35,16 +35,27 @@ extern "C" {
 
 int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_cidr);
 
+/** also give intercepted hostnames an address from `dns_cidr6` (/64 or shorter), and answer AAAA queries for them */
+int ziti_dns_setup_ipv6(const char *dns_cidr6);
+
 int ziti_dns_set_upstream(uv_loop_t *l, tunnel_upstream_dns_array upstreams);
 
+/** select how queries are spread over the upstreams: "race" (default), "sequential" or "all" */
+int ziti_dns_set_upstream_strategy(const char *strategy);
+
 const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *intercept);
 
+/** IPv6 address of a registered hostname, or NULL if there is no IPv6 pool */
+const ip_addr_t *ziti_dns_hostname_ip6(const ziti_address *addr);
+
 const char *ziti_dns_reverse_lookup_domain(const ip_addr_t *addr);
 
 const char *ziti_dns_reverse_lookup(const char *ip_addr);
 
 void ziti_dns_deregister_intercept(void *intercept);
 
+void ziti_dns_get_cache_stats(tunnel_dns_cache_stats *stats);
+
 #ifdef __cplusplus
 };
 #endif
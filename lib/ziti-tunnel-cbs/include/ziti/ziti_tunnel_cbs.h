@@ -44,7 +44,8 @@ XX(dst_port, model_string, none, dst_port, __VA_ARGS__)\
 XX(src_protocol, model_string, none, src_protocol, __VA_ARGS__)\
 XX(src_ip, model_string, none, src_ip, __VA_ARGS__)\
 XX(src_port, model_string, none, src_port, __VA_ARGS__)\
-XX(source_addr, model_string, none, source_addr, __VA_ARGS__)
+XX(source_addr, model_string, none, source_addr, __VA_ARGS__)\
+XX(dns_format, model_string, none, dns_format, __VA_ARGS__)
 
 DECLARE_ENUM(TunnelConnectionType, TUNNELER_CONN_TYPE_ENUM)
 
@@ -304,7 +305,12 @@ DECLARE_MODEL(ext_signer_event, EXT_SIGNER_EVENT_MODEL)
 
 typedef struct tunneled_service_s tunneled_service_t;
 
+/** backpressure threshold (and client receive window) of a new connection */
 #define MAX_PENDING_BYTES (128 * 1024)
+/** the most that a single connection's threshold grows to. TCP_WND in lwipopts.h is the same */
+#define PENDING_BYTES_CEILING (8 * 1024 * 1024)
+/** total growth above MAX_PENDING_BYTES granted across all connections */
+#define PENDING_BYTES_BUDGET (256 * 1024 * 1024)
 
 /** context passed through the tunneler SDK for network i/o */
 typedef struct ziti_io_ctx_s {
@@ -312,6 +318,18 @@ typedef struct ziti_io_ctx_s {
     bool ziti_eof;
     bool tnlr_eof;
     uint64_t pending_wbytes;
+
+    // the backpressure threshold is sized to the bandwidth-delay product of ziti writes
+    uint64_t pending_limit;
+    uint64_t written;        // total bytes passed to ziti_write
+    uint64_t completed;      // total bytes whose writes completed
+    uint64_t sample_end;     // `written` mark whose completion ends the current sample. 0 if none
+    uint64_t sample_start;   // uv_hrtime() when the sample started
+    uint64_t sample_base;    // `completed` when the sample started
+    uint64_t min_latency;    // lowest write completion latency (ns) seen recently
+    uint64_t min_latency_at;
+    uint64_t last_completed_at;
+    bool limited;            // writes were held back by pending_limit during the sample
 } ziti_io_context;
 
 
@@ -336,6 +354,9 @@ void *ziti_sdk_c_dial(const void *app_intercept_ctx, struct io_ctx_s *io);
 /** called from tunneler SDK when intercepted client sends data */
 ssize_t ziti_sdk_c_write(const void *ziti_io_ctx, void *write_ctx, const void *data, size_t len);
 
+/** called from tunneler SDK when intercepted client sends data that spans several buffers */
+ssize_t ziti_sdk_c_writev(const void *ziti_io_ctx, void *write_ctx, const uv_buf_t *bufs, unsigned int nbufs);
+
 /** called by tunneler SDK after a client connection's RX is closed
  * return 0 if TX should still be open, 1 if both sides are closed */
 int ziti_sdk_c_close(void *io_ctx);
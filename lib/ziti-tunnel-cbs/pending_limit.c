@@ -0,0 +1,108 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "pending_limit.h"
+
+static bool set_limit(ziti_io_context *zio, pending_budget_t *budget, uint64_t limit) {
+    if (limit == zio->pending_limit) {
+        return false;
+    }
+    budget->used -= zio->pending_limit - MAX_PENDING_BYTES;
+    budget->used += limit - MAX_PENDING_BYTES;
+    zio->pending_limit = limit;
+    return true;
+}
+
+void pending_limit_init(ziti_io_context *zio) {
+    zio->pending_wbytes = 0;
+    zio->pending_limit = MAX_PENDING_BYTES;
+    zio->written = 0;
+    zio->completed = 0;
+    zio->sample_end = 0;
+    zio->sample_start = 0;
+    zio->sample_base = 0;
+    zio->min_latency = 0;
+    zio->min_latency_at = 0;
+    zio->last_completed_at = 0;
+    zio->limited = false;
+}
+
+void pending_limit_on_write(ziti_io_context *zio, size_t len, uint64_t now) {
+    zio->pending_wbytes += len;
+    zio->written += len;
+    if (zio->pending_wbytes >= zio->pending_limit - zio->pending_limit / 4) {
+        zio->limited = true;
+    }
+    if (zio->sample_end == 0) {
+        zio->sample_end = zio->written;
+        zio->sample_start = now;
+        zio->sample_base = zio->completed;
+    }
+}
+
+bool pending_limit_on_written(ziti_io_context *zio, pending_budget_t *budget, size_t len, uint64_t now) {
+    zio->pending_wbytes -= len;
+    zio->completed += len;
+    zio->last_completed_at = now;
+    if (zio->sample_end == 0 || zio->completed < zio->sample_end) {
+        return false;
+    }
+
+    uint64_t elapsed = now - zio->sample_start;
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+    if (zio->min_latency == 0 || elapsed < zio->min_latency ||
+        now - zio->min_latency_at > PENDING_MIN_LATENCY_WINDOW) {
+        zio->min_latency = elapsed;
+        zio->min_latency_at = now;
+    }
+    uint64_t bdp = (zio->completed - zio->sample_base) * zio->min_latency / elapsed;
+    bool limited = zio->limited;
+    zio->limited = false;
+    zio->sample_end = 0;
+    if (!limited) {
+        // the client did not keep the pipe full, so the sample says nothing about the path
+        return false;
+    }
+
+    uint64_t limit = 2 * bdp;
+    if (limit > 2 * zio->pending_limit) {
+        limit = 2 * zio->pending_limit;
+    }
+    if (limit > PENDING_BYTES_CEILING) {
+        limit = PENDING_BYTES_CEILING;
+    }
+    if (limit < MAX_PENDING_BYTES) {
+        limit = MAX_PENDING_BYTES;
+    }
+    uint64_t available = budget->total > budget->used ? budget->total - budget->used : 0;
+    if (limit > zio->pending_limit + available) {
+        limit = zio->pending_limit + available;
+    }
+    return set_limit(zio, budget, limit);
+}
+
+bool pending_limit_reclaim_idle(ziti_io_context *zio, pending_budget_t *budget, uint64_t now) {
+    if (zio->pending_wbytes > 0 || now - zio->last_completed_at < PENDING_IDLE_RESET) {
+        return false;
+    }
+    return pending_limit_reset(zio, budget);
+}
+
+bool pending_limit_reset(ziti_io_context *zio, pending_budget_t *budget) {
+    return set_limit(zio, budget, MAX_PENDING_BYTES);
+}
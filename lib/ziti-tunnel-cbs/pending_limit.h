@@ -0,0 +1,65 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_PENDING_LIMIT_H
+#define ZITI_TUNNELER_SDK_PENDING_LIMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ziti/ziti_tunnel_cbs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* lowest latency samples older than this are replaced, so the estimate follows path changes. times are in ns */
+#define PENDING_MIN_LATENCY_WINDOW (10 * 1000000000ULL)
+
+/* a connection that has not written for this long gives its grown threshold back */
+#define PENDING_IDLE_RESET (1000000000ULL)
+
+/* growth above MAX_PENDING_BYTES that connections may share */
+typedef struct pending_budget_s {
+    uint64_t total;
+    uint64_t used;
+} pending_budget_t;
+
+extern void pending_limit_init(ziti_io_context *zio);
+
+/* called when bytes are passed to ziti_write. starts a latency sample if none is running */
+extern void pending_limit_on_write(ziti_io_context *zio, size_t len, uint64_t now);
+
+/*
+ * called when a ziti_write completes. when a sample completes on a connection that was held back by its threshold,
+ * the threshold is moved toward twice the bandwidth-delay product: the bytes completed during the sample, scaled by
+ * the lowest latency seen. it at most doubles per sample, and only grows while the budget allows.
+ * returns true if the threshold changed.
+ */
+extern bool pending_limit_on_written(ziti_io_context *zio, pending_budget_t *budget, size_t len, uint64_t now);
+
+/* give the growth of a connection that has been idle for PENDING_IDLE_RESET back to the budget.
+ * returns true if the threshold changed */
+extern bool pending_limit_reclaim_idle(ziti_io_context *zio, pending_budget_t *budget, uint64_t now);
+
+/* give all growth back to the budget, e.g. when the connection closes. returns true if the threshold changed */
+extern bool pending_limit_reset(ziti_io_context *zio, pending_budget_t *budget);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_PENDING_LIMIT_H
@@ -0,0 +1,130 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <cstring>
+#include "catch2/catch.hpp"
+#include "../dns_cache.h"
+
+// A query for Example.com, with mixed case to check that names are compared case-insensitively
+static const uint8_t query[] = {
+        0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        7, 'E', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, 0x00, 0x01, 0x00, 0x01,
+};
+
+// example.com A 1.2.3.4, ttl 60
+static const uint8_t answer[] = {
+        0xab, 0xcd, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, 0x00, 0x01, 0x00, 0x01,
+        0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 60, 0x00, 0x04, 1, 2, 3, 4,
+};
+static const size_t answer_ttl_offset = sizeof(answer) - 10;
+
+// NXDOMAIN with an SOA whose MINIMUM (30) is below its ttl (3600)
+static const uint8_t nxdomain[] = {
+        0xab, 0xcd, 0x81, 0x83, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+        7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, 0x00, 0x01, 0x00, 0x01,
+        0xc0, 0x14, 0x00, 0x06, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 26,
+        1, 'a', 0, 1, 'b', 0,
+        0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 4, 0, 0, 0, 30,
+};
+
+static uint32_t ttl_at(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+TEST_CASE("dns_cache_positive", "[dns]") {
+    dns_cache_t cache;
+    dns_cache_init(&cache, 16);
+    uint8_t resp[512];
+
+    CHECK(dns_cache_get(&cache, query, sizeof(query), resp, sizeof(resp), 0) == 0);
+    REQUIRE(dns_cache_put(&cache, query, sizeof(query), answer, sizeof(answer), 1000));
+    CHECK(dns_cache_size(&cache) == 1);
+
+    size_t len = dns_cache_get(&cache, query, sizeof(query), resp, sizeof(resp), 11000);
+    REQUIRE(len == sizeof(answer));
+    // the client's ID, with the ttl aged by 10 seconds
+    CHECK(resp[0] == 0x12);
+    CHECK(resp[1] == 0x34);
+    CHECK(ttl_at(resp + answer_ttl_offset) == 50);
+
+    // expired
+    CHECK(dns_cache_get(&cache, query, sizeof(query), resp, sizeof(resp), 61000) == 0);
+    CHECK(dns_cache_size(&cache) == 0);
+    CHECK(cache.hits == 1);
+    CHECK(cache.misses == 2);
+
+    dns_cache_clear(&cache);
+}
+
+TEST_CASE("dns_cache_negative", "[dns]") {
+    dns_cache_t cache;
+    dns_cache_init(&cache, 16);
+    uint8_t resp[512];
+
+    REQUIRE(dns_cache_put(&cache, query, sizeof(query), nxdomain, sizeof(nxdomain), 0));
+    CHECK(dns_cache_get(&cache, query, sizeof(query), resp, sizeof(resp), 29999) == sizeof(nxdomain));
+    CHECK(dns_cache_get(&cache, query, sizeof(query), resp, sizeof(resp), 30000) == 0);
+
+    dns_cache_clear(&cache);
+}
+
+TEST_CASE("dns_cache_rejects", "[dns]") {
+    dns_cache_t cache;
+    dns_cache_init(&cache, 16);
+
+    // truncated
+    uint8_t tc[sizeof(answer)];
+    memcpy(tc, answer, sizeof(answer));
+    tc[2] |= 0x02;
+    CHECK_FALSE(dns_cache_put(&cache, query, sizeof(query), tc, sizeof(tc), 0));
+
+    // SERVFAIL
+    uint8_t servfail[sizeof(answer)];
+    memcpy(servfail, answer, sizeof(answer));
+    servfail[3] = (servfail[3] & 0xF0) | 2;
+    CHECK_FALSE(dns_cache_put(&cache, query, sizeof(query), servfail, sizeof(servfail), 0));
+
+    // answer for another name
+    uint8_t other[sizeof(answer)];
+    memcpy(other, answer, sizeof(answer));
+    other[13] = 'x';
+    CHECK_FALSE(dns_cache_put(&cache, query, sizeof(query), other, sizeof(other), 0));
+
+    CHECK(dns_cache_size(&cache) == 0);
+    dns_cache_clear(&cache);
+}
+
+TEST_CASE("dns_cache_lru", "[dns]") {
+    dns_cache_t cache;
+    dns_cache_init(&cache, 1);
+    uint8_t resp[512];
+
+    uint8_t query2[sizeof(query)];
+    uint8_t answer2[sizeof(answer)];
+    memcpy(query2, query, sizeof(query));
+    memcpy(answer2, answer, sizeof(answer));
+    query2[13] = answer2[13] = 'f';
+
+    REQUIRE(dns_cache_put(&cache, query, sizeof(query), answer, sizeof(answer), 0));
+    REQUIRE(dns_cache_put(&cache, query2, sizeof(query2), answer2, sizeof(answer2), 0));
+    CHECK(dns_cache_size(&cache) == 1);
+    CHECK(cache.evictions == 1);
+    CHECK(dns_cache_get(&cache, query, sizeof(query), resp, sizeof(resp), 0) == 0);
+    CHECK(dns_cache_get(&cache, query2, sizeof(query2), resp, sizeof(resp), 0) == sizeof(answer2));
+
+    dns_cache_clear(&cache);
+}
@@ -120,3 +120,143 @@ TEST_CASE("dns parse MX", "[dns]") {
     free_dns_message(&req);
 
 }
+
+TEST_CASE("dns edns0", "[dns]") {
+    // yahoo.com A query advertising a 4096 byte payload
+    uint8_t q[] = {
+  0x53, 0x6b, 0x01, 0x20, 0x00, 0x01, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x01, 0x05, 0x79, 0x61, 0x68,
+  0x6f, 0x6f, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x01, 0x00, 0x01, 0x00, 0x00, 0x29, 0x10, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+    CHECK(dns_edns_payload(q, sizeof(q)) == 4096);
+
+    size_t len = dns_strip_opt(q, sizeof(q));
+    CHECK(len == sizeof(q) - 11);
+    CHECK(q[11] == 0);
+    CHECK(dns_edns_payload(q, len) == -1);
+
+    // yahoo.com A 1.2.3.4
+    uint8_t r[] = {
+  0x53, 0x6b, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x00, 0x05, 0x79, 0x61, 0x68,
+  0x6f, 0x6f, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x01, 0x00,
+  0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04, 0x01,
+  0x02, 0x03, 0x04
+};
+    len = dns_truncate(r, sizeof(r));
+    CHECK(len == 27);
+    CHECK((r[2] & 0x02) != 0);
+    CHECK(r[7] == 0);
+}
+
+TEST_CASE("dns response limits", "[dns]") {
+    // yahoo.com A query advertising a 4096 byte payload
+    uint8_t q[] = {
+  0x53, 0x6b, 0x01, 0x20, 0x00, 0x01, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x01, 0x05, 0x79, 0x61, 0x68,
+  0x6f, 0x6f, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x01, 0x00, 0x01, 0x00, 0x00, 0x29, 0x10, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+    bool edns = false;
+    CHECK(dns_max_response(q, sizeof(q), false, &edns) == 4096);
+    CHECK(edns);
+    CHECK(dns_max_response(q, sizeof(q), true, &edns) == 65535);
+    CHECK(edns);
+
+    // payload sizes below 512 are treated as 512
+    q[30] = 0x01;
+    q[31] = 0x00;
+    CHECK(dns_max_response(q, sizeof(q), false, &edns) == 512);
+
+    // no OPT record
+    size_t len = dns_strip_opt(q, sizeof(q));
+    CHECK(dns_max_response(q, len, false, &edns) == 512);
+    CHECK_FALSE(edns);
+    CHECK(dns_max_response(q, len, true, &edns) == 65535);
+    CHECK_FALSE(edns);
+}
+
+TEST_CASE("dns fit response", "[dns]") {
+    // yahoo.com A 1.2.3.4, with an OPT record
+    const uint8_t r[] = {
+  0x53, 0x6b, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x01, 0x05, 0x79, 0x61, 0x68,
+  0x6f, 0x6f, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x01, 0x00,
+  0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04, 0x01,
+  0x02, 0x03, 0x04, 0x00, 0x00, 0x29, 0x10, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+    uint8_t b[sizeof(r)];
+
+    // an EDNS client that accepts the whole answer gets it as is
+    memcpy(b, r, sizeof(r));
+    CHECK(dns_fit_response(b, sizeof(b), true, 512) == sizeof(r));
+    CHECK(memcmp(b, r, sizeof(r)) == 0);
+
+    // clients that sent no OPT record don't get one back
+    memcpy(b, r, sizeof(r));
+    size_t len = dns_fit_response(b, sizeof(b), false, 512);
+    CHECK(len == sizeof(r) - 11);
+    CHECK(b[7] == 1);  // the answer is kept
+    CHECK(b[11] == 0);
+    CHECK((b[2] & 0x02) == 0);
+
+    // answers that are too large are cut to the question, with TC set
+    memcpy(b, r, sizeof(r));
+    len = dns_fit_response(b, sizeof(b), true, 40);
+    CHECK(len == 27);
+    CHECK((b[2] & 0x02) != 0);
+    CHECK(b[7] == 0);
+}
+
+TEST_CASE("dns tcp framing", "[dns]") {
+    // two pipelined messages of 3 and 1 bytes, then the start of a third
+    const uint8_t stream[] = { 0x00, 0x03, 'a', 'b', 'c', 0x00, 0x01, 'd', 0x01, 0x00, 'e' };
+
+    CHECK(dns_tcp_frame_len(stream, 0) == 0);
+    CHECK(dns_tcp_frame_len(stream, 1) == 0);
+    // the length prefix arrived, but not the whole message
+    CHECK(dns_tcp_frame_len(stream, 4) == 0);
+    CHECK(dns_tcp_frame_len(stream, 5) == 5);
+    CHECK(dns_tcp_frame_len(stream, sizeof(stream)) == 5);
+    CHECK(dns_tcp_frame_len(stream + 5, sizeof(stream) - 5) == 3);
+    // 256 byte message, only one byte of it received
+    CHECK(dns_tcp_frame_len(stream + 8, sizeof(stream) - 8) == 0);
+}
+
+TEST_CASE("dns wire relay", "[dns]") {
+    // yahoo.com A 1.2.3.4, ttl 60, with an OPT record that has DO set
+    uint8_t r[] = {
+  0x53, 0x6b, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x01, 0x05, 0x79, 0x61, 0x68,
+  0x6f, 0x6f, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x01, 0x00,
+  0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04, 0x01,
+  0x02, 0x03, 0x04, 0x00, 0x00, 0x29, 0x10, 0x00,
+  0x00, 0x80, 0x00, 0x00, 0x00, 0x00
+};
+    dns_age_ttl(r, sizeof(r), 10);
+    CHECK(r[36] == 50);
+    CHECK(r[50] == 0x80); // the OPT record's flags (DO) are left alone
+    CHECK(r[51] == 0x00);
+    dns_age_ttl(r, sizeof(r), 100);
+    CHECK(r[36] == 0);
+
+    // queries relayed from other hosts may be cut short
+    uint8_t q[] = {
+  0x53, 0x6b, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x05, 0x79, 0x61, 0x68,
+  0x6f, 0x6f, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x01, 0x00, 0x01
+};
+    for (size_t len = 0; len < sizeof(q); len++) {
+        dns_message req = {0};
+        CHECK(parse_dns_req(&req, q, len) != 0);
+        free_dns_message(&req);
+    }
+}
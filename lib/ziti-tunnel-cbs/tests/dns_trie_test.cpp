@@ -0,0 +1,104 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <string>
+#include "catch2/catch.hpp"
+#include "../dns_trie.h"
+
+static int A, B, C, D;
+
+TEST_CASE("dns_trie_find_wildcard", "[dns]") {
+    dns_trie_t trie;
+    dns_trie_init(&trie);
+
+    CHECK(dns_trie_set(&trie, "example.com", true, &A) == nullptr);
+    CHECK(dns_trie_set(&trie, "b.example.com", true, &B) == nullptr);
+    CHECK(dns_trie_set(&trie, "host.example.com", false, &C) == nullptr);
+    CHECK(trie.size == 3);
+
+    // wildcards match names below their domain, the most specific one wins
+    CHECK(dns_trie_find_wildcard(&trie, "a.example.com", false) == &A);
+    CHECK(dns_trie_find_wildcard(&trie, "x.a.example.com", false) == &A);
+    CHECK(dns_trie_find_wildcard(&trie, "x.b.example.com", false) == &B);
+    CHECK(dns_trie_find_wildcard(&trie, "b.example.com", false) == &A);
+    CHECK(dns_trie_find_wildcard(&trie, "b.example.com", true) == &B);
+    CHECK(dns_trie_find_wildcard(&trie, "example.com", false) == nullptr);
+    CHECK(dns_trie_find_wildcard(&trie, "example.com", true) == &A);
+    CHECK(dns_trie_find_wildcard(&trie, "xexample.com", true) == nullptr);
+    CHECK(dns_trie_find_wildcard(&trie, "example.org", true) == nullptr);
+
+    // names and wildcards are kept apart
+    CHECK(dns_trie_get(&trie, "host.example.com", false) == &C);
+    CHECK(dns_trie_get(&trie, "host.example.com", true) == nullptr);
+    CHECK(dns_trie_get(&trie, "example.com", false) == nullptr);
+    CHECK(dns_trie_find_wildcard(&trie, "host.example.com", false) == &A);
+
+    // the root wildcard matches everything
+    dns_trie_set(&trie, "", true, &D);
+    CHECK(dns_trie_find_wildcard(&trie, "example.org", false) == &D);
+    CHECK(dns_trie_find_wildcard(&trie, "a.example.com", false) == &A);
+
+    dns_trie_clear(&trie, nullptr);
+    CHECK(trie.size == 0);
+    CHECK(dns_trie_find_wildcard(&trie, "a.example.com", false) == nullptr);
+}
+
+TEST_CASE("dns_trie_remove", "[dns]") {
+    dns_trie_t trie;
+    dns_trie_init(&trie);
+
+    dns_trie_set(&trie, "example.com", true, &A);
+    dns_trie_set(&trie, "a.b.example.com", false, &B);
+
+    CHECK(dns_trie_remove(&trie, "b.example.com", false) == nullptr);
+    CHECK(dns_trie_remove(&trie, "a.b.example.com", false) == &B);
+    CHECK(dns_trie_find_wildcard(&trie, "a.b.example.com", false) == &A);
+    // the nodes that led to a.b.example.com are gone
+    auto com = (dns_trie_node *) model_map_get_key(&trie.root.children, "com", 3);
+    REQUIRE(com != nullptr);
+    auto example = (dns_trie_node *) model_map_get_key(&com->children, "example", 7);
+    REQUIRE(example != nullptr);
+    CHECK(model_map_size(&example->children) == 0);
+    CHECK(dns_trie_remove(&trie, "example.com", true) == &A);
+    CHECK(trie.size == 0);
+    CHECK(model_map_size(&trie.root.children) == 0);
+}
+
+TEST_CASE("dns_trie_depth", "[dns]") {
+    dns_trie_t trie;
+    dns_trie_init(&trie);
+
+    std::string deepest = "a";
+    for (int i = 1; i < DNS_TRIE_MAX_DEPTH; i++) {
+        deepest += ".a";
+    }
+    std::string too_deep = "b." + deepest;
+
+    CHECK(dns_trie_set(&trie, deepest.c_str(), false, &A) == nullptr);
+    CHECK(dns_trie_get(&trie, deepest.c_str(), false) == &A);
+    CHECK(trie.size == 1);
+
+    // 129 labels are rejected, and lookups of them don't overrun
+    CHECK(dns_trie_set(&trie, too_deep.c_str(), false, &B) == nullptr);
+    CHECK(trie.size == 1);
+    CHECK(dns_trie_get(&trie, too_deep.c_str(), false) == nullptr);
+    CHECK(dns_trie_remove(&trie, too_deep.c_str(), false) == nullptr);
+    CHECK(dns_trie_find_wildcard(&trie, too_deep.c_str(), false) == nullptr);
+
+    CHECK(dns_trie_remove(&trie, deepest.c_str(), false) == &A);
+    CHECK(trie.size == 0);
+    CHECK(model_map_size(&trie.root.children) == 0);
+}
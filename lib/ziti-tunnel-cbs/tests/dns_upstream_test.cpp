@@ -0,0 +1,104 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <string>
+#include "catch2/catch.hpp"
+#include "../dns_upstream.h"
+
+TEST_CASE("upstream strategy names", "[dns_upstream]") {
+    dns_upstream_strategy s;
+    CHECK(dns_upstream_strategy_from_string("sequential", &s) == 0);
+    CHECK(s == dns_upstream_sequential);
+    CHECK(dns_upstream_strategy_from_string("race", &s) == 0);
+    CHECK(s == dns_upstream_race);
+    CHECK(std::string(dns_upstream_strategy_name(dns_upstream_all)) == "all");
+    CHECK(dns_upstream_strategy_from_string("fastest", &s) != 0);
+}
+
+TEST_CASE("upstreams are ordered by latency", "[dns_upstream]") {
+    dns_upstream_stats_t stats[3];
+    for (auto &st : stats) dns_upstream_stats_init(&st);
+
+    for (int i = 0; i < 20; i++) {
+        dns_upstream_on_answer(&stats[0], 80);
+        dns_upstream_on_answer(&stats[1], 120);
+        dns_upstream_on_answer(&stats[2], 10);
+    }
+
+    uint8_t order[3];
+    dns_upstream_order(stats, 3, 1000, order);
+    CHECK(order[0] == 2);
+    CHECK(order[1] == 0);
+    CHECK(order[2] == 1);
+
+    CHECK(dns_upstream_hedge_delay(&stats[2]) < dns_upstream_hedge_delay(&stats[1]));
+    CHECK(dns_upstream_failover_delay(&stats[2]) >= dns_upstream_hedge_delay(&stats[2]));
+}
+
+TEST_CASE("failing upstreams are demoted until they answer", "[dns_upstream]") {
+    dns_upstream_stats_t stats[2];
+    dns_upstream_stats_init(&stats[0]);
+    dns_upstream_stats_init(&stats[1]);
+    dns_upstream_on_answer(&stats[0], 5);
+    dns_upstream_on_answer(&stats[1], 2000);
+
+    uint64_t now = 1000;
+    for (int i = 1; i < DNS_UPSTREAM_DEMOTE_ERRORS; i++) {
+        CHECK_FALSE(dns_upstream_on_error(&stats[0], now));
+    }
+    CHECK(dns_upstream_on_error(&stats[0], now));
+    CHECK(dns_upstream_is_demoted(&stats[0], now));
+
+    uint8_t order[2];
+    dns_upstream_order(stats, 2, now, order);
+    CHECK(order[0] == 1);
+
+    // demotion expires on its own
+    CHECK_FALSE(dns_upstream_is_demoted(&stats[0], now + DNS_UPSTREAM_DEMOTE_MS));
+    dns_upstream_order(stats, 2, now + DNS_UPSTREAM_DEMOTE_MS, order);
+    CHECK(order[0] == 0);
+
+    // and is lifted by an answer
+    dns_upstream_on_error(&stats[0], now);
+    dns_upstream_on_answer(&stats[0], 5);
+    CHECK_FALSE(dns_upstream_is_demoted(&stats[0], now));
+    CHECK(stats[0].consecutive_errors == 0);
+}
+
+TEST_CASE("upstreams are failed over long before they time out", "[dns_upstream]") {
+    dns_upstream_stats_t fast, slow;
+    dns_upstream_stats_init(&fast);
+    dns_upstream_stats_init(&slow);
+    for (int i = 0; i < 50; i++) {
+        dns_upstream_on_answer(&fast, 2);
+        dns_upstream_on_answer(&slow, 4000);
+    }
+
+    // failing over tracks latency
+    CHECK(dns_upstream_failover_delay(&fast) < dns_upstream_failover_delay(&slow));
+    CHECK(dns_upstream_hedge_delay(&fast) < dns_upstream_hedge_delay(&slow));
+
+    // but giving up does not. a recursive lookup may take seconds even on an upstream that is usually fast
+    CHECK(DNS_UPSTREAM_TIMEOUT_MS >= 5000);
+    CHECK(dns_upstream_failover_delay(&slow) < DNS_UPSTREAM_TIMEOUT_MS);
+    CHECK(dns_upstream_hedge_delay(&slow) < DNS_UPSTREAM_TIMEOUT_MS);
+
+    // a slow answer after a failover keeps the upstream healthy
+    dns_upstream_on_answer(&fast, 3000);
+    CHECK(fast.consecutive_errors == 0);
+    CHECK(fast.errors == 0);
+    CHECK_FALSE(dns_upstream_is_demoted(&fast, 0));
+}
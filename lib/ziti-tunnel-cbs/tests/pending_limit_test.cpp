@@ -0,0 +1,107 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../pending_limit.h"
+
+static const uint64_t MS = 1000000;
+
+/** run one sample that writes `len` bytes at `now` and completes them `latency` later */
+static bool sample(ziti_io_context *zio, pending_budget_t *budget, size_t len, uint64_t now, uint64_t latency) {
+    pending_limit_on_write(zio, len, now);
+    return pending_limit_on_written(zio, budget, len, now + latency);
+}
+
+TEST_CASE("pending limit follows the bdp", "[pending_limit]") {
+    ziti_io_context zio = {};
+    pending_limit_init(&zio);
+    pending_budget_t budget = { PENDING_BYTES_BUDGET, 0 };
+
+    // a client that doesn't fill the pipe says nothing about the path
+    CHECK_FALSE(sample(&zio, &budget, 1000, 0, 10 * MS));
+    CHECK(zio.pending_limit == MAX_PENDING_BYTES);
+    CHECK(zio.min_latency == 10 * MS);
+
+    // writes that only queue up behind each other: 96k completed in 4x the path latency
+    CHECK_FALSE(sample(&zio, &budget, 96 * 1024, 1000 * MS, 40 * MS));
+    CHECK(zio.pending_limit == MAX_PENDING_BYTES);
+
+    // a full pipe that completes in the path latency doubles the limit, up to the ceiling
+    uint64_t now = 2000 * MS;
+    while (zio.pending_limit < PENDING_BYTES_CEILING) {
+        uint64_t before = zio.pending_limit;
+        CHECK(sample(&zio, &budget, before - 1, now, 10 * MS));
+        CHECK(zio.pending_limit > before);
+        CHECK(zio.pending_limit <= 2 * before);
+        CHECK(budget.used == zio.pending_limit - MAX_PENDING_BYTES);
+        now += 100 * MS;
+    }
+    CHECK(zio.pending_limit == PENDING_BYTES_CEILING);
+    CHECK_FALSE(sample(&zio, &budget, PENDING_BYTES_CEILING - 1, now, 10 * MS));
+    CHECK(zio.pending_limit == PENDING_BYTES_CEILING);
+
+    CHECK(pending_limit_reset(&zio, &budget));
+    CHECK(zio.pending_limit == MAX_PENDING_BYTES);
+    CHECK(budget.used == 0);
+}
+
+TEST_CASE("pending limit growth is shared from the budget", "[pending_limit]") {
+    pending_budget_t budget = { 64 * 1024, 0 };
+    ziti_io_context a = {}, b = {};
+    pending_limit_init(&a);
+    pending_limit_init(&b);
+
+    CHECK(sample(&a, &budget, MAX_PENDING_BYTES - 1, 0, 10 * MS));
+    CHECK(a.pending_limit == MAX_PENDING_BYTES + 64 * 1024);
+    CHECK(budget.used == 64 * 1024);
+
+    // nothing is left for b
+    CHECK_FALSE(sample(&b, &budget, MAX_PENDING_BYTES - 1, 0, 10 * MS));
+    CHECK(b.pending_limit == MAX_PENDING_BYTES);
+
+    // until a gives its growth back
+    CHECK(pending_limit_reset(&a, &budget));
+    CHECK(budget.used == 0);
+    CHECK(sample(&b, &budget, MAX_PENDING_BYTES - 1, 100 * MS, 10 * MS));
+    CHECK(b.pending_limit == MAX_PENDING_BYTES + 64 * 1024);
+}
+
+TEST_CASE("idle connections give their growth back", "[pending_limit]") {
+    pending_budget_t budget = { PENDING_BYTES_BUDGET, 0 };
+    ziti_io_context zio = {};
+    pending_limit_init(&zio);
+
+    REQUIRE(sample(&zio, &budget, MAX_PENDING_BYTES - 1, 0, 10 * MS));
+    uint64_t grown = zio.pending_limit;
+    CHECK(budget.used == grown - MAX_PENDING_BYTES);
+
+    // not idle long enough
+    CHECK_FALSE(pending_limit_reclaim_idle(&zio, &budget, 10 * MS + PENDING_IDLE_RESET / 2));
+    CHECK(zio.pending_limit == grown);
+
+    // writes in flight
+    uint64_t now = 10 * MS + PENDING_IDLE_RESET / 2;
+    pending_limit_on_write(&zio, 1000, now);
+    CHECK_FALSE(pending_limit_reclaim_idle(&zio, &budget, now + 2 * PENDING_IDLE_RESET));
+    pending_limit_on_written(&zio, &budget, 1000, now + MS);
+    CHECK(zio.pending_limit == grown);
+
+    CHECK_FALSE(pending_limit_reclaim_idle(&zio, &budget, now + PENDING_IDLE_RESET));
+    CHECK(pending_limit_reclaim_idle(&zio, &budget, now + MS + PENDING_IDLE_RESET));
+    CHECK(zio.pending_limit == MAX_PENDING_BYTES);
+    CHECK(budget.used == 0);
+    CHECK_FALSE(pending_limit_reclaim_idle(&zio, &budget, now + MS + 2 * PENDING_IDLE_RESET));
+}
@@ -19,6 +19,9 @@
 #include <ziti/ziti_dns.h>
 #include "ziti_instance.h"
 #include "dns_host.h"
+#include "dns_cache.h"
+#include "dns_upstream.h"
+#include "dns_trie.h"
 
 #define MAX_UPSTREAMS 5
 #define MAX_DNS_NAME 256
@@ -41,40 +44,104 @@ enum ns_q_type {
 typedef struct ziti_dns_client_s {
     io_ctx_t *io_ctx;
     bool is_tcp;
+    bool closing; // tcp client sent FIN. close once its queries are answered
     model_map active_reqs; // dns_reqs keyed by address of ID.
+
+    // tcp clients frame messages with a two byte length (RFC 1035 4.2.2) and may pipeline queries
+    uint8_t *in;
+    size_t in_len;
+    size_t in_cap;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    LIST_ENTRY(ziti_dns_client_s) flush_link; // in ziti_dns.flush_clients while out has unsent bytes
 } ziti_dns_client_t;
 
+/* largest DNS message; the TCP length prefix is 16 bits */
+#define DNS_LOCAL_RESP_MAX DNS_MAX_MSG_LEN
+
+/* how long to wait for an upstream to answer over TCP after its UDP answer was truncated */
+#define DNS_UPSTREAM_TCP_TIMEOUT 3000
+
+/* how often responses that did not fit the client's TCP send window are retried */
+#define DNS_TCP_FLUSH_INTERVAL 10
+
+/* most response bytes that a TCP client may leave unread. a client that pipelines queries without
+ * reading the answers is closed when it goes over */
+#define DNS_TCP_OUT_MAX (4 * (DNS_MAX_MSG_LEN + 2))
+
+struct dns_tcp_query_s;
+
 struct dns_req {
-    uint16_t id;
+    uint16_t id;          // the client's query ID. keys the client's active_reqs
+    uint16_t upstream_id; // unique among in-flight requests. keys ziti_dns.requests and is sent upstream
     size_t req_len;
-    uint8_t req[4096];
+    uint8_t *req;
     size_t resp_len;
-    uint8_t resp[4096];
+    uint8_t *resp;
 
     dns_message msg;
 
     struct in_addr addr;
 
-    uint8_t *rp;
+    bool edns;       // the query has an OPT record
+    size_t max_resp; // largest response the client accepts
 
     ziti_dns_client_t *clt;
+    struct dns_req *next_free;
+
+    // upstream attempts. upstreams are asked in up_order, up_asked has a bit for every
+    // upstream the query was sent to, and up_waiting for those that have neither answered nor failed
+    uint8_t up_order[MAX_UPSTREAMS];
+    uint8_t up_tried;
+    uint8_t up_asked;
+    uint8_t up_waiting;
+    uint64_t up_sent[MAX_UPSTREAMS];
+    uint64_t up_deadline;
+    LIST_ENTRY(dns_req) up_link; // in ziti_dns.upstream_reqs while waiting for upstreams
+    struct dns_tcp_query_s *tcp_query; // retrying a truncated upstream answer over tcp
 };
 
+/* completed requests are kept for reuse, up to this many */
+#define DNS_REQ_FREE_MAX 256
+
+/* names matched by a wildcard domain give their IPs back once they have not been resolved for this long.
+ * well above the TTL of our answers, so clients have forgotten the address by then */
+#define DNS_WILDCARD_IDLE_MS (10 * 60 * 1000)
+
+/* most idle wildcard names that are examined for reclamation per allocation */
+#define DNS_RECLAIM_SCAN_MAX 8
+
 static void* on_dns_client(const void *app_intercept_ctx, io_ctx_t *io);
 static int on_dns_close(void *dns_io_ctx);
+static int on_dns_close_write(void *dns_io_ctx);
 static ssize_t on_dns_req(const void *ziti_io_ctx, void *write_ctx, const void *q_packet, size_t len);
+static bool dns_client_query(ziti_dns_client_t *clt, const uint8_t *q_packet, size_t q_len);
 static int query_upstream(struct dns_req *req);
 static void dns_upstream_alloc(uv_handle_t *h, size_t reqlen, uv_buf_t *b);
 static void on_upstream_packet(uv_udp_t *h, ssize_t rc, const uv_buf_t *buf, const struct sockaddr* addr, unsigned int flags);
 static void complete_dns_req(struct dns_req *req);
+static struct dns_req *new_dns_req(void);
 static void free_dns_req(struct dns_req *req);
+static bool next_upstream_id(uint16_t *id);
+static bool send_upstream(struct dns_req *req, uint64_t now);
+static void upstream_req_done(struct dns_req *req);
+static void schedule_upstream_timer(uint64_t deadline);
+static void on_upstream_timer(uv_timer_t *t);
+static void on_flush_timer(uv_timer_t *t);
+static bool dns_client_write(ziti_dns_client_t *clt, const uint8_t *msg, size_t len);
+static void abort_tcp_query(struct dns_tcp_query_s *q);
+static bool start_tcp_query(struct dns_req *req, int idx);
+static void set_upstream_resp(struct dns_req *req, const uint8_t *resp, size_t resp_len);
 
 typedef struct dns_domain_s {
     char name[MAX_DNS_NAME];
 
     model_map intercepts; // set[intercept]
+    LIST_HEAD(, dns_entry_s) entries; // names that were resolved through this domain
 
     ziti_connection resolv_proxy;
+    bool proxy_wire; // the host said hello, so queries go to resolv_proxy in wire format
 
 } dns_domain_t;
 
@@ -83,12 +150,26 @@ typedef struct dns_entry_s {
     char name[MAX_DNS_NAME];
     char ip[MAX_IP_LENGTH];
     ip_addr_t addr;
+    bool has_ip4; // false if the IPv4 pool was exhausted
+    char ip6[IP6ADDR_STRLEN_MAX];
+    ip_addr_t addr6;
+    bool has_ip6;
     dns_domain_t *domain;
 
     model_map intercepts;
 
+    // names created for a wildcard domain are kept in ziti_dns.wildcard_lru, least recently resolved first
+    uint64_t last_used;
+    TAILQ_ENTRY(dns_entry_s) lru_link;
+    LIST_ENTRY(dns_entry_s) domain_link;
 } dns_entry_t;
 
+// what an intercept registered, so deregistering it only visits those names
+typedef struct dns_intercept_regs_s {
+    model_map entries; // set[dns_entry_t]
+    model_map domains; // set[dns_domain_t]
+} dns_intercept_regs_t;
+
 struct ziti_dns_s {
 
     struct {
@@ -96,51 +177,117 @@ struct ziti_dns_s {
         uint32_t counter;
         uint32_t counter_mask;
         uint32_t capacity;
+
+        // offsets given back by inactive names. handed out oldest first, and only after the pool has been used
+        // once, so an address stays out of circulation for as long as possible
+        uint32_t *released;
+        uint32_t released_head;
+        uint32_t released_len;
+        uint32_t released_cap;
     } ip_pool;
 
-    // map[hostname -> dns_entry_t]
-    model_map hostnames;
+    // hostnames -> dns_entry_t, and wildcard domains -> dns_domain_t
+    dns_trie_t names;
 
     // map[ip4_addr_t -> dns_entry_t]
     model_map ip_addresses;
 
-    // map[domain -> dns_domain_t]
-    model_map domains;
+    // addresses are the pool's /64 prefix and a counter, which is never reused
+    struct {
+        uint32_t prefix[2]; // network order
+        uint64_t next_iid;
+        bool enabled;
+    } ip6_pool;
+
+    // map[interface id -> dns_entry_t]
+    model_map ip6_addresses;
+
+    // map[intercept -> dns_intercept_regs_t]
+    model_map intercept_regs;
+
+    TAILQ_HEAD(, dns_entry_s) wildcard_lru;
 
     uv_loop_t *loop;
     tunneler_context tnlr;
 
-    model_map requests;
+    model_map requests; // dns_req keyed by upstream_id
+    struct dns_req *free_reqs;
+    size_t num_free_reqs;
     uv_udp_t upstream;
     bool is_ipv4;
     int num_dns_up;
     struct sockaddr_in6 upstream_addr[MAX_UPSTREAMS];
+    dns_upstream_stats_t upstream_stats[MAX_UPSTREAMS];
+    dns_upstream_strategy upstream_strategy;
+    LIST_HEAD(, dns_req) upstream_reqs;
+    uv_timer_t upstream_timer;
+    uint64_t upstream_timer_due; // 0 if the timer is not running
+    LIST_HEAD(, ziti_dns_client_s) flush_clients;
+    uv_timer_t flush_timer;
+    dns_cache_t cache; // upstream responses
 } ziti_dns;
 
+static void release_ipv4(uint32_t addr) {
+    uint32_t offset = ntohl(addr) & ziti_dns.ip_pool.counter_mask;
+    if (ziti_dns.ip_pool.released_len == ziti_dns.ip_pool.released_cap) {
+        uint32_t cap = ziti_dns.ip_pool.released_cap ? ziti_dns.ip_pool.released_cap * 2 : 64;
+        uint32_t *released = calloc(cap, sizeof(uint32_t));
+        for (uint32_t i = 0; i < ziti_dns.ip_pool.released_len; i++) {
+            released[i] = ziti_dns.ip_pool.released[(ziti_dns.ip_pool.released_head + i) % ziti_dns.ip_pool.released_cap];
+        }
+        free(ziti_dns.ip_pool.released);
+        ziti_dns.ip_pool.released = released;
+        ziti_dns.ip_pool.released_head = 0;
+        ziti_dns.ip_pool.released_cap = cap;
+    }
+    uint32_t tail = (ziti_dns.ip_pool.released_head + ziti_dns.ip_pool.released_len++) % ziti_dns.ip_pool.released_cap;
+    ziti_dns.ip_pool.released[tail] = offset;
+}
+
+static bool reclaim_wildcard_entry(void);
+
 static uint32_t next_ipv4() {
-    uint32_t candidate;
-    uint32_t i = 0; // track how many candidates have been considered. should never exceed pool capacity.
+    // addresses that were never handed out. only the tun and dns IPs are skipped here
+    while (ziti_dns.ip_pool.counter < ziti_dns.ip_pool.counter_mask) {
+        uint32_t candidate = htonl(ziti_dns.ip_pool.base | ziti_dns.ip_pool.counter++);
+        if (model_map_getl(&ziti_dns.ip_addresses, candidate) == NULL) {
+            return candidate;
+        }
+    }
 
-    if (model_map_size(&ziti_dns.ip_addresses) == ziti_dns.ip_pool.capacity) {
+    if (ziti_dns.ip_pool.released_len == 0 && !reclaim_wildcard_entry()) {
         ZITI_LOG(ERROR, "DNS ip pool exhausted (%u IPs). Try rerunning with larger DNS range.",
                  ziti_dns.ip_pool.capacity);
         return INADDR_NONE;
     }
 
-    do {
-        candidate = htonl(ziti_dns.ip_pool.base | (ziti_dns.ip_pool.counter++ & ziti_dns.ip_pool.counter_mask));
-        i += 1;
-        if (ziti_dns.ip_pool.counter == ziti_dns.ip_pool.counter_mask) {
-            ziti_dns.ip_pool.counter = 1;
-        }
-    } while ((model_map_getl(&ziti_dns.ip_addresses, candidate) != NULL) && i < ziti_dns.ip_pool.capacity);
+    uint32_t offset = ziti_dns.ip_pool.released[ziti_dns.ip_pool.released_head];
+    ziti_dns.ip_pool.released_head = (ziti_dns.ip_pool.released_head + 1) % ziti_dns.ip_pool.released_cap;
+    ziti_dns.ip_pool.released_len--;
+    return htonl(ziti_dns.ip_pool.base | offset);
+}
 
-    if (i == ziti_dns.ip_pool.capacity) {
-        ZITI_LOG(ERROR, "no IPs available after scanning entire pool");
-        return INADDR_NONE;
-    }
+static uint64_t ip6_iid(const ip6_addr_t *a) {
+    return (uint64_t) lwip_ntohl(a->addr[2]) << 32 | lwip_ntohl(a->addr[3]);
+}
 
-    return candidate;
+static bool in_ip6_pool(const ip6_addr_t *a) {
+    return ziti_dns.ip6_pool.enabled &&
+           a->addr[0] == ziti_dns.ip6_pool.prefix[0] && a->addr[1] == ziti_dns.ip6_pool.prefix[1];
+}
+
+static void next_ipv6(ip_addr_t *addr) {
+    uint64_t iid = ziti_dns.ip6_pool.next_iid++;
+    IP_ADDR6(addr, ziti_dns.ip6_pool.prefix[0], ziti_dns.ip6_pool.prefix[1],
+             lwip_htonl((uint32_t) (iid >> 32)), lwip_htonl((uint32_t) iid));
+}
+
+static dns_entry_t *ip6_entry(const ip6_addr_t *a) {
+    if (!in_ip6_pool(a)) {
+        return NULL;
+    }
+    uint64_t iid = ip6_iid(a);
+    return model_map_get_key(&ziti_dns.ip6_addresses, &iid, sizeof(iid));
 }
 
 static int seed_dns(const char *dns_cidr) {
@@ -180,7 +327,12 @@ static int seed_dns(const char *dns_cidr) {
 
 int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_cidr) {
     ziti_dns.tnlr = tnlr;
+    TAILQ_INIT(&ziti_dns.wildcard_lru);
+    ziti_dns.loop = ziti_tunneler_loop(tnlr);
     seed_dns(dns_cidr);
+    uv_timer_init(ziti_dns.loop, &ziti_dns.flush_timer);
+    uv_unref((uv_handle_t *) &ziti_dns.flush_timer);
+    dns_cache_init(&ziti_dns.cache, DNS_CACHE_DEFAULT_CAPACITY);
 
     intercept_ctx_t *dns_intercept = intercept_ctx_new(tnlr, "ziti:dns-resolver", &ziti_dns);
     ziti_address dns_zaddr, tun_zaddr;
@@ -188,7 +340,8 @@ int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_
     intercept_ctx_add_address(dns_intercept, &dns_zaddr);
     intercept_ctx_add_port_range(dns_intercept, 53, 53);
     intercept_ctx_add_protocol(dns_intercept, "udp");
-    intercept_ctx_override_cbs(dns_intercept, on_dns_client, on_dns_req, on_dns_close, on_dns_close);
+    intercept_ctx_add_protocol(dns_intercept, "tcp");
+    intercept_ctx_override_cbs(dns_intercept, on_dns_client, on_dns_req, on_dns_close_write, on_dns_close);
     ziti_tunneler_intercept(tnlr, dns_intercept);
 
     // reserve tun and dns ips by adding to ip_addresses with empty dns entries
@@ -230,6 +383,8 @@ int ziti_dns_set_upstream(uv_loop_t *l, tunnel_upstream_dns_array upstreams) {
         }
         CHECK_UV(uv_udp_recv_start(&ziti_dns.upstream, dns_upstream_alloc, on_upstream_packet));
         uv_unref((uv_handle_t *) &ziti_dns.upstream);
+        CHECK_UV(uv_timer_init(l, &ziti_dns.upstream_timer));
+        uv_unref((uv_handle_t *) &ziti_dns.upstream_timer);
     }
 
     union {
@@ -273,16 +428,41 @@ int ziti_dns_set_upstream(uv_loop_t *l, tunnel_upstream_dns_array upstreams) {
         ZITI_LOG(INFO, "DNS upstream[%d] is set to %s:%hu", idx, dns->host, port);
     }
     ziti_dns.num_dns_up = idx;
+    for (int i = 0; i < MAX_UPSTREAMS; i++) {
+        dns_upstream_stats_init(&ziti_dns.upstream_stats[i]);
+    }
+    ZITI_LOG(INFO, "DNS upstream strategy is '%s'", dns_upstream_strategy_name(ziti_dns.upstream_strategy));
+    // answers from the previous upstreams may not hold for the new ones
+    dns_cache_clear(&ziti_dns.cache);
     return 0;
 }
 
+int ziti_dns_set_upstream_strategy(const char *strategy) {
+    if (dns_upstream_strategy_from_string(strategy, &ziti_dns.upstream_strategy) != 0) {
+        ZITI_LOG(WARN, "unknown DNS upstream strategy '%s'", strategy);
+        return -1;
+    }
+    return 0;
+}
+
+void ziti_dns_get_cache_stats(tunnel_dns_cache_stats *stats) {
+    stats->size = (model_number) dns_cache_size(&ziti_dns.cache);
+    stats->capacity = (model_number) ziti_dns.cache.capacity;
+    stats->hits = (model_number) ziti_dns.cache.hits;
+    stats->misses = (model_number) ziti_dns.cache.misses;
+    stats->evictions = (model_number) ziti_dns.cache.evictions;
+}
+
 
 void* on_dns_client(const void *app_intercept_ctx, io_ctx_t *io) {
     ZITI_LOG(TRACE, "new DNS client");
     ziti_dns_client_t *clt = calloc(1, sizeof(ziti_dns_client_t));
     io->ziti_io = clt;
     clt->io_ctx = io;
-    ziti_tunneler_set_idle_timeout(io, 5000); // 5 seconds
+    const char *intercepted = get_intercepted_address(io->tnlr_io);
+    clt->is_tcp = intercepted != NULL && strncmp(intercepted, "tcp:", 4) == 0;
+    // outlive the upstream timeout, so that queries nobody answers still get their SERVFAIL
+    ziti_tunneler_set_idle_timeout(io, DNS_UPSTREAM_TIMEOUT_MS + 1000);
     ziti_tunneler_dial_completed(io, true);
     return clt;
 }
@@ -290,7 +470,7 @@ void* on_dns_client(const void *app_intercept_ctx, io_ctx_t *io) {
 static void remove_dns_req(void *p) {
     struct dns_req *req = p;
     if (req) {
-        model_map_remove_key(&ziti_dns.requests, &req->id, sizeof(req->id));
+        model_map_remove_key(&ziti_dns.requests, &req->upstream_id, sizeof(req->upstream_id));
         free_dns_req(req);
     }
 }
@@ -301,12 +481,91 @@ int on_dns_close(void *dns_io_ctx) {
     // we may be here due to udp timeout, and reqs may have been sent to upstream.
     // remove reqs from ziti_dns to prevent completion (with invalid io_ctx) if upstream should respond after udp timeout.
     model_map_clear(&clt->active_reqs, remove_dns_req);
+    if (clt->flush_link.le_prev != NULL) {
+        LIST_REMOVE(clt, flush_link);
+    }
     ziti_tunneler_close(clt->io_ctx->tnlr_io);
+    free(clt->in);
+    free(clt->out);
     free(clt->io_ctx);
     free(dns_io_ctx);
     return 0;
 }
 
+static int on_dns_close_write(void *dns_io_ctx) {
+    ziti_dns_client_t *clt = dns_io_ctx;
+    if (clt->is_tcp && (model_map_size(&clt->active_reqs) > 0 || clt->out_len > 0)) {
+        ZITI_LOG(TRACE, "DNS client sent FIN, answering pending queries first");
+        clt->closing = true;
+        return 0;
+    }
+    return on_dns_close(dns_io_ctx);
+}
+
+static bool dns_client_done(const ziti_dns_client_t *clt) {
+    return (!clt->is_tcp || clt->closing) && model_map_size(&clt->active_reqs) == 0 && clt->out_len == 0;
+}
+
+static void flush_dns_client(ziti_dns_client_t *clt) {
+    ssize_t n = ziti_tunneler_write(clt->io_ctx->tnlr_io, clt->out, clt->out_len);
+    if (n < 0) {
+        // the connection is failing and will be closed by the tunneler
+        ZITI_LOG(WARN, "failed to write DNS response to tcp client");
+        n = (ssize_t) clt->out_len;
+    }
+    memmove(clt->out, clt->out + n, clt->out_len - n);
+    clt->out_len -= n;
+
+    bool listed = clt->flush_link.le_prev != NULL;
+    if (clt->out_len > 0 && !listed) {
+        LIST_INSERT_HEAD(&ziti_dns.flush_clients, clt, flush_link);
+        if (!uv_is_active((const uv_handle_t *) &ziti_dns.flush_timer)) {
+            uv_timer_start(&ziti_dns.flush_timer, on_flush_timer, DNS_TCP_FLUSH_INTERVAL, DNS_TCP_FLUSH_INTERVAL);
+        }
+    } else if (clt->out_len == 0 && listed) {
+        LIST_REMOVE(clt, flush_link);
+        clt->flush_link.le_prev = NULL;
+    }
+}
+
+static void on_flush_timer(uv_timer_t *t) {
+    ziti_dns_client_t *clt = LIST_FIRST(&ziti_dns.flush_clients);
+    while (clt != NULL) {
+        ziti_dns_client_t *following = LIST_NEXT(clt, flush_link);
+        flush_dns_client(clt);
+        if (dns_client_done(clt)) {
+            on_dns_close(clt);
+        }
+        clt = following;
+    }
+    if (LIST_EMPTY(&ziti_dns.flush_clients)) {
+        uv_timer_stop(t);
+    }
+}
+
+/* returns false if a tcp client has too many unread responses, and should be closed */
+static bool dns_client_write(ziti_dns_client_t *clt, const uint8_t *msg, size_t len) {
+    if (!clt->is_tcp) {
+        ziti_tunneler_write(clt->io_ctx->tnlr_io, msg, len);
+        return true;
+    }
+
+    if (clt->out_len + 2 + len > DNS_TCP_OUT_MAX) {
+        ZITI_LOG(WARN, "DNS tcp client is not reading its responses (%zu bytes unsent), closing it", clt->out_len);
+        return false;
+    }
+    if (clt->out_len + 2 + len > clt->out_cap) {
+        clt->out_cap = clt->out_len + 2 + len;
+        clt->out = realloc(clt->out, clt->out_cap);
+    }
+    clt->out[clt->out_len++] = (uint8_t) (len >> 8);
+    clt->out[clt->out_len++] = (uint8_t) (len & 0xff);
+    memcpy(clt->out + clt->out_len, msg, len);
+    clt->out_len += len;
+    flush_dns_client(clt);
+    return true;
+}
+
 static bool check_name(const char *name, char clean_name[MAX_DNS_NAME], bool *is_domain) {
     const char *hp = name;
     char *p = clean_name;
@@ -333,26 +592,104 @@ static bool check_name(const char *name, char clean_name[MAX_DNS_NAME], bool *is
     return success;
 }
 
-static dns_entry_t* new_ipv4_entry(const char *host) {
-    dns_entry_t *entry = calloc(1, sizeof(dns_entry_t));
-    strncpy(entry->name, host, sizeof(entry->name));
+static dns_entry_t* new_dns_entry(const char *host) {
     uint32_t next = next_ipv4();
-    if (next == INADDR_NONE) {
+    if (next == INADDR_NONE && !ziti_dns.ip6_pool.enabled) {
         return NULL;
     }
 
-    ip_addr_set_ip4_u32(&entry->addr, next);
-    ipaddr_ntoa_r(&entry->addr, entry->ip, sizeof(entry->ip));
+    dns_entry_t *entry = calloc(1, sizeof(dns_entry_t));
+    strncpy(entry->name, host, sizeof(entry->name));
+    if (next != INADDR_NONE) {
+        ip_addr_set_ip4_u32(&entry->addr, next);
+        ipaddr_ntoa_r(&entry->addr, entry->ip, sizeof(entry->ip));
+        entry->has_ip4 = true;
+        model_map_setl(&ziti_dns.ip_addresses, ip_2_ip4(&entry->addr)->addr, entry);
+    }
+    if (ziti_dns.ip6_pool.enabled) {
+        next_ipv6(&entry->addr6);
+        ipaddr_ntoa_r(&entry->addr6, entry->ip6, sizeof(entry->ip6));
+        entry->has_ip6 = true;
+        uint64_t iid = ip6_iid(ip_2_ip6(&entry->addr6));
+        model_map_set_key(&ziti_dns.ip6_addresses, &iid, sizeof(iid), entry);
+    }
 
-    model_map_set(&ziti_dns.hostnames, host, entry);
-    model_map_setl(&ziti_dns.ip_addresses, ip_2_ip4(&entry->addr)->addr, entry);
-    ZITI_LOG(INFO, "registered DNS entry %s -> %s", host, entry->ip);
+    dns_trie_set(&ziti_dns.names, host, false, entry);
+    ZITI_LOG(INFO, "registered DNS entry %s -> %s %s", host, entry->ip, entry->ip6);
 
     return entry;
 }
 
+static dns_entry_t *entry_for_addr(const ip_addr_t *addr) {
+    if (IP_IS_V6(addr)) {
+        return ip6_entry(ip_2_ip6(addr));
+    }
+    return model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(addr)->addr);
+}
+
+/** give back the addresses of an entry that was removed from ziti_dns.names, and free it */
+static void release_dns_entry(dns_entry_t *e) {
+    if (e->has_ip4) {
+        model_map_removel(&ziti_dns.ip_addresses, ip_2_ip4(&e->addr)->addr);
+        release_ipv4(ip_2_ip4(&e->addr)->addr);
+        ziti_tunneler_addr_released(ziti_dns.tnlr, &e->addr);
+    }
+    if (e->has_ip6) {
+        uint64_t iid = ip6_iid(ip_2_ip6(&e->addr6));
+        model_map_remove_key(&ziti_dns.ip6_addresses, &iid, sizeof(iid));
+        ziti_tunneler_addr_released(ziti_dns.tnlr, &e->addr6);
+    }
+    if (e->domain) {
+        TAILQ_REMOVE(&ziti_dns.wildcard_lru, e, lru_link);
+        LIST_REMOVE(e, domain_link);
+    }
+    model_map_clear(&e->intercepts, NULL);
+    free(e);
+}
+
+static bool entry_in_use(dns_entry_t *e) {
+    return (e->has_ip4 && ziti_tunneler_addr_in_use(ziti_dns.tnlr, &e->addr)) ||
+           (e->has_ip6 && ziti_tunneler_addr_in_use(ziti_dns.tnlr, &e->addr6));
+}
+
+static void touch_wildcard_entry(dns_entry_t *e) {
+    e->last_used = uv_now(ziti_dns.loop);
+    TAILQ_REMOVE(&ziti_dns.wildcard_lru, e, lru_link);
+    TAILQ_INSERT_TAIL(&ziti_dns.wildcard_lru, e, lru_link);
+}
+
+/**
+ * release the least recently resolved wildcard name that has been idle for DNS_WILDCARD_IDLE_MS and has no
+ * connections. names that still have connections are treated as recently used.
+ */
+static bool reclaim_wildcard_entry(void) {
+    uint64_t now = uv_now(ziti_dns.loop);
+    for (int i = 0; i < DNS_RECLAIM_SCAN_MAX; i++) {
+        dns_entry_t *e = TAILQ_FIRST(&ziti_dns.wildcard_lru);
+        if (e == NULL || now - e->last_used < DNS_WILDCARD_IDLE_MS) {
+            return false;
+        }
+
+        // also registered as a service hostname, or still connected
+        if (model_map_size(&e->intercepts) > 0 || entry_in_use(e)) {
+            touch_wildcard_entry(e);
+            continue;
+        }
+
+        ZITI_LOG(INFO, "reclaiming DNS mapping %s -> %s %s, idle for %lus",
+                 e->name, e->ip, e->ip6, (unsigned long) ((now - e->last_used) / 1000));
+        dns_trie_remove(&ziti_dns.names, e->name, false);
+        bool released_ip4 = e->has_ip4;
+        release_dns_entry(e);
+        if (released_ip4) {
+            return true;
+        }
+    }
+    return false;
+}
+
 const char *ziti_dns_reverse_lookup_domain(const ip_addr_t *addr) {
-     dns_entry_t *entry = model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(addr)->addr);
+     dns_entry_t *entry = entry_for_addr(addr);
      if (entry && entry->domain) {
          return entry->domain->name;
      }
@@ -362,19 +699,13 @@ const char *ziti_dns_reverse_lookup_domain(const ip_addr_t *addr) {
 const char *ziti_dns_reverse_lookup(const char *ip_addr) {
     ip_addr_t addr = {0};
     ipaddr_aton(ip_addr, &addr);
-    dns_entry_t *entry = model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(&addr)->addr);
+    dns_entry_t *entry = entry_for_addr(&addr);
 
     return entry ? entry->name : NULL;
 }
 
 static dns_domain_t* find_domain(const char *hostname) {
-    char *dot = strchr(hostname, '.');
-    dns_domain_t *domain = model_map_get(&ziti_dns.domains, hostname);
-    while (dot != NULL && domain == NULL) {
-        domain = model_map_get(&ziti_dns.domains, dot + 1);
-        dot = strchr(dot + 1, '.');
-    }
-    return domain;
+    return dns_trie_find_wildcard(&ziti_dns.names, hostname, true);
 }
 
 static dns_entry_t *ziti_dns_lookup(const char *hostname) {
@@ -385,20 +716,26 @@ static dns_entry_t *ziti_dns_lookup(const char *hostname) {
         return NULL;
     }
 
-    dns_entry_t *entry = model_map_get(&ziti_dns.hostnames, clean);
+    dns_entry_t *entry = dns_trie_get(&ziti_dns.names, clean, false);
 
     if (!entry) {         // try domains
         dns_domain_t *domain = find_domain(clean);
 
         if (domain && model_map_size(&domain->intercepts) > 0) {
             ZITI_LOG(DEBUG, "matching domain[%s] found for %s", domain->name, hostname);
-            entry = new_ipv4_entry(clean);
+            entry = new_dns_entry(clean);
             if (entry) {
                 entry->domain = domain;
+                LIST_INSERT_HEAD(&domain->entries, entry, domain_link);
+                TAILQ_INSERT_TAIL(&ziti_dns.wildcard_lru, entry, lru_link);
             }
         }
     }
 
+    if (entry && entry->domain) {
+        touch_wildcard_entry(entry);
+    }
+
     if (entry) {
         if (model_map_size(&entry->intercepts) > 0 ||
             (entry->domain && model_map_size(&entry->domain->intercepts) > 0)) {
@@ -411,38 +748,67 @@ static dns_entry_t *ziti_dns_lookup(const char *hostname) {
 }
 
 
+static dns_intercept_regs_t *intercept_regs(void *intercept) {
+    dns_intercept_regs_t *regs = model_map_get_key(&ziti_dns.intercept_regs, &intercept, sizeof(intercept));
+    if (regs == NULL) {
+        regs = calloc(1, sizeof(dns_intercept_regs_t));
+        model_map_set_key(&ziti_dns.intercept_regs, &intercept, sizeof(intercept), regs);
+    }
+    return regs;
+}
+
+static void remove_dns_entry(dns_entry_t *e) {
+    dns_trie_remove(&ziti_dns.names, e->name, false);
+    ZITI_LOG(INFO, "DNS mapping %s -> %s %s is now inactive", e->name, e->ip, e->ip6);
+    release_dns_entry(e);
+}
+
 void ziti_dns_deregister_intercept(void *intercept) {
-    model_map_iter it = model_map_iterator(&ziti_dns.domains);
+    dns_intercept_regs_t *regs = model_map_remove_key(&ziti_dns.intercept_regs, &intercept, sizeof(intercept));
+    if (regs == NULL) {
+        return;
+    }
+
+    model_map_iter it = model_map_iterator(&regs->domains);
     while (it != NULL) {
         dns_domain_t *domain = model_map_it_value(it);
+        it = model_map_it_remove(it);
         model_map_remove_key(&domain->intercepts, &intercept, sizeof(intercept));
-        it = model_map_it_next(it);
-    }
+        if (model_map_size(&domain->intercepts) > 0) {
+            continue;
+        }
 
-    it = model_map_iterator(&ziti_dns.hostnames);
-    while (it != NULL) {
-        dns_entry_t *e = model_map_it_value(it);
-        model_map_remove_key(&e->intercepts, &intercept, sizeof(intercept));
-        if (model_map_size(&e->intercepts) == 0 && (e->domain == NULL || model_map_size(&e->domain->intercepts) == 0)) {
-            it = model_map_it_remove(it);
-            model_map_removel(&ziti_dns.ip_addresses, ip_2_ip4(&e->addr)->addr);
-            ZITI_LOG(DEBUG, "%zu active hostnames mapped to %zu IPs", model_map_size(&ziti_dns.hostnames), model_map_size(&ziti_dns.ip_addresses));
-            ZITI_LOG(INFO, "DNS mapping %s -> %s is now inactive", e->name, e->ip);
-        } else {
-            it = model_map_it_next(it);
+        // names resolved through the domain go with it, unless a service also uses them as hostnames
+        while (!LIST_EMPTY(&domain->entries)) {
+            dns_entry_t *e = LIST_FIRST(&domain->entries);
+            if (model_map_size(&e->intercepts) == 0) {
+                remove_dns_entry(e);
+            } else {
+                LIST_REMOVE(e, domain_link);
+                TAILQ_REMOVE(&ziti_dns.wildcard_lru, e, lru_link);
+                e->domain = NULL;
+            }
+        }
+        dns_trie_remove(&ziti_dns.names, domain->name + 2, true);
+        ZITI_LOG(INFO, "wildcard domain[%s] is now inactive", domain->name);
+        // an open proxy resolve connection still refers to the domain
+        if (domain->resolv_proxy == NULL) {
+            free(domain);
         }
     }
 
-    it = model_map_iterator(&ziti_dns.domains);
+    it = model_map_iterator(&regs->entries);
     while (it != NULL) {
-        dns_domain_t *domain = model_map_it_value(it);
-        if (model_map_size(&domain->intercepts) == 0) {
-            it = model_map_it_remove(it);
-            ZITI_LOG(INFO, "wildcard domain[*%s] is now inactive", domain->name);
-        } else {
-            it = model_map_it_next(it);
+        dns_entry_t *e = model_map_it_value(it);
+        it = model_map_it_remove(it);
+        model_map_remove_key(&e->intercepts, &intercept, sizeof(intercept));
+        if (model_map_size(&e->intercepts) == 0 && e->domain == NULL) {
+            remove_dns_entry(e);
         }
     }
+    ZITI_LOG(DEBUG, "%zu active hostnames and domains, mapped to %zu IPv4 and %zu IPv6 addresses", ziti_dns.names.size,
+             model_map_size(&ziti_dns.ip_addresses), model_map_size(&ziti_dns.ip6_addresses));
+    free(regs);
 }
 
 const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *intercept) {
@@ -460,29 +826,74 @@ const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *inte
     }
 
     if (is_domain) {
-        dns_domain_t *domain = model_map_get(&ziti_dns.domains, clean + 2);
+        dns_domain_t *domain = dns_trie_get(&ziti_dns.names, clean + 2, true);
         if (domain == NULL) {
             ZITI_LOG(INFO, "registered wildcard domain[%s]", clean);
             domain = calloc(1, sizeof(dns_domain_t));
             strncpy(domain->name, clean, sizeof(domain->name));
-            model_map_set(&ziti_dns.domains, clean + 2, domain);
+            LIST_INIT(&domain->entries);
+            dns_trie_set(&ziti_dns.names, clean + 2, true, domain);
         }
         model_map_set_key(&domain->intercepts, &intercept, sizeof(intercept), intercept);
+        model_map_set_key(&intercept_regs(intercept)->domains, &domain, sizeof(domain), domain);
         return NULL;
     } else {
-        dns_entry_t *entry = model_map_get(&ziti_dns.hostnames, clean);
+        dns_entry_t *entry = dns_trie_get(&ziti_dns.names, clean, false);
         if (!entry) {
-            entry = new_ipv4_entry(clean);
+            entry = new_dns_entry(clean);
         }
         if (entry) {
             model_map_set_key(&entry->intercepts, &intercept, sizeof(intercept), intercept);
-            return &entry->addr;
+            model_map_set_key(&intercept_regs(intercept)->entries, &entry, sizeof(entry), entry);
+            return entry->has_ip4 ? &entry->addr : NULL;
         } else {
             return NULL;
         }
     }
 }
 
+const ip_addr_t *ziti_dns_hostname_ip6(const ziti_address *addr) {
+    if (addr->type != ziti_address_hostname) {
+        return NULL;
+    }
+    char clean[MAX_DNS_NAME];
+    bool is_domain = false;
+    if (!check_name(addr->addr.hostname, clean, &is_domain) || is_domain) {
+        return NULL;
+    }
+    dns_entry_t *entry = dns_trie_get(&ziti_dns.names, clean, false);
+    return entry && entry->has_ip6 ? &entry->addr6 : NULL;
+}
+
+int ziti_dns_setup_ipv6(const char *dns_cidr6) {
+    ip6_addr_t prefix;
+    const char *slash = strchr(dns_cidr6, '/');
+    char addr[IP6ADDR_STRLEN_MAX];
+    size_t addr_len = slash ? (size_t) (slash - dns_cidr6) : strlen(dns_cidr6);
+    int bits = slash ? atoi(slash + 1) : 64;
+    if (addr_len >= sizeof(addr) || bits < 1 || bits > 64) {
+        ZITI_LOG(ERROR, "Invalid IPv6 range specification[%s]: a /64 or larger prefix is expected", dns_cidr6);
+        return -1;
+    }
+    memcpy(addr, dns_cidr6, addr_len);
+    addr[addr_len] = '\0';
+    if (!ip6addr_aton(addr, &prefix)) {
+        ZITI_LOG(ERROR, "Invalid IPv6 range specification[%s]", dns_cidr6);
+        return -1;
+    }
+
+    // addresses only vary in the interface id; the rest of a shorter prefix is left as given
+    ziti_dns.ip6_pool.prefix[0] = prefix.addr[0];
+    ziti_dns.ip6_pool.prefix[1] = prefix.addr[1];
+    ziti_dns.ip6_pool.next_iid = 0;
+    ziti_dns.ip6_pool.enabled = true;
+
+    ip_addr_t net;
+    next_ipv6(&net); // the network address is never handed out
+    ZITI_LOG(INFO, "DNS configured with IPv6 range %s/64", ipaddr_ntoa(&net));
+    return 0;
+}
+
 static const char DNS_OPT[] = { 0x0, 0x0, 0x29, 0x10, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0 };
 
 #define DNS_HEADER_LEN 12
@@ -530,22 +941,44 @@ static uint8_t* format_name(uint8_t* p, const char* name) {
     return p;
 }
 
+static void set_resp(struct dns_req *req, const uint8_t *resp, size_t resp_len) {
+    free(req->resp);
+    req->resp = malloc(resp_len);
+    memcpy(req->resp, resp, resp_len);
+    req->resp_len = resp_len;
+}
+
+/* respond with an upstream (or cached) answer, fitted to what the client accepts */
+static void set_upstream_resp(struct dns_req *req, const uint8_t *resp, size_t resp_len) {
+    set_resp(req, resp, resp_len);
+    req->resp[0] = (uint8_t) (req->id >> 8);
+    req->resp[1] = (uint8_t) (req->id & 0xff);
+    if (req->resp_len > req->max_resp) {
+        ZITI_LOG(DEBUG, "response to query[%04x] is %zu bytes, client accepts %zu", req->id, req->resp_len, req->max_resp);
+    }
+    req->resp_len = dns_fit_response(req->resp, req->resp_len, req->edns, req->max_resp);
+}
+
 static void format_resp(struct dns_req *req) {
+    // responses are built here and then copied to a right-sized buffer
+    static uint8_t resp[DNS_LOCAL_RESP_MAX];
 
     // copy header from request
-    memcpy(req->resp, req->req, DNS_HEADER_LEN); // DNS header
-    DNS_SET_ANS(req->resp);
-    DNS_SET_CODE(req->resp, req->msg.status);
+    memcpy(resp, req->req, DNS_HEADER_LEN); // DNS header
+    DNS_SET_ANS(resp);
+    DNS_SET_CODE(resp, req->msg.status);
     bool recursion_avail = uv_is_active((const uv_handle_t *) &ziti_dns.upstream);
     if (recursion_avail) {
-        DNS_SET_RA(req->resp);
+        DNS_SET_RA(resp);
     }
 
     size_t query_section_len = strlen(req->msg.question[0]->name) + 2 + 4;
-    memcpy(req->resp + DNS_HEADER_LEN, req->req + DNS_HEADER_LEN, query_section_len);
+    memcpy(resp + DNS_HEADER_LEN, req->req + DNS_HEADER_LEN, query_section_len);
 
-    uint8_t *rp = req->resp + DNS_HEADER_LEN + query_section_len;
-    uint8_t *resp_end = req->resp + sizeof(req->resp);
+    uint8_t *rp = resp + DNS_HEADER_LEN + query_section_len;
+    // leave room for the OPT record if the client sent one
+    size_t max_resp = req->max_resp < sizeof(resp) ? req->max_resp : sizeof(resp);
+    uint8_t *resp_end = resp + max_resp - (req->edns ? sizeof(DNS_OPT) : 0);
     bool truncated = false;
 
     if (req->msg.status == DNS_NO_ERROR && req->msg.answer != NULL) {
@@ -559,6 +992,7 @@ static void format_resp(struct dns_req *req) {
                 goto done;
             }
 
+            uint8_t *rr = rp; // start of this record, to drop it if the data is bad
             // name ref
             *rp++ = 0xc0;
             *rp++ = 0x0c;
@@ -582,6 +1016,24 @@ static void format_resp(struct dns_req *req) {
                     break;
                 }
 
+                case NS_T_AAAA: {
+                    ip6_addr_t a6;
+                    if (!ip6addr_aton(a->data, &a6)) {
+                        ZITI_LOG(WARN, "invalid AAAA record[%s]", a->data);
+                        rp = rr;
+                        ans_count--;
+                        break;
+                    }
+                    if (resp_end - rp < (2 + sizeof(a6.addr))) {
+                        truncated = true;
+                        goto done;
+                    }
+                    SET_U16(rp, sizeof(a6.addr));
+                    memcpy(rp, a6.addr, sizeof(a6.addr));
+                    rp += sizeof(a6.addr);
+                    break;
+                }
+
                 case NS_T_TXT: {
                     uint16_t txtlen = strlen(a->data);
                     uint16_t datalen = 1 + txtlen;
@@ -632,17 +1084,19 @@ static void format_resp(struct dns_req *req) {
         done:
         if (truncated) {
             ZITI_LOG(DEBUG, "dns response truncated");
-            DNS_SET_TC(req->resp);
+            DNS_SET_TC(resp);
         }
-        DNS_SET_ARS(req->resp, ans_count);
+        DNS_SET_ARS(resp, ans_count);
     }
 
-    DNS_SET_AARS(req->resp, 1);
-    if (resp_end - rp > 11) {
+    if (req->edns) {
+        DNS_SET_AARS(resp, 1);
         memcpy(rp, DNS_OPT, sizeof(DNS_OPT));
         rp += sizeof(DNS_OPT);
+    } else {
+        DNS_SET_AARS(resp, 0);
     }
-    req->resp_len = rp - req->resp;
+    set_resp(req, resp, rp - resp);
 }
 
 static void process_host_req(struct dns_req *req) {
@@ -650,7 +1104,7 @@ static void process_host_req(struct dns_req *req) {
     if (entry) {
         req->msg.status = DNS_NO_ERROR;
 
-        if (req->msg.question[0]->type == NS_T_A) {
+        if (req->msg.question[0]->type == NS_T_A && entry->has_ip4) {
             req->addr.s_addr = entry->addr.u_addr.ip4.addr;
 
             dns_answer *a = calloc(1, sizeof(dns_answer));
@@ -659,6 +1113,13 @@ static void process_host_req(struct dns_req *req) {
             a->data = strdup(entry->ip);
             req->msg.answer = calloc(2, sizeof(dns_answer *));
             req->msg.answer[0] = a;
+        } else if (req->msg.question[0]->type == NS_T_AAAA && entry->has_ip6) {
+            dns_answer *a = calloc(1, sizeof(dns_answer));
+            a->ttl = 60;
+            a->type = NS_T_AAAA;
+            a->data = strdup(entry->ip6);
+            req->msg.answer = calloc(2, sizeof(dns_answer *));
+            req->msg.answer[0] = a;
         }
 
         format_resp(req);
@@ -677,6 +1138,7 @@ static void proxy_domain_close_cb(ziti_connection c) {
     dns_domain_t *domain = ziti_conn_data(c);
     if (domain) {
         domain->resolv_proxy = NULL;
+        domain->proxy_wire = false;
     }
 }
 
@@ -693,14 +1155,38 @@ static void on_proxy_connect(ziti_connection conn, int status) {
 
 static ssize_t on_proxy_data(ziti_connection conn, const uint8_t* data, ssize_t status) {
     if (status >= 0) {
-        ZITI_LOG(DEBUG, "proxy resolve: %.*s", (int)status, data);
+        dns_domain_t *domain = ziti_conn_data(conn);
         dns_message msg = {0};
-        int rc = parse_dns_message(&msg, (const char *) data, status);
-        if (rc < 0) {
+        // a wire format answer can start with '{' too, but it never parses as JSON
+        if (status > 0 && data[0] == '{' && parse_dns_message(&msg, (const char *) data, status) >= 0) {
+            ZITI_LOG(DEBUG, "proxy resolve: %.*s", (int)status, data);
+        } else if (domain && domain->proxy_wire && status >= DNS_HEADER_LEN) {
+            free_dns_message(&msg);
+            uint16_t id = DNS_ID(data); // the request's upstream_id
+            struct dns_req *req = model_map_get_key(&ziti_dns.requests, &id, sizeof(id));
+            ZITI_LOG(TRACE, "proxy resolve[%04x]: %zd bytes", id, status);
+            if (req) {
+                set_upstream_resp(req, data, status);
+                complete_dns_req(req);
+            }
+            return status;
+        } else {
+            free_dns_message(&msg);
             // the original DNS client's request won't be completed because we can't get the msg ID.
-            return rc;
+            return -1;
         }
-        uint16_t id = msg.id;
+
+        if (msg.question == NULL && msg.comment && strcmp(msg.comment, DNS_WIRE_FORMAT) == 0) {
+            ZITI_LOG(DEBUG, "proxy resolve connection for domain[%s] accepts wire format queries",
+                     domain ? domain->name : "<unknown>");
+            if (domain) {
+                domain->proxy_wire = true;
+            }
+            free_dns_message(&msg);
+            return status;
+        }
+
+        uint16_t id = msg.id; // the request's upstream_id
         struct dns_req *req = model_map_get_key(&ziti_dns.requests, &id, sizeof(id));
         if (req) {
             req->msg.answer = msg.answer;
@@ -718,13 +1204,13 @@ static ssize_t on_proxy_data(ziti_connection conn, const uint8_t* data, ssize_t
 
 struct proxy_dns_req_wr_s {
     struct dns_req *req;
-    char *json;
+    uint8_t *msg; // JSON, or the wire format query
 };
 
 static void free_proxy_dns_wr(struct proxy_dns_req_wr_s *wr) {
-    if (wr->json) {
-        free(wr->json);
-        wr->json = NULL;
+    if (wr->msg) {
+        free(wr->msg);
+        wr->msg = NULL;
     }
     free(wr);
 }
@@ -754,18 +1240,29 @@ static void proxy_domain_req(struct dns_req *req, dns_domain_t *domain) {
     dns_question *q = req->msg.question[0];
     if (domain->resolv_proxy == NULL) {
         req->msg.status = DNS_SERVFAIL;
-    } else if (q->type == NS_T_MX || q->type == NS_T_SRV || q->type == NS_T_TXT) {
-        size_t jsonlen;
+    } else if (domain->proxy_wire || q->type == NS_T_MX || q->type == NS_T_SRV || q->type == NS_T_TXT) {
+        size_t len;
         struct proxy_dns_req_wr_s *wr = calloc(1, sizeof(struct proxy_dns_req_wr_s));
         wr->req = req;
-        wr->json = dns_message_to_json(&req->msg, MODEL_JSON_COMPACT, &jsonlen);
-        if (wr->json) {
-            ZITI_LOG(DEBUG, "writing proxy resolve req[%04x]: %s", req->id, wr->json);
-
+        if (domain->proxy_wire) {
+            // the client's own query goes through, and its answer comes back as the host's resolver gave it
+            len = req->req_len;
+            wr->msg = malloc(len);
+            memcpy(wr->msg, req->req, len);
+            wr->msg[0] = (uint8_t) (req->upstream_id >> 8);
+            wr->msg[1] = (uint8_t) (req->upstream_id & 0xff);
+            ZITI_LOG(DEBUG, "writing proxy resolve req[%04x]: %zu bytes", req->id, len);
+        } else {
+            wr->msg = (uint8_t *) dns_message_to_json(&req->msg, MODEL_JSON_COMPACT, &len);
+            if (wr->msg) {
+                ZITI_LOG(DEBUG, "writing proxy resolve req[%04x]: %s", req->id, (char *) wr->msg);
+            }
+        }
+        if (wr->msg) {
             // intercept_resolve_connect above can quick-fail if context does not have a valid API session
             // in that case resolve_proxy connection will be in Closed state and write will fail.
             // ziti_write will queue the message if the connection state is Connecting (as it will be the first time through)
-            int rc = ziti_write(domain->resolv_proxy, (uint8_t *) wr->json, jsonlen, on_proxy_write, wr);
+            int rc = ziti_write(domain->resolv_proxy, wr->msg, len, on_proxy_write, wr);
             if (rc == ZITI_OK) {
                 // completion with client will happen in on_proxy_write if write fails, or on_proxy_data when response arrives
                 return;
@@ -784,42 +1281,86 @@ static void proxy_domain_req(struct dns_req *req, dns_domain_t *domain) {
     complete_dns_req(req);
 }
 
+/* reassemble a tcp client's length-prefixed queries. queries may be pipelined, and split across reads */
+static void dns_client_read(ziti_dns_client_t *clt, const uint8_t *data, size_t len) {
+    if (clt->in_len + len > clt->in_cap) {
+        clt->in_cap = clt->in_len + len;
+        clt->in = realloc(clt->in, clt->in_cap);
+    }
+    memcpy(clt->in + clt->in_len, data, len);
+    clt->in_len += len;
+
+    size_t off = 0;
+    size_t frame_len;
+    while ((frame_len = dns_tcp_frame_len(clt->in + off, clt->in_len - off)) > 0) {
+        // the client is closed if a query can't be parsed
+        if (!dns_client_query(clt, clt->in + off + 2, frame_len - 2)) {
+            return;
+        }
+        off += frame_len;
+    }
+    memmove(clt->in, clt->in + off, clt->in_len - off);
+    clt->in_len -= off;
+}
+
 ssize_t on_dns_req(const void *ziti_io_ctx, void *write_ctx, const void *q_packet, size_t q_len) {
     ziti_dns_client_t *clt = (ziti_dns_client_t *)ziti_io_ctx;
-    const uint8_t *dns_packet = q_packet;
-    size_t dns_packet_len = q_len;
+    if (clt->is_tcp) {
+        dns_client_read(clt, q_packet, q_len);
+    } else {
+        dns_client_query(clt, q_packet, q_len);
+    }
+    ziti_tunneler_ack(write_ctx);
+    return (ssize_t)q_len;
+}
+
+/* handle one query. returns false if the client was closed */
+static bool dns_client_query(ziti_dns_client_t *clt, const uint8_t *dns_packet, size_t q_len) {
+    if (q_len < DNS_HEADER_LEN) {
+        ZITI_LOG(ERROR, "DNS message is too short: %zu bytes", q_len);
+        on_dns_close(clt);
+        return false;
+    }
 
+    // IDs are only unique per client, and each client is a separate flow
     uint16_t req_id = DNS_ID(dns_packet);
-    struct dns_req *req = model_map_get_key(&ziti_dns.requests, &req_id, sizeof(req_id));
+    struct dns_req *req = model_map_get_key(&clt->active_reqs, &req_id, sizeof(req_id));
     if (req != NULL) {
-        ZITI_LOG(TRACE, "duplicate dns req[%04x] from %s client", req_id, req->clt == ziti_io_ctx ? "same" : "another");
-        // just drop new request
-        ziti_tunneler_ack(write_ctx);
-        return (ssize_t)q_len;
+        ZITI_LOG(TRACE, "duplicate dns req[%04x]", req_id);
+        // just drop retransmitted request
+        return true;
     }
 
-    req = calloc(1, sizeof(struct dns_req));
+    req = new_dns_req();
     req->clt = clt;
 
     req->req_len = q_len;
-    memcpy(req->req, q_packet, q_len);
+    req->req = malloc(q_len);
+    memcpy(req->req, dns_packet, q_len);
 
-    if (parse_dns_req(&req->msg, dns_packet, dns_packet_len) != 0) {
+    if (parse_dns_req(&req->msg, dns_packet, q_len) != 0) {
         ZITI_LOG(ERROR, "failed to parse DNS message");
         on_dns_close(clt);
         free_dns_req(req);
-        ziti_tunneler_ack(write_ctx);
-        return (ssize_t)q_len;
+        return false;
     }
     req->id = req->msg.id;
+    req->max_resp = dns_max_response(dns_packet, q_len, clt->is_tcp, &req->edns);
+    if (!next_upstream_id(&req->upstream_id)) {
+        ZITI_LOG(WARN, "too many DNS queries in flight, dropping query[%04x]", req->id);
+        free_dns_req(req);
+        return true;
+    }
+    // proxied queries are matched to their responses by the message id
+    req->msg.id = req->upstream_id;
 
-    ZITI_LOG(TRACE, "received DNS query q_len=%zd id[%04x] recursive[%s] type[%d] name[%s]", q_len, req->id,
+    ZITI_LOG(TRACE, "received DNS query q_len=%zd id[%04x] recursive[%s] type[%d] name[%s] max_resp[%zu]", q_len, req->id,
              req->msg.recursive ? "true" : "false",
              (int)req->msg.question[0]->type,
-             req->msg.question[0]->name);
+             req->msg.question[0]->name, req->max_resp);
 
     model_map_set_key(&req->clt->active_reqs, &req->id, sizeof(req->id), req);
-    model_map_set_key(&ziti_dns.requests, &req->id, sizeof(req->id), req);
+    model_map_set_key(&ziti_dns.requests, &req->upstream_id, sizeof(req->upstream_id), req);
 
     // route request
     dns_question *q = req->msg.question[0];
@@ -842,67 +1383,433 @@ ssize_t on_dns_req(const void *ziti_io_ctx, void *write_ctx, const void *q_packe
             }
         }
     }
-
-    ziti_tunneler_ack(write_ctx);
-    return (ssize_t)q_len;
+    return true;
 }
 
 int query_upstream(struct dns_req *req) {
     bool avail = uv_is_active((const uv_handle_t *) &ziti_dns.upstream);
     bool success = false;
     if (avail && req->msg.recursive) {
-        uv_buf_t buf = uv_buf_init((char *) req->req, req->req_len);
+        static uint8_t cached[DNS_LOCAL_RESP_MAX];
+        size_t cached_len = dns_cache_get(&ziti_dns.cache, req->req, req->req_len, cached, sizeof(cached),
+                                          uv_now(ziti_dns.upstream.loop));
+        if (cached_len > 0) {
+            ZITI_LOG(TRACE, "answering query[%04x] from cache", req->id);
+            set_upstream_resp(req, cached, cached_len);
+            complete_dns_req(req);
+            return DNS_NO_ERROR;
+        }
 
-        for (int i = 0; i < ziti_dns.num_dns_up; i++) {
-            int rc = uv_udp_try_send(&ziti_dns.upstream, &buf, 1,
-                                     (struct sockaddr *) &ziti_dns.upstream_addr[i]);
-            if (rc > 0) {
-                success = true;
-            } else {
-                ZITI_LOG(WARN, "failed to query[%04x] upstream DNS server[%d]: %d(%s)",
-                         req->id, i, rc, uv_strerror(rc));
-            }
+        uint64_t now = uv_now(ziti_dns.upstream.loop);
+        dns_upstream_order(ziti_dns.upstream_stats, ziti_dns.num_dns_up, now, req->up_order);
+        LIST_INSERT_HEAD(&ziti_dns.upstream_reqs, req, up_link);
+        success = send_upstream(req, now);
+        if (success) {
+            schedule_upstream_timer(req->up_deadline);
+        } else {
+            upstream_req_done(req);
         }
     }
     return success ? DNS_NO_ERROR : DNS_REFUSE;
 }
 
+static void upstream_failed(int idx, uint64_t now) {
+    if (dns_upstream_on_error(&ziti_dns.upstream_stats[idx], now)) {
+        ZITI_LOG(WARN, "DNS upstream[%d] failed %u queries in a row, preferring other upstreams for %ds",
+                 idx, ziti_dns.upstream_stats[idx].consecutive_errors, DNS_UPSTREAM_DEMOTE_MS / 1000);
+    }
+}
+
+/* when the last of the upstreams that are still expected to answer times out */
+static uint64_t upstream_timeout_deadline(const struct dns_req *req) {
+    uint64_t deadline = 0;
+    for (int i = 0; i < ziti_dns.num_dns_up; i++) {
+        if ((req->up_waiting & (1U << i)) && req->up_sent[i] + DNS_UPSTREAM_TIMEOUT_MS > deadline) {
+            deadline = req->up_sent[i] + DNS_UPSTREAM_TIMEOUT_MS;
+        }
+    }
+    return deadline;
+}
+
+/* ask the next upstream(s) in the request's order, as the strategy allows, and set the request's deadline.
+ * returns false if no upstream is left to answer */
+static bool send_upstream(struct dns_req *req, uint64_t now) {
+    dns_upstream_strategy strategy = ziti_dns.upstream_strategy;
+    int sent = -1;
+
+    // upstreams see the tunneler-unique id. try_send copies, so the client's id is restored right after
+    req->req[0] = (uint8_t) (req->upstream_id >> 8);
+    req->req[1] = (uint8_t) (req->upstream_id & 0xff);
+    uv_buf_t buf = uv_buf_init((char *) req->req, req->req_len);
+
+    while (req->up_tried < ziti_dns.num_dns_up) {
+        int idx = req->up_order[req->up_tried++];
+        int rc = uv_udp_try_send(&ziti_dns.upstream, &buf, 1,
+                                 (struct sockaddr *) &ziti_dns.upstream_addr[idx]);
+        if (rc < 0) {
+            ZITI_LOG(WARN, "failed to query[%04x] upstream DNS server[%d]: %d(%s)",
+                     req->id, idx, rc, uv_strerror(rc));
+            upstream_failed(idx, now);
+            continue;
+        }
+        ziti_dns.upstream_stats[idx].queries++;
+        req->up_asked |= 1U << idx;
+        req->up_waiting |= 1U << idx;
+        req->up_sent[idx] = now;
+        sent = idx;
+        if (strategy != dns_upstream_all) {
+            break;
+        }
+    }
+    req->req[0] = (uint8_t) (req->id >> 8);
+    req->req[1] = (uint8_t) (req->id & 0xff);
+
+    // upstreams that were asked earlier keep their chance to answer
+    if (sent >= 0 && strategy == dns_upstream_race && req->up_tried < ziti_dns.num_dns_up) {
+        // hedge: bring in the next upstream if this one is slower than usual
+        req->up_deadline = now + dns_upstream_hedge_delay(&ziti_dns.upstream_stats[sent]);
+    } else if (sent >= 0 && strategy == dns_upstream_sequential && req->up_tried < ziti_dns.num_dns_up) {
+        req->up_deadline = now + dns_upstream_failover_delay(&ziti_dns.upstream_stats[sent]);
+    } else {
+        // nothing else to ask; wait until every outstanding upstream has timed out
+        req->up_deadline = upstream_timeout_deadline(req);
+    }
+    return req->up_waiting != 0;
+}
+
+static void upstream_req_done(struct dns_req *req) {
+    if (req->up_link.le_prev != NULL) {
+        LIST_REMOVE(req, up_link);
+        req->up_link.le_prev = NULL;
+    }
+}
+
+/* returns true if the request is still waiting for an answer */
+static bool upstream_req_expired(struct dns_req *req, uint64_t now) {
+    if (req->tcp_query != NULL) {
+        // answer with the truncated udp response
+        ZITI_LOG(DEBUG, "upstream did not answer query[%04x] over tcp", req->id);
+        abort_tcp_query(req->tcp_query);
+        upstream_req_done(req);
+        complete_dns_req(req);
+        return false;
+    }
+
+    // only upstreams that had the full timeout count as failed. a hedge or failover deadline
+    // just brings in the next upstream
+    for (int i = 0; i < ziti_dns.num_dns_up; i++) {
+        if ((req->up_waiting & (1U << i)) && req->up_sent[i] + DNS_UPSTREAM_TIMEOUT_MS <= now) {
+            req->up_waiting &= ~(1U << i);
+            upstream_failed(i, now);
+        }
+    }
+
+    if (req->up_tried < ziti_dns.num_dns_up && send_upstream(req, now)) {
+        return true;
+    }
+    if (req->up_waiting != 0) {
+        req->up_deadline = upstream_timeout_deadline(req);
+        return true;
+    }
+
+    ZITI_LOG(DEBUG, "no upstream answered query[%04x]", req->id);
+    upstream_req_done(req);
+    req->msg.status = DNS_SERVFAIL;
+    format_resp(req);
+    complete_dns_req(req);
+    return false;
+}
+
+static void schedule_upstream_timer(uint64_t deadline) {
+    if (ziti_dns.upstream_timer_due != 0 && ziti_dns.upstream_timer_due <= deadline) {
+        return;
+    }
+    uint64_t now = uv_now(ziti_dns.upstream_timer.loop);
+    ziti_dns.upstream_timer_due = deadline;
+    uv_timer_start(&ziti_dns.upstream_timer, on_upstream_timer, deadline > now ? deadline - now : 0, 0);
+}
+
+static void on_upstream_timer(uv_timer_t *t) {
+    uint64_t now = uv_now(t->loop);
+    uint64_t next = 0;
+    ziti_dns.upstream_timer_due = 0;
+
+    struct dns_req *req = LIST_FIRST(&ziti_dns.upstream_reqs);
+    while (req != NULL) {
+        struct dns_req *following = LIST_NEXT(req, up_link);
+        // expired requests that moved on to another upstream stay listed, with a later deadline
+        bool waiting = req->up_deadline > now || upstream_req_expired(req, now);
+        if (waiting && (next == 0 || req->up_deadline < next)) {
+            next = req->up_deadline;
+        }
+        req = following;
+    }
+    if (next != 0) {
+        schedule_upstream_timer(next);
+    }
+}
+
+/* index of the upstream that sent a packet, or -1 */
+static int upstream_index(const struct sockaddr *addr) {
+    for (int i = 0; i < ziti_dns.num_dns_up; i++) {
+        const struct sockaddr_in6 *up = &ziti_dns.upstream_addr[i];
+        if (addr->sa_family != up->sin6_family) {
+            continue;
+        }
+        if (addr->sa_family == AF_INET) {
+            const struct sockaddr_in *a4 = (const struct sockaddr_in *) addr;
+            const struct sockaddr_in *up4 = (const struct sockaddr_in *) up;
+            if (a4->sin_port == up4->sin_port && a4->sin_addr.s_addr == up4->sin_addr.s_addr) {
+                return i;
+            }
+        } else {
+            const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *) addr;
+            if (a6->sin6_port == up->sin6_port && memcmp(&a6->sin6_addr, &up->sin6_addr, sizeof(up->sin6_addr)) == 0) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
 static void dns_upstream_alloc(uv_handle_t *h, size_t reqlen, uv_buf_t *b) {
-    static char dns_buf[1024];
+    static char dns_buf[DNS_MAX_MSG_LEN];
     b->base = dns_buf;
     b->len = sizeof(dns_buf);
 }
 
 static void on_upstream_packet(uv_udp_t *h, ssize_t rc, const uv_buf_t *buf, const struct sockaddr* addr, unsigned int flags) {
-    if (rc > 0) {
+    if (flags & UV_UDP_PARTIAL) {
+        // a cut off answer would pass for a complete one
+        ZITI_LOG(WARN, "dropping DNS answer that did not fit the receive buffer (%zd bytes)", rc);
+        return;
+    }
+    if (rc >= DNS_HEADER_LEN) {
         uint16_t id = DNS_ID(buf->base);
         struct dns_req *req = model_map_get_key(&ziti_dns.requests, &id, sizeof(id));
         if (req != NULL) {
-            ZITI_LOG(TRACE, "upstream sent response to query[%04x] (rc=%zd)", id, rc);
-            if (rc <= sizeof(req->resp)) {
-                req->resp_len = rc;
-                memcpy(req->resp, buf->base, rc);
-            } else {
-                ZITI_LOG(WARN, "unexpected DNS response: too large");
+            int idx = upstream_index(addr);
+            // ids are easy to guess; only take answers from the upstreams the query went to
+            if (idx < 0 || (req->up_asked & (1U << idx)) == 0) {
+                char sender[INET6_ADDRSTRLEN] = "?";
+                if (addr != NULL) {
+                    uv_ip_name(addr, sender, sizeof(sender));
+                }
+                ZITI_LOG(DEBUG, "dropping answer to query[%04x] from %s, which was not asked", req->id, sender);
+                return;
             }
+            ZITI_LOG(TRACE, "upstream[%d] sent response to query[%04x] (rc=%zd)", idx, req->id, rc);
+            if (req->up_waiting & (1U << idx)) {
+                dns_upstream_stats_t *stats = &ziti_dns.upstream_stats[idx];
+                if (dns_upstream_is_demoted(stats, uv_now(h->loop))) {
+                    ZITI_LOG(INFO, "DNS upstream[%d] is answering again", idx);
+                }
+                dns_upstream_on_answer(stats, uv_now(h->loop) - req->up_sent[idx]);
+            }
+            bool truncated = (buf->base[2] & 0x2) != 0;
+            if (truncated && req->tcp_query != NULL) {
+                // already asking over tcp
+                return;
+            }
+            // a truncated answer would be replayed to clients that can take the whole thing
+            if (!truncated) {
+                dns_cache_put(&ziti_dns.cache, req->req, req->req_len, (const uint8_t *) buf->base, rc, uv_now(h->loop));
+            }
+            set_upstream_resp(req, (const uint8_t *) buf->base, rc);
+
+            // the client can take more than fit in the upstream's udp answer
+            if (truncated && req->max_resp > (size_t) rc && start_tcp_query(req, idx)) {
+                req->up_waiting = 0;
+                req->up_tried = (uint8_t) ziti_dns.num_dns_up;
+                req->up_deadline = uv_now(h->loop) + DNS_UPSTREAM_TCP_TIMEOUT;
+                schedule_upstream_timer(req->up_deadline);
+                return;
+            }
+            upstream_req_done(req);
             complete_dns_req(req);
         }
     }
 }
 
+struct dns_tcp_query_s {
+    uv_tcp_t tcp;
+    uv_connect_t connect;
+    uv_write_t write;
+    struct dns_req *req; // NULL once the request no longer needs the answer
+    uint8_t *query;
+    size_t query_len;
+    uint8_t *resp;
+    size_t resp_len;
+};
+
+static void free_tcp_query(uv_handle_t *h) {
+    struct dns_tcp_query_s *q = h->data;
+    free(q->query);
+    free(q->resp);
+    free(q);
+}
+
+static void abort_tcp_query(struct dns_tcp_query_s *q) {
+    if (q->req != NULL) {
+        q->req->tcp_query = NULL;
+        q->req = NULL;
+    }
+    if (!uv_is_closing((uv_handle_t *) &q->tcp)) {
+        uv_close((uv_handle_t *) &q->tcp, free_tcp_query);
+    }
+}
+
+static void tcp_query_done(struct dns_tcp_query_s *q, int status) {
+    struct dns_req *req = q->req;
+    if (req != NULL) {
+        if (status == 0) {
+            const uint8_t *msg = q->resp + 2;
+            size_t msg_len = q->resp_len - 2;
+            ZITI_LOG(TRACE, "upstream sent response to query[%04x] over tcp (len=%zu)", req->id, msg_len);
+            dns_cache_put(&ziti_dns.cache, req->req, req->req_len, msg, msg_len, uv_now(q->tcp.loop));
+            set_upstream_resp(req, msg, msg_len);
+        } else {
+            // the truncated udp answer stands
+            ZITI_LOG(DEBUG, "failed to query[%04x] upstream over tcp: %d(%s)", req->id, status, uv_strerror(status));
+        }
+        abort_tcp_query(q);
+        upstream_req_done(req);
+        complete_dns_req(req);
+    } else {
+        abort_tcp_query(q);
+    }
+}
+
+static void tcp_query_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *b) {
+    struct dns_tcp_query_s *q = h->data;
+    // room for one length-prefixed message
+    if (q->resp == NULL) {
+        q->resp = malloc(2 + DNS_LOCAL_RESP_MAX);
+    }
+    b->base = (char *) q->resp + q->resp_len;
+    b->len = 2 + DNS_LOCAL_RESP_MAX - q->resp_len;
+}
+
+static void on_tcp_query_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    struct dns_tcp_query_s *q = s->data;
+    if (nread < 0) {
+        tcp_query_done(q, (int) nread);
+        return;
+    }
+    q->resp_len += nread;
+    if (q->resp_len >= 2 && q->resp_len >= 2 + (size_t) (q->resp[0] << 8 | q->resp[1])) {
+        q->resp_len = 2 + (size_t) (q->resp[0] << 8 | q->resp[1]);
+        tcp_query_done(q, 0);
+    }
+}
+
+static void on_tcp_query_write(uv_write_t *wr, int status) {
+    struct dns_tcp_query_s *q = wr->data;
+    if (status < 0 && status != UV_ECANCELED) {
+        tcp_query_done(q, status);
+    }
+}
+
+static void on_tcp_query_connect(uv_connect_t *c, int status) {
+    struct dns_tcp_query_s *q = c->data;
+    if (status < 0 || q->req == NULL) {
+        if (status != UV_ECANCELED) {
+            tcp_query_done(q, status);
+        }
+        return;
+    }
+    uv_buf_t b = uv_buf_init((char *) q->query, q->query_len);
+    q->write.data = q;
+    int rc = uv_write(&q->write, (uv_stream_t *) &q->tcp, &b, 1, on_tcp_query_write);
+    if (rc == 0) {
+        rc = uv_read_start((uv_stream_t *) &q->tcp, tcp_query_alloc, on_tcp_query_read);
+    }
+    if (rc != 0) {
+        tcp_query_done(q, rc);
+    }
+}
+
+/* ask upstream `idx` again over tcp, after its udp answer was truncated */
+static bool start_tcp_query(struct dns_req *req, int idx) {
+    struct dns_tcp_query_s *q = calloc(1, sizeof(*q));
+    q->query_len = 2 + req->req_len;
+    q->query = malloc(q->query_len);
+    q->query[0] = (uint8_t) (req->req_len >> 8);
+    q->query[1] = (uint8_t) (req->req_len & 0xff);
+    memcpy(q->query + 2, req->req, req->req_len);
+    q->query[2] = (uint8_t) (req->upstream_id >> 8);
+    q->query[3] = (uint8_t) (req->upstream_id & 0xff);
+
+    uv_tcp_init(ziti_dns.upstream.loop, &q->tcp);
+    q->tcp.data = q;
+    q->connect.data = q;
+    int rc = uv_tcp_connect(&q->connect, &q->tcp, (const struct sockaddr *) &ziti_dns.upstream_addr[idx],
+                            on_tcp_query_connect);
+    if (rc != 0) {
+        ZITI_LOG(WARN, "failed to connect to upstream DNS server[%d] over tcp: %d(%s)", idx, rc, uv_strerror(rc));
+        uv_close((uv_handle_t *) &q->tcp, free_tcp_query);
+        return false;
+    }
+    ZITI_LOG(DEBUG, "upstream[%d] truncated the answer to query[%04x], retrying over tcp", idx, req->id);
+    q->req = req;
+    req->tcp_query = q;
+    return true;
+}
+
+static struct dns_req *new_dns_req(void) {
+    struct dns_req *req = ziti_dns.free_reqs;
+    if (req == NULL) {
+        return calloc(1, sizeof(struct dns_req));
+    }
+    ziti_dns.free_reqs = req->next_free;
+    ziti_dns.num_free_reqs--;
+    memset(req, 0, sizeof(*req));
+    return req;
+}
+
 static void free_dns_req(struct dns_req *req) {
+    upstream_req_done(req);
+    if (req->tcp_query != NULL) {
+        abort_tcp_query(req->tcp_query);
+    }
     free_dns_message(&req->msg);
-    free(req);
+    free(req->req);
+    free(req->resp);
+    if (ziti_dns.num_free_reqs < DNS_REQ_FREE_MAX) {
+        req->next_free = ziti_dns.free_reqs;
+        ziti_dns.free_reqs = req;
+        ziti_dns.num_free_reqs++;
+    } else {
+        free(req);
+    }
+}
+
+/* pick an unpredictable id that no in-flight request is using */
+static bool next_upstream_id(uint16_t *id) {
+    if (model_map_size(&ziti_dns.requests) >= UINT16_MAX) {
+        return false;
+    }
+    uint16_t candidate;
+    if (uv_random(NULL, NULL, &candidate, sizeof(candidate), 0, NULL) != 0) {
+        candidate = (uint16_t) rand();
+    }
+    while (model_map_get_key(&ziti_dns.requests, &candidate, sizeof(candidate)) != NULL) {
+        candidate++;
+    }
+    *id = candidate;
+    return true;
 }
 
 static void complete_dns_req(struct dns_req *req) {
-    model_map_remove_key(&ziti_dns.requests, &req->id, sizeof(req->id));
+    model_map_remove_key(&ziti_dns.requests, &req->upstream_id, sizeof(req->upstream_id));
     if (req->clt) {
-        ziti_tunneler_write(req->clt->io_ctx->tnlr_io, req->resp, req->resp_len);
-        model_map_remove_key(&req->clt->active_reqs, &req->id, sizeof(req->id));
-        // close client if there are no other pending requests
-        if (model_map_size(&req->clt->active_reqs) == 0) {
-            on_dns_close(req->clt->io_ctx->ziti_io);
+        ziti_dns_client_t *clt = req->clt;
+        // closing the client frees its active requests, so this one must not be among them
+        model_map_remove_key(&clt->active_reqs, &req->id, sizeof(req->id));
+        bool written = dns_client_write(clt, req->resp, req->resp_len);
+        // close udp clients if there are no other pending requests. tcp clients may send more queries
+        if (!written || dns_client_done(clt)) {
+            on_dns_close(clt);
         }
     } else {
         ZITI_LOG(WARN, "query[%04x] is stale", req->id);
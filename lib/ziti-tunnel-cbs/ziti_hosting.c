@@ -38,6 +38,41 @@
 
 #define KEEPALIVE_DELAY 60
 
+/* RFC 8305: the next server address is tried when the last attempt has not connected within this many ms */
+#define HOSTED_CONNECT_ATTEMPT_DELAY 250
+
+/* most server addresses that are tried for one connection */
+#define HOSTED_CONNECT_ADDRS_MAX 8
+
+/* server addresses are resolved again after this many ms */
+#define HOSTED_RESOLVE_TTL (30 * 1000)
+
+/* most resolved destinations kept per hosted service */
+#define HOSTED_RESOLVE_CACHE_MAX 64
+
+/* addresses whose last connect failed are tried after the others for this many ms */
+#define HOSTED_ADDR_PENALTY (60 * 1000)
+
+/* most server addresses with connect stats per hosted service */
+#define HOSTED_ADDR_STATS_MAX 256
+
+struct hosted_resolved_s {
+    uint64_t expires;
+    int count;
+    struct sockaddr_storage addrs[HOSTED_CONNECT_ADDRS_MAX];
+};
+
+struct hosted_addr_stats_s {
+    uint64_t attempts;
+    uint64_t failures;
+    uint64_t connect_ms; // smoothed connect latency
+    uint64_t last_used;
+    uint64_t last_success;
+    uint64_t last_failure;
+};
+
+struct hosted_connect_s;
+
 /********** hosting **********/
 static void on_bridge_close(uv_handle_t *handle);
 
@@ -54,10 +89,41 @@ struct hosted_io_ctx_s {
         uv_tcp_t tcp;
         uv_udp_t udp;
     } server;
+    uv_tcp_t *connected; // the connect attempt's handle that won the race, used instead of server.tcp
+    struct hosted_connect_s *connect; // while connect attempts are running
 };
 
+// a connection attempt to one of the server's addresses
+struct hosted_connect_attempt_s {
+    uv_tcp_t tcp; // first, so that the winner's handle can be freed as the attempt
+    uv_connect_t req;
+    struct hosted_connect_s *race;
+    int idx;
+    uint64_t started;
+    LIST_ENTRY(hosted_connect_attempt_s) link;
+};
+
+// staggered connection attempts to the server's addresses, until one of them connects
+struct hosted_connect_s {
+    hosted_io_context io;
+    uv_timer_t delay;
+    int count;
+    int next;
+    struct sockaddr_storage addrs[HOSTED_CONNECT_ADDRS_MAX];
+    LIST_HEAD(, hosted_connect_attempt_s) attempts;
+};
+
+static void end_connect_race(struct hosted_connect_s *race);
+
+static uv_handle_t *server_handle(hosted_io_context io) {
+    return io->connected ? (uv_handle_t *) io->connected : (uv_handle_t *) &io->server;
+}
+
 static void hosted_io_context_free(hosted_io_context io) {
     if (io) {
+        if (io->connect) {
+            end_connect_race(io->connect);
+        }
         if (io->app_data) {
             free_tunneler_app_data_ptr(io->app_data);
         }
@@ -111,6 +177,7 @@ static void free_hosted_service_ctx(struct hosted_service_ctx_s *hosted_ctx) {
     if (hosted_ctx->forward_address) {
         STAILQ_CLEAR(&hosted_ctx->addr_u.allowed_addresses, safe_free);
 
+        dns_trie_clear(&hosted_ctx->addr_u.allowed_names, NULL);
         while(!LIST_EMPTY(&hosted_ctx->addr_u.allowed_hostnames)) {
             struct allowed_hostname_s *dns_entry = LIST_FIRST(&hosted_ctx->addr_u.allowed_hostnames);
             LIST_REMOVE(dns_entry, _next);
@@ -124,10 +191,21 @@ static void free_hosted_service_ctx(struct hosted_service_ctx_s *hosted_ctx) {
     }
 
     STAILQ_CLEAR(&hosted_ctx->allowed_source_addresses, safe_free);
+
+    model_map_clear(&hosted_ctx->resolved, free);
+    model_map_clear(&hosted_ctx->addr_stats, free);
 }
 
+#define safe_close(h, cb) if(!uv_is_closing((uv_handle_t*)(h))) uv_close((uv_handle_t*)(h), cb)
 static void hosted_server_close_cb(uv_handle_t *handle) {
     struct hosted_io_ctx_s *io_ctx = handle->data;
+    if (io_ctx->connected && handle == (uv_handle_t *) io_ctx->connected) {
+        // the io's own handle was never connected, and is closed last
+        io_ctx->connected = NULL;
+        free(handle);
+        safe_close(&io_ctx->server, hosted_server_close_cb);
+        return;
+    }
     if (io_ctx->client) {
         ziti_close(io_ctx->client, ziti_conn_close_cb);
         ZITI_LOG(TRACE, "hosted_service[%s] client[%s] server_conn[%p] closed",
@@ -139,13 +217,12 @@ static void hosted_server_close_cb(uv_handle_t *handle) {
     }
 }
 
-#define safe_close(h, cb) if(!uv_is_closing((uv_handle_t*)(h))) uv_close((uv_handle_t*)(h), cb)
 static void hosted_server_close(struct hosted_io_ctx_s *io_ctx) {
     if (io_ctx == NULL) {
         return;
     }
 
-    safe_close(&io_ctx->server, hosted_server_close_cb);
+    safe_close(server_handle(io_ctx), hosted_server_close_cb);
 }
 
 void *local_addr(uv_handle_t *h, struct sockaddr *name, int *len) {
@@ -183,7 +260,7 @@ static void on_hosted_client_connect_complete(ziti_connection clt, int err) {
 
     if (err == ZITI_OK) {
         int rc;
-        uv_handle_t *server = (uv_handle_t *) &io_ctx->server.tcp;
+        uv_handle_t *server = server_handle(io_ctx);
         uv_os_fd_t fd;
         if ((rc = uv_fileno(server, &fd)) != 0) {
             ZITI_LOG(ERROR, "failed to bridge client[%s] with hosted_service[%s] fd[%d]: %s",
@@ -220,7 +297,7 @@ static void complete_hosted_tcp_connection(hosted_io_context io_ctx) {
     ZITI_LOG(DEBUG, "hosted_service[%s], client[%s]: connected to server %s", io_ctx->service->service_name,
              io_ctx->client_identity, io_ctx->resolved_dst);
 
-    uv_tcp_t *tcp = &io_ctx->server.tcp;
+    uv_tcp_t *tcp = (uv_tcp_t *) server_handle(io_ctx);
 
     if (uv_tcp_keepalive(tcp, 1, KEEPALIVE_DELAY) != 0) {
         ZITI_LOG(WARN, "hosted_service[%s], client[%s]: failed to set TCP keepalive",
@@ -308,19 +385,19 @@ static const char *get_protocol_str(int protocol_id) {
     }
 }
 
-static bool allowed_hostname_match(const char *hostname, const allowed_hostnames_t *hostnames) {
-    struct allowed_hostname_s *entry;
-    LIST_FOREACH(entry, hostnames, _next) {
-        if (entry->domain_name[0] == '*') {
-            if (entry->domain_name[1] == '\0') return true;
-            for (char *dot = strchr(hostname, '.'); dot != NULL; dot = strchr(dot + 1, '.')) {
-                if (strcmp(dot, entry->domain_name + 1) == 0) return true;
-            }
-        } else if (strcmp(hostname, entry->domain_name) == 0) {
-            return true;
-        }
+static void add_allowed_hostname(dns_trie_t *names, struct allowed_hostname_s *entry) {
+    const char *name = entry->domain_name;
+    if (strcmp(name, "*") == 0) {
+        dns_trie_set(names, "", true, entry);
+    } else if (strncmp(name, "*.", 2) == 0) {
+        dns_trie_set(names, name + 2, true, entry);
+    } else if (name[0] != '*') {
+        dns_trie_set(names, name, false, entry);
     }
-    return false;
+}
+
+static bool allowed_hostname_match(const char *hostname, const dns_trie_t *names) {
+    return dns_trie_get(names, hostname, false) != NULL || dns_trie_find_wildcard(names, hostname, false) != NULL;
 }
 
 static const char *compute_dst_protocol(const host_ctx_t *service, const tunneler_app_data *app_data,
@@ -449,7 +526,7 @@ static const char *compute_dst_ip_or_hn(const host_ctx_t *service, const tunnele
     // authorize address if forwarding
     if (service->forward_address) {
         if (dst.type == ziti_address_hostname) {
-            if (!allowed_hostname_match(ip_or_hn, &service->addr_u.allowed_hostnames)) {
+            if (!allowed_hostname_match(ip_or_hn, &service->addr_u.allowed_names)) {
                 snprintf(err, err_sz, "requested address '%s' is not in allowedAddresses",
                          app_data->dst_hostname);
                 return NULL;
@@ -621,6 +698,327 @@ static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *serv
 
 static void on_hosted_client_connect_resolved(uv_getaddrinfo_t* req, int status, struct addrinfo* res);
 
+static const char *addr_str(const struct sockaddr *addr, char *buf, size_t len) {
+    char ip[INET6_ADDRSTRLEN] = "?";
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) addr;
+        uv_ip6_name(in6, ip, sizeof(ip));
+        snprintf(buf, len, "[%s]:%d", ip, ntohs(in6->sin6_port));
+    } else {
+        const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+        uv_ip4_name(in, ip, sizeof(ip));
+        snprintf(buf, len, "%s:%d", ip, ntohs(in->sin_port));
+    }
+    return buf;
+}
+
+static struct hosted_addr_stats_s *get_addr_stats(struct hosted_service_ctx_s *service, const char *addr, bool create) {
+    struct hosted_addr_stats_s *stats = model_map_get(&service->addr_stats, addr);
+    if (stats || !create) {
+        return stats;
+    }
+
+    if (model_map_size(&service->addr_stats) >= HOSTED_ADDR_STATS_MAX) {
+        // forget the address that was used longest ago
+        char oldest[64] = "";
+        uint64_t oldest_used = UINT64_MAX;
+        const char *k;
+        struct hosted_addr_stats_s *st;
+        MODEL_MAP_FOREACH(k, st, &service->addr_stats) {
+            if (st->last_used < oldest_used) {
+                oldest_used = st->last_used;
+                snprintf(oldest, sizeof(oldest), "%s", k);
+            }
+        }
+        free(model_map_remove(&service->addr_stats, oldest));
+    }
+    stats = calloc(1, sizeof(struct hosted_addr_stats_s));
+    model_map_set(&service->addr_stats, addr, stats);
+    return stats;
+}
+
+static void record_connect(struct hosted_service_ctx_s *service, const struct sockaddr *addr, int status, uint64_t elapsed) {
+    char key[64];
+    addr_str(addr, key, sizeof(key));
+    struct hosted_addr_stats_s *stats = get_addr_stats(service, key, true);
+    uint64_t now = uv_now(service->loop);
+    stats->attempts++;
+    stats->last_used = now;
+    if (status == 0) {
+        stats->last_success = now;
+        bool first = stats->attempts - stats->failures == 1;
+        stats->connect_ms = first ? elapsed : (stats->connect_ms * 7 + elapsed) / 8;
+    } else {
+        stats->failures++;
+        stats->last_failure = now;
+    }
+    ZITI_LOG(DEBUG, "hosted_service[%s] server[%s] connect %s after %lums: attempts[%lu] failures[%lu] connect_ms[%lu]",
+             service->service_name, key, status == 0 ? "succeeded" : uv_strerror(status), (unsigned long) elapsed,
+             (unsigned long) stats->attempts, (unsigned long) stats->failures, (unsigned long) stats->connect_ms);
+}
+
+/**
+ * RFC 8305 ordering: address families alternate, starting with the resolver's first choice.
+ * addresses whose last connect failed recently are tried last.
+ */
+static int order_addrs(struct hosted_service_ctx_s *service, const struct hosted_resolved_s *r,
+                       struct sockaddr_storage *out) {
+    uint64_t now = uv_now(service->loop);
+    int healthy[HOSTED_CONNECT_ADDRS_MAX], failed[HOSTED_CONNECT_ADDRS_MAX];
+    int n_healthy = 0, n_failed = 0;
+    for (int i = 0; i < r->count; i++) {
+        char key[64];
+        addr_str((const struct sockaddr *) &r->addrs[i], key, sizeof(key));
+        const struct hosted_addr_stats_s *stats = get_addr_stats(service, key, false);
+        if (stats && stats->last_failure > stats->last_success && now - stats->last_failure < HOSTED_ADDR_PENALTY) {
+            failed[n_failed++] = i;
+        } else {
+            healthy[n_healthy++] = i;
+        }
+    }
+
+    int n = 0;
+    bool used[HOSTED_CONNECT_ADDRS_MAX] = { false };
+    int family = n_healthy > 0 ? r->addrs[healthy[0]].ss_family : AF_UNSPEC;
+    while (n < n_healthy) {
+        int pick = -1;
+        for (int i = 0; i < n_healthy && pick < 0; i++) {
+            if (!used[i] && r->addrs[healthy[i]].ss_family == family) pick = i;
+        }
+        for (int i = 0; i < n_healthy && pick < 0; i++) {
+            if (!used[i]) pick = i;
+        }
+        used[pick] = true;
+        out[n++] = r->addrs[healthy[pick]];
+        family = family == AF_INET6 ? AF_INET : AF_INET6;
+    }
+    for (int i = 0; i < n_failed; i++) {
+        out[n++] = r->addrs[failed[i]];
+    }
+    return n;
+}
+
+static const struct hosted_resolved_s *lookup_resolved(struct hosted_service_ctx_s *service, const char *protocol,
+                                                       const char *host, const char *port) {
+    char key[320];
+    snprintf(key, sizeof(key), "%s:%s:%s", protocol, host, port);
+    struct hosted_resolved_s *r = model_map_get(&service->resolved, key);
+    if (r && r->expires <= uv_now(service->loop)) {
+        model_map_remove(&service->resolved, key);
+        free(r);
+        r = NULL;
+    }
+    return r;
+}
+
+/** keep the addresses in `res` for HOSTED_RESOLVE_TTL. returns NULL if there are none that can be used */
+static const struct hosted_resolved_s *store_resolved(struct hosted_service_ctx_s *service, const char *protocol,
+                                                      const char *host, const char *port, const struct addrinfo *res) {
+    struct hosted_resolved_s *r = calloc(1, sizeof(struct hosted_resolved_s));
+    for (; res != NULL && r->count < HOSTED_CONNECT_ADDRS_MAX; res = res->ai_next) {
+        if ((res->ai_family == AF_INET || res->ai_family == AF_INET6) && res->ai_addrlen <= sizeof(r->addrs[0])) {
+            memcpy(&r->addrs[r->count++], res->ai_addr, res->ai_addrlen);
+        }
+    }
+    if (r->count == 0) {
+        free(r);
+        return NULL;
+    }
+
+    uint64_t now = uv_now(service->loop);
+    if (model_map_size(&service->resolved) >= HOSTED_RESOLVE_CACHE_MAX) {
+        model_map_iter it = model_map_iterator(&service->resolved);
+        while (it != NULL) {
+            struct hosted_resolved_s *old = model_map_it_value(it);
+            if (old->expires <= now) {
+                it = model_map_it_remove(it);
+                free(old);
+            } else {
+                it = model_map_it_next(it);
+            }
+        }
+        if (model_map_size(&service->resolved) >= HOSTED_RESOLVE_CACHE_MAX) {
+            model_map_clear(&service->resolved, free);
+        }
+    }
+
+    char key[320];
+    snprintf(key, sizeof(key), "%s:%s:%s", protocol, host, port);
+    r->expires = now + HOSTED_RESOLVE_TTL;
+    free(model_map_set(&service->resolved, key, r));
+    return r;
+}
+
+static void next_connect_attempt(struct hosted_connect_s *race);
+
+static void free_connect_attempt(uv_handle_t *h) {
+    free(h);
+}
+
+static void free_connect_race(uv_handle_t *h) {
+    free(h->data);
+}
+
+static void close_connect_attempt(struct hosted_connect_attempt_s *a) {
+    LIST_REMOVE(a, link);
+    uv_close((uv_handle_t *) &a->tcp, free_connect_attempt);
+}
+
+/** stop racing. attempts that are still running are abandoned */
+static void end_connect_race(struct hosted_connect_s *race) {
+    while (!LIST_EMPTY(&race->attempts)) {
+        close_connect_attempt(LIST_FIRST(&race->attempts));
+    }
+    race->io->connect = NULL;
+    uv_close((uv_handle_t *) &race->delay, free_connect_race);
+}
+
+static void on_connect_attempt_delay(uv_timer_t *t) {
+    next_connect_attempt(t->data);
+}
+
+static void on_connect_attempt(uv_connect_t *req, int status) {
+    if (status == UV_ECANCELED) {
+        return; // abandoned by end_connect_race
+    }
+
+    struct hosted_connect_attempt_s *a = req->data;
+    struct hosted_connect_s *race = a->race;
+    hosted_io_context io = race->io;
+    const struct sockaddr *addr = (const struct sockaddr *) &race->addrs[a->idx];
+    record_connect(io->service, addr, status, uv_now(io->service->loop) - a->started);
+
+    if (status < 0) {
+        char key[64];
+        ZITI_LOG(WARN, "hosted_service[%s], client[%s]: connect to %s failed: %s", io->service->service_name,
+                 io->client_identity, addr_str(addr, key, sizeof(key)), uv_strerror(status));
+        close_connect_attempt(a);
+        // no need to wait for the delay, try the next address right away
+        uv_timer_stop(&race->delay);
+        next_connect_attempt(race);
+        return;
+    }
+
+    char key[64];
+    snprintf(io->resolved_dst, sizeof(io->resolved_dst), "%s:%s",
+             get_protocol_str(IPPROTO_TCP), addr_str(addr, key, sizeof(key)));
+
+    LIST_REMOVE(a, link);
+    end_connect_race(race);
+    a->tcp.data = io;
+    io->connected = &a->tcp;
+
+    if (io->client == NULL) {
+        ZITI_LOG(ERROR, "client closed before server connection was established");
+        hosted_server_close(io);
+        return;
+    }
+    complete_hosted_tcp_connection(io);
+}
+
+static void next_connect_attempt(struct hosted_connect_s *race) {
+    hosted_io_context io = race->io;
+    uv_loop_t *loop = io->service->loop;
+    while (race->next < race->count) {
+        struct hosted_connect_attempt_s *a = calloc(1, sizeof(struct hosted_connect_attempt_s));
+        a->race = race;
+        a->idx = race->next++;
+        a->started = uv_now(loop);
+        a->req.data = a;
+        const struct sockaddr *addr = (const struct sockaddr *) &race->addrs[a->idx];
+
+        int uv_err = uv_tcp_init(loop, &a->tcp);
+        if (uv_err != 0) {
+            ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: failed to initialize tcp handle: %s",
+                     io->service->service_name, io->client_identity, uv_strerror(uv_err));
+            free(a);
+            break;
+        }
+        a->tcp.data = a;
+        uv_err = uv_tcp_connect(&a->req, &a->tcp, addr, on_connect_attempt);
+        if (uv_err == 0) {
+            LIST_INSERT_HEAD(&race->attempts, a, link);
+            uv_timer_start(&race->delay, on_connect_attempt_delay, HOSTED_CONNECT_ATTEMPT_DELAY, 0);
+            return;
+        }
+
+        char key[64];
+        ZITI_LOG(WARN, "hosted_service[%s], client[%s]: uv_tcp_connect(%s) failed: %s", io->service->service_name,
+                 io->client_identity, addr_str(addr, key, sizeof(key)), uv_strerror(uv_err));
+        record_connect(io->service, addr, uv_err, 0);
+        uv_close((uv_handle_t *) &a->tcp, free_connect_attempt);
+    }
+
+    if (LIST_EMPTY(&race->attempts)) {
+        ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: failed to connect to %s:%s:%s (%d addresses)",
+                 io->service->service_name, io->client_identity, io->computed_dst_protocol,
+                 io->computed_dst_ip_or_hn, io->computed_dst_port, race->count);
+        end_connect_race(race);
+        hosted_server_close(io);
+    }
+}
+
+/** connect to the best of the resolved addresses, racing tcp connections to all of them */
+static void connect_resolved(hosted_io_context io, const struct hosted_resolved_s *resolved) {
+    struct hosted_service_ctx_s *service = io->service;
+    struct sockaddr_storage addrs[HOSTED_CONNECT_ADDRS_MAX];
+    int count = order_addrs(service, resolved, addrs);
+    int protocol = get_protocol_id(io->computed_dst_protocol);
+    bool bound = io->app_data && io->app_data->source_addr && io->app_data->source_addr[0] != '\0';
+
+    if (protocol == IPPROTO_TCP && !bound) {
+        struct hosted_connect_s *race = calloc(1, sizeof(struct hosted_connect_s));
+        race->io = io;
+        race->count = count;
+        memcpy(race->addrs, addrs, count * sizeof(addrs[0]));
+        LIST_INIT(&race->attempts);
+        uv_timer_init(service->loop, &race->delay);
+        race->delay.data = race;
+        io->connect = race;
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s:%s:%s (%d addresses)",
+                 service->service_name, io->client_identity, io->computed_dst_protocol, io->computed_dst_ip_or_hn,
+                 io->computed_dst_port, count);
+        next_connect_attempt(race);
+        return;
+    }
+
+    // a bound source address decides the address family, and udp has no handshake to race
+    const struct sockaddr *addr = (const struct sockaddr *) &addrs[0];
+    char key[64];
+    snprintf(io->resolved_dst, sizeof(io->resolved_dst), "%s:%s",
+             get_protocol_str(protocol), addr_str(addr, key, sizeof(key)));
+
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s",
+             service->service_name, io->client_identity, io->resolved_dst);
+
+    int uv_err;
+    switch (protocol) {
+        case IPPROTO_TCP:
+            {
+                uv_connect_t *c = malloc(sizeof(uv_connect_t));
+                uv_err = uv_tcp_connect(c, &io->server.tcp, addr, on_hosted_tcp_server_connect_complete);
+                if (uv_err != 0) {
+                    ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_tcp_connect failed: %s",
+                             service->service_name, io->client_identity, uv_strerror(uv_err));
+                    hosted_server_close(io);
+                    free(c);
+                }
+            }
+            break;
+        case IPPROTO_UDP:
+            uv_err = uv_udp_connect(&io->server.udp, addr);
+            if (uv_err != 0) {
+                ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_udp_connect failed: %s",
+                         service->service_name, io->client_identity, uv_strerror(uv_err));
+                hosted_server_close(io);
+            } else if (ziti_accept(io->client, on_hosted_client_connect_complete, NULL) != ZITI_OK) {
+                ZITI_LOG(ERROR, "ziti_accept failed");
+                hosted_server_close(io);
+            }
+            break;
+    }
+}
+
 /** called by ziti sdk when a ziti endpoint (client) initiates connection to a hosted service
  * - compute dial address (from appdata if forwarding, or from dial address in config)
  * - if forwarding, validate address is allowed
@@ -659,7 +1057,7 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
     }
 
     if (app_data != NULL && app_data->conn_type == TunnelConnectionTypes.resolver) {
-        accept_resolver_conn(clt, &service_ctx->addr_u.allowed_hostnames);
+        accept_resolver_conn(clt, service_ctx->loop, &service_ctx->addr_u.allowed_hostnames, app_data->dns_format);
         free_tunneler_app_data_ptr(app_data);
         return;
     }
@@ -727,6 +1125,12 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
         return;
     }
 
+    const struct hosted_resolved_s *resolved = lookup_resolved(service_ctx, protocol, ip_or_hn, port);
+    if (resolved) {
+        connect_resolved(io, resolved);
+        return;
+    }
+
     uv_getaddrinfo_t *ai_req = calloc(1, sizeof(uv_getaddrinfo_t));
     ai_req->data = io;
     int s = uv_getaddrinfo(service_ctx->loop, ai_req, on_hosted_client_connect_resolved, ip_or_hn, port, &hints);
@@ -758,54 +1162,19 @@ static void on_hosted_client_connect_resolved(uv_getaddrinfo_t* ai_req, int stat
         return;
     }
 
-    if (res->ai_next != NULL) {
-        ZITI_LOG(DEBUG, "hosted_service[%s], client[%s]: getaddrinfo(%s:%s:%s) returned multiple results; using first",
+    const struct hosted_resolved_s *resolved = store_resolved(io->service, io->computed_dst_protocol,
+                                                              io->computed_dst_ip_or_hn, io->computed_dst_port, res);
+    uv_freeaddrinfo(res);
+    free(ai_req);
+
+    if (resolved == NULL) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s] getaddrinfo(%s:%s:%s) returned no usable addresses",
                  io->service->service_name, io->client_identity, io->computed_dst_protocol,
                  io->computed_dst_ip_or_hn, io->computed_dst_port);
+        hosted_server_close(io);
+        return;
     }
-
-    uv_getnameinfo_t ni_req = {0};
-    int uv_err = uv_getnameinfo(io->service->loop, &ni_req, NULL, res->ai_addr, NI_NUMERICHOST | NI_NUMERICSERV);
-    if (uv_err == 0) {
-        snprintf(io->resolved_dst, sizeof(io->resolved_dst), "%s:%s:%s",
-                 get_protocol_str(res->ai_protocol), ni_req.host, ni_req.service);
-    } else {
-        ZITI_LOG(WARN, "hosted_service[%s] client[%s] getnameinfo failed: %s", io->service->service_name,
-                 io->client_identity, uv_strerror(uv_err));
-        strncpy(io->resolved_dst, "<unknown>", sizeof(io->resolved_dst));
-    }
-
-    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s",
-             io->service->service_name, io->client_identity, io->resolved_dst);
-
-    switch (res->ai_protocol) {
-        case IPPROTO_TCP:
-            {
-                uv_connect_t *c = malloc(sizeof(uv_connect_t));
-                uv_err = uv_tcp_connect(c, &io->server.tcp, res->ai_addr, on_hosted_tcp_server_connect_complete);
-                if (uv_err != 0) {
-                    ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_tcp_connect failed: %s",
-                             io->service->service_name, io->client_identity, uv_strerror(uv_err));
-                    hosted_server_close(io);
-                    free(c);
-                }
-            }
-            break;
-        case IPPROTO_UDP:
-            uv_err = uv_udp_connect(&io->server.udp, res->ai_addr);
-            if (uv_err != 0) {
-                ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_udp_connect failed: %s",
-                         io->service->service_name, io->client_identity, uv_strerror(uv_err));
-                hosted_server_close(io);
-            } else if (ziti_accept(io->client, on_hosted_client_connect_complete, NULL) != ZITI_OK) {
-                ZITI_LOG(ERROR, "ziti_accept failed");
-                hosted_server_close(io);
-            }
-            break;
-    }
-
-    uv_freeaddrinfo(res);
-    free(ai_req);
+    connect_resolved(io, resolved);
 }
 
 /** called by ziti SDK when a hosted service listener is ready */
@@ -916,6 +1285,7 @@ host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service
             if (host_v1_cfg->forward_address) {
                 STAILQ_INIT(&host_ctx->addr_u.allowed_addresses);
                 LIST_INIT(&host_ctx->addr_u.allowed_hostnames);
+                dns_trie_init(&host_ctx->addr_u.allowed_names);
 
                 ziti_address_array allowed_addrs = host_v1_cfg->allowed_addresses;
                 for (i = 0; allowed_addrs != NULL && allowed_addrs[i] != NULL; i++) {
@@ -925,6 +1295,7 @@ host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service
                         struct allowed_hostname_s *dns_entry = calloc(1, sizeof(struct allowed_hostname_s));
                         dns_entry->domain_name = strdup(allowed_addrs[i]->addr.hostname);
                         LIST_INSERT_HEAD(&host_ctx->addr_u.allowed_hostnames, dns_entry, _next);
+                        add_allowed_hostname(&host_ctx->addr_u.allowed_names, dns_entry);
                     } else if (allowed_addrs[i]->type == ziti_address_cidr) {
                         address_t *a = calloc(1, sizeof(address_t));
                         ziti_address_print(a->str, sizeof(a->str), allowed_addrs[i]);
@@ -1061,6 +1432,13 @@ host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service
 
 static void on_uv_close(uv_handle_t *handle) {
     struct hosted_io_ctx_s *io_ctx = handle->data;
+    if (io_ctx && io_ctx->connected && handle == (uv_handle_t *) io_ctx->connected) {
+        // the io's own handle was never connected, and is closed last
+        io_ctx->connected = NULL;
+        free(handle);
+        uv_close((uv_handle_t *) &io_ctx->server, on_uv_close);
+        return;
+    }
     hosted_io_context_free(io_ctx);
 }
 
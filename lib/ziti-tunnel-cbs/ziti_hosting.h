@@ -22,6 +22,7 @@
 #define ZITI_TUNNEL_SDK_C_ZITI_HOSTING_H
 #include <ziti/ziti_tunnel.h>
 #include "tlsuv/http.h"
+#include "dns_trie.h"
 // allowed address is one of:
 // - ip subnet address
 // - DNS name or wildcard
@@ -50,6 +51,7 @@ struct hosted_service_ctx_s {
         struct {
             address_list_t allowed_addresses;
             allowed_hostnames_t allowed_hostnames;
+            dns_trie_t allowed_names; // allowed_hostnames, for matching
             ziti_address_translation_array translations;
         };
         const char *address;
@@ -62,6 +64,9 @@ struct hosted_service_ctx_s {
     address_list_t    allowed_source_addresses;
     const char *proxy_addr;
     tlsuv_connector_t *proxy_connector;
+
+    model_map resolved;   // "proto:host:port" -> struct hosted_resolved_s
+    model_map addr_stats; // "ip:port" -> struct hosted_addr_stats_s, connect results per server address
 };
 
 struct tunneled_service_s {
@@ -69,6 +74,6 @@ struct tunneled_service_s {
     host_ctx_t      *host;
 };
 
-void accept_resolver_conn(ziti_connection conn, allowed_hostnames_t *allowed);
+void accept_resolver_conn(ziti_connection conn, uv_loop_t *loop, allowed_hostnames_t *allowed, const char *dns_format);
 
 #endif //ZITI_TUNNEL_SDK_C_ZITI_HOSTING_H
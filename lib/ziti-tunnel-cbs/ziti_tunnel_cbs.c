@@ -30,6 +30,7 @@
 #include "ziti/ziti_tunnel_cbs.h"
 #include "ziti_hosting.h"
 #include "ziti_instance.h"
+#include "pending_limit.h"
 #include "lwip/err.h"
 
 typedef int (*cfg_parse_fn)(void *, const char *, size_t);
@@ -294,7 +295,8 @@ void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
     io->ziti_io = ziti_io_ctx;
     ziti_io_ctx->ziti_eof = false;
     ziti_io_ctx->tnlr_eof = false;
-    ziti_io_ctx->pending_wbytes = 0;
+    pending_limit_init(ziti_io_ctx);
+    ziti_tunneler_set_rcv_window(io->tnlr_io, MAX_PENDING_BYTES);
 
     ziti_context ziti_ctx = zi_ctx->ztx;
     if (ziti_conn_init(ziti_ctx, &ziti_io_ctx->ziti_conn, io) != ZITI_OK) {
@@ -361,6 +363,64 @@ void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
     return ziti_io_ctx;
 }
 
+static pending_budget_t pending_budget = { .total = PENDING_BYTES_BUDGET };
+
+/* connections whose threshold has grown. idle ones are swept every PENDING_IDLE_RESET */
+static model_map grown_conns;
+static uv_timer_t grown_sweep_timer;
+static bool grown_sweep_ready;
+
+static void on_grown_sweep(uv_timer_t *t) {
+    uint64_t now = uv_hrtime();
+    model_map_iter it = model_map_iterator(&grown_conns);
+    while (it != NULL) {
+        ziti_io_context *zio = model_map_it_value(it);
+        if (pending_limit_reclaim_idle(zio, &pending_budget, now)) {
+            ZITI_LOG(VERBOSE, "ziti_conn[%p] is idle, pending limit reset to %d", zio->ziti_conn, MAX_PENDING_BYTES);
+            struct io_ctx_s *io = ziti_conn_data(zio->ziti_conn);
+            if (io != NULL) {
+                ziti_tunneler_set_rcv_window(io->tnlr_io, zio->pending_limit);
+            }
+        }
+        if (zio->pending_limit == MAX_PENDING_BYTES) {
+            it = model_map_it_remove(it);
+        } else {
+            it = model_map_it_next(it);
+        }
+    }
+    if (model_map_size(&grown_conns) == 0) {
+        uv_timer_stop(t);
+    }
+}
+
+/** resize the client's receive window to a changed threshold, and keep track of connections that have grown */
+static void on_pending_limit_changed(struct io_ctx_s *io, ziti_io_context *zio) {
+    ZITI_LOG(VERBOSE, "ziti_conn[%p] pending limit %" PRIu64 " (budget used %" PRIu64 ")",
+             zio->ziti_conn, zio->pending_limit, pending_budget.used);
+    ziti_tunneler_set_rcv_window(io->tnlr_io, zio->pending_limit);
+    if (zio->pending_limit == MAX_PENDING_BYTES) {
+        model_map_remove_key(&grown_conns, &zio, sizeof(zio));
+        return;
+    }
+
+    model_map_set_key(&grown_conns, &zio, sizeof(zio), zio);
+    if (!grown_sweep_ready) {
+        uv_timer_init(ziti_tunneler_io_loop(io->tnlr_io), &grown_sweep_timer);
+        uv_unref((uv_handle_t *) &grown_sweep_timer);
+        grown_sweep_ready = true;
+    }
+    if (!uv_is_active((const uv_handle_t *) &grown_sweep_timer)) {
+        uint64_t interval = PENDING_IDLE_RESET / 1000000; // ms
+        uv_timer_start(&grown_sweep_timer, on_grown_sweep, interval, interval);
+    }
+}
+
+static void on_pending_written(struct io_ctx_s *io, ziti_io_context *zio, size_t len) {
+    if (pending_limit_on_written(zio, &pending_budget, len, uv_hrtime())) {
+        on_pending_limit_changed(io, zio);
+    }
+}
+
 /** called by ziti SDK when data transfer initiated by ziti_write completes */
 static void on_ziti_write(ziti_connection ziti_conn, ssize_t len, void *ctx) {
     struct io_ctx_s *io = ziti_conn_data(ziti_conn);
@@ -371,7 +431,7 @@ static void on_ziti_write(ziti_connection ziti_conn, ssize_t len, void *ctx) {
             ZITI_LOG(ERROR, "ziti_write(ziti_conn[%p]) failed: %s", ziti_conn, ziti_errorstr(len));
             ziti_close(ziti_conn, ziti_conn_close_cb);
         } else {
-            zio->pending_wbytes -= len;
+            on_pending_written(io, zio, len);
         }
     }
 
@@ -384,18 +444,93 @@ static void on_ziti_write(ziti_connection ziti_conn, ssize_t len, void *ctx) {
 /** called from tunneler SDK when intercepted client sends data */
 ssize_t ziti_sdk_c_write(const void *ziti_io_ctx, void *write_ctx, const void *data, size_t len) {
     struct ziti_io_ctx_s *_ziti_io_ctx = (struct ziti_io_ctx_s *)ziti_io_ctx;
-    if (_ziti_io_ctx->pending_wbytes + len < MAX_PENDING_BYTES) {
+    if (_ziti_io_ctx->pending_wbytes + len < _ziti_io_ctx->pending_limit) {
         int zs = ziti_write(_ziti_io_ctx->ziti_conn, (void *) data, len, on_ziti_write, write_ctx);
         if (zs == ZITI_OK) {
-            _ziti_io_ctx->pending_wbytes += len;
+            pending_limit_on_write(_ziti_io_ctx, len, uv_hrtime());
         }
         return zs;
     }
 
     ZITI_LOG(VERBOSE, "applying backpressure %" PRIu64 " pending bytes", _ziti_io_ctx->pending_wbytes);
+    _ziti_io_ctx->limited = true;
     return ERR_WOULDBLOCK;
 }
 
+/** a vectored write that acks the tunneler once all of its messages are written */
+struct ziti_writev_req_s {
+    void *write_ctx;
+    unsigned int pending;
+    bool failed;
+};
+
+static void on_ziti_writev(ziti_connection ziti_conn, ssize_t len, void *ctx) {
+    struct ziti_writev_req_s *req = ctx;
+    struct io_ctx_s *io = ziti_conn_data(ziti_conn);
+    if (io != NULL) {
+        ziti_io_context *zio = io->ziti_io;
+
+        if (len < 0) {
+            if (!req->failed) {
+                ZITI_LOG(ERROR, "ziti_write(ziti_conn[%p]) failed: %s", ziti_conn, ziti_errorstr(len));
+                ziti_close(ziti_conn, ziti_conn_close_cb);
+            }
+            req->failed = true;
+        } else {
+            on_pending_written(io, zio, len);
+        }
+    }
+
+    if (--req->pending == 0) {
+        ziti_tunneler_ack(req->write_ctx);
+        free(req);
+    }
+}
+
+/**
+ * the SDK has no vectored write, so each buffer (one pbuf of the client's segment) becomes a ziti message of its
+ * own. nothing is copied here; the SDK still copies each message once as it encrypts it into its own buffer.
+ */
+ssize_t ziti_sdk_c_writev(const void *ziti_io_ctx, void *write_ctx, const uv_buf_t *bufs, unsigned int nbufs) {
+    struct ziti_io_ctx_s *_ziti_io_ctx = (struct ziti_io_ctx_s *)ziti_io_ctx;
+    if (nbufs == 0 || nbufs > ZITI_SDK_MAX_WRITEV_BUFS) {
+        return ZITI_INVALID_STATE;
+    }
+
+    size_t len = 0;
+    for (unsigned int i = 0; i < nbufs; i++) {
+        len += bufs[i].len;
+    }
+    if (_ziti_io_ctx->pending_wbytes + len >= _ziti_io_ctx->pending_limit) {
+        ZITI_LOG(VERBOSE, "applying backpressure %" PRIu64 " pending bytes", _ziti_io_ctx->pending_wbytes);
+        _ziti_io_ctx->limited = true;
+        return ERR_WOULDBLOCK;
+    }
+
+    struct ziti_writev_req_s *req = malloc(sizeof(struct ziti_writev_req_s));
+    req->write_ctx = write_ctx;
+    req->failed = false;
+
+    req->pending = nbufs;
+    for (unsigned int m = 0; m < nbufs; m++) {
+        int zs = ziti_write(_ziti_io_ctx->ziti_conn, (uint8_t *) bufs[m].base, bufs[m].len, on_ziti_writev, req);
+        if (zs != ZITI_OK) {
+            req->pending -= nbufs - m;
+            if (req->pending == 0) {
+                free(req);
+                return zs;
+            }
+            // messages that were already queued ack the tunneler when they complete
+            ZITI_LOG(ERROR, "ziti_write(ziti_conn[%p]) failed: %s", _ziti_io_ctx->ziti_conn, ziti_errorstr(zs));
+            req->failed = true;
+            ziti_close(_ziti_io_ctx->ziti_conn, ziti_conn_close_cb);
+            break;
+        }
+        pending_limit_on_write(_ziti_io_ctx, bufs[m].len, uv_hrtime());
+    }
+    return ZITI_OK;
+}
+
 ziti_intercept_t *new_ziti_intercept(ziti_context ztx, ziti_service *service, ziti_intercept_t *curr_i) {
     ziti_intercept_t *zi_ctx = calloc(1, sizeof(ziti_intercept_t));
     zi_ctx->ztx = ztx;
@@ -464,9 +599,18 @@ static const ziti_address  *intercept_addr_from_cfg_addr(const ziti_address *cfg
     return intercept_addr_p;
 }
 
+/** hostnames also get an address from the IPv6 pool, if one is configured. call after intercept_addr_from_cfg_addr */
+static const ziti_address *intercept_addr6_from_cfg_addr(const ziti_address *cfg_addr) {
+    static ziti_address dns_addr6;
+    const ip_addr_t *intercept_ip6 = ziti_dns_hostname_ip6(cfg_addr);
+    if (intercept_ip6 == NULL || !ziti_address_from_ip_addr(&dns_addr6, intercept_ip6)) {
+        return NULL;
+    }
+    return &dns_addr6;
+}
+
 intercept_ctx_t *new_intercept_ctx(tunneler_context tnlr_ctx, ziti_intercept_t *zi_ctx) {
     intercept_ctx_t *i_ctx = intercept_ctx_new(tnlr_ctx, zi_ctx->service_name, zi_ctx);
-    intercept_ctx_set_match_addr(i_ctx, intercept_match_addr);
 
     const ziti_address *za;
     switch (zi_ctx->cfg_desc->cfgtype) {
@@ -475,6 +619,7 @@ intercept_ctx_t *new_intercept_ctx(tunneler_context tnlr_ctx, ziti_intercept_t *
             intercept_ctx_add_protocol(i_ctx, "tcp");
             za = intercept_addr_from_cfg_addr(&zi_ctx->cfg.client_v1.hostname, zi_ctx);
             intercept_ctx_add_address(i_ctx, za);
+            intercept_ctx_add_address(i_ctx, intercept_addr6_from_cfg_addr(&zi_ctx->cfg.client_v1.hostname));
             intercept_ctx_add_port_range(i_ctx, zi_ctx->cfg.client_v1.port, zi_ctx->cfg.client_v1.port);
             break;
         case INTERCEPT_CFG_V1:
@@ -488,10 +633,16 @@ intercept_ctx_t *new_intercept_ctx(tunneler_context tnlr_ctx, ziti_intercept_t *
             MODEL_LIST_FOREACH(addr, config->addresses) {
                 za = intercept_addr_from_cfg_addr(addr, zi_ctx);
                 intercept_ctx_add_address(i_ctx, za);
+                intercept_ctx_add_address(i_ctx, intercept_addr6_from_cfg_addr(addr));
+                // only wildcard domains need the predicate. the tunneler scans every intercept that has one
+                if (addr->type == ziti_address_hostname && addr->addr.hostname[0] == '*') {
+                    intercept_ctx_set_match_addr(i_ctx, intercept_match_addr);
+                }
             }
             MODEL_LIST_FOREACH(addr, config->allowed_source_addresses) {
                 za = intercept_addr_from_cfg_addr(addr, zi_ctx);
                 intercept_ctx_add_allowed_source_address(i_ctx, za);
+                intercept_ctx_add_allowed_source_address(i_ctx, intercept_addr6_from_cfg_addr(addr));
             }
             ziti_port_range *pr;
             MODEL_LIST_FOREACH(pr, config->port_ranges) {
@@ -606,6 +757,9 @@ static void ziti_conn_close_cb(ziti_connection zc) {
         return;
     }
     if (io->ziti_io) {
+        ziti_io_context *zio = io->ziti_io;
+        pending_limit_reset(zio, &pending_budget);
+        model_map_remove_key(&grown_conns, &zio, sizeof(zio));
         free(io->ziti_io);
         io->ziti_io = NULL;
     }
@@ -615,7 +769,8 @@ static void ziti_conn_close_cb(ziti_connection zc) {
     ZITI_LOG(VERBOSE, "nulled data for ziti_conn[%p]", zc);
 }
 
-#define RESOLVE_APP_DATA "{\"connType\":\"resolver\"}"
+// hosts that know the wire format (DNS_WIRE_FORMAT) say so once the connection is accepted. older hosts ignore dns_format
+#define RESOLVE_APP_DATA "{\"connType\":\"resolver\",\"dns_format\":\"wire\"}"
 ziti_connection intercept_resolve_connect(ziti_intercept_t *intercept, void *ctx, ziti_conn_cb conn_cb, ziti_data_cb data_cb) {
     ziti_connection conn;
     ziti_conn_init(intercept->ztx, &conn, ctx);
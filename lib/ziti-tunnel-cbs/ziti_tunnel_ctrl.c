@@ -24,6 +24,7 @@
 #include "ziti_instance.h"
 
 #include <tlsuv/http.h>
+#include <json-c/json_tokener.h>
 
 #include <string.h>
 #include <stdarg.h>
@@ -174,6 +175,13 @@ static void dump_to_file(dumper dump, void *dump_ctx, char* outputFile) {
     fclose(fp);
 }
 
+/** the tunneler's ip stats with the DNS cache stats added */
+static void get_ip_stats(tunnel_ip_stats *stats) {
+    ziti_tunnel_get_ip_stats(stats);
+    stats->dns_cache = calloc(1, sizeof(tunnel_dns_cache_stats));
+    ziti_dns_get_cache_stats(stats->dns_cache);
+}
+
 static void ip_dump(const tunnel_ip_stats *stats, dump_writer writer, void *writer_ctx) {
     int i;
 
@@ -197,6 +205,15 @@ static void ip_dump(const tunnel_ip_stats *stats, dump_writer writer, void *writ
                conns[i]->protocol, local_addr, remote_addr, conns[i]->state, conns[i]->service);
     }
 
+    const tunnel_dns_cache_stats *dns = stats->dns_cache;
+    if (dns != NULL) {
+        model_number lookups = dns->hits + dns->misses;
+        writer(writer_ctx, "\n=================\nDNS Cache:\n");
+        writer(writer_ctx, "%-12s%-12s%-12s%-12s%-12s%-12s\n", "Size", "Capacity", "Hits", "Misses", "Evictions", "Hit Ratio");
+        writer(writer_ctx, "%-12ld%-12ld%-12ld%-12ld%-12ld%.1f%%\n", dns->size, dns->capacity, dns->hits, dns->misses,
+               dns->evictions, lookups > 0 ? 100.0 * (double) dns->hits / (double) lookups : 0.0);
+    }
+
 }
 
 static void disconnect_identity(ziti_context ziti_ctx, void *tnlr_ctx) {
@@ -395,7 +412,7 @@ static int process_cmd(const tunnel_command *cmd, command_cb cb, void *ctx) {
                 break;
             }
             tunnel_ip_stats stats = {0};
-            ziti_tunnel_get_ip_stats(&stats);
+            get_ip_stats(&stats);
             result.data = tunnel_ip_stats_to_json(&stats, MODEL_JSON_COMPACT, NULL);
             bool success = true;
             if (dump.dump_path != NULL) {
@@ -1500,7 +1517,7 @@ static void on_sigdump(uv_signal_t *sig, int signum) {
 
     CHECK(cleanup, fprintf(dumpfile, "IP Dump starting: %s\n", time_str));
     tunnel_ip_stats stats = {0};
-    ziti_tunnel_get_ip_stats(&stats);
+    get_ip_stats(&stats);
     ip_dump(&stats, (dump_writer) fprintf, dumpfile);
     free_tunnel_ip_stats(&stats);
 
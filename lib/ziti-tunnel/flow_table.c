@@ -0,0 +1,269 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include "flow_table.h"
+
+#define FLOW_TABLE_MIN_BUCKETS 64
+
+static inline u32_t hash_mix(u32_t h, u32_t v) {
+    h ^= v;
+    h *= 0x9E3779B1u;
+    return h ^ (h >> 15);
+}
+
+static u32_t hash_addr(u32_t h, const ip_addr_t *addr) {
+#if LWIP_IPV6
+    if (IP_IS_V6(addr)) {
+        const ip6_addr_t *a6 = ip_2_ip6(addr);
+        for (int i = 0; i < 4; i++) {
+            h = hash_mix(h, a6->addr[i]);
+        }
+        return h;
+    }
+#endif
+    return hash_mix(h, ip4_addr_get_u32(ip_2_ip4(addr)));
+}
+
+static u32_t flow_hash(const ip_addr_t *src, u16_t src_port, const ip_addr_t *dst, u16_t dst_port) {
+    u32_t h = 0x811C9DC5u;
+    h = hash_addr(h, src);
+    h = hash_addr(h, dst);
+    h = hash_mix(h, ((u32_t) src_port << 16) | dst_port);
+    return h;
+}
+
+static inline int flow_matches(const flow_entry_t *e, u32_t hash, const ip_addr_t *src, u16_t src_port,
+                               const ip_addr_t *dst, u16_t dst_port) {
+    return e->hash == hash &&
+           e->src_port == src_port &&
+           e->dst_port == dst_port &&
+           ip_addr_cmp(&e->src, src) &&
+           ip_addr_cmp(&e->dst, dst);
+}
+
+static inline u32_t dst_hash(const ip_addr_t *dst) {
+    return hash_addr(0x811C9DC5u, dst);
+}
+
+static int dst_resize(flow_table_t *ft, size_t nbuckets) {
+    flow_dst_t **buckets = calloc(nbuckets, sizeof(flow_dst_t *));
+    if (buckets == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < ft->ndst_buckets; i++) {
+        flow_dst_t *d = ft->dst_buckets[i];
+        while (d != NULL) {
+            flow_dst_t *next = d->next;
+            size_t b = d->hash & (nbuckets - 1);
+            d->next = buckets[b];
+            buckets[b] = d;
+            d = next;
+        }
+    }
+    free(ft->dst_buckets);
+    ft->dst_buckets = buckets;
+    ft->ndst_buckets = nbuckets;
+    return 0;
+}
+
+/** count one more flow to `dst`. returns 0 on success */
+static int dst_ref(flow_table_t *ft, const ip_addr_t *dst) {
+    if (ft->ndst_buckets == 0 && dst_resize(ft, FLOW_TABLE_MIN_BUCKETS) != 0) {
+        return -1;
+    }
+
+    u32_t hash = dst_hash(dst);
+    for (flow_dst_t *d = ft->dst_buckets[hash & (ft->ndst_buckets - 1)]; d != NULL; d = d->next) {
+        if (d->hash == hash && ip_addr_cmp(&d->dst, dst)) {
+            d->flows++;
+            return 0;
+        }
+    }
+
+    if (ft->ndsts >= ft->ndst_buckets) {
+        dst_resize(ft, ft->ndst_buckets * 2);
+    }
+
+    flow_dst_t *d = calloc(1, sizeof(flow_dst_t));
+    if (d == NULL) {
+        return -1;
+    }
+    ip_addr_copy(d->dst, *dst);
+    d->hash = hash;
+    d->flows = 1;
+
+    size_t b = hash & (ft->ndst_buckets - 1);
+    d->next = ft->dst_buckets[b];
+    ft->dst_buckets[b] = d;
+    ft->ndsts++;
+    return 0;
+}
+
+static void dst_unref(flow_table_t *ft, const ip_addr_t *dst) {
+    u32_t hash = dst_hash(dst);
+    for (flow_dst_t **dp = &ft->dst_buckets[hash & (ft->ndst_buckets - 1)]; *dp != NULL; dp = &(*dp)->next) {
+        flow_dst_t *d = *dp;
+        if (d->hash == hash && ip_addr_cmp(&d->dst, dst)) {
+            if (--d->flows == 0) {
+                *dp = d->next;
+                ft->ndsts--;
+                free(d);
+            }
+            return;
+        }
+    }
+}
+
+static int flow_table_resize(flow_table_t *ft, size_t nbuckets) {
+    flow_entry_t **buckets = calloc(nbuckets, sizeof(flow_entry_t *));
+    if (buckets == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < ft->nbuckets; i++) {
+        flow_entry_t *e = ft->buckets[i];
+        while (e != NULL) {
+            flow_entry_t *next = e->next;
+            size_t b = e->hash & (nbuckets - 1);
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+    free(ft->buckets);
+    ft->buckets = buckets;
+    ft->nbuckets = nbuckets;
+    return 0;
+}
+
+int flow_table_put(flow_table_t *ft, const ip_addr_t *src, u16_t src_port,
+                   const ip_addr_t *dst, u16_t dst_port, void *pcb) {
+    if (ft->nbuckets == 0 && flow_table_resize(ft, FLOW_TABLE_MIN_BUCKETS) != 0) {
+        return -1;
+    }
+
+    u32_t hash = flow_hash(src, src_port, dst, dst_port);
+    for (flow_entry_t *e = ft->buckets[hash & (ft->nbuckets - 1)]; e != NULL; e = e->next) {
+        if (flow_matches(e, hash, src, src_port, dst, dst_port)) {
+            e->pcb = pcb;
+            return 0;
+        }
+    }
+
+    // keep the load factor at or below 1. a failed resize only costs longer chains.
+    if (ft->count >= ft->nbuckets) {
+        flow_table_resize(ft, ft->nbuckets * 2);
+    }
+
+    flow_entry_t *e = calloc(1, sizeof(flow_entry_t));
+    if (e == NULL || dst_ref(ft, dst) != 0) {
+        free(e);
+        return -1;
+    }
+    ip_addr_copy(e->src, *src);
+    ip_addr_copy(e->dst, *dst);
+    e->src_port = src_port;
+    e->dst_port = dst_port;
+    e->hash = hash;
+    e->pcb = pcb;
+
+    size_t b = hash & (ft->nbuckets - 1);
+    e->next = ft->buckets[b];
+    ft->buckets[b] = e;
+    ft->count++;
+    return 0;
+}
+
+void *flow_table_get(const flow_table_t *ft, const ip_addr_t *src, u16_t src_port,
+                     const ip_addr_t *dst, u16_t dst_port) {
+    if (ft->count == 0) {
+        return NULL;
+    }
+
+    u32_t hash = flow_hash(src, src_port, dst, dst_port);
+    for (flow_entry_t *e = ft->buckets[hash & (ft->nbuckets - 1)]; e != NULL; e = e->next) {
+        if (flow_matches(e, hash, src, src_port, dst, dst_port)) {
+            return e->pcb;
+        }
+    }
+    return NULL;
+}
+
+void flow_table_remove(flow_table_t *ft, const ip_addr_t *src, u16_t src_port,
+                       const ip_addr_t *dst, u16_t dst_port, const void *pcb) {
+    if (ft->count == 0) {
+        return;
+    }
+
+    u32_t hash = flow_hash(src, src_port, dst, dst_port);
+    for (flow_entry_t **ep = &ft->buckets[hash & (ft->nbuckets - 1)]; *ep != NULL; ep = &(*ep)->next) {
+        flow_entry_t *e = *ep;
+        if (flow_matches(e, hash, src, src_port, dst, dst_port)) {
+            // the flow may have been taken over by a newer pcb
+            if (e->pcb == pcb) {
+                *ep = e->next;
+                ft->count--;
+                dst_unref(ft, &e->dst);
+                free(e);
+            }
+            return;
+        }
+    }
+}
+
+size_t flow_table_dst_count(const flow_table_t *ft, const ip_addr_t *dst) {
+    if (ft->ndsts == 0) {
+        return 0;
+    }
+
+    u32_t hash = dst_hash(dst);
+    for (flow_dst_t *d = ft->dst_buckets[hash & (ft->ndst_buckets - 1)]; d != NULL; d = d->next) {
+        if (d->hash == hash && ip_addr_cmp(&d->dst, dst)) {
+            return d->flows;
+        }
+    }
+    return 0;
+}
+
+void flow_table_clear(flow_table_t *ft) {
+    for (size_t i = 0; i < ft->nbuckets; i++) {
+        flow_entry_t *e = ft->buckets[i];
+        while (e != NULL) {
+            flow_entry_t *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    free(ft->buckets);
+    ft->buckets = NULL;
+    ft->nbuckets = 0;
+    ft->count = 0;
+
+    for (size_t i = 0; i < ft->ndst_buckets; i++) {
+        flow_dst_t *d = ft->dst_buckets[i];
+        while (d != NULL) {
+            flow_dst_t *next = d->next;
+            free(d);
+            d = next;
+        }
+    }
+    free(ft->dst_buckets);
+    ft->dst_buckets = NULL;
+    ft->ndst_buckets = 0;
+    ft->ndsts = 0;
+}
@@ -0,0 +1,81 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_FLOW_TABLE_H
+#define ZITI_TUNNELER_SDK_FLOW_TABLE_H
+
+#include <stddef.h>
+#include "lwip/ip_addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * hash index of intercepted flows, keyed by (client addr, client port, intercepted addr, intercepted port).
+ * the protocol is implied by the table. values are pcbs owned by lwip; the table only borrows them.
+ */
+typedef struct flow_entry_s {
+    ip_addr_t src;
+    ip_addr_t dst;
+    u16_t src_port;
+    u16_t dst_port;
+    u32_t hash;
+    void *pcb;
+    struct flow_entry_s *next;
+} flow_entry_t;
+
+/** number of flows to one intercepted address */
+typedef struct flow_dst_s {
+    ip_addr_t dst;
+    u32_t hash;
+    size_t flows;
+    struct flow_dst_s *next;
+} flow_dst_t;
+
+typedef struct flow_table_s {
+    flow_entry_t **buckets;
+    size_t nbuckets;
+    size_t count;
+
+    flow_dst_t **dst_buckets;
+    size_t ndst_buckets;
+    size_t ndsts;
+} flow_table_t;
+
+/** index `pcb` by the given flow. an existing entry for the same flow is re-pointed at `pcb`. returns 0 on success */
+extern int flow_table_put(flow_table_t *ft, const ip_addr_t *src, u16_t src_port,
+                          const ip_addr_t *dst, u16_t dst_port, void *pcb);
+
+/** return the pcb that is indexed by the given flow, or NULL */
+extern void *flow_table_get(const flow_table_t *ft, const ip_addr_t *src, u16_t src_port,
+                            const ip_addr_t *dst, u16_t dst_port);
+
+/** remove the given flow if it is currently indexed to `pcb` */
+extern void flow_table_remove(flow_table_t *ft, const ip_addr_t *src, u16_t src_port,
+                              const ip_addr_t *dst, u16_t dst_port, const void *pcb);
+
+/** return the number of flows to `dst` */
+extern size_t flow_table_dst_count(const flow_table_t *ft, const ip_addr_t *dst);
+
+/** remove all entries and release the bucket array */
+extern void flow_table_clear(flow_table_t *ft);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_FLOW_TABLE_H
@@ -17,9 +17,13 @@
 #ifndef ZITI_TUNNELER_SDK_NETIF_DRIVER_H
 #define ZITI_TUNNELER_SDK_NETIF_DRIVER_H
 
+#include <stdbool.h>
 #include <sys/types.h>
 #include "uv.h"
 
+/* max number of buffers that are passed to netif_driver->writev for a single packet */
+#define NETIF_MAX_WRITEV_BUFS 16
+
 /* this struct is defined by the netif implementation */
 typedef struct netif_handle_s *netif_handle;
 
@@ -28,11 +32,17 @@ typedef void (*packet_cb)(const char *buf, ssize_t len, void *netif);
 
 typedef int (*netif_close_cb)(netif_handle dev);
 typedef ssize_t (*netif_read_cb)(netif_handle dev, void *buf, size_t buf_len);
+/* read one packet that is scattered across `nbufs` buffers, and set `csum_valid` if the device vouches for its
+ * transport checksum */
+typedef ssize_t (*netif_readv_cb)(netif_handle dev, const uv_buf_t *bufs, unsigned int nbufs, bool *csum_valid);
 typedef ssize_t (*netif_write_cb)(netif_handle dev, const void *buf, size_t len);
+/* write one packet that is scattered across `nbufs` buffers */
+typedef ssize_t (*netif_writev_cb)(netif_handle dev, const uv_buf_t *bufs, unsigned int nbufs);
 typedef int (*uv_poll_req_fn)(netif_handle dev, uv_loop_t *loop, uv_poll_t *tun_poll_req);
 typedef int (*setup_packet_cb)(netif_handle dev, uv_loop_t *loop, packet_cb cb, void *netif);
 typedef int (*add_route_cb)(netif_handle dev, const char *dest);
 typedef int (*delete_route_cb)(netif_handle dev, const char *dest);
+/* returns 0 if the route was excluded, or was queued and will be retried by the driver until it is */
 typedef int (*exclude_route_fn)(netif_handle dev, uv_loop_t *loop, const char *dest);
 typedef int (*commit_routes_fn)(netif_handle dev, uv_loop_t *loop);
 
@@ -41,7 +51,9 @@ typedef const char *(*name_fn)(netif_handle dev);
 typedef struct netif_driver_s {
     netif_handle handle;
     netif_read_cb read;
+    netif_readv_cb readv; // optional. used instead of read when set, so small packets don't pin large buffers
     netif_write_cb write;
+    netif_writev_cb writev; // optional. when set, outbound packets are queued and written without flattening
     netif_close_cb close;
     uv_poll_req_fn uv_poll_init;
     setup_packet_cb setup;
@@ -98,6 +98,11 @@ typedef STAILQ_HEAD(port_range_list_s, port_range_s) port_range_list_t;
 typedef void * (*ziti_sdk_dial_cb)(const void *app_intercept_ctx, io_ctx_t *io);
 typedef int (*ziti_sdk_close_cb)(void *ziti_io_ctx);
 typedef ssize_t (*ziti_sdk_write_cb)(const void *ziti_io_ctx, void *write_ctx, const void *data, size_t len);
+/** write several buffers as one unit. write_ctx is acked (ziti_tunneler_ack) once, after all of them are written */
+typedef ssize_t (*ziti_sdk_writev_cb)(const void *ziti_io_ctx, void *write_ctx, const uv_buf_t *bufs, unsigned int nbufs);
+
+/* max number of buffers that are passed to ziti_sdk_writev_cb for a single write */
+#define ZITI_SDK_MAX_WRITEV_BUFS 16
 typedef host_ctx_t * (*ziti_sdk_host_cb)(void *ziti_ctx, uv_loop_t *loop, const char *service_name, cfg_type_e cfg_type, const void *cfg);
 
 /** data needed to intercept packets and dial the associated ziti service */
@@ -105,6 +110,8 @@ typedef struct intercept_ctx_s  intercept_ctx_t;
 typedef const ziti_address * (*intercept_match_addr_fn)(ip_addr_t *addr, void *app_intercept_ctx);
 
 extern intercept_ctx_t *intercept_ctx_new(tunneler_context tnlr_ctx, const char *app_id, void *app_intercept_ctx);
+/** set a predicate for addresses that can't be indexed, e.g. wildcard domains. it is called for every lookup that
+ * doesn't find an exact host match, so only set it on intercepts that need it */
 extern void intercept_ctx_set_match_addr(intercept_ctx_t *intercept, intercept_match_addr_fn pred);
 extern void intercept_ctx_add_protocol(intercept_ctx_t *ctx, const char *protocol);
 /** parse address string as hostname|ip|cidr and add result to list of intercepted addresses */
@@ -118,6 +125,7 @@ struct io_ctx_s {
     void *                ziti_io; // context specific to ziti SDK being used by the app.
     const void *          ziti_ctx;
     ziti_sdk_write_cb     write_fn;
+    ziti_sdk_writev_cb    writev_fn;
     ziti_sdk_close_cb     close_write_fn;
     ziti_sdk_close_cb     close_fn;
 };
@@ -137,7 +145,10 @@ typedef struct tunneler_sdk_options_s {
     ziti_sdk_close_cb   ziti_close;
     ziti_sdk_close_cb   ziti_close_write;
     ziti_sdk_write_cb   ziti_write;
+    ziti_sdk_writev_cb  ziti_writev; // optional. when set, tcp data is written to ziti without flattening pbuf chains
     ziti_sdk_host_cb    ziti_host;
+    unsigned int   max_tcp_connections; // 0 uses MEMP_NUM_TCP_PCB
+    unsigned int   max_udp_connections; // 0 uses MEMP_NUM_UDP_PCB
 } tunneler_sdk_options;
 
 extern port_range_t *parse_port_range(uint16_t low, uint16_t high);
@@ -163,7 +174,18 @@ extern const port_range_t *port_match(int port, const port_range_list_t *port_ra
 extern tunneler_context ziti_tunneler_init(tunneler_sdk_options *opts, uv_loop_t *loop);
 extern tunneler_context ziti_tunneler_init_host_only(tunneler_sdk_options *opts, uv_loop_t *loop);
 
+extern uv_loop_t *ziti_tunneler_loop(tunneler_context tnlr_ctx);
+
+/** the loop that a connection's i/o runs on */
+extern uv_loop_t *ziti_tunneler_io_loop(tunneler_io_context tnlr_io_ctx);
+
 extern void ziti_tunneler_exclude_route(tunneler_context tnlr_ctx, const char* dst);
+
+/** true if lwip still has a tcp or udp connection to the intercepted address `addr` */
+extern bool ziti_tunneler_addr_in_use(tunneler_context tnlr_ctx, const ip_addr_t *addr);
+
+/** called when an intercepted address may be reassigned, so lookups cached for it are dropped */
+extern void ziti_tunneler_addr_released(tunneler_context tnlr_ctx, const ip_addr_t *addr);
 extern void ziti_tunnel_commit_routes(tunneler_context tnlr_ctx);
 
 /** called by tunneler application when it is done with a tunneler_context.
@@ -184,6 +206,9 @@ extern void ziti_tunneler_dial_completed(struct io_ctx_s *io_context, bool ok);
 
 extern ssize_t ziti_tunneler_write(tunneler_io_context tnlr_io_ctx, const void *data, size_t len);
 
+/** size the receive window advertised to a tcp client. has no effect on udp */
+extern void ziti_tunneler_set_rcv_window(tunneler_io_context tnlr_io_ctx, size_t wnd);
+
 struct write_ctx_s;
 extern void ziti_tunneler_ack(struct write_ctx_s *write_ctx);
 
@@ -217,12 +242,23 @@ XX(remote_port, model_number, none, RemotePort, __VA_ARGS__) \
 XX(state, model_string, none, State, __VA_ARGS__) \
 XX(service, model_string, none, Service, __VA_ARGS__)
 
+// the counters are 64-bit model_numbers
+#define TNL_DNS_CACHE_STATS(XX, ...) \
+XX(size, model_number, none, Size, __VA_ARGS__) \
+XX(capacity, model_number, none, Capacity, __VA_ARGS__) \
+XX(hits, model_number, none, Hits, __VA_ARGS__) \
+XX(misses, model_number, none, Misses, __VA_ARGS__) \
+XX(evictions, model_number, none, Evictions, __VA_ARGS__)
+
+// dns_cache is filled in by the DNS layer, which is not part of the tunneler sdk
 #define TNL_IP_STATS(XX, ...) \
 XX(pools, tunnel_ip_mem_pool, array, Pools, __VA_ARGS__) \
-XX(connections, tunnel_ip_conn, array, Connections, __VA_ARGS__)
+XX(connections, tunnel_ip_conn, array, Connections, __VA_ARGS__) \
+XX(dns_cache, tunnel_dns_cache_stats, ptr, DnsCache, __VA_ARGS__)
 
 DECLARE_MODEL(tunnel_ip_mem_pool, TNL_IP_MEM_POOL)
 DECLARE_MODEL(tunnel_ip_conn, TNL_IP_CONN)
+DECLARE_MODEL(tunnel_dns_cache_stats, TNL_DNS_CACHE_STATS)
 DECLARE_MODEL(tunnel_ip_stats, TNL_IP_STATS)
 
 extern void ziti_tunnel_get_ip_stats(tunnel_ip_stats *stats);
@@ -14,11 +14,13 @@
  limitations under the License.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "ziti_tunnel_priv.h"
 #include "ziti/ziti_model.h"
+#include "lwip/ip.h"
 
 bool protocol_match(const char *protocol, const protocol_list_t *protocols) {
     protocol_t *p;
@@ -145,90 +147,512 @@ const port_range_t *port_match(int port, const port_range_list_t *port_ranges) {
     return best_pr;
 }
 
+/*
+ * compiled intercept index.
+ *
+ * for each protocol, the CIDR addresses of all intercepts are loaded into a binary prefix trie per address
+ * family. every trie node that terminates a prefix holds the port rules of the intercepts with that prefix,
+ * sorted by the low end of the port range. a lookup walks the trie along the destination address, so the
+ * deepest node with a matching rule has the smallest address range, and within a node the smallest port
+ * range wins. ties go to the intercept that is later in `tnlr_ctx->intercepts`, as the list scan did.
+ *
+ * intercepts with a match_addr predicate (wildcard domains) can't be indexed by address, so they are kept
+ * in a separate list and consulted only when the trie can't produce an exact host match.
+ */
+struct port_rule {
+    uint16_t low;
+    uint16_t high;
+    unsigned int order; // position in tnlr_ctx->intercepts
+    intercept_ctx_t *intercept;
+};
+
+struct trie_node {
+    struct trie_node *child[2];
+    struct port_rule *rules;
+    size_t num_rules;
+};
+
+struct proto_index {
+    char *protocol;
+    struct trie_node *root[2]; // [0] ipv4, [1] ipv6
+    struct port_rule *dynamic; // intercepts with match_addr. low/high are unused
+    size_t num_dynamic;
+};
+
+struct intercept_index_s {
+    unsigned int version;
+    struct proto_index *protos;
+    size_t num_protos;
+};
+
 struct addr_match {
-    const ziti_address *addr;
     int addr_score;
-    const port_range_t *pr;
     int pr_score;
+    unsigned int order;
     intercept_ctx_t *intercept;
 };
 
-/** return the intercept context with the smallest address range for a packet based on its destination ip:port */
-intercept_ctx_t * lookup_intercept_by_address(tunneler_context tnlr_ctx, const char *protocol,
-                                              ip_addr_t *src_addr, ip_addr_t *dst_addr, uint16_t dst_port) {
-    if (tnlr_ctx == NULL) {
-        TNL_LOG(DEBUG, "null tnlr_ctx");
-        return NULL;
+static inline int addr_bit(const uint8_t *addr, int i) {
+    return (addr[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+static void free_trie(struct trie_node *n) {
+    if (n == NULL) return;
+    free_trie(n->child[0]);
+    free_trie(n->child[1]);
+    free(n->rules);
+    free(n);
+}
+
+void free_intercept_index(struct intercept_index_s *idx) {
+    if (idx == NULL) return;
+    for (size_t i = 0; i < idx->num_protos; i++) {
+        free(idx->protos[i].protocol);
+        free_trie(idx->protos[i].root[0]);
+        free_trie(idx->protos[i].root[1]);
+        free(idx->protos[i].dynamic);
     }
+    free(idx->protos);
+    free(idx);
+}
 
-    char key[3+1+IPADDR_STRLEN_MAX+1+6+1]; // [proto]:[ip]:[port]
-    snprintf(key, sizeof(key), "%s:%s:%d", protocol, ipaddr_ntoa(dst_addr), dst_port);
-    intercept_ctx_t *intercept = model_map_get(&tnlr_ctx->intercepts_cache, key);
-    ziti_address src_za;
-    ziti_address_from_ip_addr(&src_za, src_addr);
-    if (intercept != NULL) {
-        if (address_match(&src_za, &intercept->allowed_source_addresses) != NULL) {
-            return intercept;
+static struct proto_index *get_proto_index(struct intercept_index_s *idx, const char *protocol, bool create) {
+    for (size_t i = 0; i < idx->num_protos; i++) {
+        if (strcmp(idx->protos[i].protocol, protocol) == 0) {
+            return &idx->protos[i];
         }
     }
+    if (!create) return NULL;
+
+    struct proto_index *protos = realloc(idx->protos, (idx->num_protos + 1) * sizeof(struct proto_index));
+    if (protos == NULL) return NULL;
+    idx->protos = protos;
+    struct proto_index *pi = &idx->protos[idx->num_protos++];
+    memset(pi, 0, sizeof(*pi));
+    pi->protocol = strdup(protocol);
+    return pi;
+}
 
-    ziti_address za;
-    ziti_address_from_ip_addr(&za, dst_addr);
-    struct addr_match curr, best = { 0 };
+static bool append_rule(struct port_rule **rules, size_t *num_rules, const struct port_rule *r) {
+    struct port_rule *n = realloc(*rules, (*num_rules + 1) * sizeof(struct port_rule));
+    if (n == NULL) return false;
+    n[(*num_rules)++] = *r;
+    *rules = n;
+    return true;
+}
 
-    LIST_FOREACH(intercept, &tnlr_ctx->intercepts, entries) {
-        if (!protocol_match(protocol, &intercept->protocols)) continue;
+static bool index_address(struct proto_index *pi, const ziti_address *za, intercept_ctx_t *intercept, unsigned int order) {
+    if (za->type != ziti_address_cidr) {
+        return true; // hostnames are matched through match_addr
+    }
+    int family = za->addr.cidr.af == AF_INET6 ? 1 : 0;
+    int bits = (int) za->addr.cidr.bits;
+    const uint8_t *ip = za->addr.cidr.ip.s6_addr;
+
+    struct trie_node **np = &pi->root[family];
+    for (int i = 0; ; i++) {
+        if (*np == NULL && (*np = calloc(1, sizeof(struct trie_node))) == NULL) {
+            return false;
+        }
+        if (i == bits) break;
+        np = &(*np)->child[addr_bit(ip, i)];
+    }
 
-        // enforce the source address whitelist if it isn't empty
-        bool has_allowed_source_addresses = STAILQ_FIRST(&intercept->allowed_source_addresses) != NULL;
-        if (has_allowed_source_addresses && address_match(&src_za, &intercept->allowed_source_addresses) == NULL) {
-            continue;
+    struct trie_node *n = *np;
+    const port_range_t *pr;
+    STAILQ_FOREACH(pr, &intercept->port_ranges, entries) {
+        struct port_rule r = {
+                .low = (uint16_t) pr->low,
+                .high = (uint16_t) pr->high,
+                .order = order,
+                .intercept = intercept,
+        };
+        if (!append_rule(&n->rules, &n->num_rules, &r)) {
+            return false;
         }
+    }
+    return true;
+}
+
+static int cmp_port_rule(const void *a, const void *b) {
+    const struct port_rule *ra = a, *rb = b;
+    return (int) ra->low - (int) rb->low;
+}
 
-        curr.intercept = intercept;
-        // try IP or hostname match
-        curr.addr = address_match(&za, &intercept->addresses);
-        curr.addr_score = -1;
-        if (curr.addr) {
-            if (za.type == ziti_address_cidr) {
-                curr.addr_score = (int) (za.addr.cidr.bits - curr.addr->addr.cidr.bits);
-            } else {
-                curr.addr_score = 0;
+static void sort_trie_rules(struct trie_node *n) {
+    if (n == NULL) return;
+    if (n->num_rules > 1) {
+        qsort(n->rules, n->num_rules, sizeof(struct port_rule), cmp_port_rule);
+    }
+    sort_trie_rules(n->child[0]);
+    sort_trie_rules(n->child[1]);
+}
+
+static struct intercept_index_s *build_intercept_index(tunneler_context tnlr_ctx) {
+    struct intercept_index_s *idx = calloc(1, sizeof(struct intercept_index_s));
+    if (idx == NULL) return NULL;
+    idx->version = tnlr_ctx->intercepts_version;
+
+    unsigned int order = 0;
+    intercept_ctx_t *intercept;
+    LIST_FOREACH(intercept, &tnlr_ctx->intercepts, entries) {
+        protocol_t *proto;
+        STAILQ_FOREACH(proto, &intercept->protocols, entries) {
+            struct proto_index *pi = get_proto_index(idx, proto->protocol, true);
+            if (pi == NULL) goto error;
+
+            address_t *a;
+            STAILQ_FOREACH(a, &intercept->addresses, entries) {
+                if (!index_address(pi, &a->za, intercept, order)) goto error;
             }
-        } else if (intercept->match_addr) {
-            // check for wildcard domain match
-            curr.addr = intercept->match_addr(dst_addr, intercept->app_intercept_ctx);
-            if (curr.addr) {
-                curr.addr_score = 1; // leave room for a matching plain ziti_address_hostname to win
+            if (intercept->match_addr) {
+                struct port_rule r = { .order = order, .intercept = intercept };
+                if (!append_rule(&pi->dynamic, &pi->num_dynamic, &r)) goto error;
             }
         }
-        if (curr.addr_score < 0) continue;
+        order++;
+    }
+
+    for (size_t i = 0; i < idx->num_protos; i++) {
+        sort_trie_rules(idx->protos[i].root[0]);
+        sort_trie_rules(idx->protos[i].root[1]);
+    }
+    TNL_LOG(DEBUG, "compiled intercept index for %u intercepts", order);
+    return idx;
+
+error:
+    TNL_LOG(ERR, "failed to allocate intercept index");
+    free_intercept_index(idx);
+    return NULL;
+}
+
+static inline bool source_allowed(const intercept_ctx_t *intercept, const ziti_address *src_za) {
+    // enforce the source address whitelist if it isn't empty
+    return STAILQ_EMPTY(&intercept->allowed_source_addresses) ||
+           address_match(src_za, &intercept->allowed_source_addresses) != NULL;
+}
 
-        curr.pr = port_match(dst_port, &intercept->port_ranges);
-        curr.pr_score = (curr.pr != NULL) ? curr.pr->high - curr.pr->low : -1;
-        if (curr.pr_score < 0) continue;
+/** returns true if `curr` is a better match than `best`: smaller address range, then smaller port range */
+static inline bool better_match(const struct addr_match *curr, const struct addr_match *best) {
+    if (best->intercept == NULL) return true;
+    if (curr->addr_score != best->addr_score) return curr->addr_score < best->addr_score;
+    if (curr->pr_score != best->pr_score) return curr->pr_score < best->pr_score;
+    return curr->order > best->order;
+}
 
-        if (best.intercept == NULL) {
-            // first match
-            best = curr;
-            continue;
+/**
+ * find the best rule in a trie node for the given port. rules are sorted by `low`.
+ * `restricted` tracks the best rule with allowed source addresses, regardless of the source.
+ */
+static void match_node_rules(const struct trie_node *n, int addr_score, uint16_t port, const ziti_address *src_za,
+                             struct addr_match *best, struct addr_match *restricted) {
+    for (size_t i = 0; i < n->num_rules && n->rules[i].low <= port; i++) {
+        const struct port_rule *r = &n->rules[i];
+        if (port > r->high) continue;
+        struct addr_match curr = {
+                .addr_score = addr_score,
+                .pr_score = r->high - r->low,
+                .order = r->order,
+                .intercept = r->intercept,
+        };
+        if (better_match(&curr, best) && source_allowed(r->intercept, src_za)) {
+            *best = curr;
+        }
+        if (!STAILQ_EMPTY(&r->intercept->allowed_source_addresses) && better_match(&curr, restricted)) {
+            *restricted = curr;
         }
+    }
+}
 
-        if (curr.addr_score > best.addr_score) {
-            // current address score is inferior to best match so far
-            continue;
+static struct addr_match index_lookup(struct intercept_index_s *idx, const char *protocol, ip_addr_t *dst_addr,
+                                      uint16_t dst_port, const ziti_address *src_za, struct addr_match *restricted) {
+    struct addr_match best = { 0 };
+    struct proto_index *pi = get_proto_index(idx, protocol, false);
+    if (pi == NULL) return best;
+
+    const uint8_t *ip;
+    int family, max_bits;
+    if (IP_IS_V6(dst_addr)) {
+        ip = (const uint8_t *) ip_2_ip6(dst_addr)->addr;
+        family = 1;
+        max_bits = 128;
+    } else {
+        ip = (const uint8_t *) &ip_2_ip4(dst_addr)->addr;
+        family = 0;
+        max_bits = 32;
+    }
+
+    // walk toward the host address; a match at a deeper node always beats a shallower one
+    const struct trie_node *n = pi->root[family];
+    for (int depth = 0; n != NULL; depth++) {
+        if (n->num_rules > 0) {
+            struct addr_match node_best = { 0 };
+            match_node_rules(n, max_bits - depth, dst_port, src_za, &node_best, restricted);
+            if (node_best.intercept != NULL) {
+                best = node_best;
+            }
         }
+        if (depth == max_bits) break;
+        n = n->child[addr_bit(ip, depth)];
+    }
 
-        if (curr.pr_score > best.pr_score) {
-            // current port matches, but matching range is larger than best matching range.
-            continue;
+    // wildcard domain matches score 1, leaving room for a matching plain ziti_address_hostname to win
+    if (pi->num_dynamic > 0 && (best.intercept == NULL || best.addr_score >= 1)) {
+        ziti_address za;
+        ziti_address_from_ip_addr(&za, dst_addr);
+        for (size_t i = 0; i < pi->num_dynamic; i++) {
+            intercept_ctx_t *intercept = pi->dynamic[i].intercept;
+            // intercepts with a matching address were scored by the trie
+            if (address_match(&za, &intercept->addresses) != NULL) continue;
+
+            const port_range_t *pr = port_match(dst_port, &intercept->port_ranges);
+            if (pr == NULL) continue;
+            struct addr_match curr = {
+                    .addr_score = 1,
+                    .pr_score = pr->high - pr->low,
+                    .order = pi->dynamic[i].order,
+                    .intercept = intercept,
+            };
+            bool wins = better_match(&curr, &best) && source_allowed(intercept, src_za);
+            bool restricted_wins = !STAILQ_EMPTY(&intercept->allowed_source_addresses) && better_match(&curr, restricted);
+            if (!wins && !restricted_wins) continue;
+            if (intercept->match_addr(dst_addr, intercept->app_intercept_ctx) == NULL) continue;
+            if (wins) best = curr;
+            if (restricted_wins) *restricted = curr;
         }
+    }
+
+    return best;
+}
+
+/*
+ * intercept lookup cache.
+ *
+ * a fixed-size set associative cache keyed by (protocol, address family, destination address, port).
+ * only positive results are cached, along with their address score, so that changes to intercepts can
+ * evict just the entries they might affect (see intercepts_changed). lookups whose answer depends on an intercept's
+ * allowed source addresses aren't cached, since another source could get a different answer.
+ * the address picks a run of INTERCEPT_CACHE_ADDR_SETS sets and the protocol and port pick one of them, so
+ * entries for an address can be evicted without scanning the whole cache (see intercept_cache_evict_addr).
+ */
+#define INTERCEPT_CACHE_SETS 1024 // must be a power of 2
+#define INTERCEPT_CACHE_WAYS 4
+#define INTERCEPT_CACHE_ADDR_SETS 16 // must be a power of 2, and at most INTERCEPT_CACHE_SETS
+
+struct intercept_cache_entry {
+    uint8_t addr[16];
+    uint16_t port;
+    uint8_t proto; // 0 if the entry is unused
+    uint8_t family;
+    uint8_t addr_score;
+    intercept_ctx_t *intercept;
+};
 
-        best = curr;
+struct intercept_cache_s {
+    struct intercept_cache_entry sets[INTERCEPT_CACHE_SETS][INTERCEPT_CACHE_WAYS];
+};
+
+struct intercept_cache_key {
+    uint8_t addr[16];
+    uint16_t port;
+    uint8_t proto;
+    uint8_t family;
+};
+
+static uint8_t cache_proto_id(const char *protocol) {
+    if (strcmp(protocol, "tcp") == 0) return IP_PROTO_TCP;
+    if (strcmp(protocol, "udp") == 0) return IP_PROTO_UDP;
+    return 0;
+}
+
+static bool make_cache_key(struct intercept_cache_key *key, const char *protocol, const ip_addr_t *dst_addr,
+                           uint16_t dst_port) {
+    memset(key, 0, sizeof(*key));
+    if ((key->proto = cache_proto_id(protocol)) == 0) {
+        return false;
+    }
+    key->port = dst_port;
+    if (IP_IS_V6(dst_addr)) {
+        key->family = 6;
+        memcpy(key->addr, ip_2_ip6(dst_addr)->addr, 16);
+    } else {
+        key->family = 4;
+        memcpy(key->addr, &ip_2_ip4(dst_addr)->addr, 4);
+    }
+    return true;
+}
+
+static uint32_t fnv1a(uint32_t h, const uint8_t *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ b[i]) * 0x01000193u;
+    }
+    return h;
+}
+
+/** the first of the sets that hold entries for the key's address */
+static uint32_t cache_addr_set(const struct intercept_cache_key *key) {
+    uint32_t h = fnv1a(0x811C9DC5u, key->addr, sizeof(key->addr));
+    return fnv1a(h, &key->family, sizeof(key->family));
+}
+
+static struct intercept_cache_entry *cache_set(struct intercept_cache_s *cache, const struct intercept_cache_key *key) {
+    uint32_t h = fnv1a(0x811C9DC5u, (const uint8_t *) &key->port, sizeof(key->port));
+    h = fnv1a(h, &key->proto, sizeof(key->proto));
+    uint32_t s = cache_addr_set(key) + (h & (INTERCEPT_CACHE_ADDR_SETS - 1));
+    return cache->sets[s & (INTERCEPT_CACHE_SETS - 1)];
+}
+
+static inline bool cache_entry_matches(const struct intercept_cache_entry *e, const struct intercept_cache_key *key) {
+    return e->proto == key->proto && e->port == key->port && e->family == key->family &&
+           memcmp(e->addr, key->addr, sizeof(e->addr)) == 0;
+}
+
+static struct intercept_cache_entry *cache_get(struct intercept_cache_s *cache, const struct intercept_cache_key *key) {
+    if (cache == NULL) return NULL;
+    struct intercept_cache_entry *set = cache_set(cache, key);
+    for (int i = 0; i < INTERCEPT_CACHE_WAYS; i++) {
+        if (set[i].proto != 0 && cache_entry_matches(&set[i], key)) {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+/** insert at the front of the set, evicting the oldest entry if the set is full */
+static void cache_put(struct intercept_cache_s *cache, const struct intercept_cache_key *key,
+                      intercept_ctx_t *intercept, int addr_score) {
+    struct intercept_cache_entry *set = cache_set(cache, key);
+    int last = INTERCEPT_CACHE_WAYS - 1;
+    for (int i = 0; i < INTERCEPT_CACHE_WAYS; i++) {
+        if (set[i].proto == 0 || cache_entry_matches(&set[i], key)) {
+            last = i;
+            break;
+        }
+    }
+    memmove(&set[1], &set[0], last * sizeof(struct intercept_cache_entry));
+    memcpy(set[0].addr, key->addr, sizeof(set[0].addr));
+    set[0].port = key->port;
+    set[0].proto = key->proto;
+    set[0].family = key->family;
+    set[0].addr_score = (uint8_t) addr_score;
+    set[0].intercept = intercept;
+}
+
+static bool prefix_match(const uint8_t *addr, const uint8_t *prefix, int bits) {
+    int bytes = bits / 8;
+    if (memcmp(addr, prefix, bytes) != 0) return false;
+    int rem = bits % 8;
+    if (rem == 0) return true;
+    uint8_t mask = (uint8_t) (0xFF << (8 - rem));
+    return (addr[bytes] & mask) == (prefix[bytes] & mask);
+}
+
+/** true if a lookup for the cached entry could be answered differently because of `intercept` */
+static bool cache_entry_affected(const struct intercept_cache_entry *e, const intercept_ctx_t *intercept) {
+    if (e->intercept == intercept) return true;
+    // a wildcard domain match can beat anything other than an exact host match
+    if (intercept->match_addr && e->addr_score >= 1) return true;
+
+    const address_t *a;
+    STAILQ_FOREACH(a, &intercept->addresses, entries) {
+        if (a->za.type != ziti_address_cidr) continue;
+        int family = a->za.addr.cidr.af == AF_INET6 ? 6 : 4;
+        if (family == e->family && prefix_match(e->addr, a->za.addr.cidr.ip.s6_addr, (int) a->za.addr.cidr.bits)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void intercepts_changed(tunneler_context tnlr_ctx, const intercept_ctx_t *intercept) {
+    if (tnlr_ctx == NULL) return;
+    tnlr_ctx->intercepts_version++;
+
+    struct intercept_cache_s *cache = tnlr_ctx->intercepts_cache;
+    if (cache == NULL) return;
+    int evicted = 0;
+    for (int s = 0; s < INTERCEPT_CACHE_SETS; s++) {
+        struct intercept_cache_entry *set = cache->sets[s];
+        for (int i = 0; i < INTERCEPT_CACHE_WAYS; i++) {
+            if (set[i].proto != 0 && (intercept == NULL || cache_entry_affected(&set[i], intercept))) {
+                set[i].proto = 0;
+                evicted++;
+            }
+        }
+    }
+    TNL_LOG(VERBOSE, "evicted %d intercept cache entries", evicted);
+}
+
+void intercept_cache_evict_addr(tunneler_context tnlr_ctx, const ip_addr_t *dst_addr) {
+    struct intercept_cache_s *cache = tnlr_ctx->intercepts_cache;
+    if (cache == NULL) return;
+
+    struct intercept_cache_key key;
+    make_cache_key(&key, "tcp", dst_addr, 0);
+    uint32_t first = cache_addr_set(&key);
+    int evicted = 0;
+    for (uint32_t s = 0; s < INTERCEPT_CACHE_ADDR_SETS; s++) {
+        struct intercept_cache_entry *set = cache->sets[(first + s) & (INTERCEPT_CACHE_SETS - 1)];
+        for (int i = 0; i < INTERCEPT_CACHE_WAYS; i++) {
+            if (set[i].proto != 0 && set[i].family == key.family && memcmp(set[i].addr, key.addr, sizeof(key.addr)) == 0) {
+                set[i].proto = 0;
+                evicted++;
+            }
+        }
+    }
+    TNL_LOG(VERBOSE, "evicted %d intercept cache entries for %s", evicted, ipaddr_ntoa(dst_addr));
+}
+
+intercept_ctx_t *intercept_cache_get(tunneler_context tnlr_ctx, const char *protocol, const ip_addr_t *dst_addr,
+                                     uint16_t dst_port) {
+    struct intercept_cache_key key;
+    if (!make_cache_key(&key, protocol, dst_addr, dst_port)) return NULL;
+    struct intercept_cache_entry *e = cache_get(tnlr_ctx->intercepts_cache, &key);
+    return e ? e->intercept : NULL;
+}
+
+/** return the intercept context with the smallest address range for a packet based on its destination ip:port */
+intercept_ctx_t * lookup_intercept_by_address(tunneler_context tnlr_ctx, const char *protocol,
+                                              ip_addr_t *src_addr, ip_addr_t *dst_addr, uint16_t dst_port) {
+    if (tnlr_ctx == NULL) {
+        TNL_LOG(DEBUG, "null tnlr_ctx");
+        return NULL;
     }
 
-    model_map_set(&tnlr_ctx->intercepts_cache, key, best.intercept);
-    return best.intercept;
+    ziti_address src_za;
+    ziti_address_from_ip_addr(&src_za, src_addr);
+
+    struct intercept_cache_key key;
+    bool cacheable = make_cache_key(&key, protocol, dst_addr, dst_port);
+    if (cacheable) {
+        struct intercept_cache_entry *e = cache_get(tnlr_ctx->intercepts_cache, &key);
+        if (e != NULL) {
+            return e->intercept;
+        }
+    }
+
+    if (tnlr_ctx->intercept_index == NULL || tnlr_ctx->intercept_index->version != tnlr_ctx->intercepts_version) {
+        free_intercept_index(tnlr_ctx->intercept_index);
+        tnlr_ctx->intercept_index = build_intercept_index(tnlr_ctx);
+        if (tnlr_ctx->intercept_index == NULL) {
+            return NULL;
+        }
+    }
+
+    struct addr_match restricted = { 0 };
+    struct addr_match m = index_lookup(tnlr_ctx->intercept_index, protocol, dst_addr, dst_port, &src_za, &restricted);
+    // the result depends on the source if a source restricted intercept matched, or would have won if it was allowed
+    bool src_dependent = restricted.intercept != NULL &&
+            (restricted.intercept == m.intercept || better_match(&restricted, &m));
+    if (m.intercept != NULL && cacheable && !src_dependent) {
+        if (tnlr_ctx->intercepts_cache == NULL) {
+            tnlr_ctx->intercepts_cache = calloc(1, sizeof(struct intercept_cache_s));
+        }
+        if (tnlr_ctx->intercepts_cache != NULL) {
+            cache_put(tnlr_ctx->intercepts_cache, &key, m.intercept, m.addr_score);
+        }
+    }
+    return m.intercept;
 }
 
 void free_intercept(intercept_ctx_t *intercept) {
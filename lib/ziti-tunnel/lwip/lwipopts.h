@@ -3,6 +3,16 @@
 
 #define NO_SYS 1
 
+/* allocate pools and the heap from slabs that grow on demand (mem_slab.c), rather than from fixed arrays or
+ * with a libc malloc per pbuf, segment and pcb. MEM_SIZE and the MEMP_NUM_* values below are not hard limits;
+ * connection limits are enforced by the tunneler (see tunneler_sdk_options). */
+#define MEM_LIBC_MALLOC       1
+#define MEMP_MEM_MALLOC       1
+#include "mem_slab.h"
+#define mem_clib_malloc       mem_slab_malloc
+#define mem_clib_calloc       mem_slab_calloc
+#define mem_clib_free         mem_slab_free
+
 #ifndef MEM_SIZE
 #define MEM_SIZE              524288      /* the size of the heap memory (1600) */
 #endif
@@ -18,10 +28,10 @@
 //#define MEMP_NUM_PBUF       64          /* number of memp struct pbufs (used for PBUF_ROM and PBUF_REF) */
 
 #ifndef MEMP_NUM_UDP_PCB
-#define MEMP_NUM_UDP_PCB      16          /* simultaneously active UDP "connections" (4) */
+#define MEMP_NUM_UDP_PCB      16          /* default limit of simultaneously active UDP "connections" (4) */
 #endif
 #ifndef MEMP_NUM_TCP_PCB
-#define MEMP_NUM_TCP_PCB      64          /* simultaneously active TCP connections (5) */
+#define MEMP_NUM_TCP_PCB      64          /* default limit of simultaneously active TCP connections (5) */
 #endif
 #ifndef MEMP_NUM_TCP_SEG
 #define MEMP_NUM_TCP_SEG      1024        /* simultaneously queued TCP segments (16) */
@@ -29,8 +39,10 @@
 #ifndef PBUF_POOL_SIZE
 #define PBUF_POOL_SIZE        512         /* number of buffers in the pbuf pool (16) */
 #endif
+#define LWIP_SUPPORT_CUSTOM_PBUF 1        /* netif_shim reads packets into PBUF_REF custom pbufs */
 
-#define TCP_WND               0xffff      /* size of a TCP window. when using TCP_RCV_SCALE, TCP_WND is the total size with scaling applied (4 * TCP_MSS) */
+#define TCP_WND               (8*1024*1024) /* size of a TCP window. when using TCP_RCV_SCALE, TCP_WND is the total size with scaling applied (4 * TCP_MSS). 8MB, the same as PENDING_BYTES_CEILING in ziti_tunnel_cbs.h, since a window larger than the most a connection may have pending to ziti is never filled. must not exceed 0xffff << TCP_RCV_SCALE (~1GB). connections start at 0xffff and are grown by the tunneler app (ziti_tunneler_set_rcv_window) */
+#define TCP_WND_UPDATE_THRESHOLD (0xffff/4) /* send window updates as often as with the initial window (LWIP_MIN((TCP_WND / 4), (TCP_MSS * 4))) */
 #ifdef TCP_MSS
 #undef TCP_MSS  /* cleanup warnings */
 #endif
@@ -41,6 +53,7 @@
 #define TCP_SNDLOWAT          (0xffff-(4*TCP_MSS)-1) /* TCP writable space (bytes). must be less than TCP_SND_BUF. the amount of space which must be available in the TCP snd_buf for select to return writable (combined with TCP_SNDQUEUELOWAT) LWIP_MIN(LWIP_MAX(((TCP_SND_BUF)/2), (2 * TCP_MSS) + 1), (TCP_SND_BUF) - 1) */
 #define LWIP_WND_SCALE        1           /* set to 1 to enable window scaling */
 #define TCP_RCV_SCALE         14          /* desired scaling factor - shift count in the range of [0..14] */
+#define LWIP_TCP_PCB_NUM_EXT_ARGS 2     /* tunnel_tcp.c is notified when lwip frees a pcb so it can drop its flow index entry and held data */
 
 #define LWIP_SINGLE_NETIF 1               /* avoid some lwip "routing" logic */
 
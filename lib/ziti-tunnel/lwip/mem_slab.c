@@ -0,0 +1,214 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem_slab.h"
+
+/* every object is preceded by a header that points to its slab. 16 bytes keeps objects aligned like malloc */
+#define SLAB_HDR_SIZE 16
+
+/* slabs are sized to hold about this many bytes of objects, and at least two objects */
+#define SLAB_BYTES (64 * 1024)
+
+/* object sizes, without the header. larger allocations go straight to malloc */
+static const uint32_t class_sizes[] = {
+        32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384,
+        24576, 32768,
+};
+#define NUM_CLASSES (sizeof(class_sizes) / sizeof(class_sizes[0]))
+
+struct slab_s;
+
+typedef struct slab_class_s {
+    size_t size;            // object size, without the header
+    size_t per_slab;        // number of objects in a slab
+    struct slab_s *partial; // slabs that have free objects
+    struct slab_s *spare;   // one slab with no objects in use, kept so alloc/free churn doesn't hit malloc
+} slab_class_t;
+
+typedef struct slab_s {
+    slab_class_t *cls;
+    struct slab_s *next;
+    struct slab_s *prev;
+    void *free_list;        // linked through the first bytes of each free object
+    size_t used;
+} slab_t;
+
+typedef union slab_hdr_u {
+    slab_t *slab;           // NULL for allocations that don't fit a size class
+    char pad[SLAB_HDR_SIZE];
+} slab_hdr_t;
+
+#define SLAB_BASE_SIZE ((sizeof(slab_t) + SLAB_HDR_SIZE - 1) / SLAB_HDR_SIZE * SLAB_HDR_SIZE)
+
+static slab_class_t classes[NUM_CLASSES];
+static size_t reserved;
+
+static slab_hdr_t *obj_hdr(void *obj) {
+    return (slab_hdr_t *) ((char *) obj - SLAB_HDR_SIZE);
+}
+
+static slab_class_t *size_class(size_t size) {
+    if (size > class_sizes[NUM_CLASSES - 1]) {
+        return NULL;
+    }
+    size_t lo = 0, hi = NUM_CLASSES - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (class_sizes[mid] < size) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    slab_class_t *c = &classes[lo];
+    if (c->size == 0) {
+        c->size = class_sizes[lo];
+        c->per_slab = SLAB_BYTES / (SLAB_HDR_SIZE + c->size);
+        if (c->per_slab < 2) {
+            c->per_slab = 2;
+        }
+    }
+    return c;
+}
+
+static size_t slab_bytes(const slab_class_t *c) {
+    return SLAB_BASE_SIZE + c->per_slab * (SLAB_HDR_SIZE + c->size);
+}
+
+static slab_t *new_slab(slab_class_t *c) {
+    slab_t *s = malloc(slab_bytes(c));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->cls = c;
+    s->next = s->prev = NULL;
+    s->free_list = NULL;
+    s->used = 0;
+
+    char *p = (char *) s + SLAB_BASE_SIZE;
+    for (size_t i = 0; i < c->per_slab; i++) {
+        ((slab_hdr_t *) p)->slab = s;
+        void *obj = p + SLAB_HDR_SIZE;
+        *(void **) obj = s->free_list;
+        s->free_list = obj;
+        p += SLAB_HDR_SIZE + c->size;
+    }
+    reserved += slab_bytes(c);
+    return s;
+}
+
+static void link_partial(slab_t *s) {
+    slab_class_t *c = s->cls;
+    s->prev = NULL;
+    s->next = c->partial;
+    if (c->partial != NULL) {
+        c->partial->prev = s;
+    }
+    c->partial = s;
+}
+
+static void unlink_partial(slab_t *s) {
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        s->cls->partial = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+    s->next = s->prev = NULL;
+}
+
+void *mem_slab_malloc(size_t size) {
+    slab_class_t *c = size_class(size);
+    if (c == NULL) {
+        slab_hdr_t *h = malloc(SLAB_HDR_SIZE + size);
+        if (h == NULL) {
+            return NULL;
+        }
+        h->slab = NULL;
+        return (char *) h + SLAB_HDR_SIZE;
+    }
+
+    slab_t *s = c->partial;
+    if (s == NULL) {
+        if (c->spare != NULL) {
+            s = c->spare;
+            c->spare = NULL;
+        } else if ((s = new_slab(c)) == NULL) {
+            return NULL;
+        }
+        link_partial(s);
+    }
+
+    void *obj = s->free_list;
+    s->free_list = *(void **) obj;
+    s->used++;
+    if (s->free_list == NULL) {
+        unlink_partial(s);
+    }
+    return obj;
+}
+
+void *mem_slab_calloc(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *obj = mem_slab_malloc(count * size);
+    if (obj != NULL) {
+        memset(obj, 0, count * size);
+    }
+    return obj;
+}
+
+void mem_slab_free(void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+    slab_hdr_t *h = obj_hdr(obj);
+    slab_t *s = h->slab;
+    if (s == NULL) {
+        free(h);
+        return;
+    }
+
+    bool was_full = s->free_list == NULL;
+    *(void **) obj = s->free_list;
+    s->free_list = obj;
+    s->used--;
+    if (was_full) {
+        link_partial(s);
+    }
+
+    if (s->used == 0) {
+        slab_class_t *c = s->cls;
+        unlink_partial(s);
+        if (c->spare == NULL) {
+            c->spare = s;
+        } else {
+            reserved -= slab_bytes(c);
+            free(s);
+        }
+    }
+}
+
+size_t mem_slab_reserved(void) {
+    return reserved;
+}
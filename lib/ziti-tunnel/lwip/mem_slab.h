@@ -0,0 +1,42 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_MEM_SLAB_H
+#define ZITI_TUNNELER_SDK_MEM_SLAB_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * size-class slab allocator that backs lwip's heap and pools (see lwipopts.h). objects are carved from
+ * slabs that are allocated as the pools grow, and slabs are returned to libc once all of their objects
+ * are freed. like lwip itself, it must only be used from the tunneler's loop thread.
+ */
+extern void *mem_slab_malloc(size_t size);
+extern void *mem_slab_calloc(size_t count, size_t size);
+extern void mem_slab_free(void *ptr);
+
+/* bytes currently held in slabs, whether their objects are in use or not */
+extern size_t mem_slab_reserved(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_MEM_SLAB_H
@@ -2,6 +2,8 @@
 
 #define LWIP_DONT_PROVIDE_BYTEORDER_FUNCTIONS 1
 
+#include <stdlib.h>
+#include <string.h>
 #include "uv.h"
 #include "lwip/err.h"
 #include "lwip/pbuf.h"
@@ -17,25 +19,200 @@
 /* max ipv4 MTU */
 #define BUFFER_SIZE 64 * 1024
 
+/* max number of packets read per poll wakeup */
+#define MAX_READS_PER_POLL 128
+
+/* large receive buffer size. pbuf lengths are u16_t, so a custom pbuf can't describe a BUFFER_SIZE buffer */
+#define RX_BUF_SIZE 0xFFFF
+
+/* small receive buffer size. holds acks, dns and other packets up to a typical mtu, and the headers of larger ones */
+#define RX_SMALL_BUF_SIZE 2048
+
+/* number of receive buffers of each size that lwip may hold at once. reads are copied into PBUF_POOL pbufs when
+ * exhausted */
+#define RX_POOL_SIZE 128
+#define RX_SMALL_POOL_SIZE 4096
+
 static char shim_buffer[BUFFER_SIZE];
+
 /**
- * This function is called by the TCP/IP stack when an IP packet should be sent.
+ * receive buffers are wrapped in PBUF_REF custom pbufs, so packets are read from the
+ * device directly into the memory that lwip processes. buffers return to their pool
+ * when lwip (or the ziti write that holds the pbuf) frees the pbuf.
+ *
+ * packets are read into a small buffer, and only the bytes that don't fit spill into a
+ * large one, so a held ack pins 2k rather than 64k.
  */
-static err_t netif_shim_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
-    netif_driver dev = netif->state;
+struct rx_pool_s {
+    struct rx_pbuf_s *free_list;
+    int allocated;
+    int limit;
+    size_t buf_size;
+};
+
+struct rx_pbuf_s {
+    struct pbuf_custom pc; // must be first
+    struct rx_pbuf_s *next;
+    struct rx_pool_s *pool;
+    bool csum_valid; // the driver vouched for the packet's transport checksum
+    char buf[];
+};
+
+static struct rx_pool_s rx_small_pool = { .limit = RX_SMALL_POOL_SIZE, .buf_size = RX_SMALL_BUF_SIZE };
+static struct rx_pool_s rx_large_pool = { .limit = RX_POOL_SIZE, .buf_size = RX_BUF_SIZE };
+
+static void rx_pbuf_release(struct pbuf *p) {
+    struct rx_pbuf_s *rx = (struct rx_pbuf_s *) p;
+    rx->next = rx->pool->free_list;
+    rx->pool->free_list = rx;
+}
+
+static struct rx_pbuf_s *rx_pbuf_get(struct rx_pool_s *pool) {
+    struct rx_pbuf_s *rx = pool->free_list;
+    if (rx != NULL) {
+        pool->free_list = rx->next;
+        return rx;
+    }
+
+    if (pool->allocated >= pool->limit) {
+        return NULL;
+    }
+
+    rx = malloc(sizeof(struct rx_pbuf_s) + pool->buf_size);
+    if (rx == NULL) {
+        return NULL;
+    }
+    rx->pc.custom_free_function = rx_pbuf_release;
+    rx->pool = pool;
+    pool->allocated++;
+    return rx;
+}
+
+static struct pbuf *rx_pbuf_alloc(struct rx_pbuf_s *rx, size_t len) {
+    return pbuf_alloced_custom(PBUF_RAW, (u16_t) len, PBUF_REF, &rx->pc, rx->buf, (u16_t) rx->pool->buf_size);
+}
+
+static void input_pbuf(struct netif *netif, struct pbuf *p) {
+    err_t err = netif->input(p, netif);
+    if (err != ERR_OK) {
+        TNL_LOG(ERR, "============================> tunif_input: netif input error %s", lwip_strerr(err));
+        pbuf_free(p);
+    }
+}
+
+/* max number of outbound packets that are queued before they are flushed to the driver */
+#define TX_QUEUE_SIZE 64
 
+/* outbound packets waiting for netif_shim_flush(). each pbuf is referenced until it is written */
+static struct {
+    struct pbuf *pkts[TX_QUEUE_SIZE];
+    int count;
+} tx_queue;
+
+static err_t write_flattened(netif_driver dev, struct pbuf *p) {
     u16_t copied = pbuf_copy_partial(p, shim_buffer, p->tot_len, 0);
     if (copied != p->tot_len) {
         TNL_LOG(ERR, "pbuf_copy_partial() failed %d/%d", copied, p->tot_len);
         return ERR_BUF; // ?
     }
 
-    if (ip_ver(shim_buffer) == 4)
-        TNL_LOG(TRACE, "writing packet " PACKET_FMT " len=%d", PACKET_FMT_ARGS(shim_buffer), copied);
     dev->write(dev->handle, shim_buffer, p->tot_len);
     return ERR_OK;
 }
 
+/** write a packet with one driver call, passing the pbuf chain as-is when the driver supports writev */
+static err_t write_packet(netif_driver dev, struct pbuf *p) {
+    char *pkt = p->payload;
+    if (ip_ver(pkt) == 4)
+        TNL_LOG(TRACE, "writing packet " PACKET_FMT " len=%d", PACKET_FMT_ARGS(pkt), p->tot_len);
+
+    if (dev->writev == NULL) {
+        return write_flattened(dev, p);
+    }
+
+    uv_buf_t bufs[NETIF_MAX_WRITEV_BUFS];
+    unsigned int nbufs = 0;
+    struct pbuf *q = p;
+    while (q != NULL && nbufs < NETIF_MAX_WRITEV_BUFS) {
+        if (q->len > 0) {
+            bufs[nbufs++] = uv_buf_init(q->payload, q->len);
+        }
+        q = q->next;
+    }
+
+    if (q != NULL) {
+        TNL_LOG(VERBOSE, "pbuf chain exceeds %d buffers, copying packet", NETIF_MAX_WRITEV_BUFS);
+        return write_flattened(dev, p);
+    }
+
+    dev->writev(dev->handle, bufs, nbufs);
+    return ERR_OK;
+}
+
+/**
+ * This function is called by the TCP/IP stack when an IP packet should be sent.
+ * Packets are queued (by reference) for drivers that implement writev, and written
+ * when the tunneler flushes the queue before the loop blocks for i/o.
+ */
+static err_t netif_shim_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    netif_driver dev = netif->state;
+
+    if (dev->writev == NULL) {
+        return write_packet(dev, p);
+    }
+
+    if (tx_queue.count == TX_QUEUE_SIZE) {
+        netif_shim_flush(netif);
+    }
+
+    // lwip won't retransmit a tcp segment while we hold a reference to it
+    pbuf_ref(p);
+    tx_queue.pkts[tx_queue.count++] = p;
+    return ERR_OK;
+}
+
+err_t netif_shim_writev(struct netif *netif, const uv_buf_t *bufs, unsigned int nbufs) {
+    netif_driver dev = netif->state;
+    ssize_t rc;
+    if (dev->writev != NULL) {
+        rc = dev->writev(dev->handle, bufs, nbufs);
+    } else {
+        size_t len = 0;
+        for (unsigned int i = 0; i < nbufs; i++) {
+            if (len + bufs[i].len > sizeof(shim_buffer)) {
+                return ERR_BUF;
+            }
+            memcpy(shim_buffer + len, bufs[i].base, bufs[i].len);
+            len += bufs[i].len;
+        }
+        rc = dev->write(dev->handle, shim_buffer, len);
+    }
+    return rc < 0 ? ERR_IF : ERR_OK;
+}
+
+bool netif_shim_csum_valid(const struct pbuf *p) {
+    if ((p->flags & PBUF_FLAG_IS_CUSTOM) == 0) {
+        return false;
+    }
+    const struct rx_pbuf_s *rx = (const struct rx_pbuf_s *) p;
+    return rx->pc.custom_free_function == rx_pbuf_release && rx->csum_valid;
+}
+
+void netif_shim_flush(struct netif *netif) {
+    netif_driver dev = netif->state;
+    int count = tx_queue.count;
+
+    tx_queue.count = 0;
+    for (int i = 0; i < count; i++) {
+        write_packet(dev, tx_queue.pkts[i]);
+        pbuf_free(tx_queue.pkts[i]);
+    }
+
+    if (count > 0) {
+        TNL_LOG(TRACE, "flushed %d packets", count);
+    }
+}
+
 /**
  * This function is called by the TCP/IP stack when an IP6 packet should be sent.
  */
@@ -43,28 +220,134 @@ static err_t netif_shim_output_ip6(struct netif *netif, struct pbuf *p, const ip
     return netif_shim_output(netif, p, NULL);
 }
 
+/**
+ * wrap a packet that was read into `small`, and the part that didn't fit into `large`, in a pbuf chain.
+ * the buffers are returned to their pools if the packet can't be wrapped.
+ */
+static struct pbuf *rx_packet(struct rx_pbuf_s *small, struct rx_pbuf_s *large, size_t nr) {
+    struct pbuf *p = rx_pbuf_alloc(small, nr < RX_SMALL_BUF_SIZE ? nr : RX_SMALL_BUF_SIZE);
+    if (p == NULL) {
+        rx_pbuf_release(&small->pc.pbuf);
+        if (large != NULL) rx_pbuf_release(&large->pc.pbuf);
+        return NULL;
+    }
+    if (large == NULL) {
+        return p;
+    }
+
+    struct pbuf *tail = rx_pbuf_alloc(large, nr - RX_SMALL_BUF_SIZE);
+    if (tail == NULL) {
+        pbuf_free(p);
+        rx_pbuf_release(&large->pc.pbuf);
+        return NULL;
+    }
+    pbuf_cat(p, tail);
+    return p;
+}
+
 /**
  * This function should be called when a packet is ready to be read
- * from the interface. It uses the function low_level_input() that
- * should handle the actual reception of bytes from the network
- * interface.
+ * from the interface. Packets are read directly into pbufs from the
+ * receive pools, so lwip processes the bytes where the device put them.
+ * Packets are copied into PBUF_POOL pbufs when the receive pools are
+ * exhausted.
  */
 void netif_shim_input(struct netif *netif) {
+    static bool warned_rx_pool = false;
+    static bool rx_pool_exhausted = false;
+    static char copy_buf[BUFFER_SIZE];
     netif_driver dev = netif->state;
-    char buf[BUFFER_SIZE];
 
     int count = 0;
-    while (count < 128) {
-        ssize_t nr = dev->read(dev->handle, buf, sizeof(buf));
+    while (count < MAX_READS_PER_POLL) {
+        struct rx_pbuf_s *small = rx_pbuf_get(&rx_small_pool);
+        struct rx_pbuf_s *large = rx_pbuf_get(&rx_large_pool);
+        if ((small == NULL || large == NULL) != rx_pool_exhausted) {
+            rx_pool_exhausted = !rx_pool_exhausted;
+            if (rx_pool_exhausted && !warned_rx_pool) {
+                // this repeats whenever a busy upload holds its buffers, so only the first occurrence is a warning
+                TNL_LOG(WARN, "receive buffers exhausted (%d small, %d large in use). copying packets until buffers "
+                              "are released", rx_small_pool.allocated, rx_large_pool.allocated);
+                warned_rx_pool = true;
+            } else {
+                TNL_LOG(DEBUG, "receive buffers %s", rx_pool_exhausted ? "exhausted" : "available");
+            }
+        }
+
+        bool csum_valid = false;
+        ssize_t nr;
+        if (dev->readv != NULL) {
+            // the head of the packet goes into the small buffer, and only what doesn't fit into the large one
+            uv_buf_t bufs[2] = {
+                    uv_buf_init(small ? small->buf : copy_buf, RX_SMALL_BUF_SIZE),
+                    uv_buf_init(large ? large->buf : copy_buf + RX_SMALL_BUF_SIZE, RX_BUF_SIZE - RX_SMALL_BUF_SIZE),
+            };
+            nr = dev->readv(dev->handle, bufs, 2, &csum_valid);
+            if (nr > 0 && (small == NULL || (large == NULL && nr > RX_SMALL_BUF_SIZE))) {
+                // reassemble the packet in copy_buf
+                if (small != NULL) {
+                    memcpy(copy_buf, small->buf, RX_SMALL_BUF_SIZE);
+                }
+                if (large != NULL && nr > RX_SMALL_BUF_SIZE) {
+                    memcpy(copy_buf + RX_SMALL_BUF_SIZE, large->buf, nr - RX_SMALL_BUF_SIZE);
+                }
+                if (small != NULL) rx_pbuf_release(&small->pc.pbuf);
+                if (large != NULL) rx_pbuf_release(&large->pc.pbuf);
+                small = large = NULL;
+            }
+        } else {
+            // without readv the packet size isn't known up front. small packets are moved out of the large buffer
+            nr = dev->read(dev->handle, large ? large->buf : copy_buf, RX_BUF_SIZE);
+            if (nr > 0 && nr <= RX_SMALL_BUF_SIZE && small != NULL && large != NULL) {
+                memcpy(small->buf, large->buf, nr);
+            } else if (nr > RX_SMALL_BUF_SIZE && large != NULL) {
+                // the whole packet is in the large buffer
+                if (small != NULL) rx_pbuf_release(&small->pc.pbuf);
+                small = NULL;
+            } else if (nr > 0) {
+                if (large != NULL) memcpy(copy_buf, large->buf, nr);
+                if (small != NULL) rx_pbuf_release(&small->pc.pbuf);
+                if (large != NULL) rx_pbuf_release(&large->pc.pbuf);
+                small = large = NULL;
+            }
+        }
         if ((nr <= 0) || (nr > 0xffff)) {
+            if (small != NULL) rx_pbuf_release(&small->pc.pbuf);
+            if (large != NULL) rx_pbuf_release(&large->pc.pbuf);
             break;
         }
         count++;
 
-        if (ip_ver(buf) == 4)
-            TNL_LOG(TRACE, "received packet " PACKET_FMT " len=%zd", PACKET_FMT_ARGS(buf), nr);
+        if (small == NULL && large == NULL) {
+            if (ip_ver(copy_buf) == 4)
+                TNL_LOG(TRACE, "received packet " PACKET_FMT " len=%zd", PACKET_FMT_ARGS(copy_buf), nr);
+            on_packet(copy_buf, nr, netif);
+            continue;
+        }
+
+        if (large != NULL && small != NULL && nr <= RX_SMALL_BUF_SIZE) {
+            rx_pbuf_release(&large->pc.pbuf);
+            large = NULL;
+        }
+        struct pbuf *p;
+        if (small != NULL) {
+            small->csum_valid = csum_valid;
+            p = rx_packet(small, large, nr);
+        } else {
+            large->csum_valid = false;
+            p = rx_pbuf_alloc(large, nr);
+            if (p == NULL) {
+                rx_pbuf_release(&large->pc.pbuf);
+            }
+        }
+        if (p == NULL) {
+            TNL_LOG(WARN, "pbuf_alloced_custom failed for len=%zd, dropping packet", nr);
+            continue;
+        }
 
-        on_packet(buf, nr, netif);
+        if (ip_ver(p->payload) == 4)
+            TNL_LOG(TRACE, "received packet " PACKET_FMT " len=%zd", PACKET_FMT_ARGS(p->payload), nr);
+        input_pbuf(netif, p);
     }
     TNL_LOG(TRACE, "done after reading %d packets", count);
 }
@@ -97,11 +380,7 @@ void on_packet(const char *buf, ssize_t nr, void *ctx) {
         return;
     }
 
-    err_t err = netif->input(p, netif);
-    if (err != ERR_OK) {
-        TNL_LOG(ERR, "============================> tunif_input: netif input error %s", lwip_strerr(err));
-        pbuf_free(p);
-    }
+    input_pbuf(netif, p);
 }
 
 /**
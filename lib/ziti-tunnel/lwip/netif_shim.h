@@ -9,12 +9,26 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+#include "uv.h"
 #include "lwip/netif.h"
 
 err_t netif_shim_init(struct netif *netif);
 
 void netif_shim_input(struct netif *netif);
 
+/** write packets that were queued for drivers that implement writev */
+void netif_shim_flush(struct netif *netif);
+
+/**
+ * write a packet that is scattered across `bufs` right away, rather than queueing it, so the buffers only need to
+ * stay valid for the duration of the call.
+ */
+err_t netif_shim_writev(struct netif *netif, const uv_buf_t *bufs, unsigned int nbufs);
+
+/** returns true if `p` was read from a device that vouched for its transport checksum */
+bool netif_shim_csum_valid(const struct pbuf *p);
+
 void on_packet(const char *buf, ssize_t nr, void *netif);
 
 #ifdef __cplusplus
@@ -87,15 +87,48 @@ TEST_CASE("address_match", "[address]") {
     IP_ADDR4(&src_allowed, 10, 0, 10, 1);
     IP_ADDR4(&src_denied, 10, 0, 10, 2);
     intercept_ctx_add_allowed_source_address(intercept_s3, ZA_INIT_STR(&za, "10.0.10.1"));
-    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &src_allowed, &ip, 83) == intercept_s3);
     // s4 has a larger port range than s3, but no source ip whitelist
     REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &src_denied, &ip, 83) == intercept_s4);
+    // the denied source's answer must not be served to an allowed source
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &src_allowed, &ip, 83) == intercept_s3);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &src_denied, &ip, 83) == intercept_s4);
+
+    // answers that depend on the source aren't cached
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip, 83) == nullptr);
 
     // verify the intercept cache is populated
-    REQUIRE(model_map_get(&tctx.intercepts_cache, "tcp:127.0.0.1:80") == nullptr);
-    REQUIRE(model_map_get(&tctx.intercepts_cache, "tcp:192.168.0.88:80") == intercept_s1);
-    REQUIRE(model_map_get(&tctx.intercepts_cache, "tcp:192.168.0.10:80") == intercept_s2);
-    REQUIRE(model_map_get(&tctx.intercepts_cache, "tcp:192.168.0.10:81") == intercept_s3);
+    // s3 allows fewer sources, but s1 wins for every source
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, &ip, 80) == intercept_s1);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip, 80) == intercept_s1);
+    ip_addr_t ip10;
+    IP_ADDR4(&ip10, 192, 168, 0, 10);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip10, &ip10, 88) == intercept_s4);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip10, 88) == intercept_s4);
+    IP_ADDR4(&ip, 127, 0, 0, 1);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip, 80) == nullptr);
+
+    // an intercept that doesn't overlap leaves cached entries alone
+    intercept_ctx_t *intercept_s5 = intercept_ctx_new(&tctx, "s5", nullptr);
+    LIST_INSERT_HEAD(&tctx.intercepts, intercept_s5, entries);
+    intercept_ctx_add_address(intercept_s5, ZA_INIT_STR(&za, "10.1.0.0/16"));
+    intercept_ctx_add_protocol(intercept_s5, "tcp");
+    intercept_ctx_add_port_range(intercept_s5, 80, 80);
+    IP_ADDR4(&ip, 192, 168, 0, 88);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip, 80) == intercept_s1);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip10, 88) == intercept_s4);
+
+    // removing an intercept evicts only its own entries
+    LIST_REMOVE(intercept_s1, entries);
+    intercepts_changed(&tctx, intercept_s1);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip, 80) == nullptr);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip10, 88) == intercept_s4);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, &ip, 80) == intercept_s2);
+
+    // releasing an address evicts only its entries
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip, 80) == intercept_s2);
+    intercept_cache_evict_addr(&tctx, &ip);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip, 80) == nullptr);
+    REQUIRE(intercept_cache_get(&tctx, "tcp", &ip10, 88) == intercept_s4);
 
     // todo hostname and wildcard dns matching
 }
@@ -114,4 +147,37 @@ TEST_CASE("address_conversion", "[address]") {
     ziti_address_print(za_str, sizeof(za_str), &za_from_ip6);
     fprintf(stderr, "%s converted to %s\n", ip6_str, za_str);
     REQUIRE(ziti_address_match(&za_from_ip6, &za_from_str) == 0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("address_match_ipv6", "[address]") {
+    struct tunneler_ctx_s tctx = { };
+    ziti_address za;
+    ip_addr_t ip, src;
+    LIST_INIT(&tctx.intercepts);
+    ipaddr_aton("2001:db8::1", &src);
+
+    intercept_ctx_t *intercept_s1 = intercept_ctx_new(&tctx, "s1", nullptr);
+    LIST_INSERT_HEAD(&tctx.intercepts, intercept_s1, entries);
+    intercept_ctx_add_address(intercept_s1, ZA_INIT_STR(&za, "fd00:1::/32"));
+    intercept_ctx_add_protocol(intercept_s1, "udp");
+    intercept_ctx_add_port_range(intercept_s1, 1000, 2000);
+
+    intercept_ctx_t *intercept_s2 = intercept_ctx_new(&tctx, "s2", nullptr);
+    LIST_INSERT_HEAD(&tctx.intercepts, intercept_s2, entries);
+    intercept_ctx_add_address(intercept_s2, ZA_INIT_STR(&za, "fd00:1:2::/48"));
+    intercept_ctx_add_protocol(intercept_s2, "udp");
+    intercept_ctx_add_port_range(intercept_s2, 1500, 1500);
+
+    ipaddr_aton("fd00:1:2::5", &ip);
+    REQUIRE(lookup_intercept_by_address(&tctx, "udp", &src, &ip, 1500) == intercept_s2);
+    // longer prefix doesn't match the port, so fall back to the shorter prefix
+    REQUIRE(lookup_intercept_by_address(&tctx, "udp", &src, &ip, 1501) == intercept_s1);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &src, &ip, 1500) == nullptr);
+    ipaddr_aton("fd00:2::5", &ip);
+    REQUIRE(lookup_intercept_by_address(&tctx, "udp", &src, &ip, 1500) == nullptr);
+
+    // the index is rebuilt when intercepts change
+    intercept_ctx_add_port_range(intercept_s1, 53, 53);
+    ipaddr_aton("fd00:1:2::5", &ip);
+    REQUIRE(lookup_intercept_by_address(&tctx, "udp", &src, &ip, 53) == intercept_s1);
+}
@@ -0,0 +1,106 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "flow_table.h"
+
+TEST_CASE("flow_table", "[flow]") {
+    flow_table_t ft = { };
+    ip_addr_t client, svc, client6;
+    IP_ADDR4(&client, 100, 64, 0, 1);
+    IP_ADDR4(&svc, 100, 64, 0, 2);
+    IP_ADDR6_HOST(&client6, 0xfd000000, 0, 0, 1);
+    int pcb1, pcb2, pcb3;
+
+    REQUIRE(flow_table_get(&ft, &client, 5000, &svc, 80) == nullptr);
+
+    REQUIRE(flow_table_put(&ft, &client, 5000, &svc, 80, &pcb1) == 0);
+    REQUIRE(flow_table_put(&ft, &client6, 5000, &svc, 80, &pcb3) == 0);
+    REQUIRE(flow_table_get(&ft, &client, 5000, &svc, 80) == &pcb1);
+    REQUIRE(flow_table_get(&ft, &client6, 5000, &svc, 80) == &pcb3);
+    REQUIRE(flow_table_get(&ft, &client, 5001, &svc, 80) == nullptr);
+    REQUIRE(flow_table_get(&ft, &svc, 5000, &client, 80) == nullptr);
+
+    // a newer pcb takes over the flow; removing the stale pcb must not drop it
+    REQUIRE(flow_table_put(&ft, &client, 5000, &svc, 80, &pcb2) == 0);
+    flow_table_remove(&ft, &client, 5000, &svc, 80, &pcb1);
+    REQUIRE(flow_table_get(&ft, &client, 5000, &svc, 80) == &pcb2);
+    flow_table_remove(&ft, &client, 5000, &svc, 80, &pcb2);
+    REQUIRE(flow_table_get(&ft, &client, 5000, &svc, 80) == nullptr);
+
+    // grow past the initial bucket count
+    for (u16_t port = 1; port <= 1000; port++) {
+        REQUIRE(flow_table_put(&ft, &client, port, &svc, 443, &pcb1) == 0);
+    }
+    CHECK(ft.count == 1001);
+    CHECK(ft.nbuckets >= ft.count);
+    for (u16_t port = 1; port <= 1000; port++) {
+        REQUIRE(flow_table_get(&ft, &client, port, &svc, 443) == &pcb1);
+    }
+
+    flow_table_clear(&ft);
+    CHECK(ft.count == 0);
+    REQUIRE(flow_table_get(&ft, &client6, 5000, &svc, 80) == nullptr);
+    CHECK(flow_table_dst_count(&ft, &svc) == 0);
+}
+
+TEST_CASE("flow_table counts flows per destination", "[flow]") {
+    flow_table_t ft = { };
+    ip_addr_t client, svc, svc6;
+    IP_ADDR4(&client, 100, 64, 0, 1);
+    IP_ADDR4(&svc, 100, 64, 0, 2);
+    IP_ADDR6_HOST(&svc6, 0xfd007a69, 0x74690000, 0, 2);
+    int pcb1, pcb2;
+
+    CHECK(flow_table_dst_count(&ft, &svc) == 0);
+
+    REQUIRE(flow_table_put(&ft, &client, 5000, &svc, 80, &pcb1) == 0);
+    REQUIRE(flow_table_put(&ft, &client, 5001, &svc, 443, &pcb1) == 0);
+    REQUIRE(flow_table_put(&ft, &client, 5000, &svc6, 80, &pcb1) == 0);
+    CHECK(flow_table_dst_count(&ft, &svc) == 2);
+    CHECK(flow_table_dst_count(&ft, &svc6) == 1);
+    CHECK(flow_table_dst_count(&ft, &client) == 0);
+
+    // taking over a flow doesn't count it twice, and removing the stale pcb doesn't uncount it
+    REQUIRE(flow_table_put(&ft, &client, 5000, &svc, 80, &pcb2) == 0);
+    CHECK(flow_table_dst_count(&ft, &svc) == 2);
+    flow_table_remove(&ft, &client, 5000, &svc, 80, &pcb1);
+    CHECK(flow_table_dst_count(&ft, &svc) == 2);
+
+    flow_table_remove(&ft, &client, 5000, &svc, 80, &pcb2);
+    flow_table_remove(&ft, &client, 5001, &svc, 443, &pcb1);
+    CHECK(flow_table_dst_count(&ft, &svc) == 0);
+    CHECK(flow_table_dst_count(&ft, &svc6) == 1);
+    CHECK(ft.ndsts == 1);
+
+    // grow past the initial bucket count
+    for (u8_t i = 1; i <= 200; i++) {
+        ip_addr_t dst;
+        IP_ADDR4(&dst, 100, 64, 1, i);
+        REQUIRE(flow_table_put(&ft, &client, 6000, &dst, 80, &pcb1) == 0);
+        REQUIRE(flow_table_put(&ft, &client, 6001, &dst, 80, &pcb1) == 0);
+    }
+    CHECK(ft.ndsts == 201);
+    for (u8_t i = 1; i <= 200; i++) {
+        ip_addr_t dst;
+        IP_ADDR4(&dst, 100, 64, 1, i);
+        CHECK(flow_table_dst_count(&ft, &dst) == 2);
+    }
+
+    flow_table_clear(&ft);
+    CHECK(ft.ndsts == 0);
+    CHECK(flow_table_dst_count(&ft, &svc6) == 0);
+}
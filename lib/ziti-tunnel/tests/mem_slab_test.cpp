@@ -0,0 +1,72 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "catch2/catch.hpp"
+#include "lwip/mem_slab.h"
+
+TEST_CASE("mem_slab reuses freed objects", "[slab]") {
+    void *a = mem_slab_malloc(100);
+    REQUIRE(a != nullptr);
+    CHECK(((uintptr_t) a) % 16 == 0);
+    memset(a, 0xAB, 100);
+    mem_slab_free(a);
+    CHECK(mem_slab_malloc(100) == a);
+    mem_slab_free(a);
+
+    // sizes beyond the largest class are allocated directly
+    size_t before = mem_slab_reserved();
+    void *big = mem_slab_malloc(256 * 1024);
+    REQUIRE(big != nullptr);
+    memset(big, 0xAB, 256 * 1024);
+    CHECK(mem_slab_reserved() == before);
+    mem_slab_free(big);
+
+    auto z = static_cast<unsigned char *>(mem_slab_calloc(10, 32));
+    REQUIRE(z != nullptr);
+    for (int i = 0; i < 10 * 32; i++) {
+        CHECK(z[i] == 0);
+    }
+    mem_slab_free(z);
+    CHECK(mem_slab_calloc(SIZE_MAX, 2) == nullptr);
+}
+
+TEST_CASE("mem_slab grows and shrinks", "[slab]") {
+    size_t before = mem_slab_reserved();
+
+    std::vector<void *> objs;
+    for (int i = 0; i < 10000; i++) {
+        void *p = mem_slab_malloc(200);
+        REQUIRE(p != nullptr);
+        memset(p, i, 200);
+        objs.push_back(p);
+    }
+    size_t grown = mem_slab_reserved();
+    CHECK(grown >= before + 10000 * 200);
+
+    // free every other object first, so slabs are released only once they are empty
+    for (size_t i = 0; i < objs.size(); i += 2) {
+        mem_slab_free(objs[i]);
+    }
+    CHECK(mem_slab_reserved() == grown);
+    for (size_t i = 1; i < objs.size(); i += 2) {
+        mem_slab_free(objs[i]);
+    }
+    // one empty slab per size class is kept
+    CHECK(mem_slab_reserved() <= before + 64 * 1024 + 1024);
+}
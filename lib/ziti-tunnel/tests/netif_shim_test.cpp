@@ -0,0 +1,195 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "catch2/catch.hpp"
+#include "ziti/netif_driver.h"
+#include "netif_shim.h"
+
+/** a driver that hands out one queued packet per read */
+struct fake_dev {
+    std::vector<std::vector<char>> pkts;
+    size_t next;
+};
+
+static ssize_t fake_read(netif_handle h, void *buf, size_t buf_len) {
+    auto dev = reinterpret_cast<fake_dev *>(h);
+    if (dev->next == dev->pkts.size()) {
+        return 0;
+    }
+    auto &pkt = dev->pkts[dev->next++];
+    size_t len = pkt.size() < buf_len ? pkt.size() : buf_len;
+    memcpy(buf, pkt.data(), len);
+    return (ssize_t) len;
+}
+
+/** scatters the next packet across `bufs`, like readv(2) */
+static ssize_t fake_readv(netif_handle h, const uv_buf_t *bufs, unsigned int nbufs, bool *csum_valid) {
+    auto dev = reinterpret_cast<fake_dev *>(h);
+    if (dev->next == dev->pkts.size()) {
+        return 0;
+    }
+    auto &pkt = dev->pkts[dev->next++];
+    size_t off = 0;
+    for (unsigned int i = 0; i < nbufs && off < pkt.size(); i++) {
+        size_t len = pkt.size() - off < bufs[i].len ? pkt.size() - off : bufs[i].len;
+        memcpy(bufs[i].base, pkt.data() + off, len);
+        off += len;
+    }
+    *csum_valid = true;
+    return (ssize_t) off;
+}
+
+static std::vector<char> written;
+
+static ssize_t fake_write(netif_handle h, const void *buf, size_t len) {
+    written.assign((const char *) buf, (const char *) buf + len);
+    return (ssize_t) len;
+}
+
+static std::vector<std::vector<char>> received;
+static std::vector<bool> received_csum_valid;
+
+static err_t capture_input(struct pbuf *p, struct netif *netif) {
+    std::vector<char> pkt(p->tot_len);
+    pbuf_copy_partial(p, pkt.data(), p->tot_len, 0);
+    received.push_back(pkt);
+    received_csum_valid.push_back(netif_shim_csum_valid(p));
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static std::vector<char> make_packet(size_t len) {
+    std::vector<char> pkt(len);
+    for (size_t i = 0; i < len; i++) {
+        pkt[i] = (char) (i * 7);
+    }
+    pkt[0] = 0x45; // ipv4, ihl=5
+    pkt[9] = 17;   // udp
+    return pkt;
+}
+
+TEST_CASE("netif_shim_input", "[netif]") {
+    fake_dev dev = { };
+    netif_driver_t driver = { };
+    driver.handle = reinterpret_cast<netif_handle>(&dev);
+    driver.read = fake_read;
+
+    struct netif netif = { };
+    netif.state = &driver;
+    netif.input = capture_input;
+    received.clear();
+
+    dev.pkts.push_back(make_packet(60));
+    dev.pkts.push_back(make_packet(1500));
+    // the largest packet a u16_t pbuf length can describe
+    dev.pkts.push_back(make_packet(0xFFFF));
+
+    netif_shim_input(&netif);
+
+    REQUIRE(received.size() == dev.pkts.size());
+    for (size_t i = 0; i < dev.pkts.size(); i++) {
+        CHECK(received[i] == dev.pkts[i]);
+    }
+
+    // receive buffers were returned to the pool and are reused
+    dev.pkts.push_back(make_packet(100));
+    netif_shim_input(&netif);
+    REQUIRE(received.size() == 4);
+    CHECK(received[3] == dev.pkts[3]);
+}
+
+TEST_CASE("netif_shim_input readv", "[netif]") {
+    fake_dev dev = { };
+    netif_driver_t driver = { };
+    driver.handle = reinterpret_cast<netif_handle>(&dev);
+    driver.read = fake_read;
+    driver.readv = fake_readv;
+
+    struct netif netif = { };
+    netif.state = &driver;
+    netif.input = capture_input;
+    received.clear();
+    received_csum_valid.clear();
+
+    // packets that fit the small buffer, and packets that spill into a large one
+    dev.pkts.push_back(make_packet(60));
+    dev.pkts.push_back(make_packet(2048));
+    dev.pkts.push_back(make_packet(2049));
+    dev.pkts.push_back(make_packet(0xFFFF));
+
+    netif_shim_input(&netif);
+
+    REQUIRE(received.size() == dev.pkts.size());
+    for (size_t i = 0; i < dev.pkts.size(); i++) {
+        CHECK(received[i] == dev.pkts[i]);
+        CHECK(received_csum_valid[i]);
+    }
+}
+
+TEST_CASE("netif_shim_csum_valid", "[netif]") {
+    fake_dev dev = { };
+    netif_driver_t driver = { };
+    driver.handle = reinterpret_cast<netif_handle>(&dev);
+    driver.read = fake_read;
+
+    struct netif netif = { };
+    netif.state = &driver;
+    netif.input = capture_input;
+    received.clear();
+    received_csum_valid.clear();
+
+    // a driver that only implements read doesn't vouch for anything
+    dev.pkts.push_back(make_packet(100));
+    netif_shim_input(&netif);
+    REQUIRE(received_csum_valid.size() == 1);
+    CHECK_FALSE(received_csum_valid[0]);
+
+    driver.readv = fake_readv;
+    dev.pkts.push_back(make_packet(100));
+    netif_shim_input(&netif);
+    REQUIRE(received_csum_valid.size() == 2);
+    CHECK(received_csum_valid[1]);
+
+    // pbufs that weren't read by the shim
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, 100, PBUF_RAM);
+    REQUIRE(p != nullptr);
+    CHECK_FALSE(netif_shim_csum_valid(p));
+    pbuf_free(p);
+}
+
+TEST_CASE("netif_shim_writev", "[netif]") {
+    fake_dev dev = { };
+    netif_driver_t driver = { };
+    driver.handle = reinterpret_cast<netif_handle>(&dev);
+    driver.write = fake_write;
+
+    struct netif netif = { };
+    netif.state = &driver;
+
+    // without writev, the buffers are flattened into one write
+    char hdr[] = "header";
+    char data[] = "payload";
+    uv_buf_t bufs[2] = {
+            uv_buf_init(hdr, sizeof(hdr) - 1),
+            uv_buf_init(data, sizeof(data) - 1),
+    };
+    written.clear();
+    CHECK(netif_shim_writev(&netif, bufs, 2) == ERR_OK);
+    CHECK(std::string(written.begin(), written.end()) == "headerpayload");
+}
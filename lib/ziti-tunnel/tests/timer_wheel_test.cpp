@@ -0,0 +1,94 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <vector>
+#include "catch2/catch.hpp"
+#include "timer_wheel.h"
+
+static void collect(timer_wheel_entry_t *e, void *ctx) {
+    static_cast<std::vector<timer_wheel_entry_t *> *>(ctx)->push_back(e);
+}
+
+TEST_CASE("timer_wheel_expiry", "[timer]") {
+    timer_wheel_t tw;
+    timer_wheel_init(&tw, 1000, 500);
+    std::vector<timer_wheel_entry_t *> fired;
+
+    timer_wheel_entry_t a = {}, b = {}, c = {};
+    timer_wheel_touch(&tw, &a, 500 + 5000);
+    timer_wheel_touch(&tw, &b, 500 + 30000);
+    timer_wheel_touch(&tw, &c, 500 + 3600 * 1000);
+    CHECK(tw.count == 3);
+
+    // never early, at most one tick late
+    CHECK(timer_wheel_advance(&tw, 5499, collect, &fired) == 0);
+    CHECK(timer_wheel_advance(&tw, 6000, collect, &fired) == 1);
+    REQUIRE(fired.size() == 1);
+    CHECK(fired[0] == &a);
+    CHECK(a.wheel == nullptr);
+
+    // activity pushes the deadline out with a plain store
+    b.expires = 20000 + 30000;
+    CHECK(timer_wheel_advance(&tw, 31000, collect, &fired) == 0);
+    CHECK(timer_wheel_advance(&tw, 49999, collect, &fired) == 0);
+    CHECK(timer_wheel_advance(&tw, 50000, collect, &fired) == 1);
+    CHECK(fired.back() == &b);
+
+    // an earlier deadline re-files the entry
+    timer_wheel_touch(&tw, &c, 55000);
+    CHECK(timer_wheel_advance(&tw, 55000, collect, &fired) == 1);
+    CHECK(fired.back() == &c);
+    CHECK(tw.count == 0);
+}
+
+TEST_CASE("timer_wheel_levels", "[timer]") {
+    timer_wheel_t tw;
+    timer_wheel_init(&tw, 1, 0);
+    std::vector<timer_wheel_entry_t *> fired;
+
+    // deadlines on every level, and one beyond the top
+    const uint64_t deadlines[] = { 1, 63, 64, 65, 4095, 4096, 4097, 300000, 16777215, 16777216, 20000000 };
+    const size_t n = sizeof(deadlines) / sizeof(deadlines[0]);
+    timer_wheel_entry_t entries[n] = {};
+    for (size_t i = 0; i < n; i++) {
+        timer_wheel_touch(&tw, &entries[i], deadlines[i]);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        CHECK(timer_wheel_advance(&tw, deadlines[i] - 1, collect, &fired) == 0);
+        CHECK(timer_wheel_advance(&tw, deadlines[i], collect, &fired) == 1);
+        REQUIRE(fired.size() == i + 1);
+        CHECK(fired[i] == &entries[i]);
+    }
+    CHECK(tw.count == 0);
+}
+
+TEST_CASE("timer_wheel_remove", "[timer]") {
+    timer_wheel_t tw;
+    timer_wheel_init(&tw, 10, 0);
+    std::vector<timer_wheel_entry_t *> fired;
+
+    timer_wheel_entry_t a = {}, b = {};
+    timer_wheel_touch(&tw, &a, 100);
+    timer_wheel_touch(&tw, &b, 100);
+    timer_wheel_remove(&a);
+    timer_wheel_remove(&a);
+    CHECK(tw.count == 1);
+
+    CHECK(timer_wheel_advance(&tw, 100, collect, &fired) == 1);
+    REQUIRE(fired.size() == 1);
+    CHECK(fired[0] == &b);
+}
@@ -0,0 +1,130 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SPAN(l) ((uint64_t) 1 << (TIMER_WHEEL_BITS * (l)))
+
+static uint64_t due_tick(const timer_wheel_t *tw, uint64_t expires) {
+    return (expires + tw->tick - 1) / tw->tick;
+}
+
+/** file `e` relative to `base`, the first tick that has not been processed */
+static void file_entry(timer_wheel_t *tw, timer_wheel_entry_t *e, uint64_t base) {
+    uint64_t due = due_tick(tw, e->expires);
+    if (due < base) {
+        due = base;
+    }
+    uint64_t delta = due - base;
+    if (delta >= LEVEL_SPAN(TIMER_WHEEL_LEVELS)) {
+        // beyond the top level. park it as far out as possible; it is re-filed when it comes up
+        delta = LEVEL_SPAN(TIMER_WHEEL_LEVELS) - 1;
+        due = base + delta;
+    }
+    int level = 0;
+    while (delta >= LEVEL_SPAN(level + 1)) {
+        level++;
+    }
+    e->due = due;
+    LIST_INSERT_HEAD(&tw->slots[level][(due >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK], e, _next);
+}
+
+/** move the entries of `slot` to `to`, leaving `slot` empty */
+static void take_slot(struct timer_wheel_slot_s *slot, struct timer_wheel_slot_s *to) {
+    to->lh_first = slot->lh_first;
+    if (to->lh_first != NULL) {
+        to->lh_first->_next.le_prev = &to->lh_first;
+    }
+    LIST_INIT(slot);
+}
+
+void timer_wheel_init(timer_wheel_t *tw, uint64_t tick, uint64_t now) {
+    tw->tick = tick > 0 ? tick : 1;
+    tw->current = now / tw->tick;
+    tw->count = 0;
+    for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        for (int s = 0; s < TIMER_WHEEL_SLOTS; s++) {
+            LIST_INIT(&tw->slots[l][s]);
+        }
+    }
+}
+
+void timer_wheel_add(timer_wheel_t *tw, timer_wheel_entry_t *e) {
+    timer_wheel_remove(e);
+    file_entry(tw, e, tw->current + 1);
+    e->wheel = tw;
+    tw->count++;
+}
+
+void timer_wheel_touch(timer_wheel_t *tw, timer_wheel_entry_t *e, uint64_t expires) {
+    e->expires = expires;
+    if (e->wheel == NULL || due_tick(tw, expires) < e->due) {
+        timer_wheel_add(tw, e);
+    }
+}
+
+void timer_wheel_remove(timer_wheel_entry_t *e) {
+    if (e->wheel == NULL) {
+        return;
+    }
+    LIST_REMOVE(e, _next);
+    e->wheel->count--;
+    e->wheel = NULL;
+}
+
+size_t timer_wheel_advance(timer_wheel_t *tw, uint64_t now, timer_wheel_cb cb, void *ctx) {
+    uint64_t target = now / tw->tick;
+    size_t expired = 0;
+
+    while (tw->current < target) {
+        if (tw->count == 0) {
+            tw->current = target;
+            break;
+        }
+        uint64_t t = tw->current + 1;
+        struct timer_wheel_slot_s pending;
+
+        // bring down the next span of each level that has wrapped around
+        for (int l = 1; l < TIMER_WHEEL_LEVELS && ((t >> (TIMER_WHEEL_BITS * (l - 1))) & SLOT_MASK) == 0; l++) {
+            take_slot(&tw->slots[l][(t >> (TIMER_WHEEL_BITS * l)) & SLOT_MASK], &pending);
+            timer_wheel_entry_t *e;
+            while ((e = LIST_FIRST(&pending)) != NULL) {
+                LIST_REMOVE(e, _next);
+                file_entry(tw, e, t);
+            }
+        }
+
+        take_slot(&tw->slots[0][t & SLOT_MASK], &pending);
+        tw->current = t;
+
+        // callbacks may add or remove entries, including ones still in `pending`
+        timer_wheel_entry_t *e;
+        while ((e = LIST_FIRST(&pending)) != NULL) {
+            LIST_REMOVE(e, _next);
+            if (due_tick(tw, e->expires) > t) {
+                // pushed out since it was filed
+                file_entry(tw, e, t + 1);
+                continue;
+            }
+            e->wheel = NULL;
+            tw->count--;
+            expired++;
+            cb(e, ctx);
+        }
+    }
+    return expired;
+}
@@ -0,0 +1,78 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_TIMER_WHEEL_H
+#define ZITI_TUNNELER_SDK_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ziti/sys/queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/**
+ * an entry's deadline can be pushed out by storing a later `expires`; the entry is only re-filed when its slot
+ * comes up. use timer_wheel_touch to move a deadline in either direction.
+ */
+typedef struct timer_wheel_entry_s {
+    uint64_t expires; // ms, same clock as the `now` given to the wheel
+    uint64_t due;     // tick that the entry is filed under
+    void *data;
+    struct timer_wheel_s *wheel; // NULL when not scheduled
+    LIST_ENTRY(timer_wheel_entry_s) _next;
+} timer_wheel_entry_t;
+
+LIST_HEAD(timer_wheel_slot_s, timer_wheel_entry_s);
+
+/**
+ * hierarchical timing wheel with a coarse tick. entries fire in the first tick at or after their deadline, so they
+ * can run up to one tick late but never early.
+ */
+typedef struct timer_wheel_s {
+    uint64_t tick;    // ms per tick
+    uint64_t current; // last tick that was processed
+    size_t count;
+    struct timer_wheel_slot_s slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+/** called for each expired entry. the entry is unscheduled before the call, and may be freed or re-added */
+typedef void (*timer_wheel_cb)(timer_wheel_entry_t *e, void *ctx);
+
+extern void timer_wheel_init(timer_wheel_t *tw, uint64_t tick, uint64_t now);
+
+/** schedule `e` to expire at `e->expires`. an entry that is already scheduled is re-filed */
+extern void timer_wheel_add(timer_wheel_t *tw, timer_wheel_entry_t *e);
+
+/** set the deadline of `e`, scheduling it if needed. only re-files the entry when the deadline moves earlier */
+extern void timer_wheel_touch(timer_wheel_t *tw, timer_wheel_entry_t *e, uint64_t expires);
+
+/** unschedule `e`. does nothing if it is not scheduled */
+extern void timer_wheel_remove(timer_wheel_entry_t *e);
+
+/** process all ticks up to `now`, calling `cb` for entries that have expired. returns the number of expired entries */
+extern size_t timer_wheel_advance(timer_wheel_t *tw, uint64_t now, timer_wheel_cb cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_TIMER_WHEEL_H
@@ -19,6 +19,8 @@
 #include "tunnel_tcp.h"
 #include "lwip_cloned_fns.h"
 #include "ziti_tunnel_priv.h"
+#include "flow_table.h"
+#include "lwip/memp.h"
 #include "ziti/sys/queue.h"
 
 #if _WIN32
@@ -60,6 +62,115 @@ static const char* tcp_state_str(int st) {
     return tcp_labels[st];
 }
 
+/** index of intercepted tcp connections. entries are dropped when lwip frees the pcb */
+static flow_table_t tcp_flows;
+static u8_t tcp_flow_ext_id;
+
+static void on_tcp_pcb_destroyed(u8_t id, void *data) {
+    struct tcp_pcb *pcb = data;
+    flow_table_remove(&tcp_flows, &pcb->remote_ip, pcb->remote_port, &pcb->local_ip, pcb->local_port, pcb);
+}
+
+static const struct tcp_ext_arg_callbacks tcp_flow_callbacks = {
+        .destroy = on_tcp_pcb_destroyed,
+};
+
+/** bytes of ziti data that a connection may hold while waiting for the client to ack them */
+#define TCP_HELD_MAX (4 * TCP_SND_BUF)
+
+/**
+ * a block of data received from ziti. lwip queues segments that reference it rather than copies of it,
+ * so it is kept until the client has acked all of it.
+ */
+struct held_chunk_s {
+    STAILQ_ENTRY(held_chunk_s) _next;
+    size_t len;
+    size_t written; /* bytes handed to lwip */
+    size_t acked;   /* bytes acked by the client */
+    uint8_t data[];
+};
+
+enum held_fin_e {
+    held_fin_none,
+    held_fin_shutdown,
+    held_fin_close,
+};
+
+/**
+ * ziti data held for a tcp connection, and the receive window offered to the client. this belongs to the pcb
+ * rather than the io context, since lwip keeps (re)transmitting held data after the ziti side is closed.
+ */
+struct tcp_held_s {
+    STAILQ_HEAD(held_chunks_s, held_chunk_s) chunks;
+    size_t held;         /* bytes accepted from ziti and not yet acked */
+    size_t pending;      /* bytes accepted from ziti and not yet handed to lwip */
+    enum held_fin_e fin; /* close deferred until pending bytes are handed to lwip */
+    u32_t rcv_wnd;       /* receive window offered to the client, including data that is not yet written to ziti */
+    u32_t rcv_withheld;  /* credit kept back from tcp_recved after the window shrank */
+};
+
+static u8_t tcp_held_ext_id;
+
+/**
+ * chunks that lwip is done with. packets queued for the netif may still reference them (a retransmission that was
+ * acked before it was written), so they are freed after the queue is flushed.
+ */
+static STAILQ_HEAD(retired_chunks_s, held_chunk_s) retired_chunks = STAILQ_HEAD_INITIALIZER(retired_chunks);
+
+void tunneler_tcp_free_retired(void) {
+    struct held_chunk_s *c;
+    while ((c = STAILQ_FIRST(&retired_chunks)) != NULL) {
+        STAILQ_REMOVE_HEAD(&retired_chunks, _next);
+        free(c);
+    }
+}
+
+static void on_tcp_held_destroyed(u8_t id, void *data) {
+    struct tcp_held_s *held = data;
+    STAILQ_CONCAT(&retired_chunks, &held->chunks);
+    free(held);
+}
+
+static const struct tcp_ext_arg_callbacks tcp_held_callbacks = {
+        .destroy = on_tcp_held_destroyed,
+};
+
+static unsigned int tcp_conn_limit = MEMP_NUM_TCP_PCB;
+
+void tunneler_tcp_set_conn_limit(unsigned int limit) {
+    tcp_conn_limit = limit > 0 ? limit : MEMP_NUM_TCP_PCB;
+}
+
+unsigned int tunneler_tcp_conn_limit(void) {
+    return tcp_conn_limit;
+}
+
+size_t tunneler_tcp_addr_flows(const ip_addr_t *addr) {
+    return flow_table_dst_count(&tcp_flows, addr);
+}
+
+/**
+ * returns true if a new pcb may be allocated. when at the limit, the oldest TIME_WAIT connection is
+ * recycled, as lwip does when its static pcb pool is exhausted.
+ */
+static bool tcp_conn_available(void) {
+    if (memp_pools[MEMP_TCP_PCB]->stats->used < tcp_conn_limit) {
+        return true;
+    }
+
+    struct tcp_pcb *oldest = NULL;
+    for (struct tcp_pcb *tpcb = tcp_tw_pcbs; tpcb != NULL; tpcb = tpcb->next) {
+        if (oldest == NULL || (u32_t) (tcp_ticks - tpcb->tmr) >= (u32_t) (tcp_ticks - oldest->tmr)) {
+            oldest = tpcb;
+        }
+    }
+    if (oldest != NULL) {
+        tcp_abort(oldest);
+        return true;
+    }
+    return false;
+}
+
 /** called by lwip when a client sends a SYN segment to an intercepted address.
  * this only exists to appease lwip */
 static err_t on_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
@@ -76,7 +187,10 @@ static struct tcp_pcb *new_tcp_pcb(ip_addr_t src, ip_addr_t dest, struct tcp_hdr
             TNL_LOG(ERR, "failed to allocate listener");
             return NULL;
         }
+        memset(phony_listener, 0, sizeof(*phony_listener));
         phony_listener->accept = on_accept;
+        tcp_flow_ext_id = tcp_ext_arg_alloc_id();
+        tcp_held_ext_id = tcp_ext_arg_alloc_id();
     }
     struct tcp_pcb *npcb = tcp_new();
     if (npcb == NULL) {
@@ -103,6 +217,24 @@ static struct tcp_pcb *new_tcp_pcb(ip_addr_t src, ip_addr_t dest, struct tcp_hdr
 
     /* Register the new PCB so that we can begin receiving segments for it. */
     TCP_REG_ACTIVE(npcb);
+    if (flow_table_put(&tcp_flows, &src, npcb->remote_port, &dest, npcb->local_port, npcb) != 0) {
+        TNL_LOG(ERR, "failed to index tcp flow");
+        tcp_abandon(npcb, 0);
+        return NULL;
+    }
+    tcp_ext_arg_set(npcb, tcp_flow_ext_id, npcb);
+    tcp_ext_arg_set_callbacks(npcb, tcp_flow_ext_id, &tcp_flow_callbacks);
+
+    struct tcp_held_s *held = calloc(1, sizeof(struct tcp_held_s));
+    if (held == NULL) {
+        TNL_LOG(ERR, "failed to allocate held data");
+        tcp_abandon(npcb, 0);
+        return NULL;
+    }
+    STAILQ_INIT(&held->chunks);
+    held->rcv_wnd = npcb->rcv_wnd;
+    tcp_ext_arg_set(npcb, tcp_held_ext_id, held);
+    tcp_ext_arg_set_callbacks(npcb, tcp_held_ext_id, &tcp_held_callbacks);
 
     /* Parse any options in the SYN. */
     tunneler_tcp_input(p);
@@ -118,7 +250,7 @@ static struct tcp_pcb *new_tcp_pcb(ip_addr_t src, ip_addr_t dest, struct tcp_hdr
     MIB2_STATS_INC(mib2.tcppassiveopens);
 
 #if LWIP_TCP_PCB_NUM_EXT_ARGS
-    if (tcp_ext_arg_invoke_callbacks_passive_open(pcb, npcb) != ERR_OK) {
+    if (tcp_ext_arg_invoke_callbacks_passive_open(phony_listener, npcb) != ERR_OK) {
       tcp_abandon(npcb, 0);
       return NULL;
     }
@@ -148,13 +280,26 @@ static err_t on_tcp_client_data(void *io_ctx, struct tcp_pcb *pcb, struct pbuf *
         return err;
     }
 
-    p = pbuf_coalesce(p, PBUF_RAW);
-    u16_t len = p->len;
     struct write_ctx_s *wr_ctx = calloc(1, sizeof(struct write_ctx_s));
-    wr_ctx->pbuf = p;
     wr_ctx->tcp = pcb;
     wr_ctx->ack = tunneler_tcp_ack;
-    ssize_t s = io->write_fn(io->ziti_io, wr_ctx, p->payload, len);
+    ssize_t s;
+    if (io->writev_fn != NULL && pbuf_clen(p) <= ZITI_SDK_MAX_WRITEV_BUFS) {
+        // hand the chain over as-is. it is freed when the whole write is acked
+        uv_buf_t bufs[ZITI_SDK_MAX_WRITEV_BUFS];
+        unsigned int nbufs = 0;
+        for (struct pbuf *q = p; q != NULL; q = q->next) {
+            if (q->len > 0) { // each buffer becomes a ziti message, and an empty one would read as EOF
+                bufs[nbufs++] = uv_buf_init(q->payload, q->len);
+            }
+        }
+        wr_ctx->pbuf = p;
+        s = io->writev_fn(io->ziti_io, wr_ctx, bufs, nbufs);
+    } else {
+        p = pbuf_coalesce(p, PBUF_RAW);
+        wr_ctx->pbuf = p;
+        s = io->write_fn(io->ziti_io, wr_ctx, p->payload, p->len);
+    }
     if (s == ERR_WOULDBLOCK) {
         // apply backpressure -- let LWIP keep the data and retry later
         TNL_LOG(VERBOSE, "ziti_write indicated backpressure: service=%s, client=%s", io->tnlr_io->service_name, io->tnlr_io->client);
@@ -193,39 +338,192 @@ static void on_tcp_client_err(void *io_ctx, err_t err) {
     }
 }
 
+/** hands pending held data to lwip, as much as the send buffer allows. */
+static err_t push_held(struct tcp_pcb *pcb, struct tcp_held_s *held) {
+    struct held_chunk_s *c;
+    STAILQ_FOREACH(c, &held->chunks, _next) {
+        while (c->written < c->len) {
+            size_t n = MIN(c->len - c->written, tcp_sndbuf(pcb));
+            n = MIN(n, 0xffff);
+            if (n == 0 || tcp_sndqueuelen(pcb) >= TCP_SND_QUEUELEN) {
+                return ERR_OK; // the rest is pushed when the client acks
+            }
+            // no TCP_WRITE_FLAG_COPY: lwip references the chunk until the client acks it
+            err_t err = tcp_write(pcb, c->data + c->written, (u16_t) n, 0);
+            if (err == ERR_MEM) {
+                return ERR_OK;
+            }
+            if (err != ERR_OK) {
+                return err;
+            }
+            c->written += n;
+            held->pending -= n;
+        }
+    }
+    return ERR_OK;
+}
+
+/** drops data from a client whose ziti connection is gone, while held data is still waiting to be sent */
+static err_t on_tcp_client_data_closed(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    if (p != NULL) {
+        tcp_recved(pcb, p->tot_len);
+        pbuf_free(p);
+    }
+    return ERR_OK;
+}
+
+/**
+ * called by lwip when the client acks data. acked chunks are released, and data that did not fit in the
+ * send buffer is handed to lwip.
+ */
+static err_t on_tcp_client_ack(void *io_ctx, struct tcp_pcb *pcb, u16_t len) {
+    struct tcp_held_s *held = tcp_ext_arg_get(pcb, tcp_held_ext_id);
+    if (held == NULL) {
+        return ERR_OK;
+    }
+
+    size_t acked = len;
+    struct held_chunk_s *c;
+    while (acked > 0 && (c = STAILQ_FIRST(&held->chunks)) != NULL) {
+        size_t n = MIN(acked, c->written - c->acked);
+        c->acked += n;
+        held->held -= n;
+        acked -= n;
+        if (c->acked < c->len) {
+            break;
+        }
+        STAILQ_REMOVE_HEAD(&held->chunks, _next);
+        STAILQ_INSERT_TAIL(&retired_chunks, c, _next);
+    }
+
+    err_t err = push_held(pcb, held);
+    if (err != ERR_OK) {
+        LOG_STATE(ERR, "failed to tcp_write held data: err=%d", pcb, err);
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+
+    if (held->pending == 0 && held->fin != held_fin_none) {
+        enum held_fin_e fin = held->fin;
+        held->fin = held_fin_none;
+        LOG_STATE(DEBUG, "held data queued, sending FIN", pcb);
+        err = fin == held_fin_close ? tcp_close(pcb) : tcp_shutdown(pcb, 0, 1);
+        if (err != ERR_OK) {
+            LOG_STATE(ERR, "deferred close failed; err=%d", pcb, err);
+        }
+    }
+    // lwip calls tcp_output once this returns
+    return ERR_OK;
+}
+
+/**
+ * called by the tunneler app with data from ziti. returns the number of bytes accepted, which is less than
+ * len when the connection already holds TCP_HELD_MAX bytes. the sdk keeps the rest and offers it again later;
+ * nothing signals it when acks free up room.
+ *
+ * this is still one malloc and memcpy per delivery. the sdk only lends `data` for the duration of the call and
+ * has no way to keep its buffer (and withhold the receive credit) until tcp_sent, so the bytes are copied into
+ * a held chunk which lwip references until the client acks it. going copy-free needs that api in the sdk.
+ */
 ssize_t tunneler_tcp_write(struct tcp_pcb *pcb, const void *data, size_t len) {
     if (pcb == NULL) {
         TNL_LOG(WARN, "null pcb");
         return -1;
     }
 
-    int qlen = tcp_sndqueuelen(pcb);
-    if (qlen > TCP_SND_QUEUELEN) {
-        TNL_LOG(WARN, "sndqueuelen limit reached (%d > %d)", qlen, TCP_SND_QUEUELEN);
+    struct tcp_held_s *held = tcp_ext_arg_get(pcb, tcp_held_ext_id);
+    if (held == NULL || held->fin != held_fin_none) {
+        LOG_STATE(WARN, "write after close", pcb);
+        return -1;
     }
-    // avoid ERR_MEM.
-    size_t sendlen = MIN(len, tcp_sndbuf(pcb));
-    LOG_STATE(TRACE, "sendlen=%zd", pcb, sendlen);
-    if (sendlen > 0) {
-        err_t w_err = tcp_write(pcb, data, (u16_t) sendlen,
-                                TCP_WRITE_FLAG_COPY); // TODO hold data until client acks... via on_client_ack maybe? then we wouldn't need to copy here.
-        if (w_err != ERR_OK) {
-            TNL_LOG(ERR, "failed to tcp_write %d (%ld, %zd)", w_err, sendlen, len);
-            return -1;
-        }
 
-        if (tcp_output(pcb) != ERR_OK) {
-            TNL_LOG(ERR, "failed to tcp_output");
+    size_t accepted = MIN(len, TCP_HELD_MAX - held->held);
+    LOG_STATE(TRACE, "accepted=%zd held=%zd", pcb, accepted, held->held);
+    if (accepted > 0) {
+        struct held_chunk_s *c = malloc(sizeof(struct held_chunk_s) + accepted);
+        if (c == NULL) {
+            TNL_LOG(ERR, "failed to allocate %zd bytes", accepted);
             return -1;
         }
+        c->len = accepted;
+        c->written = 0;
+        c->acked = 0;
+        memcpy(c->data, data, accepted);
+        STAILQ_INSERT_TAIL(&held->chunks, c, _next);
+        held->held += accepted;
+        held->pending += accepted;
+    }
+
+    err_t w_err = push_held(pcb, held);
+    if (w_err != ERR_OK) {
+        TNL_LOG(ERR, "failed to tcp_write %d (%zd, %zd)", w_err, accepted, len);
+        return -1;
+    }
+
+    if (tcp_output(pcb) != ERR_OK) {
+        TNL_LOG(ERR, "failed to tcp_output");
+        return -1;
     }
-    return sendlen;
+    return (ssize_t) accepted;
 }
 
 void tunneler_tcp_ack(struct write_ctx_s *write_ctx) {
     struct write_ctx_s *wr_ctx = write_ctx;
-    tcp_recved(wr_ctx->tcp, wr_ctx->pbuf->len);
+    u16_t len = wr_ctx->pbuf->tot_len;
+    struct tcp_held_s *held = tcp_ext_arg_get(wr_ctx->tcp, tcp_held_ext_id);
+    if (held != NULL && held->rcv_withheld > 0) {
+        u16_t withheld = (u16_t) MIN(len, held->rcv_withheld);
+        held->rcv_withheld -= withheld;
+        len -= withheld;
+    }
+    if (len > 0) {
+        tcp_recved(wr_ctx->tcp, len);
+    }
     pbuf_free(wr_ctx->pbuf);
+    free(wr_ctx);
+}
+
+/**
+ * the window is never sized below lwip's initial window, or above what the client can be offered (TCP_WND when it
+ * negotiated window scaling). growing opens the window right away, while shrinking holds back credit as data that
+ * is already in flight gets written to ziti.
+ */
+void tunneler_tcp_set_rcv_wnd(struct tcp_pcb *pcb, size_t wnd) {
+    struct tcp_held_s *held = tcp_ext_arg_get(pcb, tcp_held_ext_id);
+    if (held == NULL) {
+        return;
+    }
+    u32_t target = (u32_t) MIN(wnd, TCP_WND_MAX(pcb));
+    if (target < TCPWND_MIN16(TCP_WND)) {
+        target = TCPWND_MIN16(TCP_WND);
+    }
+    if (target == held->rcv_wnd) {
+        return;
+    }
+    LOG_STATE(VERBOSE, "rcv_wnd %u -> %u", pcb, held->rcv_wnd, target);
+
+    if (target < held->rcv_wnd) {
+        held->rcv_withheld += held->rcv_wnd - target;
+        held->rcv_wnd = target;
+        return;
+    }
+
+    u32_t grow = target - held->rcv_wnd;
+    held->rcv_wnd = target;
+    u32_t repaid = MIN(grow, held->rcv_withheld);
+    held->rcv_withheld -= repaid;
+    grow -= repaid;
+    if (pcb->state < ESTABLISHED) {
+        // nothing has been received yet, and tcp_recved would ack ahead of the SYN|ACK
+        pcb->rcv_wnd += grow;
+        pcb->rcv_ann_wnd = pcb->rcv_wnd;
+        return;
+    }
+    while (grow > 0) {
+        u16_t n = (u16_t) MIN(grow, 0xffff);
+        tcp_recved(pcb, n);
+        grow -= n;
+    }
 }
 
 int tunneler_tcp_close_write(struct tcp_pcb *pcb) {
@@ -233,6 +531,12 @@ int tunneler_tcp_close_write(struct tcp_pcb *pcb) {
         TNL_LOG(WARN, "null pcb");
         return 0;
     }
+    struct tcp_held_s *held = tcp_ext_arg_get(pcb, tcp_held_ext_id);
+    if (held != NULL && held->pending > 0) {
+        LOG_STATE(DEBUG, "deferring FIN until %zd held bytes are queued", pcb, held->pending);
+        held->fin = held_fin_shutdown;
+        return 0;
+    }
     LOG_STATE(DEBUG, "closing write", pcb);
     err_t err = tcp_shutdown(pcb, 0, 1);
     if (err != ERR_OK) {
@@ -261,6 +565,14 @@ int tunneler_tcp_close(struct tcp_pcb *pcb) {
         tcp_abandon(pcb, 1);
         return -1;
     }
+    struct tcp_held_s *held = tcp_ext_arg_get(pcb, tcp_held_ext_id);
+    if (held != NULL && held->pending > 0) {
+        // the client still gets what was accepted from ziti. on_tcp_client_ack closes once it's queued
+        LOG_STATE(DEBUG, "deferring close until %zd held bytes are queued", pcb, held->pending);
+        tcp_recv(pcb, on_tcp_client_data_closed);
+        held->fin = held_fin_close;
+        return 0;
+    }
     err_t err = tcp_close(pcb);
     if (err != ERR_OK) {
         LOG_STATE(ERR, "tcp_close failed; err=%d", pcb, err);
@@ -289,6 +601,7 @@ void tunneler_tcp_dial_completed(struct io_ctx_s *io, bool ok) {
     }
     ip_set_option(pcb, SOF_KEEPALIVE);
     tcp_recv(pcb, on_tcp_client_data);
+    tcp_sent(pcb, on_tcp_client_ack);
 
     /* Send a SYN|ACK together with the MSS option. */
     err_t rc = tcp_enqueue_flags(pcb, TCP_SYN | TCP_ACK);
@@ -384,36 +697,24 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
         return 0;
     }
 
-    /* pass the segment to lwip if a matching active connection exists */
-    for (struct tcp_pcb *tpcb = tcp_active_pcbs, *prev = NULL; tpcb != NULL; tpcb = tpcb->next) {
-        if (tpcb->remote_port == src_p &&
-            tpcb->local_port == dst_p &&
-            ip_addr_cmp(&tpcb->remote_ip, &src) &&
-            ip_addr_cmp(&tpcb->local_ip, &dst)) {
-            TNL_LOG(VERBOSE, "received SYN on active connection: client=tcp:%s:%d, service=%s", src_str, src_p, intercept_ctx->service_name);
-            /* Move this PCB to the front of the list so that subsequent
-               lookups will be faster (we exploit locality in TCP segment
-               arrivals). */
-            LWIP_ASSERT("tcp_input: pcb->next != pcb (before cache)", tpcb->next != tpcb);
-            if (prev != NULL) {
-                prev->next = tpcb->next;
-                tpcb->next = tcp_active_pcbs;
-                tcp_active_pcbs = tpcb;
-            } else {
-                TCP_STATS_INC(tcp.cachehit);
-            }
-            LWIP_ASSERT("tcp_input: pcb->next != pcb (after cache)", tpcb->next != tpcb);
-            return 0;
-        }
-        prev = tpcb;
+    /* pass the segment to lwip if a matching active connection exists.
+     * connections in TIME_WAIT are not active; the new SYN replaces them in the index. */
+    struct tcp_pcb *tpcb = flow_table_get(&tcp_flows, &src, src_p, &dst, dst_p);
+    if (tpcb != NULL && tpcb->state != TIME_WAIT) {
+        TNL_LOG(VERBOSE, "received SYN on active connection: client=tcp:%s:%d, service=%s", src_str, src_p, intercept_ctx->service_name);
+        return 0;
     }
 
     /* we know this is a SYN segment for an intercepted address, and we will process it */
     ziti_sdk_dial_cb zdial = intercept_ctx->dial_fn ? intercept_ctx->dial_fn : tnlr_ctx->opts.ziti_dial;
     pbuf_remove_header(p, iphdr_hlen);
+    if (!tcp_conn_available()) {
+        TNL_LOG(ERR, "dropping SYN from tcp:%s:%d - TCP connection limit is %u", src_str, src_p, tcp_conn_limit);
+        goto done;
+    }
     struct tcp_pcb *npcb = new_tcp_pcb(src, dst, tcphdr, p);
     if (npcb == NULL) {
-        TNL_LOG(ERR, "failed to allocate tcp pcb - TCP connection limit is %d", MEMP_NUM_TCP_PCB);
+        TNL_LOG(ERR, "failed to allocate tcp pcb");
         goto done;
     }
 
@@ -429,6 +730,8 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     }
     io->ziti_ctx = intercept_ctx->app_intercept_ctx;
     io->write_fn = intercept_ctx->write_fn ? intercept_ctx->write_fn : tnlr_ctx->opts.ziti_write;
+    // intercepts that override write_fn expect whole messages
+    io->writev_fn = intercept_ctx->write_fn ? NULL : tnlr_ctx->opts.ziti_writev;
     io->close_write_fn = intercept_ctx->close_write_fn ? intercept_ctx->close_write_fn : tnlr_ctx->opts.ziti_close_write;
     io->close_fn = intercept_ctx->close_fn ? intercept_ctx->close_fn : tnlr_ctx->opts.ziti_close;
 
@@ -31,8 +31,21 @@ extern u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, co
 
 extern void tunneler_tcp_ack(struct write_ctx_s *write_ctx);
 
+/** free held data that the client has acked. called after queued packets are written to the netif */
+extern void tunneler_tcp_free_retired(void);
+
+/** grow or shrink the window that is advertised to the client, within the window it can be offered */
+extern void tunneler_tcp_set_rcv_wnd(struct tcp_pcb *pcb, size_t wnd);
+
 extern int tunneler_tcp_close(struct tcp_pcb *pcb);
 
+/** set the maximum number of concurrent tcp connections. lwip pcbs are heap allocated, so this is the only limit */
+extern void tunneler_tcp_set_conn_limit(unsigned int limit);
+extern unsigned int tunneler_tcp_conn_limit(void);
+
+/** return the number of intercepted tcp connections to `addr`, including those in TIME_WAIT */
+extern size_t tunneler_tcp_addr_flows(const ip_addr_t *addr);
+
 extern int tunneler_tcp_close_write(struct tcp_pcb *pcb);
 
 /** return list of io contexts for active connections to the given service. caller must free the returned pointer */
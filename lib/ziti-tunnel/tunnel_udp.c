@@ -18,12 +18,41 @@
 
 #include "tunnel_udp.h"
 #include "ziti_tunnel_priv.h"
+#include "flow_table.h"
+#include "netif_shim.h"
+#include "lwip/memp.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/ip6.h"
+#include "lwip/prot/udp.h"
 
 #define UDP_TIMEOUT 30000
 
+/** index of intercepted udp connections, maintained alongside udp_pcbs */
+static flow_table_t udp_flows;
+
+static unsigned int udp_conn_limit = MEMP_NUM_UDP_PCB;
+
+void tunneler_udp_set_conn_limit(unsigned int limit) {
+    udp_conn_limit = limit > 0 ? limit : MEMP_NUM_UDP_PCB;
+}
+
+unsigned int tunneler_udp_conn_limit(void) {
+    return udp_conn_limit;
+}
+
+size_t tunneler_udp_addr_flows(const ip_addr_t *addr) {
+    return flow_table_dst_count(&udp_flows, addr);
+}
+
+static void remove_udp_pcb(struct udp_pcb *pcb) {
+    flow_table_remove(&udp_flows, &pcb->remote_ip, pcb->remote_port, &pcb->local_ip, pcb->local_port, pcb);
+    udp_remove(pcb);
+}
+
 // initiate orderly shutdown
-static void udp_timeout_cb(uv_timer_t *t) {
-    struct io_ctx_s *io = t->data;
+static void on_udp_idle(timer_wheel_entry_t *e, void *ctx) {
+    struct io_ctx_s *io = e->data;
     tunneler_io_context  tnlr_io = io->tnlr_io;
     if (tnlr_io) {
         TNL_LOG(TRACE, "initiating close idle_timeout[%d] src[%s] dst[%s] service[%s]", tnlr_io->idle_timeout,
@@ -32,6 +61,54 @@ static void udp_timeout_cb(uv_timer_t *t) {
     io->close_fn(io->ziti_io);
 }
 
+static void on_idle_sweep(uv_timer_t *t) {
+    tunneler_context tnlr_ctx = t->data;
+    timer_wheel_advance(&tnlr_ctx->idle_wheel, uv_now(t->loop), on_udp_idle, NULL);
+    if (tnlr_ctx->idle_wheel.count == 0) {
+        uv_timer_stop(t);
+    }
+}
+
+/** push the idle deadline of a connection out to `timeout` ms from now */
+static void touch_udp_idle(tunneler_io_context tnlr_io, uint32_t timeout) {
+    tunneler_context tnlr_ctx = tnlr_io->tnlr_ctx;
+    uint64_t now = uv_now(tnlr_ctx->loop);
+    if (!uv_is_active((uv_handle_t *) &tnlr_ctx->idle_timer_req)) {
+        // the wheel is empty while the sweep is stopped. catch it up so entries are filed relative to now
+        timer_wheel_advance(&tnlr_ctx->idle_wheel, now, on_udp_idle, NULL);
+        uv_timer_start(&tnlr_ctx->idle_timer_req, on_idle_sweep, IDLE_TIMER_TICK, IDLE_TIMER_TICK);
+    }
+    timer_wheel_touch(&tnlr_ctx->idle_wheel, &tnlr_io->idle, now + timeout);
+}
+
+/* write contexts of completed datagram writes are kept for reuse, up to this many */
+#define UDP_WRITE_CTX_POOL_SIZE 256
+
+static struct {
+    struct write_ctx_s *free_list; // linked through `pbuf`
+    int count;
+} udp_wr_pool;
+
+static struct write_ctx_s *new_udp_write_ctx(void) {
+    struct write_ctx_s *wr_ctx = udp_wr_pool.free_list;
+    if (wr_ctx != NULL) {
+        udp_wr_pool.free_list = (struct write_ctx_s *) wr_ctx->pbuf;
+        udp_wr_pool.count--;
+        return wr_ctx;
+    }
+    return malloc(sizeof(struct write_ctx_s));
+}
+
+static void release_udp_write_ctx(struct write_ctx_s *wr_ctx) {
+    if (udp_wr_pool.count >= UDP_WRITE_CTX_POOL_SIZE) {
+        free(wr_ctx);
+        return;
+    }
+    wr_ctx->pbuf = (struct pbuf *) udp_wr_pool.free_list;
+    udp_wr_pool.free_list = wr_ctx;
+    udp_wr_pool.count++;
+}
+
 static void to_ziti(struct io_ctx_s *io, struct pbuf *p) {
     static bool log_stalled_warns = true;
     if (io == NULL) {
@@ -48,12 +125,17 @@ static void to_ziti(struct io_ctx_s *io, struct pbuf *p) {
     }
 
     struct pbuf *recv_data = p;
-    uv_timer_start(io->tnlr_io->conn_timer, udp_timeout_cb, UDP_TIMEOUT, 0);
+    touch_udp_idle(io->tnlr_io, UDP_TIMEOUT);
 
     do {
         TNL_LOG(TRACE, "writing %d bytes to ziti src[%s] dst[%s] service[%s]", recv_data->len,
                 io->tnlr_io->client, io->tnlr_io->intercepted, io->tnlr_io->service_name);
-        struct write_ctx_s *wr_ctx = calloc(1, sizeof(struct write_ctx_s));
+        struct write_ctx_s *wr_ctx = new_udp_write_ctx();
+        if (wr_ctx == NULL) {
+            TNL_LOG(ERR, "failed to allocate write context");
+            pbuf_free(recv_data);
+            break;
+        }
         wr_ctx->pbuf = recv_data;
         wr_ctx->udp = io->tnlr_io->udp;
         wr_ctx->ack = tunneler_udp_ack;
@@ -65,7 +147,6 @@ static void to_ziti(struct io_ctx_s *io, struct pbuf *p) {
         ssize_t s = io->write_fn(io->ziti_io, wr_ctx, wr_ctx->pbuf->payload, wr_ctx->pbuf->len);
         if (s == ERR_WOULDBLOCK) {
             tunneler_udp_ack(wr_ctx);
-            free(wr_ctx);
             if (log_stalled_warns) {
                 TNL_LOG(WARN, "ziti_write stalled: dropping UDP packets until buffers are released service=%s, client=%s, ret=%ld",
                         io->tnlr_io->service_name, io->tnlr_io->client, s);
@@ -73,7 +154,6 @@ static void to_ziti(struct io_ctx_s *io, struct pbuf *p) {
             break;
         } else if (s < 0) {
             tunneler_udp_ack(wr_ctx);
-            free(wr_ctx);
             TNL_LOG(ERR, "ziti_write failed: service=%s, client=%s, ret=%ld", io->tnlr_io->service_name, io->tnlr_io->client, s);
             io->close_fn(io->ziti_io);
             break;
@@ -92,18 +172,12 @@ void on_udp_client_data(void *io_context, struct udp_pcb *pcb, struct pbuf *p, c
     }
     TNL_LOG(VERBOSE, "%d bytes from %s:%d", p->len, ipaddr_ntoa(addr), port);
 
-    struct io_ctx_s *io = io_context;
-    if (!io->tnlr_io->conn_timer) {
-        io->tnlr_io->conn_timer = calloc(1, sizeof(uv_timer_t));
-        io->tnlr_io->conn_timer->data = io;
-        uv_timer_init(io->tnlr_io->tnlr_ctx->loop, io->tnlr_io->conn_timer);
-    }
-
     to_ziti(io_context, p);
 }
 
 void tunneler_udp_ack(struct write_ctx_s *write_ctx) {
     pbuf_free(write_ctx->pbuf);
+    release_udp_write_ctx(write_ctx);
 }
 
 int tunneler_udp_close(struct udp_pcb *pcb) {
@@ -111,7 +185,7 @@ int tunneler_udp_close(struct udp_pcb *pcb) {
     tunneler_io_context tnlr_io_ctx = io_ctx->tnlr_io;
     TNL_LOG(DEBUG, "closing src[%s] dst[%s] service[%s]",
             tnlr_io_ctx->client, tnlr_io_ctx->intercepted, tnlr_io_ctx->service_name);
-    udp_remove(pcb);
+    remove_udp_pcb(pcb);
     return 0;
 }
 
@@ -121,6 +195,44 @@ void tunneler_udp_dial_completed(struct io_ctx_s *io, bool ok) {
     }
 }
 
+/**
+ * deliver a datagram of an established flow straight to ziti, rather than through udp_input and the linear
+ * search of udp_pcbs that it does. the checksum is verified as udp_input would, unless the driver already did.
+ */
+static u8_t udp_flow_input(struct udp_pcb *pcb, struct pbuf *p, u16_t iphdr_hlen, const struct udp_hdr *udphdr) {
+    struct io_ctx_s *io = pcb->recv_arg;
+    if (io == NULL || p->next != NULL) {
+        return 0; // let lwip process the datagram
+    }
+
+    u16_t ulen = lwip_ntohs(udphdr->len);
+    if (ulen < UDP_HLEN || ulen > p->tot_len - iphdr_hlen) {
+        TNL_LOG(DEBUG, "dropping datagram with bad length %d src[%s] dst[%s]", ulen, io->tnlr_io->client,
+                io->tnlr_io->intercepted);
+        pbuf_free(p);
+        return 1;
+    }
+
+    pbuf_remove_header(p, iphdr_hlen);
+    if (p->tot_len > ulen) {
+        pbuf_realloc(p, ulen);
+    }
+    if (!netif_shim_csum_valid(p)) {
+        // a zero checksum means "none" over ipv4, but is not allowed over ipv6
+        bool csum_ok = udphdr->chksum == 0 ? !IP_IS_V6(&pcb->local_ip) :
+                       ip_chksum_pseudo(p, IP_PROTO_UDP, p->tot_len, &pcb->remote_ip, &pcb->local_ip) == 0;
+        if (!csum_ok) {
+            TNL_LOG(DEBUG, "dropping datagram with bad checksum src[%s] dst[%s]", io->tnlr_io->client,
+                    io->tnlr_io->intercepted);
+            pbuf_free(p);
+            return 1;
+        }
+    }
+    pbuf_remove_header(p, UDP_HLEN);
+    on_udp_client_data(io, pcb, p, &pcb->remote_ip, pcb->remote_port);
+    return 1;
+}
+
 /** called by lwip when a udp datagram arrives. return 1 to indicate that the IP packet was consumed. */
 u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *addr) {
     tunneler_context tnlr_ctx = tnlr_ctx_arg;
@@ -165,22 +277,9 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     TNL_LOG(TRACE, "received datagram src[%s:%d] dst[%s:%d]", src_str, src_p, dst_str, dst_p);
 
     /* first see if this datagram belongs to an active connection */
-    for (struct udp_pcb *con_pcb = udp_pcbs, *prev = NULL; con_pcb != NULL; con_pcb = con_pcb->next) {
-        if (con_pcb->remote_port == src_p &&
-            con_pcb->local_port == dst_p &&
-            ip_addr_cmp(&con_pcb->remote_ip, &src) &&
-            ip_addr_cmp(&con_pcb->local_ip, &dst)) {
-            if (prev != NULL) {
-                /* move the pcb to the front of udp_pcbs so that is found faster next time */
-                prev->next = con_pcb->next;
-                con_pcb->next = udp_pcbs;
-                udp_pcbs = con_pcb;
-            } else {
-                UDP_STATS_INC(udp.cachehit);
-            }
-            return 0; // let lwip process the datagram
-        }
-        prev = con_pcb;
+    struct udp_pcb *flow_pcb = flow_table_get(&udp_flows, &src, src_p, &dst, dst_p);
+    if (flow_pcb != NULL) {
+        return udp_flow_input(flow_pcb, p, iphdr_hlen, udphdr);
     }
 
     /* is the dest address being intercepted? */
@@ -193,9 +292,14 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     ziti_sdk_dial_cb zdial = intercept_ctx->dial_fn ? intercept_ctx->dial_fn : tnlr_ctx->opts.ziti_dial;
 
     /* make a new pcb for this connection and register it with lwip */
+    if (memp_pools[MEMP_UDP_PCB]->stats->used >= udp_conn_limit) {
+        TNL_LOG(ERR, "dropping datagram from udp:%s:%d - UDP connection limit is %u", src_str, src_p, udp_conn_limit);
+        pbuf_free(p);
+        return 1;
+    }
     struct udp_pcb *npcb = udp_new();
     if (npcb == NULL) {
-        TNL_LOG(ERR, "unable to allocate UDP pcb - UDP connection limit is %d", MEMP_NUM_UDP_PCB);
+        TNL_LOG(ERR, "unable to allocate UDP pcb");
         pbuf_free(p);
         return 1;
     }
@@ -208,20 +312,26 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
         pbuf_free(p);
         return 1;
     }
+    if (flow_table_put(&udp_flows, &src, src_p, &dst, dst_p, npcb) != 0) {
+        TNL_LOG(ERR, "failed to index udp flow %s:%d", src_str, src_p);
+        udp_remove(npcb);
+        pbuf_free(p);
+        return 1;
+    }
 
     udp_bind_netif(npcb, &tnlr_ctx->netif);
 
     struct io_ctx_s *io = calloc(1, sizeof(struct io_ctx_s));
     if (io == NULL) {
         TNL_LOG(ERR, "failed to allocate io_context");
-        udp_remove(npcb);
+        remove_udp_pcb(npcb);
         pbuf_free(p);
         return 1;
     }
     io->tnlr_io = (tunneler_io_context)calloc(1, sizeof(struct tunneler_io_ctx_s));
     if (io->tnlr_io == NULL) {
         TNL_LOG(ERR, "failed to allocate tunneler io context");
-        udp_remove(npcb);
+        remove_udp_pcb(npcb);
         pbuf_free(p);
         return 1;
     }
@@ -235,6 +345,7 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     io->write_fn = intercept_ctx->write_fn ? intercept_ctx->write_fn : tnlr_ctx->opts.ziti_write;
     io->close_fn = intercept_ctx->close_fn ? intercept_ctx->close_fn : tnlr_ctx->opts.ziti_close;
     io->tnlr_io->idle_timeout = UDP_TIMEOUT;
+    io->tnlr_io->idle.data = io;
 
     TNL_LOG(DEBUG, "intercepted address[%s] client[%s] service[%s]", io->tnlr_io->intercepted, io->tnlr_io->client,
             intercept_ctx->service_name);
@@ -244,7 +355,7 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     void *ziti_io_ctx = zdial(intercept_ctx->app_intercept_ctx, io);
     if (ziti_io_ctx == NULL) {
         TNL_LOG(ERR, "ziti_dial(%s) failed", intercept_ctx->service_name);
-        udp_remove(npcb);
+        remove_udp_pcb(npcb);
         pbuf_free(p);
         free_tunneler_io_context(&io->tnlr_io);
         free(io);
@@ -254,20 +365,105 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     return 0; /* lwip will call on_udp_client_data_enqueue for this packet */
 }
 
+/**
+ * ip and udp headers for datagrams sent to a client, built once per flow. the fixed fields are summed up front,
+ * so checksumming a datagram only adds its lengths, the ip id and the payload.
+ */
+struct udp_reply_s {
+    u16_t hlen;   /* ip header length */
+    u32_t ip_sum; /* ipv4 header, without total length and id */
+    u32_t udp_sum; /* pseudo header and udp header, without lengths */
+    u8_t hdr[IP6_HLEN + UDP_HLEN];
+};
+
+static u16_t udp_ip_id;
+
+static u16_t fold_sum(u32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (u16_t) sum;
+}
+
+static struct udp_reply_s *new_udp_reply(const struct udp_pcb *pcb) {
+    struct udp_reply_s *r = calloc(1, sizeof(struct udp_reply_s));
+    if (r == NULL) {
+        return NULL;
+    }
+
+    if (IP_IS_V6(&pcb->local_ip)) {
+        struct ip6_hdr *ip6hdr = (struct ip6_hdr *) r->hdr;
+        IP6H_VTCFL_SET(ip6hdr, 6, 0, 0);
+        IP6H_NEXTH_SET(ip6hdr, IP_PROTO_UDP);
+        IP6H_HOPLIM_SET(ip6hdr, pcb->ttl);
+        ip6_addr_copy_to_packed(ip6hdr->src, *ip_2_ip6(&pcb->local_ip));
+        ip6_addr_copy_to_packed(ip6hdr->dest, *ip_2_ip6(&pcb->remote_ip));
+        r->hlen = IP6_HLEN;
+        r->udp_sum = LWIP_CHKSUM(&ip6hdr->src, 2 * sizeof(ip6_addr_p_t));
+    } else {
+        struct ip_hdr *iphdr = (struct ip_hdr *) r->hdr;
+        IPH_VHL_SET(iphdr, 4, IP_HLEN / 4);
+        IPH_TTL_SET(iphdr, pcb->ttl);
+        IPH_PROTO_SET(iphdr, IP_PROTO_UDP);
+        ip4_addr_copy(iphdr->src, *ip_2_ip4(&pcb->local_ip));
+        ip4_addr_copy(iphdr->dest, *ip_2_ip4(&pcb->remote_ip));
+        r->hlen = IP_HLEN;
+        r->ip_sum = LWIP_CHKSUM(iphdr, IP_HLEN);
+        r->udp_sum = LWIP_CHKSUM(&iphdr->src, 2 * sizeof(ip4_addr_p_t));
+    }
+
+    struct udp_hdr *udphdr = (struct udp_hdr *) (r->hdr + r->hlen);
+    udphdr->src = lwip_htons(pcb->local_port);
+    udphdr->dest = lwip_htons(pcb->remote_port);
+    r->udp_sum += PP_HTONS(IP_PROTO_UDP) + LWIP_CHKSUM(udphdr, UDP_HLEN);
+    return r;
+}
+
+/**
+ * send a datagram to the client. the headers are filled in from the flow's prebuilt copy and written to the netif
+ * together with the payload, so the payload is neither copied into a pbuf nor routed through ip_output. ipv4
+ * datagrams go out without a udp checksum, which is optional there and adds nothing on a hop through memory.
+ */
 ssize_t tunneler_udp_write(struct udp_pcb *pcb, const void *data, size_t len) {
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
-    memcpy(p->payload, data, len);
-    /* use udp_sendto_if_src even though local and remote addresses are in pcb, because
-     * udp_send verifies that the dest IP matches the netif's IP, and fails with ERR_RTE.
-     */
-    err_t err = udp_sendto_if_src(pcb, p, &pcb->remote_ip, pcb->remote_port, netif_default, &pcb->local_ip);
-    pbuf_free(p);
-    if (err != ERR_OK) {
+    struct io_ctx_s *io = pcb->recv_arg;
+    tunneler_io_context tnlr_io = io->tnlr_io;
+    if (tnlr_io->udp_reply == NULL && (tnlr_io->udp_reply = new_udp_reply(pcb)) == NULL) {
+        TNL_LOG(ERR, "failed to allocate udp headers");
         return -1;
     }
-    struct io_ctx_s *io = pcb->recv_arg;
-    if (io->tnlr_io->idle_timeout > 0) {
-        uv_timer_start(io->tnlr_io->conn_timer, udp_timeout_cb, io->tnlr_io->idle_timeout, 0);
+    struct udp_reply_s *r = tnlr_io->udp_reply;
+    if (len > 0xffff - r->hlen - UDP_HLEN) {
+        TNL_LOG(ERR, "datagram too large (%zd bytes) src[%s] dst[%s]", len, tnlr_io->intercepted, tnlr_io->client);
+        return -1;
+    }
+
+    u16_t ulen = (u16_t) (UDP_HLEN + len);
+    u8_t hdr[IP6_HLEN + UDP_HLEN];
+    memcpy(hdr, r->hdr, r->hlen + UDP_HLEN);
+
+    struct udp_hdr *udphdr = (struct udp_hdr *) (hdr + r->hlen);
+    udphdr->len = lwip_htons(ulen);
+    if (r->hlen == IP_HLEN) {
+        struct ip_hdr *iphdr = (struct ip_hdr *) hdr;
+        IPH_LEN_SET(iphdr, lwip_htons(r->hlen + ulen));
+        IPH_ID_SET(iphdr, lwip_htons(udp_ip_id++));
+        IPH_CHKSUM_SET(iphdr, (u16_t) ~fold_sum(r->ip_sum + IPH_LEN(iphdr) + IPH_ID(iphdr)));
+        udphdr->chksum = 0;
+    } else {
+        IP6H_PLEN_SET((struct ip6_hdr *) hdr, ulen);
+        u16_t chksum = ~fold_sum(r->udp_sum + 2 * (u32_t) udphdr->len + LWIP_CHKSUM(data, (int) len));
+        udphdr->chksum = chksum == 0 ? 0xffff : chksum;
+    }
+
+    uv_buf_t bufs[2] = {
+            uv_buf_init((char *) hdr, r->hlen + UDP_HLEN),
+            uv_buf_init((char *) data, (unsigned int) len),
+    };
+    if (netif_shim_writev(&tnlr_io->tnlr_ctx->netif, bufs, len > 0 ? 2 : 1) != ERR_OK) {
+        return -1;
+    }
+    if (tnlr_io->idle_timeout > 0) {
+        touch_udp_idle(tnlr_io, tnlr_io->idle_timeout);
     }
     return len;
 }
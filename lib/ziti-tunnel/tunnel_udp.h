@@ -26,6 +26,13 @@ extern void tunneler_udp_dial_completed(struct io_ctx_s *io, bool ok);
 extern u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *addr);
 extern void tunneler_udp_ack(struct write_ctx_s *write_ctx);
 extern int tunneler_udp_close(struct udp_pcb *pcb);
+
+/** set the maximum number of concurrent udp connections. lwip pcbs are heap allocated, so this is the only limit */
+extern void tunneler_udp_set_conn_limit(unsigned int limit);
+extern unsigned int tunneler_udp_conn_limit(void);
+
+/** return the number of intercepted udp connections to `addr` */
+extern size_t tunneler_udp_addr_flows(const ip_addr_t *addr);
 /** return list of io contexts for active connections to the given service. caller must free the returned pointer */
 extern struct io_ctx_list_s *tunneler_udp_active(const void *zi_ctx);
 
@@ -73,6 +73,12 @@ static tunneler_context create_tunneler_ctx(tunneler_sdk_options *opts, uv_loop_
     uv_sem_init(&ctx->sem, 1);
     uv_once(&default_loop_sem_init_once, default_loop_sem_init);
     memcpy(&ctx->opts, opts, sizeof(ctx->opts));
+    if (ctx->opts.max_tcp_connections == 0) {
+        ctx->opts.max_tcp_connections = MEMP_NUM_TCP_PCB;
+    }
+    if (ctx->opts.max_udp_connections == 0) {
+        ctx->opts.max_udp_connections = MEMP_NUM_UDP_PCB;
+    }
     return ctx;
 }
 
@@ -87,7 +93,6 @@ tunneler_context ziti_tunneler_init(tunneler_sdk_options *opts, uv_loop_t *loop)
     }
 
     LIST_INIT(&ctx->intercepts);
-    ctx->intercepts_cache.impl = NULL;
 
     run_packet_loop(loop, ctx);
 
@@ -105,55 +110,113 @@ void ziti_tunnel_commit_routes(tunneler_context tnlr_ctx) {
     }
 }
 
-void ziti_tunneler_exclude_route(tunneler_context tnlr_ctx, const char *dst) {
-    if (tnlr_ctx->opts.netif_driver == NULL) {
-        TNL_LOG(DEBUG, "No netif_driver found tun is running in host only mode and intercepts are disabled");
-        return;
+struct exclude_req_s {
+    uv_getaddrinfo_t resolve_req;
+    tunneler_context tnlr_ctx;
+    char *dst;
+};
+
+static bool is_local_address(const struct sockaddr_in *addr, uv_interface_address_t *if_addrs, int num_if_addrs) {
+    for (int i = 0; i < num_if_addrs; i++) {
+        struct sockaddr *a = (struct sockaddr *) &if_addrs[i].address;
+        if (a->sa_family == AF_INET) {
+            struct sockaddr_in *if_addr = (struct sockaddr_in *) a;
+            struct sockaddr_in *if_mask = (struct sockaddr_in *) &if_addrs[i].netmask;
+            if ((if_addr->sin_addr.s_addr & if_mask->sin_addr.s_addr) ==
+                (addr->sin_addr.s_addr & if_mask->sin_addr.s_addr)) {
+                TNL_LOG(DEBUG, "address is local to %s", if_addrs[i].name);
+                return true;
+            }
+        }
     }
+    return false;
+}
 
-    if (tnlr_ctx->opts.netif_driver->exclude_rt == NULL) {
-        TNL_LOG(WARN, "netif_driver->exclude_rt function is not implemented");
-        return;
+static void on_exclude_resolved(uv_getaddrinfo_t *resolve_req, int status, struct addrinfo *addrinfo) {
+    struct exclude_req_s *req = resolve_req->data;
+    tunneler_context tnlr_ctx = req->tnlr_ctx;
+    netif_driver driver = tnlr_ctx->opts.netif_driver;
+
+    if (status != 0) {
+        TNL_LOG(WARN, "failed to resolve %s: %s; route is not excluded", req->dst, uv_strerror(status));
+        goto done;
     }
 
-    uv_getaddrinfo_t resolve_req = {0};
     uv_interface_address_t *if_addrs;
     int err, num_if_addrs;
     if ((err = uv_interface_addresses(&if_addrs, &num_if_addrs)) != 0) {
         TNL_LOG(ERR, "uv_interface_addresses failed: %s", uv_strerror(err));
-        return;
+        goto done;
     }
 
-    TNL_LOG(DEBUG, "excluding %s from tunneler intercept", dst);
-
-    uv_getaddrinfo(tnlr_ctx->loop, &resolve_req, NULL, dst, NULL, NULL);
-    struct addrinfo *addrinfo = resolve_req.addrinfo;
-    while (addrinfo != NULL) {
+    for (struct addrinfo *ai = addrinfo; ai != NULL; ai = ai->ai_next) {
+        if (ai->ai_family != AF_INET) {
+            continue;
+        }
         struct excluded_route_s exrt = {0};
-        uv_ip4_name((const struct sockaddr_in *) addrinfo->ai_addr, exrt.route, MAX_ROUTE_LEN);
+        uv_ip4_name((const struct sockaddr_in *) ai->ai_addr, exrt.route, MAX_ROUTE_LEN);
+
+        if (model_map_get(&tnlr_ctx->excluded_routes, exrt.route) != NULL) {
+            TNL_LOG(TRACE, "%s(%s) is already excluded", req->dst, exrt.route);
+            continue;
+        }
         // make sure the address isn't local
-        for (int i = 0; i < num_if_addrs; i++) {
-            struct sockaddr *a = (struct sockaddr *) &if_addrs[i].address;
-            if (a->sa_family == AF_INET && addrinfo->ai_family == AF_INET) {
-                struct sockaddr_in *if_addr = (struct sockaddr_in *) a;
-                struct sockaddr_in *if_mask = (struct sockaddr_in *) &if_addrs[i].netmask;
-                struct sockaddr_in *ex_addr = (struct sockaddr_in *) addrinfo->ai_addr;
-                if ((if_addr->sin_addr.s_addr & if_mask->sin_addr.s_addr) ==
-                    (ex_addr->sin_addr.s_addr & if_mask->sin_addr.s_addr)) {
-                    TNL_LOG(DEBUG, "%s is a local address on %s; not excluding route", exrt.route, if_addrs[i].name);
-                    goto done;
-                }
-            } else if (a->sa_family == AF_INET6) {
-                TNL_LOG(TRACE, "ipv6 address compare not implemented");
-            }
+        if (is_local_address((const struct sockaddr_in *) ai->ai_addr, if_addrs, num_if_addrs)) {
+            TNL_LOG(DEBUG, "%s(%s) is a local address; not excluding route", req->dst, exrt.route);
+            continue;
+        }
+        TNL_LOG(DEBUG, "excluding %s(%s) from tunneler intercept", req->dst, exrt.route);
+        int rc = driver->exclude_rt(driver->handle, tnlr_ctx->loop, exrt.route);
+        if (rc != 0) {
+            // not recorded, so the next request for this address tries again
+            TNL_LOG(WARN, "failed to exclude %s(%s): %d", req->dst, exrt.route, rc);
+            continue;
         }
-        tnlr_ctx->opts.netif_driver->exclude_rt(tnlr_ctx->opts.netif_driver->handle, tnlr_ctx->loop, exrt.route);
-        addrinfo = addrinfo->ai_next;
+        model_map_set(&tnlr_ctx->excluded_routes, exrt.route, (void *) (uintptr_t) true);
     }
+    uv_free_interface_addresses(if_addrs, num_if_addrs);
 
     done:
-    uv_freeaddrinfo(resolve_req.addrinfo);
-    uv_free_interface_addresses(if_addrs, num_if_addrs);
+    uv_freeaddrinfo(addrinfo);
+    free(req->dst);
+    free(req);
+}
+
+/**
+ * resolution runs on the loop's thread pool. routes for addresses that are already excluded are not
+ * requested again, so repeated router events for the same address are cheap. an address counts as
+ * excluded once the driver accepts it; drivers that apply exclusions asynchronously retry failures.
+ */
+void ziti_tunneler_exclude_route(tunneler_context tnlr_ctx, const char *dst) {
+    if (tnlr_ctx->opts.netif_driver == NULL) {
+        TNL_LOG(DEBUG, "No netif_driver found tun is running in host only mode and intercepts are disabled");
+        return;
+    }
+
+    if (tnlr_ctx->opts.netif_driver->exclude_rt == NULL) {
+        TNL_LOG(WARN, "netif_driver->exclude_rt function is not implemented");
+        return;
+    }
+
+    if (dst == NULL || dst[0] == '\0') {
+        return;
+    }
+
+    struct exclude_req_s *req = calloc(1, sizeof(struct exclude_req_s));
+    req->tnlr_ctx = tnlr_ctx;
+    req->dst = strdup(dst);
+    req->resolve_req.data = req;
+
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    int rc = uv_getaddrinfo(tnlr_ctx->loop, &req->resolve_req, on_exclude_resolved, dst, NULL, &hints);
+    if (rc != 0) {
+        TNL_LOG(WARN, "failed to start resolving %s: %s; route is not excluded", dst, uv_strerror(rc));
+        free(req->dst);
+        free(req);
+    }
 }
 
 
@@ -166,13 +229,13 @@ void ziti_tunneler_shutdown(tunneler_context tnlr_ctx) {
         intercept_ctx_t *i = LIST_FIRST(&tnlr_ctx->intercepts);
         tunneler_kill_active(i->app_intercept_ctx);
         LIST_REMOVE(i, entries);
+        intercepts_changed(tnlr_ctx, i);
     }
 }
 
 /** called by tunneler application when data has been successfully written to ziti */
 void ziti_tunneler_ack(struct write_ctx_s *write_ctx) {
     write_ctx->ack(write_ctx);
-    free(write_ctx);
 }
 
 const char *get_intercepted_address(const struct tunneler_io_ctx_s * tnlr_io) {
@@ -197,11 +260,31 @@ void free_tunneler_io_context(tunneler_io_context *tnlr_io_ctx_p) {
     if (*tnlr_io_ctx_p != NULL) {
         tunneler_io_context io = *tnlr_io_ctx_p;
         if (io->service_name != NULL) free((char*)io->service_name);
+        timer_wheel_remove(&io->idle);
+        free(io->udp_reply);
         free(io);
         *tnlr_io_ctx_p = NULL;
     }
 }
 
+uv_loop_t *ziti_tunneler_loop(tunneler_context tnlr_ctx) {
+    return tnlr_ctx->loop;
+}
+
+uv_loop_t *ziti_tunneler_io_loop(tunneler_io_context tnlr_io_ctx) {
+    return tnlr_io_ctx->tnlr_ctx->loop;
+}
+
+bool ziti_tunneler_addr_in_use(tunneler_context tnlr_ctx, const ip_addr_t *addr) {
+    // the flow tables count connections by intercepted address
+    return tunneler_tcp_addr_flows(addr) > 0 || tunneler_udp_addr_flows(addr) > 0;
+}
+
+void ziti_tunneler_addr_released(tunneler_context tnlr_ctx, const ip_addr_t *addr) {
+    if (tnlr_ctx == NULL) return;
+    intercept_cache_evict_addr(tnlr_ctx, addr);
+}
+
 void ziti_tunneler_set_idle_timeout(struct io_ctx_s *io_context, unsigned int timeout) {
     io_context->tnlr_io->idle_timeout = timeout;
 }
@@ -252,12 +335,14 @@ intercept_ctx_t* intercept_ctx_new(tunneler_context tnlr_ctx, const char *app_id
 
 void intercept_ctx_set_match_addr(intercept_ctx_t *intercept, intercept_match_addr_fn pred) {
     intercept->match_addr = pred;
+    intercepts_changed(intercept->tnlr_ctx, intercept);
 }
 
 void intercept_ctx_add_protocol(intercept_ctx_t *ctx, const char *protocol) {
     protocol_t *proto = calloc(1, sizeof(protocol_t));
     proto->protocol = strdup(protocol);
     STAILQ_INSERT_TAIL(&ctx->protocols, proto, entries);
+    intercepts_changed(ctx->tnlr_ctx, ctx);
 }
 
 void intercept_ctx_add_address(intercept_ctx_t *i_ctx, const ziti_address *za) {
@@ -268,6 +353,7 @@ void intercept_ctx_add_address(intercept_ctx_t *i_ctx, const ziti_address *za) {
     memcpy(&a->za, za, sizeof(ziti_address));
     ziti_address_print(a->str, sizeof(a->str), za);
     STAILQ_INSERT_TAIL(&i_ctx->addresses, a, entries);
+    intercepts_changed(i_ctx->tnlr_ctx, i_ctx);
 }
 
 void intercept_ctx_add_allowed_source_address(intercept_ctx_t *i_ctx, const ziti_address *za) {
@@ -278,6 +364,7 @@ void intercept_ctx_add_allowed_source_address(intercept_ctx_t *i_ctx, const ziti
     memcpy(&a->za, za, sizeof(ziti_address));
     ziti_address_print(a->str, sizeof(a->str), za);
     STAILQ_INSERT_TAIL(&i_ctx->allowed_source_addresses, a, entries);
+    intercepts_changed(i_ctx->tnlr_ctx, i_ctx);
 }
 
 port_range_t *parse_port_range(uint16_t low, uint16_t high) {
@@ -301,6 +388,7 @@ port_range_t *parse_port_range(uint16_t low, uint16_t high) {
 port_range_t *intercept_ctx_add_port_range(intercept_ctx_t *i_ctx, uint16_t low, uint16_t high) {
     port_range_t *pr = parse_port_range(low, high);
     STAILQ_INSERT_TAIL(&i_ctx->port_ranges, pr, entries);
+    intercepts_changed(i_ctx->tnlr_ctx, i_ctx);
     return pr;
 }
 
@@ -318,7 +406,6 @@ int ziti_tunneler_intercept(tunneler_context tnlr_ctx, intercept_ctx_t *i_ctx) {
         return -1;
     }
 
-    model_map_clear(&tnlr_ctx->intercepts_cache, NULL);
     address_t *address;
     STAILQ_FOREACH(address, &i_ctx->addresses, entries) {
         protocol_t *proto;
@@ -339,6 +426,7 @@ int ziti_tunneler_intercept(tunneler_context tnlr_ctx, intercept_ctx_t *i_ctx) {
     }
 
     LIST_INSERT_HEAD(&tnlr_ctx->intercepts, (struct intercept_ctx_s *)i_ctx, entries);
+    intercepts_changed(tnlr_ctx, i_ctx);
 
     return 0;
 }
@@ -394,7 +482,6 @@ intercept_ctx_t * ziti_tunnel_find_intercept(tunneler_context tnlr_ctx, void *zi
 // when called due to conflict we want to mark as disabled
 void ziti_tunneler_stop_intercepting(tunneler_context tnlr_ctx, void *zi_ctx) {
     TNL_LOG(DEBUG, "removing intercept for service_ctx[%p]", zi_ctx);
-    model_map_clear(&tnlr_ctx->intercepts_cache, NULL);
     struct intercept_ctx_s *intercept = ziti_tunnel_find_intercept(tnlr_ctx, zi_ctx);
 
     if (intercept != NULL) {
@@ -402,6 +489,7 @@ void ziti_tunneler_stop_intercepting(tunneler_context tnlr_ctx, void *zi_ctx) {
         tunneler_kill_active(zi_ctx);
 
         LIST_REMOVE(intercept, entries);
+        intercepts_changed(tnlr_ctx, intercept);
 
         struct address_s *address;
         STAILQ_FOREACH(address, &intercept->addresses, entries) {
@@ -436,6 +524,13 @@ ssize_t ziti_tunneler_write(tunneler_io_context tnlr_io_ctx, const void *data, s
     return r;
 }
 
+void ziti_tunneler_set_rcv_window(tunneler_io_context tnlr_io_ctx, size_t wnd) {
+    if (tnlr_io_ctx == NULL || tnlr_io_ctx->proto != tun_tcp || tnlr_io_ctx->tcp == NULL) {
+        return;
+    }
+    tunneler_tcp_set_rcv_wnd(tnlr_io_ctx->tcp, wnd);
+}
+
 /** called by tunneler application when a ziti connection closes */
 int ziti_tunneler_close(tunneler_io_context tnlr_io_ctx) {
     if (tnlr_io_ctx == NULL) {
@@ -458,11 +553,6 @@ int ziti_tunneler_close(tunneler_io_context tnlr_io_ctx) {
             break;
     }
 
-    if (tnlr_io_ctx->conn_timer) {
-        uv_close((uv_handle_t *) tnlr_io_ctx->conn_timer, (uv_close_cb) free);
-        tnlr_io_ctx->conn_timer = NULL;
-    }
-
     free_tunneler_io_context(&tnlr_io_ctx);
     return 0;
 }
@@ -497,6 +587,13 @@ static void on_tun_data(uv_poll_t * req, int status, int events) {
     }
 }
 
+/** write packets that lwip queued during this loop iteration */
+static void on_netif_flush(uv_prepare_t *req) {
+    tunneler_context tnlr_ctx = req->data;
+    netif_shim_flush(&tnlr_ctx->netif);
+    tunneler_tcp_free_retired();
+}
+
 static void check_lwip_timeouts(uv_timer_t * timer) {
     // if timer is not active it may have been a while since
     // we run timers, let LWIP adjust timeouts
@@ -557,6 +654,9 @@ static void run_packet_loop(uv_loop_t *loop, tunneler_context tnlr_ctx) {
     }
 
     lwip_init();
+    tunneler_tcp_set_conn_limit(opts.max_tcp_connections);
+    tunneler_udp_set_conn_limit(opts.max_udp_connections);
+    TNL_LOG(INFO, "connection limits: tcp=%u udp=%u", opts.max_tcp_connections, opts.max_udp_connections);
 
     netif_driver netif_driver = opts.netif_driver;
     if (netif_add_noaddr(&tnlr_ctx->netif, netif_driver, netif_shim_init, ip_input) == NULL) {
@@ -580,6 +680,13 @@ static void run_packet_loop(uv_loop_t *loop, tunneler_context tnlr_ctx) {
         TNL_LOG(WARN, "no method to initiate tunnel reader, maybe it's ok");
     }
 
+    // flush queued packets before the loop blocks for i/o. this also frees acked tcp data, so it runs
+    // for drivers without writev too
+    uv_prepare_init(loop, &tnlr_ctx->netif_flush_req);
+    tnlr_ctx->netif_flush_req.data = tnlr_ctx;
+    uv_prepare_start(&tnlr_ctx->netif_flush_req, on_netif_flush);
+    uv_unref((uv_handle_t *) &tnlr_ctx->netif_flush_req);
+
     if ((tnlr_ctx->tcp = init_protocol_handler(IP_PROTO_TCP, recv_tcp, tnlr_ctx)) == NULL) {
         TNL_LOG(ERR, "tcp setup failed");
         exit(1);
@@ -592,6 +699,11 @@ static void run_packet_loop(uv_loop_t *loop, tunneler_context tnlr_ctx) {
     // don't run LWIP timers until we have active TCP connections
     uv_timer_init(loop, &tnlr_ctx->lwip_timer_req);
     uv_unref((uv_handle_t *) &tnlr_ctx->lwip_timer_req);
+
+    timer_wheel_init(&tnlr_ctx->idle_wheel, IDLE_TIMER_TICK, uv_now(loop));
+    uv_timer_init(loop, &tnlr_ctx->idle_timer_req);
+    tnlr_ctx->idle_timer_req.data = tnlr_ctx;
+    uv_unref((uv_handle_t *) &tnlr_ctx->idle_timer_req);
 }
 
 typedef struct ziti_tunnel_async_call_s {
@@ -655,15 +767,17 @@ void ziti_tunnel_async_send(tunneler_context tctx, ziti_tunnel_async_fn f, void
 
 IMPL_MODEL(tunnel_ip_mem_pool, TNL_IP_MEM_POOL)
 IMPL_MODEL(tunnel_ip_conn, TNL_IP_CONN)
+IMPL_MODEL(tunnel_dns_cache_stats, TNL_DNS_CACHE_STATS)
 IMPL_MODEL(tunnel_ip_stats, TNL_IP_STATS)
 
-static void ziti_tunnel_get_ip_mem_pool(tunnel_ip_mem_pool *pool, int pool_id, const char *pool_name) {
+/** pools are heap backed (MEMP_MEM_MALLOC), so `avail` reports the configured limit rather than the pool size */
+static void ziti_tunnel_get_ip_mem_pool(tunnel_ip_mem_pool *pool, int pool_id, const char *pool_name, int avail) {
     if (!pool) return;
     TNL_LOG(VERBOSE, "getting IP mem pool %s", pool_name);
     pool->name = strdup(pool_name);
     pool->used = memp_pools[pool_id]->stats->used;
     pool->max = memp_pools[pool_id]->stats->max;
-    pool->avail = memp_pools[pool_id]->stats->avail;
+    pool->avail = avail;
 }
 
 void ziti_tunnel_get_ip_stats(tunnel_ip_stats *stats) {
@@ -672,13 +786,13 @@ void ziti_tunnel_get_ip_stats(tunnel_ip_stats *stats) {
     if (stats->pools) free(stats->pools);
     stats->pools = calloc(4, sizeof(tunnel_ip_mem_pool *));
     stats->pools[0] = calloc(1, sizeof(tunnel_ip_mem_pool));
-    ziti_tunnel_get_ip_mem_pool(stats->pools[0], MEMP_PBUF_POOL, _str(MEMP_PBUF_POOL));
+    ziti_tunnel_get_ip_mem_pool(stats->pools[0], MEMP_PBUF_POOL, _str(MEMP_PBUF_POOL), PBUF_POOL_SIZE);
     stats->pools[1] = calloc(1, sizeof(tunnel_ip_mem_pool));
-    ziti_tunnel_get_ip_mem_pool(stats->pools[1], MEMP_TCP_PCB, _str(MEMP_TCP_PCB));
+    ziti_tunnel_get_ip_mem_pool(stats->pools[1], MEMP_TCP_PCB, _str(MEMP_TCP_PCB), (int) tunneler_tcp_conn_limit());
     stats->pools[2] = calloc(1, sizeof(tunnel_ip_mem_pool));
-    ziti_tunnel_get_ip_mem_pool(stats->pools[2], MEMP_UDP_PCB, _str(MEMP_UDP_PCB));
+    ziti_tunnel_get_ip_mem_pool(stats->pools[2], MEMP_UDP_PCB, _str(MEMP_UDP_PCB), (int) tunneler_udp_conn_limit());
 
-    int max_conns = MEMP_NUM_TCP_PCB + MEMP_NUM_UDP_PCB + 1;
+    int max_conns = memp_pools[MEMP_TCP_PCB]->stats->used + memp_pools[MEMP_UDP_PCB]->stats->used + 1;
     stats->connections = calloc(max_conns, sizeof(tunnel_ip_conn *));
 
     int i= 0;
@@ -19,6 +19,7 @@
 
 #include "ziti/ziti_tunnel.h"
 #include "lwip/netif.h"
+#include "timer_wheel.h"
 
 #include "ziti/ziti_model.h"
 
@@ -29,6 +30,9 @@ extern "C" {
 /* xxx.xxx.xxx.xxx/xx */
 #define MAX_ROUTE_LEN (4*4 + 2 + 1)
 
+/* resolution of connection idle timeouts, in ms */
+#define IDLE_TIMER_TICK 1000
+
 enum {
     NONE,
     ERR,
@@ -119,6 +123,9 @@ struct excluded_route_s {
     char route[MAX_ROUTE_LEN];
 };
 
+struct intercept_index_s;
+struct intercept_cache_s;
+
 typedef struct tunneler_ctx_s {
     tunneler_sdk_options opts; // this must be first - it is accessed opaquely through tunneler_context*
     struct netif netif;
@@ -127,11 +134,32 @@ typedef struct tunneler_ctx_s {
     uv_loop_t *loop;
     uv_sem_t sem;
     uv_poll_t netif_poll_req;
+    uv_prepare_t netif_flush_req;
     uv_timer_t lwip_timer_req;
+    timer_wheel_t idle_wheel; // idle timeouts of udp connections
+    uv_timer_t idle_timer_req; // sweeps `idle_wheel` while it has entries
     LIST_HEAD(intercept_ctx_list_s, intercept_ctx_s) intercepts;
-    model_map intercepts_cache; // cached intercept_ctx lookup keyed by [proto]:[ip]:[port]
+    unsigned int intercepts_version; // bumped whenever an intercept is added, removed, or modified
+    struct intercept_index_s *intercept_index; // compiled from `intercepts`, rebuilt when the version changes
+    struct intercept_cache_s *intercepts_cache; // cached lookups keyed by (proto, family, dst ip, dst port)
+    model_map excluded_routes; // addresses that netif_driver->exclude_rt accepted
 } *tunneler_context;
 
+/**
+ * must be called after `intercept` is added to or removed from `intercepts`, or modified while in the list.
+ * invalidates the compiled index and evicts cached lookups that `intercept` could affect.
+ */
+extern void intercepts_changed(tunneler_context tnlr_ctx, const intercept_ctx_t *intercept);
+
+/** return the cached intercept for a destination, without doing a lookup */
+extern intercept_ctx_t *intercept_cache_get(tunneler_context tnlr_ctx, const char *protocol, const ip_addr_t *dst_addr,
+                                            uint16_t dst_port);
+
+/** evict cached lookups for a destination address, on any port */
+extern void intercept_cache_evict_addr(tunneler_context tnlr_ctx, const ip_addr_t *dst_addr);
+
+extern void free_intercept_index(struct intercept_index_s *idx);
+
 /** return the intercept context for a packet based on its destination ip:port */
 extern intercept_ctx_t *
 lookup_intercept_by_address(tunneler_context tnlr_ctx, const char *protocol, ip_addr_t *src_addr, ip_addr_t *dst_addr, uint16_t dst_port);
@@ -151,8 +179,9 @@ struct tunneler_io_ctx_s {
         struct tcp_pcb *tcp;
         struct udp_pcb *udp;
     };
-    uv_timer_t *conn_timer;
+    timer_wheel_entry_t idle;
     uint32_t idle_timeout;
+    struct udp_reply_s *udp_reply; // prebuilt headers for datagrams sent to the client. see tunnel_udp.c
 };
 
 extern void check_tnlr_timer(tunneler_context tnlr_ctx);
@@ -162,6 +191,7 @@ extern void free_intercept(intercept_ctx_t *intercept);
 
 struct write_ctx_s;
 
+/* completes a write to ziti, and releases the write context */
 typedef void (*ack_fn)(struct write_ctx_s *write_ctx);
 
 struct write_ctx_s {
@@ -68,6 +68,26 @@ ssize_t utun_read(netif_handle tun, void *buf, size_t len) {
     return utun_data_len(readv(tun->fd, iv, 2));
 }
 
+ssize_t utun_readv(netif_handle tun, const uv_buf_t *bufs, unsigned int nbufs, bool *csum_valid) {
+    u_int32_t type;
+    struct iovec iv[1 + NETIF_MAX_WRITEV_BUFS];
+
+    *csum_valid = false;
+    if (nbufs > NETIF_MAX_WRITEV_BUFS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    iv[0].iov_base = &type;
+    iv[0].iov_len = sizeof(type);
+    for (unsigned int i = 0; i < nbufs; i++) {
+        iv[i + 1].iov_base = bufs[i].base;
+        iv[i + 1].iov_len = bufs[i].len;
+    }
+
+    return utun_data_len(readv(tun->fd, iv, (int) nbufs + 1));
+}
+
 ssize_t utun_write(netif_handle tun, const void *buf, size_t len) {
     u_int32_t type;
     struct iovec iv[2];
@@ -87,6 +107,32 @@ ssize_t utun_write(netif_handle tun, const void *buf, size_t len) {
     return utun_data_len(writev(tun->fd, iv, 2));
 }
 
+ssize_t utun_writev(netif_handle tun, const uv_buf_t *bufs, unsigned int nbufs) {
+    u_int32_t type;
+    struct iovec iv[1 + NETIF_MAX_WRITEV_BUFS];
+    struct ip *iph = (struct ip *)bufs[0].base;
+
+    if (nbufs > NETIF_MAX_WRITEV_BUFS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (iph->ip_v == 6) {
+        type = htonl(AF_INET6);
+    } else {
+        type = htonl(AF_INET);
+    }
+
+    iv[0].iov_base = &type;
+    iv[0].iov_len = sizeof(type);
+    for (unsigned int i = 0; i < nbufs; i++) {
+        iv[i + 1].iov_base = bufs[i].base;
+        iv[i + 1].iov_len = bufs[i].len;
+    }
+
+    return utun_data_len(writev(tun->fd, iv, (int) nbufs + 1));
+}
+
 int utun_uv_poll_init(netif_handle tun, uv_loop_t *loop, uv_poll_t *tun_poll_req) {
     return uv_poll_init(loop, tun_poll_req, tun->fd);
 }
@@ -262,7 +308,9 @@ netif_driver utun_open(char *error, size_t error_len, const char *cidr) {
 
     driver->handle       = tun;
     driver->read         = utun_read;
+    driver->readv        = utun_readv;
     driver->write        = utun_write;
+    driver->writev       = utun_writev;
     driver->uv_poll_init = utun_uv_poll_init;
     driver->add_route    = utun_add_route;
     driver->delete_route = utun_delete_route;
@@ -0,0 +1,443 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rtnl.h"
+
+#define RTNL_RECV_BUF_SIZE 65536
+#define RTNL_BATCH_MAX     128   /* requests per sendmsg. keeps the acks well within the socket receive buffer */
+#define RTNL_TIMEOUT_SECS  5
+
+struct rtnl_route_req {
+    struct nlmsghdr nh;
+    struct rtmsg rtm;
+    char attrs[128];
+};
+
+static uint32_t rtnl_seq;
+
+static uint32_t next_seq(uint32_t n) {
+    return __atomic_fetch_add(&rtnl_seq, n, __ATOMIC_RELAXED) + 1;
+}
+
+int rtnl_open(void) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    struct sockaddr_nl local = { .nl_family = AF_NETLINK };
+    struct timeval tv = { .tv_sec = RTNL_TIMEOUT_SECS };
+    if (bind(fd, (struct sockaddr *) &local, sizeof(local)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+#ifdef NETLINK_CAP_ACK
+    // error acks don't need to echo the failed request
+    int one = 1;
+    (void) setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+#endif
+    return fd;
+}
+
+static size_t addr_len(int family) {
+    return family == AF_INET6 ? 16 : 4;
+}
+
+static bool parse_route(const struct nlmsghdr *nh, rtnl_route *rt) {
+    const struct rtmsg *rtm = NLMSG_DATA(nh);
+    if (rtm->rtm_type != RTN_UNICAST || (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6)) {
+        return false;
+    }
+
+    memset(rt, 0, sizeof(*rt));
+    rt->family = rtm->rtm_family;
+    rt->dst_len = rtm->rtm_dst_len;
+    rt->table = rtm->rtm_table;
+
+    size_t alen = addr_len(rt->family);
+    int len = (int) RTM_PAYLOAD(nh);
+    for (const struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+            case RTA_DST:
+                if (RTA_PAYLOAD(rta) >= alen) memcpy(rt->dst, RTA_DATA(rta), alen);
+                break;
+            case RTA_GATEWAY:
+                if (RTA_PAYLOAD(rta) >= alen) {
+                    memcpy(rt->gw, RTA_DATA(rta), alen);
+                    rt->has_gw = true;
+                }
+                break;
+            case RTA_OIF:
+                memcpy(&rt->oif, RTA_DATA(rta), sizeof(rt->oif));
+                break;
+            case RTA_PRIORITY:
+                memcpy(&rt->priority, RTA_DATA(rta), sizeof(rt->priority));
+                break;
+            case RTA_TABLE:
+                memcpy(&rt->table, RTA_DATA(rta), sizeof(rt->table));
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+int rtnl_dump_routes(int fd, int family, rtnl_route **routes, size_t *count) {
+    struct {
+        struct nlmsghdr nh;
+        struct rtmsg rtm;
+    } req = {
+        .nh = {
+            .nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)),
+            .nlmsg_type = RTM_GETROUTE,
+            .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+            .nlmsg_seq = next_seq(1),
+        },
+        .rtm = { .rtm_family = (unsigned char) family },
+    };
+
+    *routes = NULL;
+    *count = 0;
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0) {
+        return -errno;
+    }
+
+    char *buf = malloc(RTNL_RECV_BUF_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    size_t cap = 0;
+    int rc = 0;
+    bool done = false;
+    while (!done) {
+        ssize_t n = recv(fd, buf, RTNL_RECV_BUF_SIZE, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            rc = -errno;
+            break;
+        }
+
+        int len = (int) n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_seq != req.nh.nlmsg_seq) {
+                continue;
+            }
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *err = NLMSG_DATA(nh);
+                rc = err->error;
+                done = true;
+                break;
+            }
+            if (nh->nlmsg_type != RTM_NEWROUTE) {
+                continue;
+            }
+            if (*count == cap) {
+                size_t new_cap = cap ? cap * 2 : 64;
+                rtnl_route *r = realloc(*routes, new_cap * sizeof(rtnl_route));
+                if (r == NULL) {
+                    rc = -ENOMEM;
+                    done = true;
+                    break;
+                }
+                *routes = r;
+                cap = new_cap;
+            }
+            if (parse_route(nh, &(*routes)[*count])) {
+                (*count)++;
+            }
+        }
+    }
+    free(buf);
+
+    if (rc != 0) {
+        free(*routes);
+        *routes = NULL;
+        *count = 0;
+    }
+    return rc;
+}
+
+static bool prefix_contains(const uint8_t *prefix, uint8_t prefix_len, const uint8_t *addr) {
+    size_t full = prefix_len / 8;
+    if (memcmp(prefix, addr, full) != 0) {
+        return false;
+    }
+    if (prefix_len % 8 == 0) {
+        return true;
+    }
+    uint8_t mask = (uint8_t) (0xFF << (8 - prefix_len % 8));
+    return (prefix[full] & mask) == (addr[full] & mask);
+}
+
+const rtnl_route *rtnl_best_route(const rtnl_route *routes, size_t count, int family, const uint8_t *addr,
+                                  int exclude_oif) {
+    const rtnl_route *best = NULL;
+    for (size_t i = 0; i < count; i++) {
+        const rtnl_route *rt = &routes[i];
+        // multipath routes have no RTA_OIF
+        if (rt->family != family || rt->oif == 0 || rt->oif == exclude_oif) {
+            continue;
+        }
+        if (!prefix_contains(rt->dst, rt->dst_len, addr)) {
+            continue;
+        }
+        if (best == NULL || rt->dst_len > best->dst_len ||
+            (rt->dst_len == best->dst_len && rt->priority < best->priority)) {
+            best = rt;
+        }
+    }
+    return best;
+}
+
+bool rtnl_has_route(const rtnl_route *routes, size_t count, const rtnl_route *rt) {
+    for (size_t i = 0; i < count; i++) {
+        if (rtnl_route_cmp(&routes[i], rt) == 0 && routes[i].oif == rt->oif && routes[i].table == rt->table) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int rtnl_parse_prefix(const char *prefix, rtnl_route *route) {
+    char addr[INET6_ADDRSTRLEN];
+    const char *slash = strchr(prefix, '/');
+    size_t len = slash ? (size_t) (slash - prefix) : strlen(prefix);
+    if (len >= sizeof(addr)) {
+        return -1;
+    }
+    memcpy(addr, prefix, len);
+    addr[len] = '\0';
+
+    int max_len;
+    if (inet_pton(AF_INET, addr, route->dst) == 1) {
+        route->family = AF_INET;
+        max_len = 32;
+    } else if (inet_pton(AF_INET6, addr, route->dst) == 1) {
+        route->family = AF_INET6;
+        max_len = 128;
+    } else {
+        return -1;
+    }
+
+    long prefix_len = max_len;
+    if (slash) {
+        char *end;
+        prefix_len = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || prefix_len < 0 || prefix_len > max_len) {
+            return -1;
+        }
+    }
+    route->dst_len = (uint8_t) prefix_len;
+    return 0;
+}
+
+const char *rtnl_format_prefix(const rtnl_route *route, char *buf, size_t len) {
+    char addr[INET6_ADDRSTRLEN] = "";
+    inet_ntop(route->family, route->dst, addr, sizeof(addr));
+    snprintf(buf, len, "%s/%u", addr, route->dst_len);
+    return buf;
+}
+
+int rtnl_route_cmp(const void *a, const void *b) {
+    const rtnl_route *ra = a;
+    const rtnl_route *rb = b;
+    if (ra->family != rb->family) {
+        return ra->family < rb->family ? -1 : 1;
+    }
+    int c = memcmp(ra->dst, rb->dst, addr_len(ra->family));
+    if (c != 0) {
+        return c;
+    }
+    return (int) ra->dst_len - (int) rb->dst_len;
+}
+
+static inline int prefix_bit(const uint8_t *addr, unsigned bit) {
+    return (addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static void mask_host_bits(rtnl_route *rt) {
+    size_t alen = addr_len(rt->family);
+    for (size_t i = 0; i < alen; i++) {
+        unsigned first = (unsigned) i * 8;
+        if (first >= rt->dst_len) {
+            rt->dst[i] = 0;
+        } else if (first + 8 > rt->dst_len) {
+            rt->dst[i] &= (uint8_t) (0xFF << (first + 8 - rt->dst_len));
+        }
+    }
+}
+
+/* `a` and `b` are the lower and upper halves of the same parent prefix */
+static bool is_sibling(const rtnl_route *a, const rtnl_route *b) {
+    if (a->family != b->family || a->dst_len != b->dst_len || a->dst_len == 0 || a->oif != b->oif) {
+        return false;
+    }
+    unsigned bit = a->dst_len - 1u;
+    return prefix_contains(a->dst, (uint8_t) bit, b->dst) &&
+           prefix_bit(a->dst, bit) == 0 && prefix_bit(b->dst, bit) == 1;
+}
+
+size_t rtnl_aggregate_routes(rtnl_route *routes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        mask_host_bits(&routes[i]);
+    }
+    qsort(routes, count, sizeof(rtnl_route), rtnl_route_cmp);
+
+    // routes[0..top) is a stack of disjoint prefixes in address order, so a route can only
+    // be covered by, or merged with, the top of the stack.
+    size_t top = 0;
+    for (size_t i = 0; i < count; i++) {
+        rtnl_route rt = routes[i];
+        if (top > 0) {
+            const rtnl_route *prev = &routes[top - 1];
+            if (prev->family == rt.family && prev->oif == rt.oif && prev->dst_len <= rt.dst_len &&
+                prefix_contains(prev->dst, prev->dst_len, rt.dst)) {
+                continue;
+            }
+        }
+        routes[top++] = rt;
+        while (top >= 2 && is_sibling(&routes[top - 2], &routes[top - 1])) {
+            top--;
+            routes[top - 1].dst_len--;
+        }
+    }
+    return top;
+}
+
+static void add_attr(struct nlmsghdr *nh, unsigned short type, const void *data, size_t len) {
+    struct rtattr *rta = (struct rtattr *) ((char *) nh + NLMSG_ALIGN(nh->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = (unsigned short) RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static void build_route_req(struct rtnl_route_req *req, int op, int flags, uint32_t seq, const rtnl_route *rt) {
+    memset(req, 0, sizeof(*req));
+    req->nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req->nh.nlmsg_type = (unsigned short) op;
+    req->nh.nlmsg_flags = (unsigned short) (NLM_F_REQUEST | NLM_F_ACK | flags);
+    req->nh.nlmsg_seq = seq;
+
+    req->rtm.rtm_family = (unsigned char) rt->family;
+    req->rtm.rtm_dst_len = rt->dst_len;
+    req->rtm.rtm_table = rt->table < 256 ? (unsigned char) rt->table : RT_TABLE_UNSPEC;
+    // same defaults as `ip route`
+    if (op == RTM_DELROUTE) {
+        req->rtm.rtm_scope = RT_SCOPE_NOWHERE;
+    } else {
+        req->rtm.rtm_protocol = RTPROT_BOOT;
+        req->rtm.rtm_scope = rt->has_gw ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+        req->rtm.rtm_type = RTN_UNICAST;
+    }
+
+    size_t alen = addr_len(rt->family);
+    add_attr(&req->nh, RTA_DST, rt->dst, alen);
+    if (rt->has_gw) {
+        add_attr(&req->nh, RTA_GATEWAY, rt->gw, alen);
+    }
+    if (rt->oif != 0) {
+        add_attr(&req->nh, RTA_OIF, &rt->oif, sizeof(rt->oif));
+    }
+    if (rt->priority != 0) {
+        add_attr(&req->nh, RTA_PRIORITY, &rt->priority, sizeof(rt->priority));
+    }
+    if (rt->table >= 256) {
+        add_attr(&req->nh, RTA_TABLE, &rt->table, sizeof(rt->table));
+    }
+}
+
+int rtnl_route_batch(int fd, int op, int flags, const rtnl_route *routes, size_t count, int *errors) {
+    struct rtnl_route_req *reqs = calloc(RTNL_BATCH_MAX, sizeof(struct rtnl_route_req));
+    char *buf = malloc(RTNL_RECV_BUF_SIZE);
+    if (reqs == NULL || buf == NULL) {
+        free(reqs);
+        free(buf);
+        return -ENOMEM;
+    }
+
+    int failed = 0;
+    for (size_t start = 0; start < count; start += RTNL_BATCH_MAX) {
+        size_t n = count - start < RTNL_BATCH_MAX ? count - start : RTNL_BATCH_MAX;
+        uint32_t seq = next_seq((uint32_t) n);
+
+        struct iovec iov[RTNL_BATCH_MAX];
+        for (size_t i = 0; i < n; i++) {
+            build_route_req(&reqs[i], op, flags, seq + (uint32_t) i, &routes[start + i]);
+            iov[i].iov_base = &reqs[i];
+            iov[i].iov_len = reqs[i].nh.nlmsg_len;
+        }
+
+        struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+        struct msghdr msg = {
+            .msg_name = &kernel,
+            .msg_namelen = sizeof(kernel),
+            .msg_iov = iov,
+            .msg_iovlen = n,
+        };
+        if (sendmsg(fd, &msg, 0) < 0) {
+            failed = -errno;
+            break;
+        }
+
+        // one ack per request. acks for other sequence numbers are stale and skipped
+        size_t acked = 0;
+        while (acked < n) {
+            ssize_t rcvd = recv(fd, buf, RTNL_RECV_BUF_SIZE, 0);
+            if (rcvd < 0) {
+                if (errno == EINTR) continue;
+                failed = -errno;
+                goto done;
+            }
+            int len = (int) rcvd;
+            for (struct nlmsghdr *nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+                if (nh->nlmsg_type != NLMSG_ERROR || nh->nlmsg_seq - seq >= n) {
+                    continue;
+                }
+                const struct nlmsgerr *err = NLMSG_DATA(nh);
+                size_t idx = start + (nh->nlmsg_seq - seq);
+                if (errors) errors[idx] = err->error;
+                if (err->error != 0) failed++;
+                acked++;
+            }
+        }
+    }
+
+    done:
+    free(reqs);
+    free(buf);
+    return failed;
+}
@@ -0,0 +1,74 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#ifndef ZITI_TUNNELER_SDK_RTNL_H
+#define ZITI_TUNNELER_SDK_RTNL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* a unicast route as seen (or programmed) over NETLINK_ROUTE */
+typedef struct rtnl_route_s {
+    int      family;    // AF_INET or AF_INET6
+    uint8_t  dst[16];
+    uint8_t  dst_len;
+    uint8_t  gw[16];
+    bool     has_gw;
+    int      oif;
+    uint32_t priority;
+    uint32_t table;
+} rtnl_route;
+
+/* parse "addr[/len]" into route->family, dst and dst_len. the length defaults to a host route. returns 0 on success */
+extern int rtnl_parse_prefix(const char *prefix, rtnl_route *route);
+
+/* format route->dst/dst_len into `buf` */
+extern const char *rtnl_format_prefix(const rtnl_route *route, char *buf, size_t len);
+
+/* order routes by family, destination and prefix length */
+extern int rtnl_route_cmp(const void *a, const void *b);
+
+/**
+ * sort `routes`, drop routes that are covered by a shorter prefix, and merge sibling prefixes
+ * (e.g. 10.0.0.0/25 and 10.0.0.128/25 become 10.0.0.0/24) with the same output interface.
+ * the result is compacted to the front of `routes`, in rtnl_route_cmp order. returns the new count.
+ */
+extern size_t rtnl_aggregate_routes(rtnl_route *routes, size_t count);
+
+/* true if `routes` has a route for the prefix of `rt` through rt->oif in rt->table */
+extern bool rtnl_has_route(const rtnl_route *routes, size_t count, const rtnl_route *rt);
+
+/* open a NETLINK_ROUTE socket for blocking request/response use. returns the fd or -errno */
+extern int rtnl_open(void);
+
+/* dump the unicast routes of every table for `family`. the caller frees *routes */
+extern int rtnl_dump_routes(int fd, int family, rtnl_route **routes, size_t *count);
+
+/* return the route that `addr` would take if routes through `exclude_oif` did not exist, or NULL */
+extern const rtnl_route *rtnl_best_route(const rtnl_route *routes, size_t count, int family, const uint8_t *addr,
+                                         int exclude_oif);
+
+/**
+ * send `op` (RTM_NEWROUTE or RTM_DELROUTE) for each route in as few sendmsg calls as possible,
+ * with `flags` added to each request. each request is acked individually; errors[i] receives
+ * 0 or -errno for routes[i] when `errors` is not NULL.
+ * returns the number of failed routes, or -errno if the socket failed.
+ */
+extern int rtnl_route_batch(int fd, int op, int flags, const rtnl_route *routes, size_t count, int *errors);
+
+#endif //ZITI_TUNNELER_SDK_RTNL_H
@@ -16,11 +16,15 @@
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <arpa/inet.h>
 //#include <linux/if.h>
 #include <linux/if_tun.h>
+#include <linux/virtio_net.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
@@ -31,6 +35,7 @@
 #include <ziti/ziti_dns.h>
 
 #include "resolvers.h"
+#include "rtnl.h"
 #include "tun.h"
 #include "utils.h"
 
@@ -49,6 +54,9 @@
 #define IP_BIN "/sbin/ip "
 #endif
 
+/* largest packet that can be passed to lwip */
+#define TUN_MTU 0xFFFF
+
 #define CHECK_UV(op) do{ int rc = op; if (rc < 0) ZITI_LOG(ERROR, "uv_err: %d/%s", rc, uv_strerror(rc)); } while(0)
 
 extern void dns_set_miss_status(int code);
@@ -78,16 +86,157 @@ static int tun_close(struct netif_handle_s *tun) {
         r = close(tun->fd);
     }
 
+    model_map_clear(&tun->routes, NULL);
+    free(tun->installed);
+
+    if (tun->exclude_retry != NULL) {
+        uv_close((uv_handle_t *) tun->exclude_retry, (uv_close_cb) free);
+    }
+    if (tun->excluded_failed != NULL) {
+        model_map_clear(tun->excluded_failed, NULL);
+        free(tun->excluded_failed);
+    }
+
     free(tun);
     return r;
 }
 
+/** ones' complement sum of `len` bytes, as 16 bit big endian words */
+static uint32_t csum_partial(const uint8_t *p, size_t len) {
+    uint32_t sum = 0;
+    while (len > 1) {
+        sum += (uint32_t) (p[0] << 8 | p[1]);
+        p += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        sum += (uint32_t) (p[0] << 8);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return sum;
+}
+
+/**
+ * the kernel leaves the transport checksum of offloaded packets incomplete (VIRTIO_NET_HDR_F_NEEDS_CSUM).
+ * the checksum field holds the pseudo-header sum, so summing from csum_start to the end of the packet
+ * and folding gives the final checksum. the packet may be scattered across `iv`, but the checksum field
+ * must be in the first buffer.
+ */
+static bool vnet_complete_csum(const struct virtio_net_hdr *vh, const struct iovec *iv, int iovcnt, size_t len) {
+    size_t start = vh->csum_start;
+    size_t off = start + vh->csum_offset;
+    if (off + 2 > len || off + 2 > iv[0].iov_len) {
+        ZITI_LOG(WARN, "invalid checksum offset %zd for %zd byte packet", off, len);
+        return false;
+    }
+
+    uint32_t sum = 0;
+    size_t pos = 0; // offset of iv[i] in the packet
+    for (int i = 0; i < iovcnt && pos < len; i++) {
+        size_t n = iv[i].iov_len < len - pos ? iv[i].iov_len : len - pos;
+        size_t skip = start > pos ? start - pos : 0;
+        if (skip < n) {
+            uint32_t s = csum_partial((const uint8_t *) iv[i].iov_base + skip, n - skip);
+            if ((pos + skip - start) & 1) {
+                // words straddle the buffers, so this buffer's bytes are summed in swapped positions
+                s = ((s & 0xFF) << 8) | (s >> 8);
+            }
+            sum += s;
+        }
+        pos += n;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    uint16_t csum = (uint16_t) ~sum;
+    uint8_t *pkt = iv[0].iov_base;
+    pkt[off] = csum >> 8;
+    pkt[off + 1] = csum & 0xFF;
+    return true;
+}
+
+/**
+ * read one packet into `bufs`, stripping the virtio-net header if the device has one. the transport checksum is
+ * valid if the kernel checked it (VIRTIO_NET_HDR_F_DATA_VALID), or if it was completed here.
+ */
+ssize_t tun_readv(netif_handle tun, const uv_buf_t *bufs, unsigned int nbufs, bool *csum_valid) {
+    *csum_valid = false;
+    if (!tun->vnet_hdr) {
+        // uv_buf_t is layout compatible with struct iovec on unix
+        return readv(tun->fd, (const struct iovec *) bufs, (int) nbufs);
+    }
+
+    if (nbufs > NETIF_MAX_WRITEV_BUFS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct virtio_net_hdr vh;
+    struct iovec iv[1 + NETIF_MAX_WRITEV_BUFS];
+    iv[0].iov_base = &vh;
+    iv[0].iov_len = sizeof(vh);
+    memcpy(&iv[1], bufs, nbufs * sizeof(struct iovec));
+    ssize_t nr = readv(tun->fd, iv, (int) nbufs + 1);
+    if (nr <= 0) {
+        return nr;
+    }
+    if (nr < (ssize_t) sizeof(vh)) {
+        errno = EIO;
+        return -1;
+    }
+    nr -= sizeof(vh);
+
+    // tcp super-segments (GSO/GRO) are passed to lwip as one segment.
+    if (vh.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        *csum_valid = vnet_complete_csum(&vh, &iv[1], (int) nbufs, nr);
+    } else if (vh.flags & VIRTIO_NET_HDR_F_DATA_VALID) {
+        *csum_valid = true;
+    }
+    return nr;
+}
+
 ssize_t tun_read(netif_handle tun, void *buf, size_t len) {
-    return read(tun->fd, buf, len);
+    bool csum_valid;
+    uv_buf_t b = uv_buf_init(buf, (unsigned int) len);
+    return tun_readv(tun, &b, 1, &csum_valid);
 }
 
 ssize_t tun_write(netif_handle tun, const void *buf, size_t len) {
-    return write(tun->fd, buf, len);
+    if (!tun->vnet_hdr) {
+        return write(tun->fd, buf, len);
+    }
+
+    // lwip computes complete checksums and its segments fit the mtu, so no offload is requested
+    struct virtio_net_hdr vh = { .gso_type = VIRTIO_NET_HDR_GSO_NONE };
+    struct iovec iv[2] = {
+            { .iov_base = &vh, .iov_len = sizeof(vh) },
+            { .iov_base = (void *) buf, .iov_len = len },
+    };
+    ssize_t nw = writev(tun->fd, iv, 2);
+    return nw > 0 ? nw - (ssize_t) sizeof(vh) : nw;
+}
+
+ssize_t tun_writev(netif_handle tun, const uv_buf_t *bufs, unsigned int nbufs) {
+    if (!tun->vnet_hdr) {
+        // uv_buf_t is layout compatible with struct iovec on unix
+        return writev(tun->fd, (const struct iovec *) bufs, (int) nbufs);
+    }
+
+    if (nbufs > NETIF_MAX_WRITEV_BUFS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct virtio_net_hdr vh = { .gso_type = VIRTIO_NET_HDR_GSO_NONE };
+    struct iovec iv[1 + NETIF_MAX_WRITEV_BUFS];
+    iv[0].iov_base = &vh;
+    iv[0].iov_len = sizeof(vh);
+    memcpy(&iv[1], bufs, nbufs * sizeof(struct iovec));
+    ssize_t nw = writev(tun->fd, iv, (int) nbufs + 1);
+    return nw > 0 ? nw - (ssize_t) sizeof(vh) : nw;
 }
 
 int tun_uv_poll_init(netif_handle tun, uv_loop_t *loop, uv_poll_t *tun_poll_req) {
@@ -99,6 +248,7 @@ int tun_add_route(netif_handle tun, const char *dest) {
         tun->route_updates = calloc(1, sizeof(*tun->route_updates));
     }
     model_map_set(tun->route_updates, dest, (void*)(uintptr_t)true);
+    return 0;
 }
 
 int tun_delete_route(netif_handle tun, const char *dest) {
@@ -106,100 +256,200 @@ int tun_delete_route(netif_handle tun, const char *dest) {
         tun->route_updates = calloc(1, sizeof(*tun->route_updates));
     }
     model_map_set(tun->route_updates, dest, (void*)(uintptr_t)false);
+    return 0;
 }
 
 struct rt_process_cmd {
-    model_map *updates;
     netif_handle tun;
+
+    // every prefix that should be routed to the tun. aggregated by the worker
+    rtnl_route *routes;
+    size_t num_routes;
+
+    // aggregated routes in the kernel. replaced by the worker with the result of the update
+    rtnl_route *installed;
+    size_t num_installed;
+
+    size_t added;
+    size_t deleted;
+    size_t failed;
 };
 
+int tun_commit_routes(netif_handle tun, uv_loop_t *l);
+
 static void route_updates_done(uv_work_t *wr, int status) {
     struct rt_process_cmd *cmd = wr->data;
-    ZITI_LOG(INFO, "route updates[%zd]: %d/%s", model_map_size(cmd->updates), status, status ? uv_strerror(status) : "OK");
-
-    model_map_iter it = model_map_iterator(cmd->updates);
-    while(it) {
-        it = model_map_it_remove(it);
-    }
-    free(cmd->updates);
+    netif_handle tun = cmd->tun;
+    ZITI_LOG(INFO, "route updates[%zd prefixes, %zd routes]: %zd added, %zd deleted, %zd failed",
+             cmd->num_routes, cmd->num_installed, cmd->added, cmd->deleted, cmd->failed);
+
+    tun->installed = cmd->installed;
+    tun->num_installed = cmd->num_installed;
+    tun->updating_routes = false;
+    free(cmd->routes);
     free(cmd);
+
+    // commit updates that were made while this one was running
+    tun_commit_routes(tun, wr->loop);
     free(wr);
 }
 
 static void process_routes_updates(uv_work_t *wr) {
     struct rt_process_cmd *cmd = wr->data;
+    char buf[INET6_ADDRSTRLEN + 8];
 
-    uv_fs_t tmp_req = {0};
-    uv_file routes_file = uv_fs_mkstemp(wr->loop, &tmp_req, "/tmp/ziti-tunnel-routes.XXXXXX", NULL);
-    if (routes_file < 0) {
-        ZITI_LOG(ERROR, "failed to create temp file for route updates %d/%s", routes_file, uv_strerror(routes_file));
-        uv_fs_req_cleanup(&tmp_req);
-        return;
+    int oif = (int) if_nametoindex(cmd->tun->name);
+    for (size_t i = 0; i < cmd->num_routes; i++) {
+        cmd->routes[i].oif = oif;
+        cmd->routes[i].table = RT_TABLE_MAIN;
     }
-
-    // get route deletes first
-    static const char *const verbs[] = {
-        "delete",
-        "add",
-    };
-    char buf[1024];
-    for (size_t i = 0; i < sizeof verbs/sizeof verbs[0]; i++) {
-        const char *const verb = verbs[i];
-        const char *prefix;
-        const void *value;
-
-        MODEL_MAP_FOREACH(prefix, value, cmd->updates) {
-            // action == 0: delete
-            // action == 1: add
-            unsigned action = (uintptr_t) value;
-            if (action == i) {
-                int len = snprintf(buf, sizeof(buf), "route %s %s dev %s\n", verb, prefix, cmd->tun->name);
-                if (len < 0 || (size_t) len >= sizeof buf) {
-                    if (len > 0) errno = ENOMEM;
-                    ZITI_LOG(ERROR, "route updates failed %d/%s", -errno, strerror(errno));
-                    goto close_file;
-                }
-
-                uv_fs_t write_req;
-                uv_buf_t b = uv_buf_init(buf, len);
-                int rc = uv_fs_write(wr->loop, &write_req, routes_file, &b, 1, -1, NULL);
-                uv_fs_req_cleanup(&write_req);
-                /* if an incomplete write is encountered, bail.
-                 * Don't want to execute clipped commands
-                 */
-                if (rc < len) {
-                    if (rc > 0) rc = UV_EIO;
-                    ZITI_LOG(ERROR, "route updates failed %d/%s", rc, uv_strerror(rc));
-                    goto close_file;
-                }
-            }
+    // aggregate a copy so cmd->routes keeps its count for logging
+    rtnl_route *wanted = calloc(cmd->num_routes ? cmd->num_routes : 1, sizeof(rtnl_route));
+    memcpy(wanted, cmd->routes, cmd->num_routes * sizeof(rtnl_route));
+    size_t num_wanted = rtnl_aggregate_routes(wanted, cmd->num_routes);
+
+    // both lists are in rtnl_route_cmp order
+    size_t max_changes = num_wanted + cmd->num_installed;
+    rtnl_route *adds = calloc(max_changes ? max_changes : 1, sizeof(rtnl_route));
+    rtnl_route *dels = calloc(max_changes ? max_changes : 1, sizeof(rtnl_route));
+    rtnl_route *result = calloc(max_changes ? max_changes : 1, sizeof(rtnl_route));
+    size_t num_adds = 0, num_dels = 0, num_result = 0;
+    size_t i = 0, j = 0;
+    while (i < num_wanted || j < cmd->num_installed) {
+        int c = i == num_wanted ? 1 : j == cmd->num_installed ? -1 : rtnl_route_cmp(&wanted[i], &cmd->installed[j]);
+        if (c < 0) {
+            adds[num_adds++] = wanted[i++];
+        } else if (c > 0) {
+            dels[num_dels++] = cmd->installed[j++];
+        } else {
+            result[num_result++] = wanted[i++];
+            j++;
         }
     }
 
-    run_command("ip -force -batch %s", uv_fs_get_path(&tmp_req));
+    int fd = rtnl_open();
+    if (fd < 0) {
+        ZITI_LOG(ERROR, "failed to open netlink socket for route updates: %d/%s", -fd, strerror(-fd));
+        // nothing changed
+        memcpy(result, cmd->installed, cmd->num_installed * sizeof(rtnl_route));
+        num_result = cmd->num_installed;
+        cmd->failed = num_adds + num_dels;
+        goto done;
+    }
+
+    // add first so that traffic for a prefix that is being re-aggregated keeps being intercepted
+    int *errors = calloc(max_changes ? max_changes : 1, sizeof(int));
+    int rc = rtnl_route_batch(fd, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL, adds, num_adds, errors);
+    if (rc < 0) {
+        ZITI_LOG(ERROR, "route updates failed: %d/%s", -rc, strerror(-rc));
+    }
 
-close_file: ; /* declaration is not a statement */
-    uv_fs_t unlink_req;
-    (void) uv_fs_unlink(wr->loop, &unlink_req, uv_fs_get_path(&tmp_req), NULL);
-    uv_fs_req_cleanup(&unlink_req);
-    uv_fs_req_cleanup(&tmp_req);
+    // EEXIST only says that the prefix is routed, maybe through another interface (e.g. by the
+    // admin, or the DNS route added by tun_open). only adopt the routes that go through the tun
+    rtnl_route *existing = NULL;
+    size_t num_existing = 0;
+    for (size_t k = 0; rc >= 0 && k < num_adds; k++) {
+        if (errors[k] == -EEXIST) {
+            int err = rtnl_dump_routes(fd, AF_UNSPEC, &existing, &num_existing);
+            if (err != 0) {
+                ZITI_LOG(WARN, "failed to dump routes: %d/%s", -err, strerror(-err));
+            }
+            break;
+        }
+    }
+    for (size_t k = 0; k < num_adds; k++) {
+        if (rc >= 0 && errors[k] == -EEXIST && !rtnl_has_route(existing, num_existing, &adds[k])) {
+            ZITI_LOG(WARN, "route %s already exists through another interface, not routing it to %s",
+                     rtnl_format_prefix(&adds[k], buf, sizeof(buf)), cmd->tun->name);
+            cmd->failed++;
+        } else if (rc >= 0 && (errors[k] == 0 || errors[k] == -EEXIST)) {
+            // EEXIST: the route through the tun is already in the kernel, e.g. left behind by an earlier run
+            result[num_result++] = adds[k];
+            cmd->added++;
+        } else {
+            int err = rc < 0 ? rc : errors[k];
+            ZITI_LOG(WARN, "failed to add route %s dev %s: %d/%s",
+                     rtnl_format_prefix(&adds[k], buf, sizeof(buf)), cmd->tun->name, -err, strerror(-err));
+            cmd->failed++;
+        }
+    }
 
-    uv_fs_t close_req;
-    (void) uv_fs_close(wr->loop, &close_req, routes_file, NULL);
-    uv_fs_req_cleanup(&close_req);
+    memset(errors, 0, max_changes * sizeof(int));
+    rc = rc < 0 ? rc : rtnl_route_batch(fd, RTM_DELROUTE, 0, dels, num_dels, errors);
+    if (rc < 0) {
+        ZITI_LOG(ERROR, "route updates failed: %d/%s", -rc, strerror(-rc));
+    }
+    for (size_t k = 0; k < num_dels; k++) {
+        int err = rc < 0 ? rc : errors[k];
+        if (err == 0 || err == -ESRCH) {
+            cmd->deleted++;
+        } else {
+            ZITI_LOG(WARN, "failed to delete route %s dev %s: %d/%s",
+                     rtnl_format_prefix(&dels[k], buf, sizeof(buf)), cmd->tun->name, -err, strerror(-err));
+            // still in the kernel
+            result[num_result++] = dels[k];
+            cmd->failed++;
+        }
+    }
+    free(errors);
+    free(existing);
+    close(fd);
+
+    done:
+    qsort(result, num_result, sizeof(rtnl_route), rtnl_route_cmp);
+    free(cmd->installed);
+    cmd->installed = result;
+    cmd->num_installed = num_result;
+    free(adds);
+    free(dels);
+    free(wanted);
 }
 
+/**
+ * pending updates are folded into the set of intercepted prefixes, which is aggregated and
+ * reconciled with the routes that are already in the kernel over NETLINK_ROUTE.
+ */
 int tun_commit_routes(netif_handle tun, uv_loop_t *l) {
-    uv_work_t *wr = calloc(1, sizeof(uv_work_t));
+    if (tun->updating_routes || tun->route_updates == NULL || model_map_size(tun->route_updates) == 0) {
+        return 0;
+    }
+
+    ZITI_LOG(INFO, "starting %zd route updates", model_map_size(tun->route_updates));
+    const char *prefix;
+    const void *value;
+    MODEL_MAP_FOREACH(prefix, value, tun->route_updates) {
+        if ((uintptr_t) value) {
+            model_map_set(&tun->routes, prefix, (void*)(uintptr_t)true);
+        } else {
+            model_map_remove(&tun->routes, prefix);
+        }
+    }
+    model_map_iter it = model_map_iterator(tun->route_updates);
+    while(it) {
+        it = model_map_it_remove(it);
+    }
+    free(tun->route_updates);
+    tun->route_updates = NULL;
+
     struct rt_process_cmd *cmd = calloc(1, sizeof(struct rt_process_cmd));
-    if (tun->route_updates && model_map_size(tun->route_updates) > 0) {
-        ZITI_LOG(INFO, "starting %zd route updates", model_map_size(tun->route_updates));
-        cmd->tun = tun;
-        cmd->updates = tun->route_updates;
-        wr->data = cmd;
-        tun->route_updates = NULL;
-        uv_queue_work(l, wr, process_routes_updates, route_updates_done);
+    cmd->tun = tun;
+    cmd->routes = calloc(model_map_size(&tun->routes) + 1, sizeof(rtnl_route));
+    MODEL_MAP_FOREACH(prefix, value, &tun->routes) {
+        if (rtnl_parse_prefix(prefix, &cmd->routes[cmd->num_routes]) != 0) {
+            ZITI_LOG(WARN, "ignoring invalid route %s", prefix);
+            continue;
+        }
+        cmd->num_routes++;
     }
+    cmd->installed = tun->installed;
+    cmd->num_installed = tun->num_installed;
+    tun->installed = NULL;
+    tun->num_installed = 0;
+    tun->updating_routes = true;
+
+    uv_work_t *wr = calloc(1, sizeof(uv_work_t));
+    wr->data = cmd;
+    uv_queue_work(l, wr, process_routes_updates, route_updates_done);
     return 0;
 }
 
@@ -350,51 +600,210 @@ static void init_dns_maintainer(uv_loop_t *loop, const char *tun_name, uint32_t
     do_dns_update(loop, 0);
 }
 
-static int tun_exclude_rt(netif_handle dev, uv_loop_t *l, const char *addr) {
-    char cmd[1024];
-    char route[128];
-    FILE *cmdpipe = NULL;
-    int n;
-
-    n = snprintf(cmd, sizeof cmd,
-        "ip -o route show match %s table all | "
-        "awk '/dev %s/ { next; } { if (match($0, / metric ([^ ]+)/)) { metric = substr($0, RSTART, RLENGTH); } printf \"%%s %%s%%s\\n\", $2, $3, metric; }'",
-        addr, dev->name);
-    if (n > 0 && (size_t) n < sizeof cmd) {
-        ZITI_LOG(DEBUG, "popen(%s)", cmd);
-        cmdpipe = popen(cmd, "r");
-    } else {
-        errno = ENOMEM;
+struct rt_exclude_cmd {
+    model_map *addrs;
+    model_map failed; // addresses that should be retried
+    netif_handle tun;
+};
+
+/* delay before failed route exclusions are retried. doubles on each failed attempt */
+#define EXCLUDE_RETRY_MIN_MS 1000
+#define EXCLUDE_RETRY_MAX_MS (60 * 1000)
+
+static void start_route_exclusions(netif_handle tun, uv_loop_t *l);
+
+static void retry_route_exclusions(uv_timer_t *t) {
+    netif_handle tun = t->data;
+    model_map *failed = tun->excluded_failed;
+    tun->excluded_failed = NULL;
+    if (failed == NULL) {
+        return;
     }
 
-    if (cmdpipe == NULL) {
-        ZITI_LOG(WARN, "ip route cmd popen(%s) failed [%d:%s]", cmd, errno, strerror(errno));
-        return -1;
+    if (tun->excluded_pending == NULL) {
+        tun->excluded_pending = calloc(1, sizeof(*tun->excluded_pending));
     }
+    const char *addr;
+    const void *value;
+    MODEL_MAP_FOREACH(addr, value, failed) {
+        model_map_set(tun->excluded_pending, addr, (void*)(uintptr_t)true);
+    }
+    model_map_clear(failed, NULL);
+    free(failed);
 
-    errno = 0;
-    size_t size = fread(route, 1, sizeof route, cmdpipe);
-    int saved_errno = errno;
-    int ferr = ferror(cmdpipe);
-    (void) pclose(cmdpipe);
-    if (ferr) {
-        errno = saved_errno ? saved_errno : EIO;
-        ZITI_LOG(WARN, "ip route cmd I/O failed [%d:%s]", errno, strerror(errno));
-        return -1;
+    ZITI_LOG(DEBUG, "retrying %zd route exclusions", model_map_size(tun->excluded_pending));
+    start_route_exclusions(tun, t->loop);
+}
+
+/** keep failed exclusions until the retry timer puts them back in the pending batch */
+static void schedule_exclusion_retry(netif_handle tun, uv_loop_t *l, model_map *failed) {
+    if (model_map_size(failed) == 0) {
+        if (tun->excluded_failed == NULL) {
+            tun->exclude_retry_ms = 0;
+        }
+        return;
     }
 
-    // only look at first line
-    char *p = memchr(route, '\n', size);
-    // was a full line read?
-    if (p == NULL || p == route) {
-        ZITI_LOG(WARN, "failed to retrieve destination route");
-        return -1;
+    if (tun->excluded_failed == NULL) {
+        tun->excluded_failed = calloc(1, sizeof(*tun->excluded_failed));
+    }
+    const char *addr;
+    const void *value;
+    MODEL_MAP_FOREACH(addr, value, failed) {
+        model_map_set(tun->excluded_failed, addr, (void*)(uintptr_t)true);
+    }
+
+    if (tun->exclude_retry == NULL) {
+        tun->exclude_retry = calloc(1, sizeof(uv_timer_t));
+        uv_timer_init(l, tun->exclude_retry);
+        uv_unref((uv_handle_t *) tun->exclude_retry);
+        tun->exclude_retry->data = tun;
+    }
+    if (!uv_is_active((uv_handle_t *) tun->exclude_retry)) {
+        if (tun->exclude_retry_ms == 0) {
+            tun->exclude_retry_ms = EXCLUDE_RETRY_MIN_MS;
+        } else if (tun->exclude_retry_ms < EXCLUDE_RETRY_MAX_MS / 2) {
+            tun->exclude_retry_ms *= 2;
+        } else {
+            tun->exclude_retry_ms = EXCLUDE_RETRY_MAX_MS;
+        }
+        ZITI_LOG(INFO, "retrying %zd failed route exclusions in %ums",
+                 model_map_size(tun->excluded_failed), tun->exclude_retry_ms);
+        uv_timer_start(tun->exclude_retry, retry_route_exclusions, tun->exclude_retry_ms, 0);
+    }
+}
+
+static void route_exclusions_done(uv_work_t *wr, int status) {
+    struct rt_exclude_cmd *cmd = wr->data;
+    ZITI_LOG(DEBUG, "route exclusions[%zd]: %d/%s", model_map_size(cmd->addrs), status, status ? uv_strerror(status) : "OK");
+
+    netif_handle tun = cmd->tun;
+    schedule_exclusion_retry(tun, wr->loop, &cmd->failed);
+    model_map_clear(&cmd->failed, NULL);
+    model_map_iter it = model_map_iterator(cmd->addrs);
+    while(it) {
+        it = model_map_it_remove(it);
+    }
+    free(cmd->addrs);
+    free(cmd);
+
+    tun->excluding = false;
+    // pick up addresses that arrived while this batch was running
+    start_route_exclusions(tun, wr->loop);
+    free(wr);
+}
+
+static void fail_route_exclusions(struct rt_exclude_cmd *cmd) {
+    const char *addr;
+    const void *value;
+    MODEL_MAP_FOREACH(addr, value, cmd->addrs) {
+        model_map_set(&cmd->failed, addr, (void*)(uintptr_t)true);
+    }
+}
+
+static void process_route_exclusions(uv_work_t *wr) {
+    struct rt_exclude_cmd *cmd = wr->data;
+
+    int fd = rtnl_open();
+    if (fd < 0) {
+        ZITI_LOG(ERROR, "failed to open netlink socket for route exclusions: %d/%s", -fd, strerror(-fd));
+        fail_route_exclusions(cmd);
+        return;
+    }
+
+    rtnl_route *routes = NULL;
+    size_t num_routes = 0;
+    int rc = rtnl_dump_routes(fd, AF_UNSPEC, &routes, &num_routes);
+    if (rc != 0) {
+        ZITI_LOG(ERROR, "failed to read routing tables: %d/%s", -rc, strerror(-rc));
+        fail_route_exclusions(cmd);
+        close(fd);
+        return;
     }
-    *p = 0;
 
-    ZITI_LOG(DEBUG, "route is %s %s", addr, route);
+    int tun_index = (int) if_nametoindex(cmd->tun->name);
+    size_t num_addrs = model_map_size(cmd->addrs);
+    rtnl_route *excluded = calloc(num_addrs, sizeof(rtnl_route));
+    const char **names = calloc(num_addrs, sizeof(char *));
+    int *errors = calloc(num_addrs, sizeof(int));
+    size_t n = 0;
+
+    const char *addr;
+    const void *value;
+    MODEL_MAP_FOREACH(addr, value, cmd->addrs) {
+        rtnl_route *rt = &excluded[n];
+        if (rtnl_parse_prefix(addr, rt) != 0) {
+            ZITI_LOG(WARN, "cannot exclude invalid address %s", addr);
+            continue;
+        }
+
+        // the route the kernel would use if intercepts did not exist
+        const rtnl_route *via = rtnl_best_route(routes, num_routes, rt->family, rt->dst, tun_index);
+        if (via == NULL) {
+            ZITI_LOG(WARN, "failed to retrieve destination route for %s", addr);
+            model_map_set(&cmd->failed, addr, (void*)(uintptr_t)true);
+            continue;
+        }
+        memcpy(rt->gw, via->gw, sizeof(rt->gw));
+        rt->has_gw = via->has_gw;
+        rt->oif = via->oif;
+        rt->priority = via->priority;
+        rt->table = RT_TABLE_MAIN;
+        names[n++] = addr;
+    }
 
-    return run_command("ip route replace %s %s", addr, route);
+    rc = rtnl_route_batch(fd, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, excluded, n, errors);
+    if (rc < 0) {
+        ZITI_LOG(ERROR, "route exclusions failed: %d/%s", -rc, strerror(-rc));
+        for (size_t i = 0; i < n; i++) {
+            model_map_set(&cmd->failed, names[i], (void*)(uintptr_t)true);
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            if (errors[i] != 0) {
+                ZITI_LOG(WARN, "failed to exclude route %s: %d/%s", names[i], -errors[i], strerror(-errors[i]));
+                model_map_set(&cmd->failed, names[i], (void*)(uintptr_t)true);
+            } else {
+                ZITI_LOG(DEBUG, "excluded route %s", names[i]);
+            }
+        }
+    }
+
+    free(errors);
+    free(names);
+    free(excluded);
+    free(routes);
+    close(fd);
+}
+
+static void start_route_exclusions(netif_handle tun, uv_loop_t *l) {
+    if (tun->excluding || tun->excluded_pending == NULL || model_map_size(tun->excluded_pending) == 0) {
+        return;
+    }
+
+    uv_work_t *wr = calloc(1, sizeof(uv_work_t));
+    struct rt_exclude_cmd *cmd = calloc(1, sizeof(struct rt_exclude_cmd));
+    ZITI_LOG(DEBUG, "starting %zd route exclusions", model_map_size(tun->excluded_pending));
+    cmd->tun = tun;
+    cmd->addrs = tun->excluded_pending;
+    wr->data = cmd;
+    tun->excluded_pending = NULL;
+    tun->excluding = true;
+    uv_queue_work(l, wr, process_route_exclusions, route_exclusions_done);
+}
+
+/**
+ * exclusions are applied on the thread pool. addresses that arrive while a batch is in flight
+ * are collected and applied together when it completes. addresses that fail are retried with backoff,
+ * since the tunneler doesn't request an exclusion again once the driver has accepted it.
+ */
+static int tun_exclude_rt(netif_handle dev, uv_loop_t *l, const char *addr) {
+    if (dev->excluded_pending == NULL) {
+        dev->excluded_pending = calloc(1, sizeof(*dev->excluded_pending));
+    }
+    model_map_set(dev->excluded_pending, addr, (void*)(uintptr_t)true);
+    start_route_exclusions(dev, l);
+    return 0;
 }
 
 static void cleanup_sock(const int *fd) {
@@ -429,7 +838,7 @@ netif_driver tun_open(uv_loop_t *loop, uint32_t tun_ip, uint32_t dns_ip, const c
     }
 
     struct ifreq ifr = { .ifr_name = "ziti%d",
-                         .ifr_flags = IFF_TUN | IFF_NO_PI };
+                         .ifr_flags = IFF_TUN | IFF_NO_PI | IFF_VNET_HDR };
 
     if (ioctl(tun->fd, TUNSETIFF, &ifr) < 0) {
         if (error != NULL) {
@@ -440,6 +849,13 @@ netif_driver tun_open(uv_loop_t *loop, uint32_t tun_ip, uint32_t dns_ip, const c
     }
 
     strncpy(tun->name, ifr.ifr_name, sizeof(tun->name));
+    tun->vnet_hdr = true;
+
+    // let the kernel hand us tcp super-segments with partial checksums instead of segmenting to mtu
+    unsigned int offload = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+    if (ioctl(tun->fd, TUNSETOFFLOAD, offload) < 0) {
+        ZITI_LOG(WARN, "failed to enable offloads on %s: %s", tun->name, strerror(errno));
+    }
 
     struct netif_driver_s *driver = calloc(1, sizeof(struct netif_driver_s));
     if (driver == NULL) {
@@ -452,7 +868,9 @@ netif_driver tun_open(uv_loop_t *loop, uint32_t tun_ip, uint32_t dns_ip, const c
 
     driver->handle       = tun;
     driver->read         = tun_read;
+    driver->readv        = tun_readv;
     driver->write        = tun_write;
+    driver->writev       = tun_writev;
     driver->uv_poll_init = tun_uv_poll_init;
     driver->add_route    = tun_add_route;
     driver->delete_route = tun_delete_route;
@@ -479,6 +897,12 @@ netif_driver tun_open(uv_loop_t *loop, uint32_t tun_ip, uint32_t dns_ip, const c
         return NULL;
     }
 
+    // a large mtu lets local clients negotiate an MSS that is only limited by lwip's TCP_MSS
+    ifr.ifr_mtu = TUN_MTU;
+    if (ioctl(netdev, SIOCSIFMTU, &ifr) == -1) {
+        ZITI_LOG(WARN, "failed to set tun mtu: %s", strerror(errno));
+    }
+
     ifr.ifr_flags = IFF_UP | IFF_RUNNING | IFF_NOARP | IFF_MULTICAST;
 
     if (ioctl(netdev, SIOCSIFFLAGS, &ifr) == -1) {
@@ -19,13 +19,25 @@
 
 //#include <linux/if.h>
 #include <net/if.h>
+#include <stdbool.h>
 #include "ziti/netif_driver.h"
 
 struct netif_handle_s {
     int  fd;
     char name[IFNAMSIZ];
-
-    model_map *route_updates;
+    bool vnet_hdr; // packets are preceded by struct virtio_net_hdr
+
+    model_map *route_updates;    // prefix -> add(true)/delete(false), applied by commit_routes
+    model_map routes;            // prefixes that are routed to the tun
+    struct rtnl_route_s *installed; // aggregated routes that are programmed in the kernel
+    size_t num_installed;
+    bool updating_routes;        // a route commit is running on the thread pool
+
+    model_map *excluded_pending; // addresses waiting for the next exclusion batch
+    bool excluding;              // an exclusion batch is running on the thread pool
+    model_map *excluded_failed;  // addresses waiting for exclude_retry
+    uv_timer_t *exclude_retry;
+    unsigned int exclude_retry_ms;
 };
 
 extern netif_driver tun_open(struct uv_loop_s *loop, uint32_t tun_ip, uint32_t dns_ip, const char *cidr, char *error, size_t error_len);
@@ -0,0 +1,214 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "rtnl.h"
+}
+
+static rtnl_route make_route(const char *prefix, int oif, uint32_t priority = 0) {
+    rtnl_route rt = {};
+    REQUIRE(rtnl_parse_prefix(prefix, &rt) == 0);
+    rt.oif = oif;
+    rt.priority = priority;
+    return rt;
+}
+
+static std::string prefix_str(const rtnl_route &rt) {
+    char buf[INET6_ADDRSTRLEN + 8];
+    return rtnl_format_prefix(&rt, buf, sizeof(buf));
+}
+
+static std::vector<std::string> aggregate(std::vector<rtnl_route> routes) {
+    size_t n = rtnl_aggregate_routes(routes.data(), routes.size());
+    std::vector<std::string> result;
+    for (size_t i = 0; i < n; i++) {
+        result.push_back(prefix_str(routes[i]));
+    }
+    return result;
+}
+
+TEST_CASE("rtnl_parse_prefix", "[rtnl]") {
+    rtnl_route rt = {};
+
+    REQUIRE(rtnl_parse_prefix("10.1.2.3", &rt) == 0);
+    CHECK(rt.family == AF_INET);
+    CHECK(rt.dst_len == 32);
+    CHECK(prefix_str(rt) == "10.1.2.3/32");
+
+    REQUIRE(rtnl_parse_prefix("10.0.0.0/8", &rt) == 0);
+    CHECK(rt.family == AF_INET);
+    CHECK(rt.dst_len == 8);
+
+    REQUIRE(rtnl_parse_prefix("0.0.0.0/0", &rt) == 0);
+    CHECK(rt.dst_len == 0);
+
+    REQUIRE(rtnl_parse_prefix("fd00:7a69::1", &rt) == 0);
+    CHECK(rt.family == AF_INET6);
+    CHECK(rt.dst_len == 128);
+
+    REQUIRE(rtnl_parse_prefix("fd00:7a69::/64", &rt) == 0);
+    CHECK(rt.family == AF_INET6);
+    CHECK(prefix_str(rt) == "fd00:7a69::/64");
+
+    CHECK(rtnl_parse_prefix("10.0.0.0/33", &rt) != 0);
+    CHECK(rtnl_parse_prefix("fd00::/129", &rt) != 0);
+    CHECK(rtnl_parse_prefix("10.0.0.0/", &rt) != 0);
+    CHECK(rtnl_parse_prefix("10.0.0.0/8x", &rt) != 0);
+    CHECK(rtnl_parse_prefix("10.0.0.0/-1", &rt) != 0);
+    CHECK(rtnl_parse_prefix("example.com", &rt) != 0);
+    CHECK(rtnl_parse_prefix("", &rt) != 0);
+}
+
+TEST_CASE("rtnl_aggregate_routes", "[rtnl]") {
+    SECTION("host bits are masked") {
+        CHECK(aggregate({make_route("10.0.0.5/24", 9)}) == std::vector<std::string>{"10.0.0.0/24"});
+    }
+
+    SECTION("covered routes are dropped") {
+        CHECK(aggregate({
+            make_route("10.1.2.3", 9),
+            make_route("10.0.0.0/8", 9),
+            make_route("10.200.0.0/16", 9),
+        }) == std::vector<std::string>{"10.0.0.0/8"});
+    }
+
+    SECTION("siblings are merged") {
+        CHECK(aggregate({
+            make_route("10.0.0.128/25", 9),
+            make_route("10.0.0.0/25", 9),
+        }) == std::vector<std::string>{"10.0.0.0/24"});
+
+        // merges cascade up to the common parent
+        CHECK(aggregate({
+            make_route("10.0.0.0/26", 9),
+            make_route("10.0.0.64/26", 9),
+            make_route("10.0.0.128/26", 9),
+            make_route("10.0.0.192/26", 9),
+        }) == std::vector<std::string>{"10.0.0.0/24"});
+    }
+
+    SECTION("adjacent prefixes of different parents are not merged") {
+        CHECK(aggregate({
+            make_route("10.0.0.128/25", 9),
+            make_route("10.0.1.0/25", 9),
+        }) == std::vector<std::string>{"10.0.0.128/25", "10.0.1.0/25"});
+    }
+
+    SECTION("routes through different interfaces are kept") {
+        CHECK(aggregate({
+            make_route("10.0.0.0/25", 9),
+            make_route("10.0.0.128/25", 3),
+        }) == std::vector<std::string>{"10.0.0.0/25", "10.0.0.128/25"});
+        CHECK(aggregate({
+            make_route("10.0.0.0/8", 9),
+            make_route("10.1.0.0/16", 3),
+        }) == std::vector<std::string>{"10.0.0.0/8", "10.1.0.0/16"});
+    }
+
+    SECTION("families are aggregated separately") {
+        CHECK(aggregate({
+            make_route("fd00::/65", 9),
+            make_route("100.64.0.1", 9),
+            make_route("fd00::8000:0:0:0/65", 9),
+            make_route("100.64.0.0/10", 9),
+        }) == std::vector<std::string>{"100.64.0.0/10", "fd00::/64"});
+    }
+
+    SECTION("duplicates collapse") {
+        CHECK(aggregate({
+            make_route("100.64.0.1", 9),
+            make_route("100.64.0.1/32", 9),
+        }) == std::vector<std::string>{"100.64.0.1/32"});
+    }
+
+    SECTION("empty") {
+        CHECK(aggregate({}).empty());
+    }
+}
+
+TEST_CASE("rtnl_best_route", "[rtnl]") {
+    const int eth0 = 2, eth1 = 3, tun = 9;
+    std::vector<rtnl_route> routes = {
+        make_route("0.0.0.0/0", eth0, 100),
+        make_route("0.0.0.0/0", eth1, 50),
+        make_route("10.0.0.0/8", eth0),
+        make_route("10.1.0.0/16", tun),
+        make_route("10.1.2.0/24", 0),   // multipath, no RTA_OIF
+        make_route("::/0", eth0),
+    };
+    uint8_t addr[16] = {};
+
+    inet_pton(AF_INET, "10.1.2.3", addr);
+    const rtnl_route *best = rtnl_best_route(routes.data(), routes.size(), AF_INET, addr, 0);
+    REQUIRE(best != nullptr);
+    CHECK(best->oif == tun);
+
+    // the tun is excluded, and the multipath route is skipped
+    best = rtnl_best_route(routes.data(), routes.size(), AF_INET, addr, tun);
+    REQUIRE(best != nullptr);
+    CHECK(prefix_str(*best) == "10.0.0.0/8");
+
+    // lowest priority wins among equal prefixes
+    inet_pton(AF_INET, "192.168.1.1", addr);
+    best = rtnl_best_route(routes.data(), routes.size(), AF_INET, addr, tun);
+    REQUIRE(best != nullptr);
+    CHECK(best->oif == eth1);
+
+    inet_pton(AF_INET6, "2001:db8::1", addr);
+    best = rtnl_best_route(routes.data(), routes.size(), AF_INET6, addr, tun);
+    REQUIRE(best != nullptr);
+    CHECK(best->oif == eth0);
+
+    CHECK(rtnl_best_route(routes.data(), 3, AF_INET6, addr, tun) == nullptr);
+    CHECK(rtnl_best_route(nullptr, 0, AF_INET, addr, tun) == nullptr);
+}
+
+TEST_CASE("rtnl_has_route", "[rtnl]") {
+    const int eth0 = 2, tun = 9;
+    std::vector<rtnl_route> routes = {
+        make_route("100.64.0.0/10", eth0),
+        make_route("10.0.0.0/8", tun),
+    };
+    for (auto &rt : routes) {
+        rt.table = 254;
+    }
+
+    rtnl_route rt = make_route("10.0.0.0/8", tun);
+    rt.table = 254;
+    CHECK(rtnl_has_route(routes.data(), routes.size(), &rt));
+
+    // same prefix through another interface is not ours
+    rt = make_route("100.64.0.0/10", tun);
+    rt.table = 254;
+    CHECK_FALSE(rtnl_has_route(routes.data(), routes.size(), &rt));
+
+    rt = make_route("10.0.0.0/16", tun);
+    rt.table = 254;
+    CHECK_FALSE(rtnl_has_route(routes.data(), routes.size(), &rt));
+
+    rt = make_route("10.0.0.0/8", tun);
+    rt.table = 100;
+    CHECK_FALSE(rtnl_has_route(routes.data(), routes.size(), &rt));
+
+    CHECK_FALSE(rtnl_has_route(nullptr, 0, &rt));
+}
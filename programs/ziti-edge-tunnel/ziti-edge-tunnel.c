@@ -126,8 +126,11 @@ bool uses_config_dir = false;
 static long refresh_metrics = 5000;
 static long metrics_latency = 5000;
 static char *configured_cidr = NULL;
+static const char *configured_cidr6 = NULL;
 static char *configured_log_level = NULL;
 static char *configured_proxy = NULL;
+static unsigned int configured_max_tcp_conns = 0;
+static unsigned int configured_max_udp_conns = 0;
 static char *ipc_discriminator = NULL;
 
 //timer
@@ -843,7 +846,10 @@ static char* normalize_host(char* hostname) {
     return hostname_new;
 }
 
-static int run_tunnel(uv_loop_t *ziti_loop, uint32_t tun_ip, uint32_t dns_ip, const char *ip_range, const char *dns_upstream) {
+#define MAX_DNS_UPSTREAMS 5
+
+static int run_tunnel(uv_loop_t *ziti_loop, uint32_t tun_ip, uint32_t dns_ip, const char *ip_range, const char *ip6_range,
+                      const char **dns_upstreams) {
     netif_driver tun;
     char tun_error[64];
 
@@ -898,11 +904,21 @@ static int run_tunnel(uv_loop_t *ziti_loop, uint32_t tun_ip, uint32_t dns_ip, co
 
     ip_addr_t dns_ip4 = IPADDR4_INIT(dns_ip);
     ziti_dns_setup(tunneler, ipaddr_ntoa(&dns_ip4), ip_range);
-    if (dns_upstream) {
-        tunnel_upstream_dns upstream = {
-                .host = dns_upstream
-        };
-        tunnel_upstream_dns *a[] = { &upstream, NULL};
+    if (ip6_range != NULL && strcmp(ip6_range, "none") != 0) {
+        if (ziti_dns_setup_ipv6(ip6_range) == 0) {
+            // individual service addresses are routed as they are intercepted, but claim the whole block like ip_range
+            tun->add_route(tun->handle, ip6_range);
+        } else {
+            ZITI_LOG(WARN, "IPv6 addresses will not be assigned to service DNS names");
+        }
+    }
+    if (dns_upstreams[0] != NULL) {
+        tunnel_upstream_dns upstreams[MAX_DNS_UPSTREAMS] = {0};
+        tunnel_upstream_dns *a[MAX_DNS_UPSTREAMS + 1] = {0};
+        for (int i = 0; dns_upstreams[i] != NULL; i++) {
+            upstreams[i].host = (char *) dns_upstreams[i];
+            a[i] = &upstreams[i];
+        }
         ziti_dns_set_upstream(ziti_loop, a);
     }
 #if __linux__
@@ -1112,8 +1128,10 @@ static tunneler_context initialize_tunneler(netif_driver tun, uv_loop_t* ziti_lo
             .ziti_close = ziti_sdk_c_close,
             .ziti_close_write = ziti_sdk_c_close_write,
             .ziti_write = ziti_sdk_c_write,
-            .ziti_host = ziti_sdk_c_host
-
+            .ziti_writev = ziti_sdk_c_writev,
+            .ziti_host = ziti_sdk_c_host,
+            .max_tcp_connections = configured_max_tcp_conns,
+            .max_udp_connections = configured_max_udp_conns,
     };
 
     if (is_host_only()) {
@@ -1161,8 +1179,12 @@ static struct option run_options[] = {
         { "verbose", required_argument, NULL, 'v'},
         { "refresh", required_argument, NULL, 'r'},
         { "dns-ip-range", required_argument, NULL, 'd'},
+        { "dns-ip6-range", required_argument, NULL, '6'},
         { "dns-upstream", required_argument, NULL, 'u'},
+        { "dns-upstream-strategy", required_argument, NULL, 'S'},
         { "proxy", required_argument, NULL, 'x' },
+        { "max-tcp-connections", required_argument, NULL, 'T' },
+        { "max-udp-connections", required_argument, NULL, 'U' },
 #if __linux__
         { "diverter", required_argument, NULL, 'D' },
         { "diverter-fw", required_argument, NULL, 'f' },
@@ -1180,7 +1202,13 @@ static struct option run_host_options[] = {
 #ifndef DEFAULT_DNS_CIDR
 #define DEFAULT_DNS_CIDR "100.64.0.1/10"
 #endif
-static const char* dns_upstream = NULL;
+// IPv6 answers are opt-in: clients that get AAAA records prefer them, and the windows and macOS drivers
+// only route IPv4 for now. e.g. `-6 fd00:7a69:7469::/64`
+#ifndef DEFAULT_DNS_CIDR6
+#define DEFAULT_DNS_CIDR6 "none"
+#endif
+static const char* dns_upstreams[MAX_DNS_UPSTREAMS + 1] = {0};
+static int num_dns_upstreams = 0;
 static bool host_only = false;
 
 #include "tlsuv/http.h"
@@ -1238,7 +1266,7 @@ static int run_opts(int argc, char *argv[]) {
 #else
 #define DIVERTER_SHORT_OPTS ""
 #endif
-    while ((c = getopt_long(argc, argv, "i:I:v:r:d:u:x:"DIVERTER_SHORT_OPTS,
+    while ((c = getopt_long(argc, argv, "i:I:v:r:d:6:u:S:x:T:U:"DIVERTER_SHORT_OPTS,
                             run_options, &option_index)) != -1) {
         switch (c) {
 #if __linux__
@@ -1280,12 +1308,42 @@ static int run_opts(int argc, char *argv[]) {
             case 'd': // ip range
                 configured_cidr = optarg;
                 break;
+            case '6':
+                configured_cidr6 = optarg;
+                break;
             case 'u':
-                dns_upstream = optarg;
+                if (num_dns_upstreams == MAX_DNS_UPSTREAMS) {
+                    fprintf(stderr, "at most %d DNS upstreams can be specified\n", MAX_DNS_UPSTREAMS);
+                    errors++;
+                    break;
+                }
+                dns_upstreams[num_dns_upstreams++] = optarg;
+                break;
+            case 'S':
+                if (ziti_dns_set_upstream_strategy(optarg) != 0) {
+                    fprintf(stderr, "invalid DNS upstream strategy '%s'\n", optarg);
+                    errors++;
+                }
                 break;
             case 'x':
                 configured_proxy = optarg;
                 break;
+            case 'T':
+            case 'U': {
+                char *end;
+                unsigned long n = strtoul(optarg, &end, 10);
+                if (*end != '\0' || n == 0 || n > UINT32_MAX) {
+                    fprintf(stderr, "invalid connection limit '%s'\n", optarg);
+                    errors++;
+                    break;
+                }
+                if (c == 'T') {
+                    configured_max_tcp_conns = (unsigned int) n;
+                } else {
+                    configured_max_udp_conns = (unsigned int) n;
+                }
+                break;
+            }
             default: {
                 fprintf(stderr, "Unknown option '%c'\n", c);
                 errors++;
@@ -1424,6 +1482,9 @@ static void run(int argc, char *argv[]) {
                 configured_cidr = strdup(DEFAULT_DNS_CIDR);
             }
         }
+        if (configured_cidr6 == NULL) {
+            configured_cidr6 = DEFAULT_DNS_CIDR6;
+        }
 
         uint32_t ip[4];
         int bits;
@@ -1544,7 +1605,7 @@ static void run(int argc, char *argv[]) {
     if (is_host_only()) {
         rc = run_tunnel_host_mode(global_loop_ref);
     } else {
-        rc = run_tunnel(global_loop_ref, tun_ip, dns_ip, configured_cidr, dns_upstream);
+        rc = run_tunnel(global_loop_ref, tun_ip, dns_ip, configured_cidr, configured_cidr6, dns_upstreams);
     }
     exit(rc);
 }
@@ -2558,7 +2619,7 @@ static CommandLine enroll_cmd = make_command(
 #endif
 
 static CommandLine run_cmd = make_command("run", "run Ziti tunnel (required superuser access)",
-                                          "-i <id.file> [-r N] [-v N] [-d|--dns-ip-range N.N.N.N/N] " DIVERTER_OPTS_SUMMARY "[-u|--dns-upstream N.N.N.N]\n",
+                                          "-i <id.file> [-r N] [-v N] [-d|--dns-ip-range N.N.N.N/N] [-6|--dns-ip6-range X:X::/N] " DIVERTER_OPTS_SUMMARY "[-T|--max-tcp-connections N] [-U|--max-udp-connections N] [-u|--dns-upstream N.N.N.N] [-S|--dns-upstream-strategy race|sequential|all]\n",
                                           "\t-i|--identity <identity>\trun with provided identity file (required)\n"
                                           "\t-I|--identity-dir <dir>\tload identities from provided directory\n"
                                           "\t-x|--proxy type://[username[:password]@]hostname_or_ip:port\tproxy to use when"
@@ -2567,8 +2628,16 @@ static CommandLine run_cmd = make_command("run", "run Ziti tunnel (required supe
                                           "\t-r|--refresh N\tset service polling interval in seconds (default 10)\n"
                                           "\t-d|--dns-ip-range <ip range>\tspecify CIDR block in which service DNS names"
                                           " are assigned in N.N.N.N/n format (default " DEFAULT_DNS_CIDR ")\n"
+                                          "\t-6|--dns-ip6-range <ip6 range>\tspecify the /64 or larger block from which service DNS names"
+                                          " are also assigned IPv6 addresses, e.g. fd00:7a69:7469::/64 (linux only, default " DEFAULT_DNS_CIDR6 ")\n"
                                           DIVERTER_OPTS_DETAIL
-                                          "\t-u|--dns-upstream <ip addr>\tresolver listening on 53/udp for DNS queries that do not match a Ziti service\n",
+                                          "\t-T|--max-tcp-connections N\tmaximum number of concurrent intercepted TCP connections\n"
+                                          "\t-U|--max-udp-connections N\tmaximum number of concurrent intercepted UDP connections\n"
+                                          "\t-u|--dns-upstream <ip addr>\tresolver listening on 53/udp for DNS queries that do not match a Ziti service."
+                                          " may be given up to 5 times\n"
+                                          "\t-S|--dns-upstream-strategy <strategy>\thow queries are spread over the upstreams: 'race' asks the fastest"
+                                          " upstream and the next one if it is slow to answer (default), 'sequential' tries one upstream at a time,"
+                                          " 'all' asks every upstream at once\n",
                                           run_opts, run);
 static CommandLine run_host_cmd = make_command("run-host", "run Ziti tunnel to host services",
                                           "-i <id.file> [-r N] [-v N]",